@@ -8,6 +8,8 @@
 #include "targets/retro-esp32/config.h"
 #elif defined(RG_TARGET_SDL2)
 #include "targets/sdl2/config.h"
+#elif defined(RG_TARGET_HEADLESS)
+#include "targets/headless/config.h"
 #elif defined(RG_TARGET_MRGC_GBM)
 #include "targets/mrgc-gbm/config.h"
 #elif defined(RG_TARGET_ESPLAY_MICRO)
@@ -42,6 +44,16 @@
 #define RG_APP_FACTORY NULL
 #endif
 
+// Size of the rewind history, it is grown to fit at least two snapshots
+#ifndef RG_REWIND_BUFFER_SIZE
+#define RG_REWIND_BUFFER_SIZE (1024 * 1024)
+#endif
+
+// How many frames run-ahead can emulate past the real one
+#ifndef RG_RUN_AHEAD_MAX_FRAMES
+#define RG_RUN_AHEAD_MAX_FRAMES 2
+#endif
+
 #ifndef RG_PATH_MAX
 #define RG_PATH_MAX 255
 #endif
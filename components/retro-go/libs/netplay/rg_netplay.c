@@ -15,6 +15,7 @@
 
 #include "rg_system.h"
 #include "rg_netplay.h"
+#include "rg_rollback.h"
 
 #define NETPLAY_VERSION 0x01
 #define MAX_PLAYERS 8
@@ -27,6 +28,9 @@
 #define WIFI_BROADCAST_ADDR "192.168.4.255"
 #define WIFI_NETPLAY_PORT 1234
 
+// Frames of input delay in rollback mode, each one hides a frame of latency before predictions kick in
+static const char *SETTING_INPUT_DELAY = "NetplayDelay";
+
 // Test to skip the network task and semaphores
 #define NETPLAY_SYNCHRONOUS_TEST
 
@@ -45,6 +49,9 @@ static wifi_config_t wifi_config;
 
 static int rx_sock, tx_sock;
 
+static rollback_t *rollback;
+static netplay_advance_t rollback_advance;
+
 
 static void dummy_netplay_callback(netplay_event_t event, void *arg)
 {
@@ -494,6 +501,9 @@ bool rg_netplay_stop(void)
 
     if (netplay_mode != NETPLAY_MODE_NONE)
     {
+        rg_rollback_destroy(rollback);
+        rollback = NULL;
+        rg_emu_suspend_rewind(false);
         network_cleanup();
         ret = esp_wifi_stop();
         netplay_status = NETPLAY_STATUS_STOPPED;
@@ -572,6 +582,120 @@ void rg_netplay_sync(void *data_in, void *data_out, uint8_t data_len)
 }
 
 
+static bool rollback_send_cb(void *arg, const void *data, size_t length)
+{
+    send_packet(remote_player->id, NETPLAY_PACKET_ROLLBACK, 0, (void*)data, length);
+    return true;
+}
+
+
+static int rollback_receive_cb(void *arg, void *data, size_t length)
+{
+    netplay_packet_t packet;
+    int len;
+
+    while ((len = recv(rx_sock, &packet, sizeof packet, MSG_DONTWAIT)) > 0)
+    {
+        if (packet.cmd == NETPLAY_PACKET_ROLLBACK && packet.data_len <= length
+            && len == sizeof(packet) - sizeof(packet.data) + packet.data_len)
+        {
+            memcpy(data, packet.data, packet.data_len);
+            return packet.data_len;
+        }
+        RG_LOGW("netplay: Unexpected packet 0x%02x during rollback\n", packet.cmd);
+    }
+
+    return 0;
+}
+
+
+static size_t rollback_save_cb(void *arg, void *buffer, size_t size)
+{
+    return rg_emu_serialize(buffer, size);
+}
+
+
+static bool rollback_load_cb(void *arg, const void *buffer, size_t size)
+{
+    return rg_emu_deserialize(buffer, size);
+}
+
+
+static void rollback_advance_cb(void *arg, const uint32_t inputs[2], bool replay)
+{
+    (*rollback_advance)(inputs, replay);
+}
+
+
+static void rollback_desync_cb(void *arg, uint32_t frame)
+{
+    RG_LOGE("netplay: Desync detected at frame %u!\n", frame);
+}
+
+
+void rg_netplay_run_frame(uint32_t input, netplay_advance_t advance)
+{
+    static uint32_t report_frame = 0;
+    uint32_t inputs[2] = {input, input};
+
+    rollback_advance = advance;
+
+    if (netplay_status == NETPLAY_STATUS_CONNECTED && !rollback)
+    {
+        const rollback_config_t config = {
+            .send = &rollback_send_cb,
+            .receive = &rollback_receive_cb,
+            .save_state = &rollback_save_cb,
+            .load_state = &rollback_load_cb,
+            .advance = &rollback_advance_cb,
+            .desync = &rollback_desync_cb,
+            .player = netplay_mode == NETPLAY_MODE_HOST ? 0 : 1,
+            .input_delay = RG_MIN(RG_MAX(rg_settings_get_number(NS_GLOBAL, SETTING_INPUT_DELAY, 2), 0), ROLLBACK_MAX_DELAY),
+            .checksum_interval = 60,
+        };
+        if (!(rollback = rg_rollback_create(&config)))
+        {
+            RG_LOGE("netplay: Rollback unavailable, stopping.\n");
+            rg_netplay_stop();
+        }
+        // Stepping back locally would desync the session, and the snapshots would fight the rollback's
+        else
+            rg_emu_suspend_rewind(true);
+        report_frame = 0;
+    }
+
+    if (netplay_status != NETPLAY_STATUS_CONNECTED || !rollback)
+    {
+        // Nobody to play with, run the frame locally
+        (*advance)(inputs, false);
+        return;
+    }
+
+    // The peer is too far behind, a frame can't run until its inputs arrive
+    int64_t stall_start = rg_system_timer();
+    while (!rg_rollback_advance(rollback, input))
+    {
+        if (rg_system_timer() - stall_start > 5000000)
+        {
+            RG_LOGE("netplay: Lost sync...\n");
+            rg_netplay_stop();
+            (*advance)(inputs, false);
+            return;
+        }
+        rg_task_delay(1);
+    }
+
+    rollback_stats_t stats = rg_rollback_get_stats(rollback);
+    if (stats.frame >= report_frame + 600)
+    {
+        RG_LOGI("netplay: frame=%u rollbacks=%u replayed=%u max=%u stalls=%u checksums=%u desyncs=%u\n",
+                stats.frame, stats.rollbacks, stats.replayed_frames, stats.max_rollback, stats.stalls,
+                stats.checksums, stats.desyncs);
+        report_frame = stats.frame;
+    }
+}
+
+
 netplay_mode_t rg_netplay_mode()
 {
     return netplay_mode;
@@ -42,6 +42,7 @@ typedef enum {
     NETPLAY_PACKET_INPUT,       // Send gamepad data
     NETPLAY_PACKET_SERIAL,      // Send serial data
     NETPLAY_PACKET_RAW_DATA,    // Send raw data for the emulator to handle (serial, memory copy, etc)
+    NETPLAY_PACKET_ROLLBACK,    // rg_rollback.c inputs and checksums
 } netplay_packet_type_t;
 
 typedef struct __attribute__ ((packed)) {
@@ -63,6 +64,8 @@ typedef struct __attribute__ ((packed)) {
 } netplay_player_t;
 
 typedef void (*netplay_callback_t)(netplay_event_t event, void *arg);
+// Runs one frame with the given inputs (host first), `replay` frames shouldn't be drawn
+typedef void (*netplay_advance_t)(const uint32_t inputs[2], bool replay);
 typedef netplay_callback_t rg_netplay_handler_t;
 
 void rg_netplay_init(netplay_callback_t callback);
@@ -71,6 +74,9 @@ bool rg_netplay_quick_start(void);
 bool rg_netplay_start(netplay_mode_t mode);
 bool rg_netplay_stop(void);
 void rg_netplay_sync(void *data_in, void *data_out, uint8_t data_len);
+// Rollback alternative to rg_netplay_sync(). The remote input is predicted instead of waited for, `advance`
+// is called again for the frames a misprediction affected. Requires the serialize handlers.
+void rg_netplay_run_frame(uint32_t input, netplay_advance_t advance);
 
 netplay_mode_t rg_netplay_mode();
 netplay_status_t rg_netplay_status();
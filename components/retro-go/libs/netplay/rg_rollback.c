@@ -0,0 +1,309 @@
+#ifdef RG_ENABLE_NETPLAY
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rg_rollback.h"
+
+#define INPUT_WINDOW    64 // Input history by frame, must be a power of two well above MAX_FRAMES + MAX_DELAY
+#define PACKET_INPUTS   16 // Inputs per packet, they're resent until acknowledged so losses are covered
+#define CHECKSUM_WINDOW 8
+
+enum
+{
+    PACKET_INPUT = 1,
+    PACKET_CHECKSUM,
+};
+
+// Inputs of frames [frame, frame + count), and the sender has ours below `ack`
+typedef struct __attribute__((packed))
+{
+    uint8_t type;
+    uint8_t count;
+    uint16_t reserved;
+    uint32_t frame;
+    uint32_t ack;
+    uint32_t inputs[PACKET_INPUTS];
+} input_packet_t;
+
+// Checksum of the state at the start of `frame`, once every input before it was known
+typedef struct __attribute__((packed))
+{
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t frame;
+    uint32_t checksum;
+} checksum_packet_t;
+
+struct rollback_s
+{
+    rollback_config_t config;
+    rollback_stats_t stats;
+    uint32_t local_inputs[INPUT_WINDOW];  // By frame, the delay is already applied (the first frames get 0)
+    uint32_t remote_inputs[INPUT_WINDOW];
+    uint32_t used_inputs[INPUT_WINDOW];   // The peer's input each frame actually ran with, maybe predicted
+    uint32_t local_acked;                 // The peer has our inputs below this frame
+    uint32_t replay_from;                 // Earliest mispredicted frame, UINT32_MAX if there is none
+    uint32_t next_checksum;
+    uint32_t stalled;
+    struct
+    {
+        uint32_t frame;
+        uint32_t local, remote;
+        bool has_local, has_remote;
+    } checksums[CHECKSUM_WINDOW];
+    uint8_t *states; // The state at the start of each of the last MAX_FRAMES + 1 frames
+    size_t state_size;
+};
+
+#define STATE(rb, frame) ((rb)->states + ((frame) % (ROLLBACK_MAX_FRAMES + 1)) * (rb)->state_size)
+
+
+static uint32_t checksum(const uint8_t *data, size_t length)
+{
+    uint32_t hash = 0x811C9DC5; // FNV-1a
+    for (size_t i = 0; i < length; ++i)
+        hash = (hash ^ data[i]) * 0x01000193;
+    return hash;
+}
+
+
+static uint32_t remote_input(rollback_t *rb, uint32_t frame)
+{
+    if (frame < rb->stats.remote_frame)
+        return rb->remote_inputs[frame % INPUT_WINDOW];
+    // The peer is predicted to keep holding the same buttons
+    return rb->stats.remote_frame ? rb->remote_inputs[(rb->stats.remote_frame - 1) % INPUT_WINDOW] : 0;
+}
+
+
+static void compare_checksum(rollback_t *rb, uint32_t frame)
+{
+    __typeof__(rb->checksums[0]) *entry = &rb->checksums[(frame / rb->config.checksum_interval) % CHECKSUM_WINDOW];
+
+    if (entry->frame != frame || !entry->has_local || !entry->has_remote)
+        return;
+
+    rb->stats.checksums++;
+    if (entry->local != entry->remote)
+    {
+        rb->stats.desyncs++;
+        if (rb->config.desync)
+            rb->config.desync(rb->config.arg, frame);
+    }
+    entry->has_local = entry->has_remote = false;
+}
+
+
+static void store_checksum(rollback_t *rb, uint32_t frame, uint32_t value, bool remote)
+{
+    __typeof__(rb->checksums[0]) *entry = &rb->checksums[(frame / rb->config.checksum_interval) % CHECKSUM_WINDOW];
+
+    if (entry->frame != frame)
+    {
+        memset(entry, 0, sizeof(*entry));
+        entry->frame = frame;
+    }
+    if (remote)
+        entry->remote = value, entry->has_remote = true;
+    else
+        entry->local = value, entry->has_local = true;
+
+    compare_checksum(rb, frame);
+}
+
+
+static void send_inputs(rollback_t *rb)
+{
+    // Everything the peer hasn't acknowledged, oldest first
+    uint32_t known = rb->stats.frame + rb->config.input_delay + 1;
+    input_packet_t packet = {PACKET_INPUT, 0, 0, rb->local_acked, rb->stats.remote_frame, {0}};
+
+    while (packet.count < PACKET_INPUTS && packet.frame + packet.count < known)
+    {
+        packet.inputs[packet.count] = rb->local_inputs[(packet.frame + packet.count) % INPUT_WINDOW];
+        packet.count++;
+    }
+
+    size_t length = sizeof(packet) - sizeof(packet.inputs) + packet.count * sizeof(packet.inputs[0]);
+    rb->config.send(rb->config.arg, &packet, length);
+}
+
+
+static void receive_inputs(rollback_t *rb, const input_packet_t *packet)
+{
+    if (packet->ack > rb->local_acked && packet->ack <= rb->stats.frame + rb->config.input_delay + 1)
+        rb->local_acked = packet->ack;
+
+    // Only what extends the known inputs matters, the rest was received before
+    for (uint32_t i = 0; i < packet->count; ++i)
+    {
+        uint32_t frame = packet->frame + i;
+        if (frame != rb->stats.remote_frame || frame >= rb->stats.frame + INPUT_WINDOW - ROLLBACK_MAX_FRAMES - 1)
+            continue;
+
+        rb->remote_inputs[frame % INPUT_WINDOW] = packet->inputs[i];
+        rb->stats.remote_frame++;
+
+        // The frame already ran with a prediction, was it right?
+        if (frame < rb->stats.frame && rb->used_inputs[frame % INPUT_WINDOW] != packet->inputs[i])
+        {
+            if (frame < rb->replay_from)
+                rb->replay_from = frame;
+        }
+    }
+}
+
+
+void rg_rollback_poll(rollback_t *rb)
+{
+    union
+    {
+        uint8_t type;
+        input_packet_t input;
+        checksum_packet_t checksum;
+        uint8_t raw[ROLLBACK_MAX_PACKET];
+    } packet;
+    int length;
+
+    while ((length = rb->config.receive(rb->config.arg, &packet, sizeof(packet))) > 0)
+    {
+        size_t header = sizeof(packet.input) - sizeof(packet.input.inputs);
+
+        if (packet.type == PACKET_INPUT && (size_t)length >= header && packet.input.count <= PACKET_INPUTS
+            && (size_t)length == header + packet.input.count * sizeof(packet.input.inputs[0]))
+        {
+            receive_inputs(rb, &packet.input);
+        }
+        else if (packet.type == PACKET_CHECKSUM && length == sizeof(packet.checksum) && rb->config.checksum_interval)
+        {
+            store_checksum(rb, packet.checksum.frame, packet.checksum.checksum, true);
+        }
+    }
+}
+
+
+static void run_frame(rollback_t *rb, uint32_t frame, bool replay)
+{
+    uint32_t inputs[2];
+
+    inputs[rb->config.player] = rb->local_inputs[frame % INPUT_WINDOW];
+    inputs[rb->config.player ^ 1] = remote_input(rb, frame);
+    rb->used_inputs[frame % INPUT_WINDOW] = inputs[rb->config.player ^ 1];
+
+    rb->config.advance(rb->config.arg, inputs, replay);
+}
+
+
+static void send_checksums(rollback_t *rb)
+{
+    // The state at the start of a frame is final once every input before it is known
+    while (rb->next_checksum <= rb->stats.remote_frame && rb->next_checksum < rb->stats.frame)
+    {
+        uint32_t frame = rb->next_checksum;
+        rb->next_checksum += rb->config.checksum_interval;
+
+        if (frame + ROLLBACK_MAX_FRAMES < rb->stats.frame)
+            continue; // Its state isn't kept anymore
+
+        checksum_packet_t packet = {PACKET_CHECKSUM, {0}, frame, checksum(STATE(rb, frame), rb->state_size)};
+        rb->config.send(rb->config.arg, &packet, sizeof(packet));
+        store_checksum(rb, frame, packet.checksum, false);
+    }
+}
+
+
+bool rg_rollback_advance(rollback_t *rb, uint32_t input)
+{
+    uint32_t frame = rb->stats.frame;
+
+    rg_rollback_poll(rb);
+
+    // A misprediction any older couldn't be fixed, the state it needs would be gone
+    if (rb->stats.remote_frame + ROLLBACK_MAX_FRAMES < frame)
+    {
+        // Keep the peer informed, but don't flood it while it catches up
+        if ((rb->stalled++ % 4) == 0)
+            send_inputs(rb);
+        rb->stats.stalls++;
+        return false;
+    }
+    rb->stalled = 0;
+
+    rb->local_inputs[(frame + rb->config.input_delay) % INPUT_WINDOW] = input;
+    send_inputs(rb);
+
+    if (rb->replay_from < frame)
+    {
+        uint32_t depth = frame - rb->replay_from;
+
+        rb->config.load_state(rb->config.arg, STATE(rb, rb->replay_from), rb->state_size);
+        for (uint32_t f = rb->replay_from; f < frame; ++f)
+        {
+            if (f > rb->replay_from)
+                rb->config.save_state(rb->config.arg, STATE(rb, f), rb->state_size);
+            run_frame(rb, f, true);
+        }
+
+        rb->stats.rollbacks++;
+        rb->stats.replayed_frames += depth;
+        if (depth > rb->stats.max_rollback)
+            rb->stats.max_rollback = depth;
+    }
+    rb->replay_from = UINT32_MAX;
+
+    rb->config.save_state(rb->config.arg, STATE(rb, frame), rb->state_size);
+    run_frame(rb, frame, false);
+    rb->stats.frame++;
+
+    if (rb->config.checksum_interval > 0)
+        send_checksums(rb);
+
+    return true;
+}
+
+
+rollback_stats_t rg_rollback_get_stats(rollback_t *rb)
+{
+    return rb->stats;
+}
+
+
+rollback_t *rg_rollback_create(const rollback_config_t *config)
+{
+    if (!config || !config->send || !config->receive || !config->save_state || !config->load_state
+        || !config->advance || (config->player & ~1) || config->input_delay < 0
+        || config->input_delay > ROLLBACK_MAX_DELAY || config->checksum_interval < 0)
+        return NULL;
+
+    size_t state_size = config->save_state(config->arg, NULL, 0);
+    rollback_t *rb = calloc(1, sizeof(rollback_t));
+    uint8_t *states = state_size ? malloc(state_size * (ROLLBACK_MAX_FRAMES + 1)) : NULL;
+
+    if (!rb || !states)
+    {
+        free(states);
+        free(rb);
+        return NULL;
+    }
+
+    rb->config = *config;
+    rb->states = states;
+    rb->state_size = state_size;
+    rb->replay_from = UINT32_MAX;
+    rb->next_checksum = config->checksum_interval;
+
+    return rb;
+}
+
+
+void rg_rollback_destroy(rollback_t *rb)
+{
+    if (rb)
+    {
+        free(rb->states);
+        free(rb);
+    }
+}
+
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Rollback netplay for two players. It only depends on the callbacks below so it can run on the host,
+// see tools/netplay_harness.c. rg_netplay.c binds it to its socket and rg_emu_serialize().
+
+#define ROLLBACK_MAX_FRAMES 8  // How far back a misprediction can be fixed, past that we wait for the peer
+#define ROLLBACK_MAX_DELAY  8  // Input delay, in frames
+#define ROLLBACK_MAX_PACKET 80 // Largest packet passed to send()
+
+typedef struct
+{
+    // Transport. Neither may block, receive returns the packet's length or <= 0 if there is none pending.
+    bool (*send)(void *arg, const void *data, size_t length);
+    int (*receive)(void *arg, void *data, size_t length);
+    // Emulation. save_state has rg_emu_serialize()'s semantics, advance runs exactly one frame. `replay`
+    // frames are being simulated again after a misprediction and shouldn't be drawn.
+    size_t (*save_state)(void *arg, void *buffer, size_t size);
+    bool (*load_state)(void *arg, const void *buffer, size_t size);
+    void (*advance)(void *arg, const uint32_t inputs[2], bool replay);
+    // Optional, called when the peer's checksum of a confirmed frame doesn't match ours
+    void (*desync)(void *arg, uint32_t frame);
+    void *arg;
+    int player;            // 0 or 1, inputs[player] is ours
+    int input_delay;       // Frames between reading the local input and using it, hides that much latency
+    int checksum_interval; // Frames between checksums, 0 to disable
+} rollback_config_t;
+
+typedef struct
+{
+    uint32_t frame;           // Next frame to run
+    uint32_t remote_frame;    // The peer's inputs are known below this frame
+    uint32_t rollbacks;
+    uint32_t replayed_frames;
+    uint32_t max_rollback;    // Deepest rollback, in frames
+    uint32_t stalls;          // Calls that couldn't advance
+    uint32_t checksums;       // Checksums compared with the peer's
+    uint32_t desyncs;
+} rollback_stats_t;
+
+typedef struct rollback_s rollback_t;
+
+rollback_t *rg_rollback_create(const rollback_config_t *config);
+void rg_rollback_destroy(rollback_t *rb);
+// Runs the next frame with `input`, after replaying the frames the peer's late inputs changed. It returns
+// false without running anything when the peer is too far behind, call it again with the same input later.
+bool rg_rollback_advance(rollback_t *rb, uint32_t input);
+// Processes pending packets without advancing, for when the game is paused or stalled
+void rg_rollback_poll(rollback_t *rb);
+rollback_stats_t rg_rollback_get_stats(rollback_t *rb);
@@ -62,6 +62,137 @@ static rg_audio_t audio;
 static rg_audio_counters_t counters;
 static int64_t dummyBusyUntil = 0;
 
+// Goal is to have ~800 samples over 2-8 buffers (3x270 or 5x180 are pretty good).
+// The unit of the length is stereo samples (4 bytes) (optimize for 533 usage).
+#ifdef RG_TARGET_ESPLAY_S3
+#define I2S_DMA_BUF_COUNT 8
+#define I2S_DMA_BUF_LEN   534
+#else
+#define I2S_DMA_BUF_COUNT 4
+#define I2S_DMA_BUF_LEN   180
+#endif
+
+// The i2s driver doesn't tell how much is left in its DMA buffers, so we estimate it from what
+// we wrote and how much time has passed since. i2s_write() blocks when full which keeps it honest.
+static struct
+{
+    int64_t time;
+    int frames;
+    int capacity; // I2S_DMA_BUF_COUNT * I2S_DMA_BUF_LEN
+} i2sQueue;
+
+#if RG_AUDIO_USE_SDL2
+#define SDL2_RING_LENGTH (16384) // In frames, must be a power of two
+#define SDL2_MAX_DRIFT   (0.005) // Maximum resampling ratio adjustment (0.5% is inaudible)
+
+// rg_audio_submit() is the only writer of head and the SDL callback the only writer of tail,
+// so the ring needs no lock. Both sides publish their index only after touching the frames.
+static struct
+{
+    rg_audio_frame_t ring[SDL2_RING_LENGTH];
+    uint32_t head;
+    uint32_t tail;
+    SDL_AudioDeviceID device;
+    int deviceRate;
+    int target;             // Fill level we try to maintain, in frames
+    float position;         // Resampler phase between `last` and the next input frame
+    rg_audio_frame_t last;  // Last input frame of the previous submission
+    bool playing;           // Set by each submission, cleared when the ring runs dry
+} sdl2;
+
+static void sdl2_audio_callback(void *arg, Uint8 *stream, int len)
+{
+    rg_audio_frame_t *buffer = (rg_audio_frame_t *)stream;
+    size_t count = len / sizeof(rg_audio_frame_t);
+    uint32_t tail = sdl2.tail;
+    size_t available = __atomic_load_n(&sdl2.head, __ATOMIC_ACQUIRE) - tail;
+    size_t length = RG_MIN(available, count);
+
+    for (size_t i = 0; i < length; ++i)
+        buffer[i] = sdl2.ring[(tail + i) & (SDL2_RING_LENGTH - 1)];
+    __atomic_store_n(&sdl2.tail, tail + length, __ATOMIC_RELEASE);
+
+    if (length < count)
+    {
+        memset(buffer + length, 0, (count - length) * sizeof(rg_audio_frame_t));
+        // Only the first dry callback counts, the app simply isn't submitting while in a menu
+        if (__atomic_exchange_n(&sdl2.playing, false, __ATOMIC_RELAXED))
+            counters.underruns++;
+    }
+}
+
+static void sdl2_write(const rg_audio_frame_t *frames, size_t count)
+{
+    while (count > 0)
+    {
+        uint32_t head = sdl2.head;
+        size_t space = SDL2_RING_LENGTH - (head - __atomic_load_n(&sdl2.tail, __ATOMIC_ACQUIRE));
+        size_t length = RG_MIN(space, count);
+
+        // The ring is only full if the device stopped pulling, there's no point waiting for it
+        if (length == 0)
+        {
+            counters.overflows += count;
+            break;
+        }
+
+        for (size_t i = 0; i < length; ++i)
+            sdl2.ring[(head + i) & (SDL2_RING_LENGTH - 1)] = frames[i];
+        __atomic_store_n(&sdl2.head, head + length, __ATOMIC_RELEASE);
+        __atomic_store_n(&sdl2.playing, true, __ATOMIC_RELAXED);
+
+        frames += length;
+        count -= length;
+    }
+}
+
+static void sdl2_submit(const rg_audio_frame_t *frames, size_t count)
+{
+    // Like i2s_write() does on the device, this is what paces the emulation: we sleep while
+    // we're ahead of the target. The timeout only guards against a stalled audio device.
+    int64_t deadline = rg_system_timer() + 200000;
+    int fill = sdl2.head - __atomic_load_n(&sdl2.tail, __ATOMIC_ACQUIRE);
+    while (fill > sdl2.target && rg_system_timer() < deadline)
+    {
+        SDL_Delay(1);
+        fill = sdl2.head - __atomic_load_n(&sdl2.tail, __ATOMIC_ACQUIRE);
+    }
+
+    // Dynamic rate control: stretch or squeeze the output slightly depending on how far the fill level
+    // is from the target. This absorbs clock drift and slow frames without underruns or pitch jumps.
+    float error = RG_MIN(RG_MAX((float)(fill - sdl2.target) / sdl2.target, -1.f), 1.f);
+    float step = (float)audio.sampleRate / sdl2.deviceRate * (1.f + SDL2_MAX_DRIFT * error);
+    float volume = audio.muted ? 0.f : (audio.volume * 0.01f);
+    rg_audio_frame_t buffer[256];
+    size_t pos = 0;
+
+    // Linear interpolation, `position` is the phase of the next output frame between `a` and `b`
+    rg_audio_frame_t a = sdl2.last;
+    float position = sdl2.position;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        rg_audio_frame_t b = frames[i];
+        for (; position < 1.f; position += step)
+        {
+            buffer[pos].left = (a.left + (b.left - a.left) * position) * volume;
+            buffer[pos].right = (a.right + (b.right - a.right) * position) * volume;
+            if (++pos == RG_COUNT(buffer))
+            {
+                sdl2_write(buffer, pos);
+                pos = 0;
+            }
+        }
+        position -= 1.f;
+        a = b;
+    }
+    sdl2_write(buffer, pos);
+
+    sdl2.last = a;
+    sdl2.position = position;
+}
+#endif
+
 static const char *SETTING_OUTPUT = "AudioSink";
 static const char *SETTING_VOLUME = "Volume";
 static const char *SETTING_FILTER = "AudioFilter";
@@ -86,6 +217,8 @@ void rg_audio_init(int sampleRate)
 
     int error_code = -1;
 
+    memset(&i2sQueue, 0, sizeof(i2sQueue));
+
     if (audio.sink->type == RG_AUDIO_SINK_DUMMY)
     {
         error_code = 0;
@@ -100,11 +233,12 @@ void rg_audio_init(int sampleRate)
             .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
             .communication_format = I2S_COMM_FORMAT_STAND_MSB,
             .intr_alloc_flags = 0, // ESP_INTR_FLAG_LEVEL1
-            .dma_buf_count = 4, // Goal is to have ~800 samples over 2-8 buffers (3x270 or 5x180 are pretty good)
-            .dma_buf_len = 180, // The unit is stereo samples (4 bytes) (optimize for 533 usage)
+            .dma_buf_count = I2S_DMA_BUF_COUNT,
+            .dma_buf_len = I2S_DMA_BUF_LEN,
         }, 0, NULL);
         if (ret == ESP_OK)
             ret = i2s_set_dac_mode(RG_AUDIO_USE_INT_DAC);
+        i2sQueue.capacity = I2S_DMA_BUF_COUNT * I2S_DMA_BUF_LEN;
         error_code = ret;
     #else
         RG_LOGE("This device does not support internal DAC mode!\n");
@@ -121,14 +255,14 @@ void rg_audio_init(int sampleRate)
         #ifdef RG_TARGET_ESPLAY_S3
             .communication_format = I2S_COMM_FORMAT_STAND_I2S | I2S_COMM_FORMAT_STAND_MSB,
             .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1, // ESP_INTR_FLAG_LEVEL1
-            .dma_buf_count = 8, // Goal is to have ~800 samples over 2-8 buffers (3x270 or 5x180 are pretty good)
-            .dma_buf_len = 534, // The unit is stereo samples (4 bytes) (optimize for 533 usage)
+            .dma_buf_count = I2S_DMA_BUF_COUNT,
+            .dma_buf_len = I2S_DMA_BUF_LEN,
             .use_apll = false, // S3 cant use apll
         #else
             .communication_format = I2S_COMM_FORMAT_STAND_I2S,
             .intr_alloc_flags = 0, // ESP_INTR_FLAG_LEVEL1
-            .dma_buf_count = 4, // Goal is to have ~800 samples over 2-8 buffers (3x270 or 5x180 are pretty good)
-            .dma_buf_len = 180, // The unit is stereo samples (4 bytes) (optimize for 533 usage)
+            .dma_buf_count = I2S_DMA_BUF_COUNT,
+            .dma_buf_len = I2S_DMA_BUF_LEN,
             .use_apll = true, // External DAC may care about accuracy
         #endif
         }, 0, NULL);
@@ -141,6 +275,7 @@ void rg_audio_init(int sampleRate)
                 .data_in_num = GPIO_NUM_NC
             });
         }
+        i2sQueue.capacity = I2S_DMA_BUF_COUNT * I2S_DMA_BUF_LEN;
         error_code = ret;
     #else
         RG_LOGE("This device does not support external DAC mode!\n");
@@ -149,8 +284,32 @@ void rg_audio_init(int sampleRate)
     else if (audio.sink->type == RG_AUDIO_SINK_SDL2)
     {
     #if RG_AUDIO_USE_SDL2
-        SDL_AudioSpec sdl2_config = {0};
-        error_code = 0;
+        SDL_AudioSpec obtained = {0};
+        memset(&sdl2, 0, sizeof(sdl2));
+        if (SDL_InitSubSystem(SDL_INIT_AUDIO) == 0)
+        {
+            // We let SDL pick the rate it likes best, the resampler converts to it anyway
+            sdl2.device = SDL_OpenAudioDevice(NULL, 0, &(SDL_AudioSpec){
+                .freq = sampleRate,
+                .format = AUDIO_S16SYS,
+                .channels = 2,
+                .samples = 512,
+                .callback = sdl2_audio_callback,
+            }, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+        }
+        if (sdl2.device)
+        {
+            // Three device buffers is enough to ride over a late frame
+            sdl2.deviceRate = obtained.freq;
+            sdl2.target = RG_MIN(obtained.samples * 3, SDL2_RING_LENGTH / 2);
+            SDL_PauseAudioDevice(sdl2.device, 0);
+            RG_LOGI("SDL2 device opened: rate=%d, samples=%d\n", obtained.freq, obtained.samples);
+            error_code = 0;
+        }
+        else
+        {
+            RG_LOGE("SDL2 error: %s\n", SDL_GetError());
+        }
     #else
         RG_LOGE("This device does not support SDL2!\n");
     #endif
@@ -215,7 +374,9 @@ void rg_audio_deinit(void)
     else if (audio.sink->type == RG_AUDIO_SINK_SDL2)
     {
     #if RG_AUDIO_USE_SDL2
-        // ...
+        SDL_CloseAudioDevice(sdl2.device);
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        sdl2.device = 0;
     #endif
     }
 
@@ -294,18 +455,25 @@ void rg_audio_submit(const rg_audio_frame_t *frames, size_t count)
                 pos = 0;
             }
         }
+
+        int64_t now = rg_system_timer();
+        int64_t drained = (now - i2sQueue.time) * audio.sampleRate / 1000000;
+        i2sQueue.frames = RG_MIN(RG_MAX(i2sQueue.frames - drained, 0) + (int64_t)count, i2sQueue.capacity);
+        i2sQueue.time = now;
     #endif
     }
     else if (audio.sink->type == RG_AUDIO_SINK_SDL2)
     {
     #if RG_AUDIO_USE_SDL2
-        //
+        sdl2_submit(frames, count);
     #endif
     }
 
     RELEASE_DEVICE();
 
-    counters.busyTime += rg_system_timer() - time_start;
+    int elapsed = rg_system_timer() - time_start;
+    rg_system_trace_stage(RG_STAGE_AUDIO, elapsed);
+    counters.busyTime += elapsed;
     counters.samples += count;
 }
 
@@ -319,6 +487,27 @@ rg_audio_counters_t rg_audio_get_counters(void)
     return counters;
 }
 
+int rg_audio_get_buffered(void)
+{
+    if (!audio.sink || audio.sampleRate <= 0)
+        return -1;
+
+    if ((audio.sink->type == RG_AUDIO_SINK_I2S_DAC || audio.sink->type == RG_AUDIO_SINK_I2S_EXT) && i2sQueue.capacity)
+    {
+        int64_t drained = (rg_system_timer() - i2sQueue.time) * audio.sampleRate / 1000000;
+        return RG_MAX(i2sQueue.frames - drained, 0) * 1000000 / audio.sampleRate;
+    }
+#if RG_AUDIO_USE_SDL2
+    else if (audio.sink->type == RG_AUDIO_SINK_SDL2 && sdl2.device)
+    {
+        int fill = __atomic_load_n(&sdl2.head, __ATOMIC_ACQUIRE) - __atomic_load_n(&sdl2.tail, __ATOMIC_ACQUIRE);
+        return (int64_t)fill * 1000000 / sdl2.deviceRate;
+    }
+#endif
+
+    return -1;
+}
+
 const rg_audio_sink_t *rg_audio_get_sinks(size_t *count)
 {
     if (count)
@@ -36,6 +36,8 @@ typedef struct
 {
     int64_t busyTime;
     int32_t samples;
+    int32_t underruns; // Times the sink ran dry while the app was submitting, not every sink can tell
+    int32_t overflows; // Frames dropped because the sink was full
 } rg_audio_counters_t;
 
 typedef struct
@@ -52,6 +54,7 @@ void rg_audio_deinit(void);
 void rg_audio_submit(const rg_audio_frame_t *frames, size_t count);
 const rg_audio_t *rg_audio_get_info(void);
 rg_audio_counters_t rg_audio_get_counters(void);
+int rg_audio_get_buffered(void); // Microseconds of audio queued in the sink, -1 if it can't tell
 
 const rg_audio_sink_t *rg_audio_get_sinks(size_t *count);
 const rg_audio_sink_t *rg_audio_get_sink(void);
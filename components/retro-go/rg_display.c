@@ -8,6 +8,7 @@
 #ifdef ESP_PLATFORM
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
+#include <freertos/semphr.h>
 #include <driver/gpio.h>
 #include <driver/spi_master.h>
 #ifdef RG_GPIO_LCD_BCKL
@@ -17,9 +18,53 @@
 #include <SDL2/SDL.h>
 #endif
 
+#ifdef ESP_PLATFORM
+typedef SemaphoreHandle_t rg_sem_t;
+#define SEM_CREATE()        xSemaphoreCreateBinary()
+#define SEM_GIVE(sem)       xSemaphoreGive(sem)
+#define SEM_TAKE(sem, ms)   xSemaphoreTake(sem, pdMS_TO_TICKS(ms))
+#else
+typedef SDL_sem *rg_sem_t;
+#define SEM_CREATE()        SDL_CreateSemaphore(0)
+#define SEM_GIVE(sem)       SDL_SemPost(sem)
+#define SEM_TAKE(sem, ms)   SDL_SemWaitTimeout(sem, ms)
+#endif
+
+#define ATOMIC_LOAD(ptr)            __atomic_load_n(ptr, __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE(ptr, val)      __atomic_store_n(ptr, val, __ATOMIC_SEQ_CST)
+#define ATOMIC_CAS(ptr, exp, val)   __atomic_compare_exchange_n(ptr, exp, val, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #define LCD_BUFFER_LENGTH     (RG_SCREEN_WIDTH * 4) // In pixels
 
-static QueueHandle_t display_task_queue;
+// Must be a power of two
+#define FRAME_QUEUE_LENGTH    (2)
+
+// Granularity of the frame diff
+#define BLOCK_WIDTH           (16) // In pixels
+#define BLOCK_HEIGHT          (8)  // In lines
+
+// Frames travel from the application to the display task through a small single producer, single
+// consumer ring. Slots are only ever swapped atomically, which lets the producer replace or take back
+// the newest frame as long as the display task hasn't started on it (latest frame wins).
+static struct
+{
+    rg_video_update_t *slots[FRAME_QUEUE_LENGTH];
+    uint32_t head;                  // Written by the producer only
+    uint32_t tail;                  // Written by the display task only
+    rg_video_update_t *drawing;     // Frame being diffed or sent to the panel
+    rg_video_update_t *reference;   // Frame currently on screen, the next one is diffed against it
+    bool force_full;                // A frame taken back had a forced full update
+    bool stop, running;
+    rg_sem_t frame_ready;           // Given by the producer
+    rg_sem_t frame_done;            // Given by the display task
+} queue;
+static const rg_video_update_t *last_update;
 static rg_display_counters_t counters;
 static rg_display_config_t config;
 static rg_display_osd_t osd;
@@ -31,6 +76,15 @@ static struct
     uint8_t repeat : 6; // How many times the line or column is repeated by the scaler or filter
 } filter_lines[320]; // This is source height
 static uint8_t screen_line_is_empty[RG_SCREEN_HEIGHT + 1];
+static uint8_t screen_col_is_empty[RG_SCREEN_WIDTH + 1]; // Same as above but for columns
+static uint16_t screen_col_src[RG_SCREEN_WIDTH + 1];     // Source column of each viewport column
+static uint32_t dirty_blocks[(320 + BLOCK_HEIGHT - 1) / BLOCK_HEIGHT]; // One bit per block, one word per row
+static struct
+{
+    float pixel; // us per source pixel
+    float setup; // us per window
+} transfer_cost = {0.5f, 50.f};
+static void (*render_line)(uint16_t *dst, const void *src, const uint16_t *map, int count, const uint16_t *palette);
 
 static const char *SETTING_BACKLIGHT = "DispBacklight";
 static const char *SETTING_SCALING = "DispScaling";
@@ -276,14 +330,21 @@ static void lcd_deinit(void)
     // gpio_reset_pin(RG_GPIO_LCD_DC);
 }
 #else
+// No panel, but the scaler still runs so that it can be benchmarked on the host
+static uint16_t lcd_buffer[LCD_BUFFER_LENGTH];
 #define lcd_init()
 #define lcd_deinit()
-#define lcd_get_buffer() (void *)0
+#define lcd_get_buffer() (lcd_buffer)
 #define lcd_set_backlight(l)
 #define lcd_send_data(a, b)
 #define lcd_set_window(a, b, c, d)
 #endif
 
+// All the pixel kernels below work on big-endian RGB565. The blends are a per-channel floor((a + b) / 2),
+// computed on two (or more) pixels at once: (a & b) + ((a ^ b) & mask) >> 1, where the mask clears the
+// lowest bit of each channel so that the shift doesn't leak into the neighbouring channel.
+#define BLEND_MASK 0xF7DEF7DE
+
 static inline unsigned blend_pixels(unsigned a, unsigned b)
 {
     // Fast path
@@ -291,26 +352,97 @@ static inline unsigned blend_pixels(unsigned a, unsigned b)
         return a;
 
     // Input in Big-Endian, swap to Little Endian
-    a = (a << 8) | (a >> 8);
-    b = (b << 8) | (b >> 8);
+    a = ((a & 0xFF) << 8) | (a >> 8);
+    b = ((b & 0xFF) << 8) | (b >> 8);
 
-    // Signed arithmetic is deliberate here
-    int r0 = (a >> 11) & 0x1F;
-    int g0 = (a >> 5) & 0x3F;
-    int b0 = (a) & 0x1F;
+    unsigned v = (a & b) + (((a ^ b) & (BLEND_MASK & 0xFFFF)) >> 1);
 
-    int r1 = (b >> 11) & 0x1F;
-    int g1 = (b >> 5) & 0x3F;
-    int b1 = (b) & 0x1F;
+    // Back to Big-Endian
+    return ((v & 0xFF) << 8) | (v >> 8);
+}
 
-    int rv = (((r1 - r0) >> 1) + r0);
-    int gv = (((g1 - g0) >> 1) + g0);
-    int bv = (((b1 - b0) >> 1) + b0);
+static inline uint32_t blend_pixels_x2(uint32_t a, uint32_t b)
+{
+    a = ((a & 0x00FF00FF) << 8) | ((a >> 8) & 0x00FF00FF);
+    b = ((b & 0x00FF00FF) << 8) | ((b >> 8) & 0x00FF00FF);
+    uint32_t v = (a & b) + (((a ^ b) & BLEND_MASK) >> 1);
+    return ((v & 0x00FF00FF) << 8) | ((v >> 8) & 0x00FF00FF);
+}
 
-    unsigned v = (rv << 11) | (gv << 5) | (bv);
+static void blend_line(uint16_t *dst, const uint16_t *a, const uint16_t *b, int width)
+{
+    int x = 0;
 
-    // Back to Big-Endian
-    return (v << 8) | (v >> 8);
+#if defined(__SSE2__)
+    const __m128i mask = _mm_set1_epi16(BLEND_MASK & 0xFFFF);
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + x));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+        va = _mm_or_si128(_mm_slli_epi16(va, 8), _mm_srli_epi16(va, 8));
+        vb = _mm_or_si128(_mm_slli_epi16(vb, 8), _mm_srli_epi16(vb, 8));
+        __m128i v = _mm_add_epi16(_mm_and_si128(va, vb), _mm_srli_epi16(_mm_and_si128(_mm_xor_si128(va, vb), mask), 1));
+        _mm_storeu_si128((__m128i *)(dst + x), _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+    }
+#elif defined(__ARM_NEON)
+    const uint16x8_t mask = vdupq_n_u16(BLEND_MASK & 0xFFFF);
+    for (; x + 8 <= width; x += 8)
+    {
+        uint16x8_t va = vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(vld1q_u16(a + x))));
+        uint16x8_t vb = vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(vld1q_u16(b + x))));
+        uint16x8_t v = vaddq_u16(vandq_u16(va, vb), vshrq_n_u16(vandq_u16(veorq_u16(va, vb), mask), 1));
+        vst1q_u16(dst + x, vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(v))));
+    }
+#else
+    // Word accesses must be aligned on the ESP32, which is only possible if all three lines agree
+    if ((((uintptr_t)dst ^ (uintptr_t)a) & 2) == 0 && (((uintptr_t)dst ^ (uintptr_t)b) & 2) == 0)
+    {
+        if (((uintptr_t)dst & 2) && width > 0)
+        {
+            dst[0] = blend_pixels(a[0], b[0]);
+            x = 1;
+        }
+        for (; x + 2 <= width; x += 2)
+        {
+            uint32_t pa = *(const uint32_t *)(a + x);
+            uint32_t pb = *(const uint32_t *)(b + x);
+            *(uint32_t *)(dst + x) = (pa == pb) ? pa : blend_pixels_x2(pa, pb);
+        }
+    }
+#endif
+
+    for (; x < width; ++x)
+        dst[x] = blend_pixels(a[x], b[x]);
+}
+
+// Line renderers, one per source format. map[] holds the source column of every output pixel.
+static void render_line_pal(uint16_t *dst, const void *src, const uint16_t *map, int count, const uint16_t *palette)
+{
+    const uint8_t *src8 = src;
+    for (int x = 0; x < count; ++x)
+        dst[x] = palette[src8[map[x]]];
+}
+
+static void render_line_565_le(uint16_t *dst, const void *src, const uint16_t *map, int count, const uint16_t *palette)
+{
+    const uint16_t *src16 = src;
+    for (int x = 0; x < count; ++x)
+    {
+        uint16_t pixel = src16[map[x]];
+        dst[x] = (pixel << 8) | (pixel >> 8);
+    }
+}
+
+static void render_line_565_be(uint16_t *dst, const void *src, const uint16_t *map, int count, const uint16_t *palette)
+{
+    const uint16_t *src16 = src;
+    for (int x = 0; x < count; ++x)
+        dst[x] = src16[map[x]];
+}
+
+static void render_line_565_be_unscaled(uint16_t *dst, const void *src, const uint16_t *map, int count, const uint16_t *palette)
+{
+    memcpy(dst, (const uint16_t *)src + map[0], count * 2);
 }
 
 static inline void write_rect(int left, int top, int width, int height,
@@ -330,20 +462,21 @@ static inline void write_rect(int left, int top, int width, int height,
     const int screen_left = display.viewport.x_pos + scaled_left;
     const int screen_bottom = RG_MIN(screen_top + scaled_height, screen_height);
     const int lines_per_buffer = LCD_BUFFER_LENGTH / scaled_width;
-    const int ix_acc = (x_inc * scaled_left) % screen_width;
     const int filter_mode = config.scaling ? config.filter : 0;
     const bool filter_y = filter_mode == RG_DISPLAY_FILTER_VERT || filter_mode == RG_DISPLAY_FILTER_BOTH;
     const bool filter_x = filter_mode == RG_DISPLAY_FILTER_HORIZ || filter_mode == RG_DISPLAY_FILTER_BOTH;
-    const int format = display.source.format;
+    const uint8_t *col_is_empty = screen_col_is_empty + scaled_left;
+    const uint16_t *col_src = screen_col_src + scaled_left;
     const int stride = display.source.stride;
-    union { const uint8_t *u8; const uint16_t *u16; } buffer;
+    const uint8_t *buffer;
 
     if (scaled_width < 1 || scaled_height < 1)
     {
         return;
     }
 
-    buffer.u8 = framebuffer + display.source.offset + (top * stride) + (left * display.source.pixlen);
+    // The column map is absolute so the line pointer must not include the left offset
+    buffer = (const uint8_t *)framebuffer + display.source.offset + (top * stride);
 
     lcd_set_window(
         screen_left + RG_SCREEN_MARGIN_LEFT,
@@ -377,31 +510,16 @@ static inline void write_rect(int left, int top, int width, int height,
             if (i > 0 && screen_line_is_empty[screen_y])
             {
                 memcpy(line_buffer_ptr, line_buffer_ptr - scaled_width, scaled_width * 2);
-                line_buffer_ptr += scaled_width;
             }
             else
             {
-                #define RENDER_LINE(pixel) { \
-                    for (int x = 0, x_acc = ix_acc; x < width;) { \
-                        *line_buffer_ptr++ = (pixel); \
-                        x_acc += x_inc; \
-                        while (x_acc >= screen_width) { \
-                            x_acc -= screen_width; \
-                            ++x; \
-                        } \
-                    } \
-                }
-                if (format & RG_PIXEL_PAL)
-                    RENDER_LINE(palette[buffer.u8[x]])
-                else if (format & RG_PIXEL_LE)
-                    RENDER_LINE((buffer.u16[x] << 8) | (buffer.u16[x] >> 8))
-                else
-                    RENDER_LINE(buffer.u16[x])
+                render_line(line_buffer_ptr, buffer, col_src, scaled_width, palette);
             }
+            line_buffer_ptr += scaled_width;
 
             if (!screen_line_is_empty[++screen_y])
             {
-                buffer.u8 += stride;
+                buffer += stride;
                 ++y;
             }
         }
@@ -422,20 +540,10 @@ static inline void write_rect(int left, int top, int width, int height,
                 if (filter_x)
                 {
                     uint16_t *buffer = line_buffer + y * scaled_width;
-                    for (int x = 0, frame_x = 0, prev_frame_x = -1, x_acc = ix_acc; x < scaled_width; ++x)
+                    for (int x = 1; x < scaled_width - 1; ++x)
                     {
-                        if (frame_x == prev_frame_x && x > 0 && x + 1 < scaled_width)
-                        {
+                        if (col_is_empty[x])
                             buffer[x] = blend_pixels(buffer[x - 1], buffer[x + 1]);
-                        }
-                        prev_frame_x = frame_x;
-
-                        x_acc += x_inc;
-                        while (x_acc >= screen_width)
-                        {
-                            x_acc -= screen_width;
-                            ++frame_x;
-                        }
                     }
                 }
 
@@ -445,10 +553,7 @@ static inline void write_rect(int left, int top, int width, int height,
                     uint16_t *lineA = line_buffer + (fill_line - 1) * scaled_width;
                     uint16_t *lineB = line_buffer + (fill_line + 0) * scaled_width;
                     uint16_t *lineC = line_buffer + (fill_line + 1) * scaled_width;
-                    for (size_t x = 0; x < scaled_width; ++x)
-                    {
-                        lineB[x] = blend_pixels(lineA[x], lineC[x]);
-                    }
+                    blend_line(lineB, lineA, lineC, scaled_width);
                     fill_line = -1;
                 }
             }
@@ -518,66 +623,370 @@ static void update_viewport_scaling(void)
         }
     }
 
+    // Build the column tables used by the line renderers and the horizontal filter
+
+    memset(screen_col_is_empty, 0, sizeof(screen_col_is_empty));
+
+    // Rounding in x_inc can make a rect overshoot the viewport by a column, so fill the whole screen width
+    for (int x = 0; x < display.screen.width; ++x)
+    {
+        screen_col_src[x] = RG_MIN((x * display.viewport.x_inc) / display.screen.width, src_width - 1);
+        screen_col_is_empty[x] = x > 0 && screen_col_src[x] == screen_col_src[x - 1];
+    }
+
+    if (display.source.format & RG_PIXEL_PAL)
+        render_line = &render_line_pal;
+    else if (display.source.format & RG_PIXEL_LE)
+        render_line = &render_line_565_le;
+    else if (display.viewport.x_inc == display.screen.width)
+        render_line = &render_line_565_be_unscaled;
+    else
+        render_line = &render_line_565_be;
+
     RG_LOGI("%dx%d@%.3f => %dx%d@%.3f x_pos:%d y_pos:%d x_inc:%d y_inc:%d\n", src_width, src_height,
             src_width / (double)src_height, new_width, new_height, new_ratio, display.viewport.x_pos,
             display.viewport.y_pos, display.viewport.x_inc, display.viewport.y_inc);
 }
 
-static void display_task(void *arg)
+static void align_rect_to_filter(rg_update_rect_t *rect)
 {
-    display_task_queue = xQueueCreate(1, sizeof(rg_video_update_t *));
+    int top = rect->top;
+    int bottom = rect->top + rect->height - 1;
 
-    while (1)
+    // The vertical filter needs to start and end on lines that aren't blended with their neighbours
+    while (top > 0 && !filter_lines[top].start)
+        top--;
+    while (bottom < display.source.height - 1 && !filter_lines[bottom].stop)
+        bottom++;
+
+    // The horizontal filter needs one more pixel on each side
+    int left = RG_MAX(rect->left - 1, 0);
+    int right = RG_MIN(rect->left + rect->width + 1, display.source.width);
+
+    *rect = (rg_update_rect_t){left, top, right - left, bottom - top + 1};
+}
+
+static rg_update_t diff_frame(rg_video_update_t *update, const rg_video_update_t *previousUpdate)
+{
+    const int frame_width = display.source.width;
+    const int frame_height = display.source.height;
+    const int stride = display.source.stride;
+    const int line_words = (frame_width * display.source.pixlen) / 4;
+    const int block_words = (BLOCK_WIDTH * display.source.pixlen) / 4;
+    const int block_cols = (frame_width + BLOCK_WIDTH - 1) / BLOCK_WIDTH;
+    const int block_rows = (frame_height + BLOCK_HEIGHT - 1) / BLOCK_HEIGHT;
+    const uint32_t all_dirty = block_cols < 32 ? (1u << block_cols) - 1 : ~0u;
+    const float setup_cost = transfer_cost.setup;
+    const float pixel_cost = transfer_cost.pixel;
+    const float full_cost = setup_cost + (frame_width * frame_height) * pixel_cost;
+    rg_update_rect_t *rects = update->rects;
+    int dirty_pixels = 0;
+    int count = 0;
+
+    RG_ASSERT(block_cols <= 32 && block_rows <= RG_COUNT(dirty_blocks), "Source too large for the dirty map");
+
+    // Pass 1: Build the block map. Once a block is known to be dirty its remaining lines aren't compared.
+    for (int row = 0; row < block_rows; ++row)
     {
-        rg_video_update_t *update;
+        const int top = row * BLOCK_HEIGHT;
+        const int lines = RG_MIN(BLOCK_HEIGHT, frame_height - top);
+        uint32_t dirty = 0;
 
-        xQueuePeek(display_task_queue, &update, portMAX_DELAY);
-        // xQueueReceive(display_task_queue, &update, portMAX_DELAY);
+        for (int line = 0; line < lines && dirty != all_dirty; ++line)
+        {
+            const int offset = display.source.offset + (top + line) * stride;
+            const uint32_t *frame_buffer = (const uint32_t *)((const uint8_t *)update->buffer + offset);
+            const uint32_t *prev_buffer = (const uint32_t *)((const uint8_t *)previousUpdate->buffer + offset);
 
-        // Received a shutdown request!
-        if (update == (void *)-1)
-            break;
+            for (int col = 0; col < block_cols; ++col)
+            {
+                if (dirty & (1u << col))
+                    continue;
+                for (int x = col * block_words, end = RG_MIN(x + block_words, line_words); x < end; ++x)
+                {
+                    if (frame_buffer[x] != prev_buffer[x])
+                    {
+                        dirty |= 1u << col;
+                        break;
+                    }
+                }
+            }
+        }
+
+        dirty_blocks[row] = dirty;
+        dirty_pixels += __builtin_popcount(dirty) * BLOCK_WIDTH * lines;
+
+        // Even a single rect covering only the dirty blocks would already cost as much as a full update
+        if (setup_cost + dirty_pixels * pixel_cost >= full_cost)
+            return RG_UPDATE_FULL;
+    }
+
+    if (dirty_pixels == 0)
+    {
+        update->rects_count = 0;
+        return RG_UPDATE_EMPTY;
+    }
+
+    // Pass 2: Coalesce the blocks into rectangles. Two areas are merged whenever the clean pixels
+    // that we'd have to send needlessly cost less than the setup of an additional window.
+    for (int row = 0; row < block_rows; ++row)
+    {
+        const uint32_t dirty = dirty_blocks[row];
+        const int top = row * BLOCK_HEIGHT;
+        const int height = RG_MIN(BLOCK_HEIGHT, frame_height - top);
+
+        for (int col = 0; col < block_cols;)
+        {
+            if (!(dirty & (1u << col)))
+            {
+                col++;
+                continue;
+            }
+
+            int start = col;
+            while (col < block_cols && (dirty & (1u << col)))
+                col++;
+            int end = col;
+
+            // Absorb the next runs on this row if the gap is cheap enough
+            while (col < block_cols)
+            {
+                int next = col;
+                while (next < block_cols && !(dirty & (1u << next)))
+                    next++;
+                if (next == block_cols || (next - end) * BLOCK_WIDTH * height * pixel_cost > setup_cost)
+                    break;
+                col = next;
+                while (col < block_cols && (dirty & (1u << col)))
+                    col++;
+                end = col;
+            }
+
+            const int left = start * BLOCK_WIDTH;
+            const int right = RG_MIN(end * BLOCK_WIDTH, frame_width);
+            const rg_update_rect_t run = {left, top, right - left, height};
+            bool merged = false;
+
+            // Try extending a rectangle that ends right above this run
+            for (int i = 0; i < count && !merged; ++i)
+            {
+                rg_update_rect_t *rect = &rects[i];
+                if (rect->top + rect->height != top)
+                    continue;
+                int u_left = RG_MIN(rect->left, run.left);
+                int u_right = RG_MAX(rect->left + rect->width, run.left + run.width);
+                int u_height = rect->height + run.height;
+                int waste = (u_right - u_left) * u_height - rect->width * rect->height - run.width * run.height;
+                if (waste * pixel_cost <= setup_cost)
+                {
+                    *rect = (rg_update_rect_t){u_left, rect->top, u_right - u_left, u_height};
+                    merged = true;
+                }
+            }
+
+            if (!merged)
+            {
+                if (count == RG_COUNT(update->rects))
+                    return RG_UPDATE_FULL;
+                rects[count++] = run;
+            }
+        }
+    }
+
+    // Pass 3: Decide, using the measured costs, if the partial update is actually worth it
+    float partial_cost = count * setup_cost;
+    for (int i = 0; i < count; ++i)
+        partial_cost += rects[i].width * rects[i].height * pixel_cost;
+
+    if (partial_cost >= full_cost)
+        return RG_UPDATE_FULL;
+
+    // If filtering is enabled we must adjust our rects to be on appropriate boundaries
+    if (config.filter && config.scaling)
+    {
+        for (int i = 0; i < count; ++i)
+            align_rect_to_filter(&rects[i]);
+    }
+
+    update->rects_count = count;
+
+    return RG_UPDATE_PARTIAL;
+}
+
+static void update_transfer_cost(int pixels, int elapsed)
+{
+    // Big transfers are dominated by the pixel cost, small ones by the window setup cost
+    if (pixels >= (display.source.width * display.source.height) / 2)
+        transfer_cost.pixel = transfer_cost.pixel * 0.9f + (RG_MAX(elapsed - transfer_cost.setup, 1) / pixels) * 0.1f;
+    else
+        transfer_cost.setup = transfer_cost.setup * 0.9f + RG_MAX(elapsed - pixels * transfer_cost.pixel, 0) * 0.1f;
+}
+
+static rg_update_t prepare_update(rg_video_update_t *update, const rg_video_update_t *reference)
+{
+    if (update->type == RG_UPDATE_FULL || !reference || reference == update || display.changed)
+        return RG_UPDATE_FULL;
+
+    if (config.update_mode == RG_DISPLAY_UPDATE_FULL)
+        return RG_UPDATE_FULL;
+
+    // There's no speed benefit in trying to diff when both buffers are in SPIRAM,
+    // it will almost always be faster to just update it everything...
+    if (PTR_IN_SPIRAM(update->buffer) && PTR_IN_SPIRAM(reference->buffer))
+        return RG_UPDATE_FULL;
+
+    // The diff only looks at indices, a palette change affects the whole frame
+    if ((display.source.format & RG_PIXEL_PAL) && memcmp(update->palette, reference->palette, sizeof(update->palette)))
+        return RG_UPDATE_FULL;
+
+    return diff_frame(update, reference);
+}
+
+static void display_update(rg_video_update_t *update)
+{
+    if (display.changed)
+    {
+        if (config.scaling != RG_DISPLAY_SCALING_FILL)
+            rg_display_clear(C_BLACK);
+        update_viewport_scaling();
+        update->type = RG_UPDATE_FULL;
+        display.changed = false;
+    }
+
+    if (update->type == RG_UPDATE_FULL)
+    {
+        update->rects[0] = (rg_update_rect_t){0, 0, display.source.width, display.source.height};
+        update->rects_count = 1;
+    }
+    else if (update->type == RG_UPDATE_EMPTY)
+    {
+        update->rects_count = 0;
+    }
+
+    // It's better to update the counters before we start the transfer, in case someone needs it
+    if (update->type == RG_UPDATE_FULL)
+        counters.fullFrames++;
+    counters.totalFrames++;
+
+    for (int i = 0; i < update->rects_count; ++i)
+    {
+        const rg_update_rect_t *rect = &update->rects[i];
+        int64_t time_start = rg_system_timer();
+        write_rect(rect->left, rect->top, rect->width, rect->height, update->buffer, update->palette);
+        update_transfer_cost(rect->width * rect->height, rg_system_timer() - time_start);
+    }
+}
+
+static bool frame_is_pending(const rg_video_update_t *frame, uint32_t head, uint32_t tail)
+{
+    for (uint32_t pos = tail; pos != head; ++pos)
+    {
+        if (ATOMIC_LOAD(&queue.slots[pos % FRAME_QUEUE_LENGTH]) == frame)
+            return true;
+    }
+    return false;
+}
+
+static rg_update_t queue_push(rg_video_update_t *update, bool full)
+{
+    uint32_t head = queue.head; // Only the producer writes head
+
+    while (1)
+    {
+        uint32_t tail = ATOMIC_LOAD(&queue.tail);
+        rg_video_update_t **newest = &queue.slots[(head - 1) % FRAME_QUEUE_LENGTH];
+        rg_video_update_t *pending = (head != tail) ? ATOMIC_LOAD(newest) : NULL;
 
-        if (display.changed)
+        // The frame was submitted again before the display task got to it (single buffered apps), what it
+        // held before is lost. Writing type races with the pop, at worst a forced full update becomes a diffed one.
+        if (pending == update)
         {
-            if (config.scaling != RG_DISPLAY_SCALING_FILL)
-                rg_display_clear(C_BLACK);
-            update_viewport_scaling();
-            update->type = RG_UPDATE_FULL;
-            display.changed = false;
+            if (full)
+                update->type = RG_UPDATE_FULL;
+            return RG_UPDATE_REPLACED;
         }
 
-        if (update->type == RG_UPDATE_FULL)
+        if (head - tail < FRAME_QUEUE_LENGTH)
         {
-            // write_rect();
-            update->diff[0] = (rg_line_diff_t){
-                .left = 0,
-                .width = display.source.width,
-                .repeat = display.source.height,
-            };
+            rg_update_t type = full ? RG_UPDATE_FULL : RG_UPDATE_PARTIAL;
+            update->type = type;
+            ATOMIC_STORE(&queue.slots[head % FRAME_QUEUE_LENGTH], update);
+            ATOMIC_STORE(&queue.head, head + 1);
+            SEM_GIVE(queue.frame_ready);
+            return type;
         }
 
-        // It's better to update the counters before we start the transfer, in case someone needs it
-        if (update->type == RG_UPDATE_FULL)
-            counters.fullFrames++;
-        counters.totalFrames++;
+        // The ring is full: the newest pending frame is replaced by this one (latest frame wins).
+        // It is diffed against what is on screen, so skipping a frame doesn't lose any change.
+        if (pending)
+        {
+            update->type = (full || pending->type == RG_UPDATE_FULL) ? RG_UPDATE_FULL : RG_UPDATE_PARTIAL;
+            if (ATOMIC_CAS(newest, &pending, update))
+                return RG_UPDATE_REPLACED;
+        }
+
+        // The display task is taking that frame right now, a slot is about to be free
+    }
+}
+
+static rg_video_update_t *queue_pop(void)
+{
+    while (!queue.stop)
+    {
+        uint32_t tail = queue.tail; // Only the display task writes tail
 
-        for (int y = 0; y < display.source.height;)
+        if (tail == ATOMIC_LOAD(&queue.head))
         {
-            rg_line_diff_t *diff = &update->diff[y];
+            SEM_TAKE(queue.frame_ready, 100);
+            continue;
+        }
 
-            if (diff->width > 0)
-            {
-                write_rect(diff->left, y, diff->width, diff->repeat, update->buffer, update->palette);
-            }
-            y += diff->repeat;
+        // The frame must be published as in use *before* it leaves the ring, otherwise rg_display_acquire()
+        // could see it as free. The CAS fails if the producer replaced or took back the frame meanwhile.
+        rg_video_update_t **slot = &queue.slots[tail % FRAME_QUEUE_LENGTH];
+        rg_video_update_t *update = ATOMIC_LOAD(slot);
+        while (update)
+        {
+            ATOMIC_STORE(&queue.drawing, update);
+            if (ATOMIC_CAS(slot, &update, NULL))
+                break;
         }
 
-        xQueueReceive(display_task_queue, &update, portMAX_DELAY);
+        // Taken back by rg_display_acquire(), head is about to move back
+        if (!update)
+        {
+            ATOMIC_STORE(&queue.drawing, NULL);
+            continue;
+        }
+
+        ATOMIC_STORE(&queue.tail, tail + 1);
+        return update;
+    }
+    return NULL;
+}
+
+static void display_task(void *arg)
+{
+    rg_video_update_t *update;
+
+    while ((update = queue_pop()))
+    {
+        int64_t time_start = rg_system_timer();
+
+        update->type = prepare_update(update, queue.reference);
+
+        // The previous reference is free as soon as the new one is set
+        ATOMIC_STORE(&queue.reference, update);
+        SEM_GIVE(queue.frame_done);
+
+        display_update(update);
+
+        rg_system_trace_stage(RG_STAGE_DISPLAY, rg_system_timer() - time_start);
+        ATOMIC_STORE(&queue.drawing, NULL);
+        SEM_GIVE(queue.frame_done);
     }
 
-    vQueueDelete(display_task_queue);
-    display_task_queue = NULL;
+    queue.running = false;
 }
 
 void rg_display_force_redraw(void)
@@ -660,11 +1069,16 @@ int rg_display_get_backlight(void)
     return config.backlight;
 }
 
-bool rg_display_save_frame(const char *filename, const rg_video_update_t *frame, int width, int height)
+rg_image_t *rg_display_copy_frame(const rg_video_update_t *frame)
 {
+    if (!frame)
+        frame = last_update;
+    if (!frame)
+        return NULL;
+
     rg_image_t *original = rg_image_alloc(display.source.width, display.source.height);
     if (!original)
-        return false;
+        return NULL;
 
     uint16_t *dst_ptr = original->data;
 
@@ -689,6 +1103,17 @@ bool rg_display_save_frame(const char *filename, const rg_video_update_t *frame,
         }
     }
 
+    return original;
+}
+
+bool rg_display_save_frame(const char *filename, const rg_video_update_t *frame, int width, int height)
+{
+    RG_ASSERT(frame, "Bad param");
+
+    rg_image_t *original = rg_display_copy_frame(frame);
+    if (!original)
+        return false;
+
     rg_image_t *img = rg_image_copy_resampled(original, width, height, 0);
     rg_image_free(original);
 
@@ -698,150 +1123,114 @@ bool rg_display_save_frame(const char *filename, const rg_video_update_t *frame,
     return success;
 }
 
-IRAM_ATTR
-rg_update_t rg_display_submit(/*const*/ rg_video_update_t *update, const rg_video_update_t *previousUpdate)
+uint32_t rg_display_get_frame_crc(void)
 {
-    const int64_t time_start = rg_system_timer();
-    // RG_ASSERT(display.source.width && display.source.height, "Source format not set!");
-    RG_ASSERT(update, "update is null!");
+    const rg_video_update_t *frame = last_update;
+    uint16_t line[display.source.width + 1];
+    uint32_t crc = 0;
 
-    if (!previousUpdate || display.changed || config.update_mode == RG_DISPLAY_UPDATE_FULL)
-    {
-        update->type = RG_UPDATE_FULL;
-    }
-    else if (PTR_IN_SPIRAM(update->buffer) && PTR_IN_SPIRAM(previousUpdate->buffer))
+    if (!frame)
+        return 0;
+
+    // The pixels are converted to 565LE first so that the result doesn't depend on the source format
+    for (int y = 0; y < display.source.height; y++)
     {
-        // There's no speed benefit in trying to diff when both buffers are in SPIRAM,
-        // it will almost always be faster to just update it everything...
-        update->type = RG_UPDATE_FULL;
-    }
-    else // RG_UPDATE_PARTIAL
-    {
-        const uint32_t *frame_buffer = update->buffer + display.source.offset; // uint64_t is 0.7% faster!
-        const uint32_t *prev_buffer = previousUpdate->buffer + display.source.offset;
-        const int frame_width = display.source.width;
-        const int frame_height = display.source.height;
-        const int stride = display.source.stride;
-        const int blocks = (frame_width * display.source.pixlen) / sizeof(*frame_buffer);
-        const int pixels_per_block = sizeof(*frame_buffer) / display.source.pixlen;
-        rg_line_diff_t *out_diff = update->diff;
-
-        // If more than 50% of the screen has changed then stop the comparison and assume that the
-        // rest also changed. This is true in 77% of the cases in Pokemon, resulting in a net
-        // benefit. The other 23% of cases would have benefited from finishing the diff, so a better
-        // heuristic might be preferable (interlaced compare perhaps?).
-        int threshold = (frame_width * frame_height) / 2;
-        int changed = 0;
-
-        for (int y = 0; y < frame_height; ++y)
-        {
-            int left = 0, width = 0;
+        const uint8_t *src_ptr8 = frame->buffer + display.source.offset + (y * display.source.stride);
+        const uint16_t *src_ptr16 = (const uint16_t *)src_ptr8;
 
-            for (int x = 0; x < blocks && changed < threshold; ++x)
-            {
-                if (frame_buffer[x] != prev_buffer[x])
-                {
-                    for (int xl = blocks - 1; xl >= x; --xl)
-                    {
-                        if (frame_buffer[xl] != prev_buffer[xl])
-                        {
-                            left = x * pixels_per_block;
-                            width = ((xl + 1) - x) * pixels_per_block;
-                            changed += width;
-                            break;
-                        }
-                    }
-                    break;
-                }
-            }
+        for (int x = 0; x < display.source.width; x++)
+        {
+            uint16_t pixel;
 
-            out_diff[y].left = left;
-            out_diff[y].width = width;
-            out_diff[y].repeat = 1;
+            if (display.source.format & RG_PIXEL_PAL)
+                pixel = frame->palette[src_ptr8[x]];
+            else
+                pixel = src_ptr16[x];
 
-            frame_buffer = (void *)frame_buffer + stride;
-            prev_buffer = (void *)prev_buffer + stride;
-        }
+            if (!(display.source.format & RG_PIXEL_LE))
+                pixel = (pixel << 8) | (pixel >> 8);
 
-        if (changed == 0)
-        {
-            update->type = RG_UPDATE_EMPTY;
-        }
-        else if (changed >= threshold)
-        {
-            update->type = RG_UPDATE_FULL;
+            line[x] = pixel;
         }
-        else
-        {
-            update->type = RG_UPDATE_PARTIAL;
-
-            // If filtering is enabled we must adjust our diff blocks to be on appropriate boundaries
-            if (config.filter && config.scaling)
-            {
-                for (int y = 0; y < frame_height; ++y)
-                {
-                    if (out_diff[y].width < 1)
-                        continue;
 
-                    int block_start = y;
-                    int block_end = y;
-                    int left = out_diff[y].left;
-                    int right = left + out_diff[y].width;
-
-                    while (block_start > 0 && (out_diff[block_start].width > 0 || !filter_lines[block_start].start))
-                        block_start--;
+        crc = rg_crc32(crc, (const uint8_t *)line, display.source.width * 2);
+    }
 
-                    while (block_end < frame_height - 1 &&
-                           (out_diff[block_end].width > 0 || !filter_lines[block_end].stop))
-                        block_end++;
+    return crc;
+}
 
-                    for (int i = block_start; i <= block_end; i++)
-                    {
-                        if (out_diff[i].width > 0)
-                        {
-                            right = RG_MAX(right, out_diff[i].left + out_diff[i].width);
-                            left = RG_MIN(left, out_diff[i].left);
-                        }
-                    }
+IRAM_ATTR
+rg_update_t rg_display_submit(/*const*/ rg_video_update_t *update, const rg_video_update_t *previousUpdate)
+{
+    const int64_t time_start = rg_system_timer();
+    // RG_ASSERT(display.source.width && display.source.height, "Source format not set!");
+    RG_ASSERT(update, "update is null!");
 
-                    left = RG_MAX(left - 1, 0);
-                    right = RG_MIN(right + 1, frame_width);
+    // The display task diffs the frame against what is actually on screen, previousUpdate
+    // only tells us whether the application allows a partial update at all.
+    // The display task may still turn it into an empty update once it has diffed the frame
+    rg_update_t type = queue_push(update, !previousUpdate || queue.force_full);
+    queue.force_full = false;
+    if (type == RG_UPDATE_REPLACED)
+        counters.droppedFrames++;
+    last_update = update;
 
-                    for (int i = block_start; i <= block_end; i++)
-                    {
-                        out_diff[i].left = left;
-                        out_diff[i].width = right - left;
-                    }
+    int elapsed = rg_system_timer() - time_start;
+    rg_system_trace_stage(RG_STAGE_SUBMIT, elapsed);
+    counters.busyTime += elapsed;
 
-                    y = block_end;
-                }
-            }
+    return type;
+}
 
-            // Combine consecutive lines with similar changes location to optimize the SPI transfer
-            rg_line_diff_t *line = &out_diff[frame_height - 1];
-            rg_line_diff_t *prev_line = line - 1;
+static rg_video_update_t *take_free_frame(rg_video_update_t *frames, size_t count)
+{
+    // Order matters: the display task marks a frame as drawing before removing it from the ring,
+    // and as reference before it stops drawing it. So we check the ring first, then in that order.
+    uint32_t tail = ATOMIC_LOAD(&queue.tail);
+    uint32_t head = queue.head;
 
-            for (; line > out_diff; --line, --prev_line)
-            {
-                int right = line->left + line->width;
-                int right_prev = prev_line->left + prev_line->width;
+    for (size_t i = 0; i < count; ++i)
+    {
+        rg_video_update_t *frame = &frames[i];
+        if (frame_is_pending(frame, head, tail))
+            continue;
+        if (frame == ATOMIC_LOAD(&queue.drawing) || frame == ATOMIC_LOAD(&queue.reference))
+            continue;
+        return frame;
+    }
 
-                if (abs(line->left - prev_line->left) <= 8 && abs(right - right_prev) <= 8)
-                {
-                    if (line->left < prev_line->left)
-                        prev_line->left = line->left;
-                    prev_line->width = RG_MAX(right, right_prev) - prev_line->left;
-                    prev_line->repeat = line->repeat + 1;
-                }
-            }
+    // Nothing is free, take back the newest frame if the display task hasn't started on it yet
+    if (head != tail)
+    {
+        rg_video_update_t **slot = &queue.slots[(head - 1) % FRAME_QUEUE_LENGTH];
+        rg_video_update_t *frame = ATOMIC_LOAD(slot);
+        if (frame >= frames && frame < frames + count && ATOMIC_CAS(slot, &frame, NULL))
+        {
+            ATOMIC_STORE(&queue.head, head - 1);
+            queue.force_full |= (frame->type == RG_UPDATE_FULL);
+            counters.droppedFrames++;
+            return frame;
         }
     }
 
-    xQueueSend(display_task_queue, &update, portMAX_DELAY);
+    return NULL;
+}
+
+IRAM_ATTR
+rg_video_update_t *rg_display_acquire(rg_video_update_t *frames, size_t count)
+{
+    const int64_t time_start = rg_system_timer();
+    RG_ASSERT(frames && count, "bad param");
+
+    rg_video_update_t *frame;
+    while (!(frame = take_free_frame(frames, count)))
+        SEM_TAKE(queue.frame_done, 10);
 
-    counters.busyTime += rg_system_timer() - time_start;
+    int elapsed = rg_system_timer() - time_start;
+    rg_system_trace_stage(RG_STAGE_SUBMIT, elapsed);
+    counters.busyTime += elapsed;
 
-    return update->type;
+    return frame;
 }
 
 void rg_display_set_source_format(int width, int height, int crop_h, int crop_v, int stride, int format)
@@ -866,11 +1255,19 @@ void rg_display_set_source_format(int width, int height, int crop_h, int crop_v,
 
 bool rg_display_sync(bool block)
 {
-#ifdef ESP_PLATFORM
-    while (block && uxQueueMessagesWaiting(display_task_queue))
-        continue; // Wait until display queue is done
-    return uxQueueMessagesWaiting(display_task_queue) == 0;
-#endif
+    // tail is checked first because a frame is marked as drawing before it leaves the ring
+    while (ATOMIC_LOAD(&queue.tail) != ATOMIC_LOAD(&queue.head) || ATOMIC_LOAD(&queue.drawing))
+    {
+        if (!block)
+            return false;
+        SEM_TAKE(queue.frame_done, 10);
+    }
+    return true;
+}
+
+int rg_display_get_backlog(void)
+{
+    return ATOMIC_LOAD(&queue.head) - ATOMIC_LOAD(&queue.tail);
 }
 
 void rg_display_write(int left, int top, int width, int height, int stride, const uint16_t *buffer)
@@ -937,9 +1334,9 @@ void rg_display_clear(uint16_t color_le)
 
 void rg_display_deinit(void)
 {
-    void *stop = (void *)-1;
-    xQueueSend(display_task_queue, &stop, portMAX_DELAY);
-    while (display_task_queue)
+    queue.stop = true;
+    SEM_GIVE(queue.frame_ready);
+    while (queue.running)
         rg_task_delay(1);
     lcd_deinit();
     RG_LOGI("Display terminated.\n");
@@ -962,6 +1359,16 @@ void rg_display_init(void)
         .changed = true,
     };
     lcd_init();
+    if (!queue.frame_ready)
+    {
+        queue.frame_ready = SEM_CREATE();
+        queue.frame_done = SEM_CREATE();
+    }
+    memset(queue.slots, 0, sizeof(queue.slots));
+    queue.head = queue.tail = 0;
+    queue.drawing = queue.reference = NULL;
+    queue.stop = false;
+    queue.running = true;
     rg_task_create("rg_display", &display_task, NULL, 3 * 1024, 5, 1);
     RG_LOGI("Display ready.\n");
 }
@@ -3,12 +3,15 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "rg_image.h"
+
 typedef enum
 {
     RG_UPDATE_EMPTY = 0,
     RG_UPDATE_FULL,
     RG_UPDATE_PARTIAL,
     RG_UPDATE_ERROR,
+    RG_UPDATE_REPLACED, // Only returned by rg_display_submit(), a frame that wasn't drawn yet was dropped
 } rg_update_t;
 
 typedef enum
@@ -75,6 +78,7 @@ typedef struct
 {
     int32_t totalFrames;
     int32_t fullFrames;
+    int32_t droppedFrames; // Replaced by a newer one before they could be drawn
     int64_t busyTime; // This is only time spent blocking the main task
 } rg_display_counters_t;
 
@@ -118,17 +122,19 @@ typedef struct
 
 typedef struct
 {
-    short left;   // int32_t left:10;
-    short width;  // int32_t width:10;
-    short repeat; // int32_t repeat:10;
-} rg_line_diff_t;
+    short left;
+    short top;
+    short width;
+    short height;
+} rg_update_rect_t;
 
 typedef struct
 {
     rg_update_t type;
     void *buffer;          // Should be at least height*stride bytes. expects uint8_t * | uint16_t *
     uint16_t palette[256]; // Used in RG_PIXEL_PAL is set
-    rg_line_diff_t diff[256];
+    int rects_count;       // Filled by the display task
+    rg_update_rect_t rects[32];
 } rg_video_update_t;
 
 void rg_display_init(void);
@@ -137,11 +143,19 @@ void rg_display_write(int left, int top, int width, int height, int stride,
                       const uint16_t *buffer); // , bool little_endian);
 void rg_display_clear(uint16_t color_le);
 bool rg_display_sync(bool block);
+int rg_display_get_backlog(void); // Frames submitted that the display task hasn't picked up yet
 void rg_display_force_redraw(void);
 bool rg_display_save_frame(const char *filename, const rg_video_update_t *frame, int width, int height);
+rg_image_t *rg_display_copy_frame(const rg_video_update_t *frame); // NULL = the last frame submitted
+uint32_t rg_display_get_frame_crc(void);
 void rg_display_set_source_format(int width, int height, int crop_h, int crop_v, int stride, int format);
 
+// Queues a frame for the display task. Returns RG_UPDATE_FULL or RG_UPDATE_PARTIAL, or RG_UPDATE_REPLACED when
+// an older frame still waiting to be drawn was dropped for this one (the display task is behind).
 rg_update_t rg_display_submit(/*const*/ rg_video_update_t *update, const rg_video_update_t *previousUpdate);
+// Returns a frame from `frames` that the display task no longer needs. If none is free, the newest one
+// still waiting to be drawn is taken back (latest frame wins). Otherwise blocks until one is released.
+rg_video_update_t *rg_display_acquire(rg_video_update_t *frames, size_t count);
 #define rg_display_queue_update rg_display_submit
 
 rg_display_counters_t rg_display_get_counters(void);
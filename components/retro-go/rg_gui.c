@@ -27,8 +27,9 @@ static struct
         rg_color_t item_disabled;
         rg_color_t scrollbar;
     } style;
-    char theme_name[32];
+    const char *theme_name; // Interned, NULL is the built-in theme
     cJSON *theme_obj;
+    bool save_failed; // A background save failed since the game menu was last opened
     bool initialized;
 } gui;
 
@@ -77,7 +78,7 @@ bool rg_gui_set_theme(const char *theme_name)
     if (new_theme)
     {
         rg_settings_set_string(NS_GLOBAL, SETTING_THEME, theme_name);
-        strcpy(gui.theme_name, theme_name);
+        gui.theme_name = const_string(theme_name);
         // FIXME: Keeping the theme around uses quite a lot of internal memory (about 3KB)...
         //        We should probably convert it to a regular array or hashmap.
         gui.theme_obj = new_theme;
@@ -86,7 +87,7 @@ bool rg_gui_set_theme(const char *theme_name)
     else
     {
         rg_settings_set_string(NS_GLOBAL, SETTING_THEME, NULL);
-        strcpy(gui.theme_name, "");
+        gui.theme_name = NULL;
         gui.theme_obj = NULL;
         RG_LOGI("Using built-in theme!\n");
     }
@@ -133,7 +134,7 @@ rg_image_t *rg_gui_get_theme_image(const char *name)
 
 const char *rg_gui_get_theme_name(void)
 {
-    return gui.theme_name[0] ? gui.theme_name : NULL;
+    return gui.theme_name;
 }
 
 void rg_gui_set_buffered(bool buffered)
@@ -884,23 +885,19 @@ void rg_gui_alert(const char *title, const char *message)
 
 char *rg_gui_file_picker(const char *title, const char *path, bool (*validator)(const char *path))
 {
-    rg_scandir_t *files = rg_storage_scandir(path, validator, false);
+    rg_scandir_t *files = rg_storage_scandir(path, validator, RG_SCANDIR_SORT);
 
-    if (!files || !files[0].is_valid)
+    if (!files || !files->count)
     {
         free(files);
         rg_gui_alert(title, "Folder is empty.");
         return NULL;
     }
 
-    size_t count = 0;
-    while (files[count].is_valid)
-        count++;
-
-    RG_LOGI("count=%d\n", count);
+    RG_LOGI("count=%d\n", (int)files->count);
 
     // Unfortunately, at this time, any more than that will blow the stack.
-    count = RG_MIN(count, 20);
+    size_t count = RG_MIN(files->count, 20);
 
     rg_gui_option_t *options = calloc(count + 1, sizeof(rg_gui_option_t));
     for (size_t i = 0; i < count; ++i)
@@ -908,7 +905,7 @@ char *rg_gui_file_picker(const char *title, const char *path, bool (*validator)(
         // To do: check extension...
         options[i].arg = i;
         options[i].flags = 1;
-        options[i].label = files[i].name;
+        options[i].label = files->entries[i].name;
     }
     options[count] = (rg_gui_option_t)RG_DIALOG_CHOICE_LAST;
 
@@ -916,7 +913,7 @@ char *rg_gui_file_picker(const char *title, const char *path, bool (*validator)(
     char *filename = NULL;
 
     if (sel >= 0 && sel < count)
-        filename = strdup(files[sel].name);
+        filename = strdup(files->entries[sel].name);
 
     free(options);
     free(files);
@@ -1078,6 +1075,34 @@ static rg_gui_event_t speedup_update_cb(rg_gui_option_t *option, rg_gui_event_t
     return RG_DIALOG_VOID;
 }
 
+static rg_gui_event_t rewind_update_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
+    {
+        rg_emu_set_rewind(!rg_emu_get_rewind());
+    }
+    strcpy(option->value, rg_emu_get_rewind() ? "On " : "Off");
+    return RG_DIALOG_VOID;
+}
+
+static rg_gui_event_t run_ahead_update_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    int frames = rg_emu_get_run_ahead();
+
+    if (event == RG_DIALOG_PREV)
+        rg_emu_set_run_ahead(frames > 0 ? frames - 1 : RG_RUN_AHEAD_MAX_FRAMES);
+    else if (event == RG_DIALOG_NEXT)
+        rg_emu_set_run_ahead(frames < RG_RUN_AHEAD_MAX_FRAMES ? frames + 1 : 0);
+
+    frames = rg_emu_get_run_ahead();
+    if (frames > 0)
+        sprintf(option->value, "%d frame%s", frames, frames > 1 ? "s" : "");
+    else
+        strcpy(option->value, "Off");
+
+    return RG_DIALOG_VOID;
+}
+
 static rg_gui_event_t disk_activity_cb(rg_gui_option_t *option, rg_gui_event_t event)
 {
     if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
@@ -1143,6 +1168,10 @@ void rg_gui_options_menu(void)
         *opt++ = (rg_gui_option_t){0, "Filter", "None", 1, &filter_update_cb};
         *opt++ = (rg_gui_option_t){0, "Update", "Partial", 1, &update_mode_update_cb};
         *opt++ = (rg_gui_option_t){0, "Speed", "1x", 1, &speedup_update_cb};
+        if (app->handlers.serialize)
+            *opt++ = (rg_gui_option_t){0, "Rewind", "Off", 1, &rewind_update_cb};
+        if (rg_emu_get_run_ahead() >= 0)
+            *opt++ = (rg_gui_option_t){0, "Run-ahead", "Off", 1, &run_ahead_update_cb};
     }
 
     size_t extra_options = get_dialog_items_count(app->options);
@@ -1257,6 +1286,43 @@ void rg_gui_about_menu(const rg_gui_option_t *extra_options)
     }
 }
 
+static void frame_timings_menu(void)
+{
+    char values[RG_STAGE_COUNT][32];
+
+    const rg_gui_option_t options[] = {
+        {0, "(p50/p99/max us)", NULL, 0, NULL},
+        {0, "Frame   ", values[RG_STAGE_FRAME], 1, NULL},
+        {0, "Emulate ", values[RG_STAGE_EMULATE], 1, NULL},
+        {0, "Submit  ", values[RG_STAGE_SUBMIT], 1, NULL},
+        {0, "Display ", values[RG_STAGE_DISPLAY], 1, NULL},
+        {0, "Audio   ", values[RG_STAGE_AUDIO], 1, NULL},
+        {0, "Storage ", values[RG_STAGE_STORAGE], 1, NULL},
+        {0, "Rewind  ", values[RG_STAGE_REWIND], 1, NULL},
+        {0, "Runahead", values[RG_STAGE_RUNAHEAD], 1, NULL},
+        RG_DIALOG_SEPARATOR,
+        {1, "Save to file", NULL, 1, NULL},
+        {2, "Reset", NULL, 1, NULL},
+        RG_DIALOG_CHOICE_LAST
+    };
+
+    for (int i = 0; i < RG_STAGE_COUNT; ++i)
+    {
+        rg_stage_stats_t stats = rg_system_get_stage_stats(i);
+        snprintf(values[i], 32, "%d/%d/%d", stats.p50, stats.p99, stats.max);
+    }
+
+    switch (rg_gui_dialog("Frame timings", options, -1))
+    {
+    case 1:
+        rg_system_save_timings(RG_BASE_PATH "/timings.csv");
+        break;
+    case 2:
+        rg_system_reset_stage_stats();
+        break;
+    }
+}
+
 void rg_gui_debug_menu(const rg_gui_option_t *extra_options)
 {
     char screen_res[20], source_res[20], scaled_res[20];
@@ -1281,6 +1347,8 @@ void rg_gui_debug_menu(const rg_gui_option_t *extra_options)
         {2, "Clear cache", NULL, 1, NULL},
         {3, "Save screenshot", NULL, 1, NULL},
         {4, "Save trace", NULL, 1, NULL},
+        {8, "Export settings", NULL, 1, NULL},
+        {7, "Frame timings", NULL, 1, NULL},
         {5, "Cheats", NULL, 1, NULL},
         {6, "Crash", NULL, 1, NULL},
         RG_DIALOG_CHOICE_LAST
@@ -1329,6 +1397,13 @@ void rg_gui_debug_menu(const rg_gui_option_t *extra_options)
     case 6:
         RG_PANIC("Crash test!");
         break;
+    case 7:
+        frame_timings_menu();
+        break;
+    case 8:
+        if (!rg_settings_export(RG_STORAGE_ROOT "/settings"))
+            rg_gui_alert("Export settings", "Some settings couldn't be written.");
+        break;
     }
 }
 
@@ -1396,6 +1471,11 @@ int rg_gui_savestate_menu(const char *title, const char *rom_path, bool quick_re
     return sel;
 }
 
+static void save_done_cb(uint8_t slot, bool success, void *arg)
+{
+    gui.save_failed |= !success;
+}
+
 void rg_gui_game_menu(void)
 {
     const rg_gui_option_t choices[] = {
@@ -1418,6 +1498,13 @@ void rg_gui_game_menu(void)
 
     rg_audio_set_mute(true);
 
+    // The save finished in the middle of the game, this is the first chance to tell
+    if (gui.save_failed)
+    {
+        gui.save_failed = false;
+        rg_gui_alert("Save failed", NULL);
+    }
+
     sel = rg_gui_dialog("Retro-Go", choices, 0);
 
     rg_settings_commit();
@@ -1435,8 +1522,25 @@ void rg_gui_game_menu(void)
 
     switch (sel)
     {
-        case 1000: if ((slot = rg_gui_savestate_menu("Save", 0, 0)) >= 0) rg_emu_save_state(slot); break;
-        case 2000: if ((slot = rg_gui_savestate_menu("Save", 0, 0)) >= 0) {rg_emu_save_state(slot); rg_system_exit();} break;
+        case 1000:
+            if ((slot = rg_gui_savestate_menu("Save", 0, 0)) < 0)
+                break;
+            rg_emu_save_state_async(slot, &save_done_cb, NULL);
+            if (gui.save_failed) // It failed before going to the background
+            {
+                gui.save_failed = false;
+                rg_gui_alert("Save failed", NULL);
+            }
+            break;
+        case 2000:
+            if ((slot = rg_gui_savestate_menu("Save", 0, 0)) < 0)
+                break;
+            // The same background writer as Save & Continue, but we must know how it went before quitting
+            rg_gui_draw_hourglass();
+            if (rg_emu_save_state_async(slot, NULL, NULL) && rg_emu_save_state_wait())
+                rg_system_exit();
+            rg_gui_alert("Save failed", NULL);
+            break;
         case 3001: if ((slot = rg_gui_savestate_menu("Load", 0, 0)) >= 0) rg_emu_load_state(slot); break;
         case 3002: rg_emu_reset(false); break;
         case 3003: rg_emu_reset(true); break;
@@ -163,14 +163,16 @@ rg_image_t *rg_image_copy_resampled(const rg_image_t *img, int new_width, int ne
     }
     else
     {
-        float step_x = (float)img->width / new_width;
-        float step_y = (float)img->height / new_height;
+        // 16.16 fixed point steps, float to int conversions in the inner loop are slow on the ESP32
+        uint32_t step_x = ((uint32_t)img->width << 16) / new_width;
+        uint32_t step_y = ((uint32_t)img->height << 16) / new_height;
         uint16_t *dst = new_img->data;
-        for (int y = 0; y < new_height; y++)
+        for (uint32_t y = 0, src_y = 0; y < new_height; y++, src_y += step_y)
         {
-            for (int x = 0; x < new_width; x++)
+            const uint16_t *src = img->data + (src_y >> 16) * img->width;
+            for (uint32_t x = 0, src_x = 0; x < new_width; x++, src_x += step_x)
             {
-                *(dst++) = img->data[((int)(y * step_y) * img->width) + (int)(x * step_x)];
+                *(dst++) = src[src_x >> 16];
             }
         }
     }
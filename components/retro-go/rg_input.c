@@ -148,6 +148,9 @@ static inline uint32_t gamepad_read(void)
     if (state == (RG_KEY_SELECT|RG_KEY_A))
         state = RG_KEY_OPTION;
 #endif
+    // Only taken from the game when rewinding is enabled
+    if (state == (RG_KEY_SELECT|RG_KEY_LEFT) && rg_emu_get_rewind())
+        state = RG_KEY_REWIND;
 
     return state;
 }
@@ -352,6 +355,7 @@ const char *rg_input_get_key_name(rg_key_t key)
     case RG_KEY_Y: return "Y";
     case RG_KEY_L: return "Left Shoulder";
     case RG_KEY_R: return "Right Shoulder";
+    case RG_KEY_REWIND: return "Rewind";
     case RG_KEY_NONE: return "None";
     default: return "Unknown";
     }
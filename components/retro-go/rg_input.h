@@ -19,7 +19,8 @@ typedef enum
     RG_KEY_Y       = (1 << 11),
     RG_KEY_L       = (1 << 12),
     RG_KEY_R       = (1 << 13),
-    RG_KEY_COUNT   = 14,
+    RG_KEY_REWIND  = (1 << 14), // Virtual, see rg_emu_set_rewind()
+    RG_KEY_COUNT   = 15,
     RG_KEY_ANY     = 0xFFFF,
     RG_KEY_ALL     = 0xFFFF,
     RG_KEY_NONE    = 0,
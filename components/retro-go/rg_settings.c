@@ -1,31 +1,319 @@
 #include "rg_system.h"
 
+#include <sys/stat.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <cJSON.h>
 
-static cJSON *config_root = NULL;
+// Settings are kept in memory and only written by rg_settings_commit(). Each namespace is stored in a
+// compact binary file (<ns>.bin) which stays resident once loaded: keys and unmodified strings point
+// directly into it, so loading a namespace is one read and two allocations. A <ns>.json file placed in
+// the config folder (by hand, or by an older version) is merged on top and renamed to <ns>.json.imported
+// once the binary file has been written. rg_settings_export() writes JSON copies for humans to read.
+#define SETTINGS_MAGIC   0x54534752 // "RGST"
+#define SETTINGS_VERSION 1
 
+enum
+{
+    SETTING_NULL = 0,
+    SETTING_NUMBER,
+    SETTING_STRING,
+};
+
+// File format: {header} {{record} {key} {value}, ...}
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+} settings_header_t;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t hash;
+    uint8_t type;
+    uint8_t key_len;    // Including the terminating NUL
+    uint16_t value_len; // Including the terminating NUL for strings
+} settings_record_t;
+
+typedef struct
+{
+    uint32_t hash;
+    uint8_t type;
+    const char *key;
+    union
+    {
+        double number;
+        char *string;
+    };
+} setting_t;
+
+typedef struct namespace_s
+{
+    struct namespace_s *next;
+    char *blob;
+    size_t blob_size;
+    setting_t *items;
+    size_t count;
+    size_t capacity;
+    bool changed;
+    bool imported; // <ns>.json must be renamed once the binary file is written
+    char name[];
+} namespace_t;
+
+static namespace_t *namespaces = NULL;
+static bool initialized = false;
+
+
+static uint32_t hash_key(const char *key)
+{
+    uint32_t hash = 0x811C9DC5; // FNV-1a
+    while (*key)
+        hash = (hash ^ (uint8_t)*key++) * 0x01000193;
+    return hash;
+}
+
+static bool in_blob(const namespace_t *ns, const void *ptr)
+{
+    return ns->blob && (const char *)ptr >= ns->blob && (const char *)ptr < ns->blob + ns->blob_size;
+}
+
+static void release_value(namespace_t *ns, setting_t *item)
+{
+    if (item->type == SETTING_STRING && !in_blob(ns, item->string))
+        free(item->string);
+    item->type = SETTING_NULL;
+}
+
+static void free_namespace(namespace_t *ns)
+{
+    for (size_t i = 0; i < ns->count; i++)
+        release_value(ns, &ns->items[i]);
+    free(ns->items);
+    free(ns->blob);
+    free(ns);
+}
+
+static setting_t *find_item(namespace_t *ns, const char *key)
+{
+    uint32_t hash = hash_key(key);
+    for (size_t i = 0; i < ns->count; i++)
+    {
+        if (ns->items[i].hash == hash && strcmp(ns->items[i].key, key) == 0)
+            return &ns->items[i];
+    }
+    return NULL;
+}
+
+static setting_t *add_item(namespace_t *ns, const char *key, bool intern_key)
+{
+    if (ns->count == ns->capacity)
+    {
+        size_t capacity = ns->capacity ? ns->capacity * 2 : 16;
+        setting_t *items = realloc(ns->items, capacity * sizeof(setting_t));
+        if (!items)
+            return NULL;
+        ns->items = items;
+        ns->capacity = capacity;
+    }
+
+    // The same few keys are set over and over in every namespace, interned copies are never freed
+    if (intern_key)
+        key = const_string(key);
+
+    setting_t *item = &ns->items[ns->count++];
+    memset(item, 0, sizeof(setting_t));
+    item->hash = hash_key(key);
+    item->key = key;
+    return item;
+}
+
+static void get_path(char *buffer, const char *name, const char *ext)
+{
+    snprintf(buffer, RG_PATH_MAX, "%s/%s.%s", RG_BASE_PATH_CONFIG, name, ext);
+}
+
+static bool load_binary(namespace_t *ns, const char *path)
+{
+    void *data = NULL;
+    size_t size = 0;
+
+    if (!rg_storage_read_file(path, &data, &size))
+        return false;
+
+    const settings_header_t *header = data;
+    size_t pos = sizeof(settings_header_t);
+    bool valid = size >= pos && header->magic == SETTINGS_MAGIC && header->version == SETTINGS_VERSION;
+
+    ns->blob = data;
+    ns->blob_size = size;
+
+    for (size_t i = 0; valid && i < header->count; i++)
+    {
+        settings_record_t record;
+        if (pos + sizeof(record) > size)
+        {
+            valid = false;
+            break;
+        }
+        memcpy(&record, ns->blob + pos, sizeof(record));
+        pos += sizeof(record);
+
+        const char *key = ns->blob + pos;
+        char *value = ns->blob + pos + record.key_len;
+        pos += record.key_len + record.value_len;
+
+        // Records are only trusted if they are within the file and properly terminated
+        if (pos > size || !record.key_len || key[record.key_len - 1] != 0
+            || (record.type == SETTING_STRING && (!record.value_len || value[record.value_len - 1] != 0))
+            || (record.type == SETTING_NUMBER && record.value_len != sizeof(double)))
+        {
+            valid = false;
+            break;
+        }
+
+        setting_t *item = add_item(ns, key, false);
+        if (!item)
+            break;
+        item->type = record.type;
+        if (record.type == SETTING_NUMBER)
+            memcpy(&item->number, value, sizeof(double));
+        else if (record.type == SETTING_STRING)
+            item->string = value;
+        else
+            item->type = SETTING_NULL;
+    }
+
+    // A corrupted file is rejected as a whole, a partial namespace could mix old and default values
+    if (!valid)
+    {
+        RG_LOGE("Config file '%s' is corrupted, ignoring it\n", path);
+        ns->count = 0;
+        free(ns->blob);
+        ns->blob = NULL;
+        ns->blob_size = 0;
+    }
+
+    return valid;
+}
+
+static bool import_json(namespace_t *ns, const char *path)
+{
+    void *data = NULL;
+    size_t size = 0;
+
+    if (!rg_storage_read_file(path, &data, &size))
+        return false;
+
+    cJSON *root = cJSON_Parse(data);
+    free(data);
 
-static FILE *open_config_file(const char *name, const char *mode)
+    if (!cJSON_IsObject(root))
+    {
+        RG_LOGE("Parse failed in config file '%s'\n", path);
+        cJSON_Delete(root);
+        return false;
+    }
+
+    for (cJSON *obj = root->child; obj; obj = obj->next)
+    {
+        setting_t *item = find_item(ns, obj->string) ?: add_item(ns, obj->string, true);
+        if (!item)
+            break;
+        release_value(ns, item);
+        if (cJSON_IsNumber(obj) || cJSON_IsBool(obj))
+        {
+            item->type = SETTING_NUMBER;
+            item->number = cJSON_IsBool(obj) ? cJSON_IsTrue(obj) : obj->valuedouble;
+        }
+        else if (cJSON_IsString(obj) && (item->string = strdup(obj->valuestring)))
+        {
+            item->type = SETTING_STRING;
+        }
+    }
+
+    cJSON_Delete(root);
+    return true;
+}
+
+static bool save_binary(namespace_t *ns, const char *path)
+{
+    settings_header_t header = {SETTINGS_MAGIC, SETTINGS_VERSION, 0};
+    size_t size = sizeof(header);
+
+    for (size_t i = 0; i < ns->count; i++)
+    {
+        const setting_t *item = &ns->items[i];
+        size += sizeof(settings_record_t) + strlen(item->key) + 1;
+        if (item->type == SETTING_NUMBER)
+            size += sizeof(double);
+        else if (item->type == SETTING_STRING)
+            size += strlen(item->string) + 1;
+    }
+
+    // The whole file is built in memory, the card sees a single write
+    char *data = malloc(size);
+    char *ptr = data + sizeof(header);
+    if (!data)
+        return false;
+
+    for (size_t i = 0; i < ns->count && header.count < UINT16_MAX; i++)
+    {
+        const setting_t *item = &ns->items[i];
+        size_t key_len = strlen(item->key) + 1;
+        size_t value_len = 0;
+        if (item->type == SETTING_NUMBER)
+            value_len = sizeof(double);
+        else if (item->type == SETTING_STRING)
+            value_len = strlen(item->string) + 1;
+        if (key_len > UINT8_MAX || value_len > UINT16_MAX)
+        {
+            RG_LOGW("Setting '%s' is too large to be saved\n", item->key);
+            continue;
+        }
+        settings_record_t record = {item->hash, item->type, key_len, value_len};
+        memcpy(ptr, &record, sizeof(record));
+        memcpy(ptr + sizeof(record), item->key, key_len);
+        memcpy(ptr + sizeof(record) + key_len, item->type == SETTING_NUMBER ? (void *)&item->number : item->string, value_len);
+        ptr += sizeof(record) + key_len + value_len;
+        header.count++;
+    }
+    memcpy(data, &header, sizeof(header));
+
+    bool success = rg_storage_write_file(path, data, ptr - data);
+    free(data);
+    return success;
+}
+
+static bool save_json(namespace_t *ns, const char *path)
 {
-    char pathbuf[RG_PATH_MAX];
-    snprintf(pathbuf, RG_PATH_MAX, "%s/%s.json", RG_BASE_PATH_CONFIG, name);
-    RG_LOGI("Opening %s for %s", pathbuf, mode);
-    FILE *fp = fopen(pathbuf, mode);
-    if (!fp)
+    cJSON *root = cJSON_CreateObject();
+    bool success = false;
+
+    for (size_t i = 0; i < ns->count; i++)
     {
-        rg_storage_mkdir(rg_dirname(pathbuf));
-        rg_storage_delete(pathbuf);
-        fp = fopen(pathbuf, mode);
+        const setting_t *item = &ns->items[i];
+        if (item->type == SETTING_NUMBER)
+            cJSON_AddNumberToObject(root, item->key, item->number);
+        else if (item->type == SETTING_STRING)
+            cJSON_AddStringToObject(root, item->key, item->string);
+        else
+            cJSON_AddNullToObject(root, item->key);
     }
-    return fp;
+
+    char *buffer = cJSON_Print(root);
+    if (buffer)
+        success = rg_storage_write_file(path, buffer, strlen(buffer));
+
+    cJSON_free(buffer);
+    cJSON_Delete(root);
+    return success;
 }
 
-static cJSON *json_root(const char *name, bool mode)
+static namespace_t *get_namespace(const char *name)
 {
-    if (!config_root)
+    if (!initialized)
         return NULL;
 
     if (name == NS_GLOBAL)
@@ -39,96 +327,140 @@ static cJSON *json_root(const char *name, bool mode)
     else if (name == NS_BOOT)
         name = "boot";
 
-    cJSON *branch = cJSON_GetObjectItem(config_root, name);
-    if (!branch)
+    if (!name)
+        return NULL;
+
+    for (namespace_t *ns = namespaces; ns; ns = ns->next)
     {
-        branch = cJSON_AddObjectToObject(config_root, name);
-        cJSON_AddStringToObject(branch, "namespace", name);
-        cJSON_AddNumberToObject(branch, "changed", 0);
-        FILE *fp = open_config_file(name, "rb");
-        if (fp)
-        {
-            fseek(fp, 0, SEEK_END);
-            long length = ftell(fp);
-            fseek(fp, 0, SEEK_SET);
-            char *buffer = calloc(1, length + 1);
-            if (fread(buffer, 1, length, fp))
-            {
-                cJSON *values = cJSON_Parse(buffer);
-                if (!values)
-                {
-                    RG_LOGE("Parse failed in config file '%s'", name);
-                    values = cJSON_CreateObject();
-                }
-                cJSON_AddItemToObject(branch, "values", values);
-            }
-            free(buffer);
-            fclose(fp);
-        }
+        if (strcmp(ns->name, name) == 0)
+            return ns;
     }
 
-    cJSON *root = cJSON_GetObjectItem(branch, "values");
-    if (!cJSON_IsObject(root))
+    namespace_t *ns = calloc(1, sizeof(namespace_t) + strlen(name) + 1);
+    if (!ns)
+        return NULL;
+    strcpy(ns->name, name);
+
+    char path[RG_PATH_MAX];
+    struct stat st;
+
+    get_path(path, name, "bin");
+    if (stat(path, &st) == 0)
     {
-        cJSON_DeleteItemFromObject(branch, "values");
-        root = cJSON_AddObjectToObject(branch, "values");
+        RG_LOGI("Loading %s\n", path);
+        load_binary(ns, path);
     }
 
-    if (mode)
+    // Any JSON file in the config folder is new, the ones we import are renamed by rg_settings_commit()
+    get_path(path, name, "json");
+    if (stat(path, &st) == 0)
     {
-        cJSON_SetNumberHelper(cJSON_GetObjectItem(branch, "changed"), 1);
+        RG_LOGI("Importing %s\n", path);
+        if (import_json(ns, path))
+            ns->changed = ns->imported = true;
     }
 
-    return root;
+    ns->next = namespaces;
+    namespaces = ns;
+
+    return ns;
 }
 
-static void update_value(const char *section, const char *key, cJSON *new_value)
+static void update_value(const char *section, const char *key, int type, double number, const char *string)
 {
-    cJSON *obj = cJSON_GetObjectItem(json_root(section, 0), key);
-    if (obj == NULL)
-        cJSON_AddItemToObject(json_root(section, 1), key, new_value);
-    else if (!cJSON_Compare(obj, new_value, true))
-        cJSON_ReplaceItemInObject(json_root(section, 1), key, new_value);
-    else
-        cJSON_Delete(new_value);
+    namespace_t *ns = get_namespace(section);
+    setting_t *item;
+
+    if (!ns || !key)
+        return;
+
+    if ((item = find_item(ns, key)))
+    {
+        if (item->type == type && (type == SETTING_NULL
+            || (type == SETTING_NUMBER && item->number == number)
+            || (type == SETTING_STRING && strcmp(item->string, string) == 0)))
+            return;
+        release_value(ns, item);
+    }
+    else if (!(item = add_item(ns, key, true)))
+    {
+        return;
+    }
+
+    if (type == SETTING_STRING && !(item->string = strdup(string)))
+        type = SETTING_NULL;
+    item->number = type == SETTING_NUMBER ? number : item->number;
+    item->type = type;
+    ns->changed = true;
 }
 
 void rg_settings_init(void)
 {
-    config_root = cJSON_CreateObject();
-    json_root(NS_GLOBAL, 0);
-    json_root(NS_BOOT, 0);
+    initialized = true;
+    get_namespace(NS_GLOBAL);
+    get_namespace(NS_BOOT);
 }
 
 void rg_settings_commit(void)
 {
-    if (!config_root)
+    const int64_t time_start = rg_system_timer();
+
+    if (!initialized)
         return;
 
-    for (cJSON *branch = config_root->child; branch; branch = branch->next)
+    // A savestate may be written in the background
+    rg_storage_lock();
+
+    for (namespace_t *ns = namespaces; ns; ns = ns->next)
     {
-        char *name = cJSON_GetStringValue(cJSON_GetObjectItem(branch, "namespace"));
-        int changed = cJSON_GetNumberValue(cJSON_GetObjectItem(branch, "changed"));
+        char path[RG_PATH_MAX];
 
-        if (!changed)
+        if (!ns->changed)
             continue;
 
-        char *buffer = cJSON_Print(cJSON_GetObjectItem(branch, "values"));
-        if (!buffer)
+        rg_storage_mkdir(RG_BASE_PATH_CONFIG);
+
+        get_path(path, ns->name, "bin");
+        if (!save_binary(ns, path))
             continue;
+        ns->changed = false;
 
-        FILE *fp = open_config_file(name, "wb");
-        if (fp)
+        // Only now that its values are safe in the binary file, or it would be imported again next time
+        if (ns->imported)
         {
-            if (fputs(buffer, fp) >= 0)
-                cJSON_SetNumberHelper(cJSON_GetObjectItem(branch, "changed"), 0);
-            fclose(fp);
+            char new_path[RG_PATH_MAX];
+            get_path(path, ns->name, "json");
+            get_path(new_path, ns->name, "json.imported");
+            rg_storage_delete(new_path);
+            if (rename(path, new_path) != 0)
+                RG_LOGW("Failed to rename '%s'\n", path);
+            ns->imported = false;
         }
+    }
+
+    rg_storage_commit();
+    rg_storage_unlock();
+
+    rg_system_trace_stage(RG_STAGE_STORAGE, rg_system_timer() - time_start);
+}
 
-        cJSON_free(buffer);
+bool rg_settings_export(const char *path)
+{
+    bool success = initialized && rg_storage_mkdir(path);
+
+    if (!success)
+        return false;
+
+    // Only the namespaces used so far are in memory, which covers the global, boot and app ones
+    for (namespace_t *ns = namespaces; ns; ns = ns->next)
+    {
+        char file_path[RG_PATH_MAX];
+        snprintf(file_path, RG_PATH_MAX, "%s/%s.json", path, ns->name);
+        success &= save_json(ns, file_path);
     }
 
     rg_storage_commit();
+    return success;
 }
 
 void rg_settings_reset(void)
@@ -136,38 +468,49 @@ void rg_settings_reset(void)
     RG_LOGI("Clearing settings...\n");
     rg_storage_delete(RG_BASE_PATH_CONFIG);
     rg_storage_mkdir(RG_BASE_PATH_CONFIG);
-    if (config_root)
+    while (namespaces)
     {
-        cJSON_Delete(config_root);
-        config_root = cJSON_CreateObject();
+        namespace_t *next = namespaces->next;
+        free_namespace(namespaces);
+        namespaces = next;
     }
 }
 
 double rg_settings_get_number(const char *section, const char *key, double default_value)
 {
-    cJSON *obj = cJSON_GetObjectItem(json_root(section, 0), key);
-    return obj ? obj->valuedouble : default_value;
+    namespace_t *ns = get_namespace(section);
+    setting_t *item = ns && key ? find_item(ns, key) : NULL;
+    return item && item->type == SETTING_NUMBER ? item->number : default_value;
 }
 
 void rg_settings_set_number(const char *section, const char *key, double value)
 {
-    update_value(section, key, cJSON_CreateNumber(value));
+    update_value(section, key, SETTING_NUMBER, value, NULL);
 }
 
 char *rg_settings_get_string(const char *section, const char *key, const char *default_value)
 {
-    cJSON *obj = cJSON_GetObjectItem(json_root(section, 0), key);
-    if (cJSON_IsString(obj))
-        return strdup(obj->valuestring);
+    namespace_t *ns = get_namespace(section);
+    setting_t *item = ns && key ? find_item(ns, key) : NULL;
+    if (item && item->type == SETTING_STRING)
+        return strdup(item->string);
     return default_value ? strdup(default_value) : NULL;
 }
 
 void rg_settings_set_string(const char *section, const char *key, const char *value)
 {
-    update_value(section, key, value ? cJSON_CreateString(value) : cJSON_CreateNull());
+    update_value(section, key, value ? SETTING_STRING : SETTING_NULL, 0, value);
 }
 
 void rg_settings_delete(const char *section, const char *key)
 {
-    cJSON_DeleteItemFromObject(json_root(section, 1), key);
+    namespace_t *ns = get_namespace(section);
+    setting_t *item = ns && key ? find_item(ns, key) : NULL;
+
+    if (!item)
+        return;
+
+    release_value(ns, item);
+    *item = ns->items[--ns->count];
+    ns->changed = true;
 }
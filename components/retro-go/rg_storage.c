@@ -3,6 +3,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,12 +15,31 @@
 #include <esp_vfs_fat.h>
 #endif
 
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+typedef SemaphoreHandle_t rg_lock_t;
+#define LOCK_CREATE()       xSemaphoreCreateRecursiveMutex()
+#define LOCK_TAKE(lock)     xSemaphoreTakeRecursive(lock, portMAX_DELAY)
+#define LOCK_GIVE(lock)     xSemaphoreGiveRecursive(lock)
+#else
+#include <SDL2/SDL.h>
+typedef SDL_mutex *rg_lock_t; // SDL's mutexes are recursive
+#define LOCK_CREATE()       SDL_CreateMutex()
+#define LOCK_TAKE(lock)     SDL_LockMutex(lock)
+#define LOCK_GIVE(lock)     SDL_UnlockMutex(lock)
+#endif
+
 #if defined(_WIN32) || defined(_WIN64)
 #define mkdir(A, B) mkdir(A)
+#elif !defined(ESP_PLATFORM)
+#include <sys/mman.h>
+#define USE_MMAP
 #endif
 
 static bool disk_mounted = false;
 static bool disk_led = true;
+static rg_lock_t storage_lock;
 
 static const char *SETTING_DISK_ACTIVITY = "DiskActivity";
 
@@ -58,11 +78,27 @@ static esp_err_t sdcard_do_transaction(int slot, sdmmc_command_t *cmdinfo)
 }
 #endif
 
+void rg_storage_lock(void)
+{
+    if (storage_lock)
+        LOCK_TAKE(storage_lock);
+}
+
+void rg_storage_unlock(void)
+{
+    if (storage_lock)
+        LOCK_GIVE(storage_lock);
+}
+
 void rg_storage_init(void)
 {
     if (disk_mounted)
         rg_storage_deinit();
 
+    // Created before any task that could use it, and never destroyed
+    if (!storage_lock)
+        storage_lock = LOCK_CREATE();
+
     int error_code = -1;
 
 #if RG_STORAGE_DRIVER == 0 // Host (stdlib)
@@ -234,6 +270,233 @@ bool rg_storage_mkdir(const char *dir)
     return false;
 }
 
+bool rg_storage_read_file(const char *path, void **data_ptr, size_t *data_len)
+{
+    RG_ASSERT(path && data_ptr && data_len, "Bad param");
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return false;
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    // One extra byte so that text files can be used as a C string
+    void *data = size >= 0 ? malloc(size + 1) : NULL;
+    if (!data || (size > 0 && fread(data, size, 1, fp) != 1))
+    {
+        RG_LOGE("Read of '%s' failed (size: %ld)\n", path, size);
+        fclose(fp);
+        free(data);
+        return false;
+    }
+    fclose(fp);
+
+    ((char *)data)[size] = 0;
+    *data_ptr = data;
+    *data_len = size;
+    return true;
+}
+
+bool rg_storage_write_file(const char *path, const void *data_ptr, const size_t data_len)
+{
+    RG_ASSERT(path && (data_ptr || !data_len), "Bad param");
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        return false;
+
+    bool success = data_len == 0 || fwrite(data_ptr, data_len, 1, fp) == 1;
+    if (fclose(fp) != 0)
+        success = false;
+
+    if (!success)
+    {
+        RG_LOGE("Write of '%s' failed\n", path);
+        unlink(path);
+    }
+    return success;
+}
+
+rg_hasher_t *rg_storage_hasher_create(size_t buffer_size)
+{
+    // SD reads are DMA'd straight into the buffer when it's in internal RAM and a multiple of the sector size,
+    // bigger buffers mean fewer and longer transactions. The host can afford to go much bigger.
+#ifdef ESP_PLATFORM
+    buffer_size = buffer_size ? ((buffer_size + 511) & ~511) : 0x4000;
+    rg_hasher_t *hasher = calloc(1, sizeof(rg_hasher_t));
+    uint8_t *buffer = rg_alloc(buffer_size, MEM_DMA);
+#else
+    buffer_size = buffer_size ? buffer_size : 0x40000;
+    rg_hasher_t *hasher = calloc(1, sizeof(rg_hasher_t));
+    uint8_t *buffer = malloc(buffer_size);
+#endif
+    if (!hasher || !buffer)
+    {
+        free(hasher);
+        free(buffer);
+        return NULL;
+    }
+    hasher->buffer = buffer;
+    hasher->buffer_size = buffer_size;
+    return hasher;
+}
+
+void rg_storage_hasher_free(rg_hasher_t *hasher)
+{
+    if (!hasher)
+        return;
+    rg_storage_hasher_close(hasher);
+    free(hasher->buffer);
+    free(hasher);
+}
+
+bool rg_storage_hasher_open(rg_hasher_t *hasher, const char *path, size_t offset)
+{
+    RG_ASSERT(hasher && path, "Bad param");
+
+    rg_storage_hasher_close(hasher);
+
+    if (!(hasher->fp = fopen(path, "rb")))
+        return false;
+
+    // Our reads are larger than stdio's buffer, it would only add a copy
+    setvbuf(hasher->fp, NULL, _IONBF, 0);
+
+    if (offset && fseek(hasher->fp, offset, SEEK_SET) != 0)
+    {
+        rg_storage_hasher_close(hasher);
+        return false;
+    }
+
+    hasher->crc = 0;
+    hasher->length = 0;
+    return true;
+}
+
+int rg_storage_hasher_step(rg_hasher_t *hasher)
+{
+    RG_ASSERT(hasher, "Bad param");
+
+    if (!hasher->fp)
+        return -1;
+
+    size_t count = fread(hasher->buffer, 1, hasher->buffer_size, hasher->fp);
+    hasher->crc = rg_crc32(hasher->crc, hasher->buffer, count);
+    hasher->length += count;
+
+    if (count == hasher->buffer_size)
+        return 1;
+
+    int ret = feof(hasher->fp) ? 0 : -1;
+    rg_storage_hasher_close(hasher);
+    return ret;
+}
+
+void rg_storage_hasher_close(rg_hasher_t *hasher)
+{
+    if (hasher && hasher->fp)
+    {
+        fclose(hasher->fp);
+        hasher->fp = NULL;
+    }
+}
+
+bool rg_storage_crc32_file(const char *path, size_t offset, uint32_t *crc)
+{
+    RG_ASSERT(path && crc, "Bad param");
+
+    rg_hasher_t *hasher = rg_storage_hasher_create(0);
+    int ret = -1;
+
+    if (hasher && rg_storage_hasher_open(hasher, path, offset))
+    {
+        while ((ret = rg_storage_hasher_step(hasher)) > 0)
+            continue;
+        *crc = hasher->crc;
+    }
+    rg_storage_hasher_free(hasher);
+
+    return ret == 0;
+}
+
+rg_file_map_t *rg_storage_map_file(const char *path, size_t min_length, size_t align)
+{
+    RG_ASSERT(path, "Bad param");
+
+    rg_file_map_t *map = calloc(1, sizeof(rg_file_map_t));
+    FILE *fp = fopen(path, "rb");
+    if (!map || !fp)
+        goto fail;
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size < 0)
+        goto fail;
+
+    map->size = size;
+    map->length = RG_MAX(map->size, min_length);
+    if (align > 1)
+        map->length = (map->length + align - 1) & ~(align - 1);
+
+#ifdef USE_MMAP
+    // Reserve the whole view as zero pages, then lay the file over its start. The kernel zeroes the tail of
+    // the last file page, pages entirely past EOF would fault if they came from the file.
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t map_length = (RG_MAX(map->length, 1) + page_size - 1) & ~(page_size - 1);
+    void *data = mmap(NULL, map_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data != MAP_FAILED)
+    {
+        if (map->size == 0 || mmap(data, map->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(fp), 0) == data)
+        {
+            fclose(fp);
+            map->data = data;
+            map->mapped = true;
+            RG_LOGI("Mapped '%s' (%d bytes)\n", path, (int)map->size);
+            return map;
+        }
+        munmap(data, map_length);
+    }
+    RG_LOGW("mmap of '%s' failed, falling back to a read\n", path);
+#endif
+
+    // Our storage is FAT, files aren't contiguous in flash so there is nothing to map on the device itself
+    if (!(map->data = malloc(RG_MAX(map->length, 1))))
+        goto fail;
+    if (map->size > 0 && fread(map->data, map->size, 1, fp) != 1)
+        goto fail;
+    memset(map->data + map->size, 0, map->length - map->size);
+    fclose(fp);
+    return map;
+
+fail:
+    RG_LOGE("Mapping of '%s' failed\n", path);
+    if (fp)
+        fclose(fp);
+    if (map)
+        free(map->data);
+    free(map);
+    return NULL;
+}
+
+void rg_storage_unmap_file(rg_file_map_t *map)
+{
+    if (!map)
+        return;
+#ifdef USE_MMAP
+    if (map->mapped)
+    {
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        munmap(map->data, (RG_MAX(map->length, 1) + page_size - 1) & ~(page_size - 1));
+    }
+    else
+#endif
+        free(map->data);
+    free(map);
+}
+
 bool rg_storage_delete(const char *path)
 {
     RG_ASSERT(path, "Bad param");
@@ -265,11 +528,40 @@ bool rg_storage_delete(const char *path)
 
 static int scandir_natural_sort(const void *a, const void *b)
 {
-    // FIXME: Do something...
-    return 0;
+    // Runs of digits compare by value so that "Game 2" comes before "Game 10", the rest ignores case
+    const char *s1 = ((const rg_scandir_entry_t *)a)->name;
+    const char *s2 = ((const rg_scandir_entry_t *)b)->name;
+
+    while (*s1 && *s2)
+    {
+        if (isdigit((unsigned char)*s1) && isdigit((unsigned char)*s2))
+        {
+            while (*s1 == '0')
+                s1++;
+            while (*s2 == '0')
+                s2++;
+            size_t len1 = 0, len2 = 0;
+            while (isdigit((unsigned char)s1[len1]))
+                len1++;
+            while (isdigit((unsigned char)s2[len2]))
+                len2++;
+            if (len1 != len2)
+                return len1 < len2 ? -1 : 1;
+            int diff = strncmp(s1, s2, len1);
+            if (diff)
+                return diff;
+            s1 += len1;
+            s2 += len2;
+            continue;
+        }
+        int c1 = tolower((unsigned char)*s1++);
+        int c2 = tolower((unsigned char)*s2++);
+        if (c1 != c2)
+            return c1 - c2;
+    }
+    return (unsigned char)*s1 - (unsigned char)*s2;
 }
 
-// FIXME: rg_scandir_t should probably be {count, items[]} to avoid walking the array to get the count...
 rg_scandir_t *rg_storage_scandir(const char *path, bool (*validator)(const char *path), uint32_t flags)
 {
     RG_ASSERT(path, "Bad param");
@@ -278,68 +570,100 @@ rg_scandir_t *rg_storage_scandir(const char *path, bool (*validator)(const char
     if (!dir)
         return NULL;
 
-    rg_scandir_t *results = calloc(1, sizeof(rg_scandir_t));
-    size_t capacity = 0;
-    size_t count = 0;
+    // Entries and names are collected in two growing buffers, then packed in a single allocation
+    rg_scandir_entry_t *entries = NULL;
+    char *names = NULL;
+    size_t entries_capacity = 0, names_capacity = 0;
+    size_t count = 0, names_size = 0;
     struct dirent *ent;
     struct stat statbuf;
 
     size_t path_len = strlen(path) + 1;
-    size_t name_maxlen = sizeof(results[0].name) - 1;
-    char fullpath[path_len + name_maxlen + 1];
+    char fullpath[RG_PATH_MAX + 1];
 
-    sprintf(fullpath, "%s/", path);
+    snprintf(fullpath, sizeof(fullpath), "%s/", path);
 
     while ((ent = readdir(dir)))
     {
         if (ent->d_name[0] == '.') // Ignore all dot files
             continue;
 
-        if (strlen(ent->d_name) > name_maxlen) // Filename is too long
+        size_t name_len = strlen(ent->d_name) + 1;
+        if (path_len + name_len > sizeof(fullpath)) // Path is too long
             continue;
 
-        strcpy(fullpath + path_len, ent->d_name);
+        memcpy(fullpath + path_len, ent->d_name, name_len);
 
         if (validator && !validator(fullpath))
             continue;
 
-        if (count + 1 >= capacity)
+        if (count == entries_capacity)
         {
-            capacity += 100;
-            void *temp = realloc(results, (capacity + 1) * sizeof(rg_scandir_t));
+            void *temp = realloc(entries, RG_MAX(entries_capacity * 2, 32) * sizeof(rg_scandir_entry_t));
             if (!temp)
             {
                 RG_LOGW("Not enough memory to finish scan!\n");
                 break;
             }
-            results = temp;
+            entries = temp;
+            entries_capacity = RG_MAX(entries_capacity * 2, 32);
         }
 
-        rg_scandir_t *result = &results[count++];
+        if (names_size + name_len > names_capacity)
+        {
+            void *temp = realloc(names, RG_MAX(names_capacity * 2, names_size + name_len + 1024));
+            if (!temp)
+            {
+                RG_LOGW("Not enough memory to finish scan!\n");
+                break;
+            }
+            names = temp;
+            names_capacity = RG_MAX(names_capacity * 2, names_size + name_len + 1024);
+        }
 
-        strcpy(result->name, ent->d_name);
-        result->is_valid = 1;
+        rg_scandir_entry_t *entry = &entries[count++];
+        memset(entry, 0, sizeof(*entry));
+        // Only an offset for now, the names buffer may still move
+        entry->name = (const char *)(uintptr_t)names_size;
+        memcpy(names + names_size, ent->d_name, name_len);
+        names_size += name_len;
     #if defined(DT_REG) && defined(DT_DIR)
-        result->is_file = ent->d_type == DT_REG;
-        result->is_dir = ent->d_type == DT_DIR;
+        entry->is_file = ent->d_type == DT_REG;
+        entry->is_dir = ent->d_type == DT_DIR;
     #else
         flags |= RG_SCANDIR_STAT;
     #endif
 
         if ((flags & RG_SCANDIR_STAT) && stat(fullpath, &statbuf) == 0)
         {
-            result->is_file = S_ISREG(statbuf.st_mode);
-            result->is_dir = S_ISDIR(statbuf.st_mode);
-            result->size = statbuf.st_size;
-            result->mtime = statbuf.st_mtime;
+            entry->is_file = S_ISREG(statbuf.st_mode);
+            entry->is_dir = S_ISDIR(statbuf.st_mode);
+            entry->size = statbuf.st_size;
+            entry->mtime = statbuf.st_mtime;
         }
     }
-    memset(&results[count], 0, sizeof(rg_scandir_t));
+    closedir(dir);
 
-    if (flags & RG_SCANDIR_SORT)
+    size_t names_offset = sizeof(rg_scandir_t) + count * sizeof(rg_scandir_entry_t);
+    rg_scandir_t *results = malloc(names_offset + names_size);
+    if (results)
     {
-        qsort(results, count, sizeof(rg_scandir_t), scandir_natural_sort);
+        char *packed_names = (char *)results + names_offset;
+        if (names_size)
+            memcpy(packed_names, names, names_size);
+        for (size_t i = 0; i < count; i++)
+        {
+            results->entries[i] = entries[i];
+            results->entries[i].name = packed_names + (uintptr_t)entries[i].name;
+        }
+        results->count = count;
+
+        if (flags & RG_SCANDIR_SORT)
+            qsort(results->entries, count, sizeof(rg_scandir_entry_t), scandir_natural_sort);
     }
 
+    free(entries);
+    free(names);
+
     return results;
 }
@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #define RG_BASE_PATH        RG_STORAGE_ROOT "/retro-go"
 #define RG_BASE_PATH_BIOS   RG_BASE_PATH "/bios"
@@ -14,16 +15,42 @@
 #define RG_BASE_PATH_SAVES  RG_BASE_PATH "/saves"
 #define RG_BASE_PATH_THEMES RG_BASE_PATH "/themes"
 
-typedef struct __attribute__((packed))
+typedef struct
 {
-    uint8_t is_valid : 1;
-    uint8_t is_file  : 1;
-    uint8_t is_dir   : 1;
-    uint8_t unused   : 5;
-    char name[91];
+    const char *name; // Points inside the rg_scandir_t allocation
     int32_t mtime, size;
+    uint8_t is_file : 1;
+    uint8_t is_dir  : 1;
+} rg_scandir_entry_t;
+
+// A single allocation, free() it when done
+typedef struct
+{
+    size_t count;
+    rg_scandir_entry_t entries[];
 } rg_scandir_t;
 
+// Streaming CRC32 of files, one chunk per step so that the caller can interleave other work or give up.
+// A hasher can be reused for any number of files, its buffer is allocated once.
+typedef struct
+{
+    uint8_t *buffer;
+    size_t buffer_size;
+    FILE *fp;
+    uint32_t crc;   // Running CRC, final once step() returns 0
+    size_t length;  // Bytes hashed so far
+} rg_hasher_t;
+
+// A private view of a file, writes go to the view and never reach the file. On the host the file is mmap'd
+// copy-on-write so pages are only read (and duplicated) when touched, elsewhere it is a plain heap copy.
+typedef struct
+{
+    uint8_t *data;
+    size_t size;    // File size
+    size_t length;  // View size, at least `size`. Bytes past the end of the file read as zero
+    bool mapped;    // false = heap copy
+} rg_file_map_t;
+
 enum
 {
     RG_SCANDIR_STAT = 1, // This will populate file size
@@ -32,6 +59,10 @@ enum
 
 void rg_storage_init(void);
 void rg_storage_deinit(void);
+// Serializes the tasks that use the storage at the same time (launcher previews, savestate writer...). It's
+// recursive and taken around whole sequences of file operations, the functions below don't take it themselves.
+void rg_storage_lock(void);
+void rg_storage_unlock(void);
 bool rg_storage_format(void);
 bool rg_storage_ready(void);
 void rg_storage_commit(void);
@@ -40,5 +71,13 @@ bool rg_storage_get_activity_led(void);
 bool rg_storage_read_file(const char *path, void **data_ptr, size_t *data_len);
 bool rg_storage_write_file(const char *path, const void *data_ptr, const size_t data_len);
 bool rg_storage_delete(const char *path);
+rg_file_map_t *rg_storage_map_file(const char *path, size_t min_length, size_t align); // align: power of 2 or 0
+void rg_storage_unmap_file(rg_file_map_t *map);
+rg_hasher_t *rg_storage_hasher_create(size_t buffer_size); // 0 = default
+void rg_storage_hasher_free(rg_hasher_t *hasher);
+bool rg_storage_hasher_open(rg_hasher_t *hasher, const char *path, size_t offset);
+int rg_storage_hasher_step(rg_hasher_t *hasher); // 1 = more to do, 0 = done, -1 = error
+void rg_storage_hasher_close(rg_hasher_t *hasher);
+bool rg_storage_crc32_file(const char *path, size_t offset, uint32_t *crc);
 bool rg_storage_mkdir(const char *dir);
 rg_scandir_t *rg_storage_scandir(const char *path, bool (*validator)(const char *path), uint32_t flags);
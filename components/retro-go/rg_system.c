@@ -19,6 +19,9 @@
 #include <esp_timer.h>
 #include <esp_sleep.h>
 #include <driver/gpio.h>
+#ifdef RG_ENABLE_PROFILING
+#include <xtensa/hal.h>
+#endif
 #else
 #include <SDL2/SDL.h>
 #endif
@@ -54,21 +57,176 @@ typedef struct
     char name[16];
 } rg_task_t;
 
+#ifndef ESP_PLATFORM
+static struct
+{
+    int32_t frames;   // Number of frames to run, 0 means benchmarking is disabled
+    int32_t count;    // Number of frames that were measured so far
+    int64_t started;
+    int64_t lastTick;
+    int32_t *samples; // Wall time of every frame, in us
+} benchmark;
+#endif
+
+#define RG_TRACE_LENGTH  128 // In frames, must be a power of two
+#define RG_TRACE_BUCKETS 64  // Quarter octaves, the last one is everything above 115ms
+
+// Stages accumulate into `pending` from any thread, rg_system_tick() moves them to the ring. Only the
+// main thread writes the ring and histograms. Readers may see a torn frame, it's only statistics.
+static struct
+{
+    int32_t pending[RG_STAGE_COUNT];
+    struct
+    {
+        uint32_t frame;
+        int64_t time;
+        int32_t stages[RG_STAGE_COUNT];
+    } frames[RG_TRACE_LENGTH];
+    uint32_t head;
+    uint32_t histogram[RG_STAGE_COUNT][RG_TRACE_BUCKETS];
+    int32_t max[RG_STAGE_COUNT];
+    int64_t lastTick;
+} trace;
+
+// The frame pacing controller predicts the cost of the next frame from what the previous ones cost,
+// then compares it to the time budget left by the audio buffer and the wall clock.
+static struct
+{
+    int64_t frameStart;
+    int64_t lastEnd;
+    int32_t frameTime;  // Wall time budget of a frame at the current speed, in us
+    float emulateTime;  // EWMA of the busy time of a skipped frame
+    float drawTime;     // EWMA of the extra busy time of a drawn frame
+    int32_t lag;        // How far behind the wall clock we are, in us, negative when ahead. At most one frame either way
+    int32_t skipped;    // Consecutive skipped frames
+    bool drawing;
+} pacing;
+
+#define REWIND_INTERVAL     4   // Minimum frames between two snapshots
+#define REWIND_MAX_INTERVAL 60  // Past that the budget is simply too small to be useful
+#define REWIND_MAX_SNAPSHOTS 512
+#define REWIND_MAX_DELTA(size) ((size) + 4 * (2 * (size) / 0xFFFF + 3))
+
+// Snapshots are stored as the XOR of themselves and the previous one, run-length encoded in a ring. Only the
+// newest snapshot is kept in full (`state`), applying the deltas to it walks back through the history.
+static struct
+{
+    uint8_t *state;   // Newest snapshot
+    uint8_t *scratch; // The snapshot being captured
+    size_t state_size;
+    uint8_t *buffer;  // Deltas ring, the oldest are dropped to make room
+    size_t buffer_size;
+    struct {uint32_t offset, length;} entries[REWIND_MAX_SNAPSHOTS];
+    uint32_t head, count;
+    int32_t interval;  // Frames between snapshots, stretched when a capture costs more than the budget
+    int32_t countdown;
+    int32_t budget;    // Average capture cost allowed per frame, in us
+    bool current;      // The emulator is still at `state`
+    bool enabled;
+    bool suspended;    // Netplay owns the emulator's state
+} history;
+
+#define RUNAHEAD_SUSPEND 0.90f // Fraction of the frame time above which run-ahead is suspended
+#define RUNAHEAD_RESUME  0.75f // And below which it is resumed, as predicted from the plain frames
+
+static struct
+{
+    uint8_t *state;
+    size_t state_size; // Allocated
+    int32_t frames;    // Setting, 0 is off
+    float frameCost;   // EWMA of the real frame, in us
+    float extraCost;   // EWMA of the snapshot, speculative frames and restore
+    float stateCost;   // EWMA of the snapshot and restore alone
+    bool suspended;
+    bool supported;    // The app runs its frames through rg_emu_run_frame()
+} runahead;
+
+enum {SAVER_IDLE, SAVER_BUSY, SAVER_DONE};
+
+// The main task runs on core 0
+#if defined(ESP_PLATFORM) && !CONFIG_FREERTOS_UNICORE
+#define SAVER_CORE 1
+#else
+#define SAVER_CORE -1
+#endif
+
+// Savestates are captured in memory by the caller, then written by a low priority task
+static struct
+{
+    uint8_t slot;
+    char *filename;
+    char *preview;       // Screenshot for the launcher
+    void *data;
+    size_t size;
+    rg_image_t *frame;   // Full size copy of the last frame
+    int preview_width;
+    rg_save_callback_t callback;
+    void *arg;
+    bool success;        // Result of the last save
+    int state;           // SAVER_*, accessed atomically
+} saver = {.success = true};
+
+static void save_state_finish(void);
+
+static const char *const stage_names[RG_STAGE_COUNT] = {"frame", "emulate", "submit", "display", "audio", "storage", "rewind", "runahead"};
+
+#define BLOB_MAGIC 0x42534752 // "RGSB"
+typedef struct
+{
+    uint32_t magic;
+    uint32_t size;    // Header included
+    uint32_t version; // rg_emu_blob_t.version
+    uint32_t reserved;
+} blob_header_t;
+
+// Chunks aren't padded, their data follows the header immediately
+typedef struct
+{
+    char tag[28];
+    uint32_t length;
+} blob_chunk_t;
+
 #ifdef RG_ENABLE_PROFILING
+#define PROFILE_MAX_THREADS 6
+#define PROFILE_MAX_DEPTH   64
+#define PROFILE_MAX_NODES   1024 // Per thread, must be a power of two
+#define PROFILE_MAGIC       0x46504752 // "RGPF"
+#define PROFILE_VERSION     1
+
+// A node is a function in a given calling context (its parent node), so the dump is a call tree
+typedef struct
+{
+    uintptr_t func;
+    int32_t parent;
+    uint32_t calls;
+    uint64_t self_time;
+    uint64_t total_time;
+} profile_node_t;
+
+// Each thread only ever writes to its own context, so no locking is needed
 typedef struct
 {
-    void *func_ptr, *caller_ptr;
-    int32_t num_calls, run_time;
-    int64_t enter_time;
-} profile_frame_t;
+    char name[16];
+    int depth;
+    uint32_t dropped;
+    struct
+    {
+        int32_t node;
+        uint32_t enter_time;
+        uint32_t child_time;
+    } stack[PROFILE_MAX_DEPTH];
+    profile_node_t nodes[PROFILE_MAX_NODES];
+} profile_thread_t;
 
 static struct
 {
     int64_t time_started;
-    int32_t total_frames;
-    SemaphoreHandle_t lock;
-    profile_frame_t frames[512];
+    uint32_t ticks_per_us;
+    uint32_t threads_count;
+    profile_thread_t threads[PROFILE_MAX_THREADS];
 } *profile;
+
+NO_PROFILE static void profile_init(void);
 #endif
 
 // The trace will survive a software reset
@@ -86,6 +244,9 @@ static const char *SETTING_BOOT_NAME = "BootName";
 static const char *SETTING_BOOT_ARGS = "BootArgs";
 static const char *SETTING_BOOT_FLAGS = "BootFlags";
 static const char *SETTING_TIMEZONE = "Timezone";
+static const char *SETTING_REWIND = "Rewind";
+static const char *SETTING_REWIND_BUDGET = "RewindBudget";
+static const char *SETTING_RUN_AHEAD = "RunAhead";
 
 #define WDT_TIMEOUT 10000000
 #define WDT_RELOAD(val) wdtCounter = (val)
@@ -131,6 +292,90 @@ static void update_memory_statistics(void)
 #endif
 }
 
+static inline int trace_bucket(uint32_t us)
+{
+    if (us < 4)
+        return us;
+    int exponent = 31 - __builtin_clz(us);
+    return RG_MIN(4 * (exponent - 1) + ((us >> (exponent - 2)) & 3), RG_TRACE_BUCKETS - 1);
+}
+
+static inline int trace_bucket_limit(int bucket)
+{
+    if (bucket < 4)
+        return bucket;
+    return ((5 + bucket % 4) << (bucket / 4 - 1)) - 1;
+}
+
+static rg_stage_stats_t trace_histogram_stats(const uint32_t *histogram, int max)
+{
+    rg_stage_stats_t stats = {0};
+    int count = 0;
+
+    for (int i = 0; i < RG_TRACE_BUCKETS; ++i)
+        stats.count += histogram[i];
+
+    for (int i = 0; i < RG_TRACE_BUCKETS; ++i)
+    {
+        count += histogram[i];
+        if (!stats.p50 && count * 2 >= stats.count)
+            stats.p50 = RG_MIN(trace_bucket_limit(i), max);
+        if (!stats.p99 && count * 100 >= stats.count * 99)
+            stats.p99 = RG_MIN(trace_bucket_limit(i), max);
+    }
+    stats.max = max;
+
+    return stats;
+}
+
+static void trace_tick(int busyTime)
+{
+    int64_t now = statistics.lastTick;
+    uint32_t head = trace.head;
+    __typeof__(trace.frames[0]) *frame = &trace.frames[head % RG_TRACE_LENGTH];
+
+    rg_system_trace_stage(RG_STAGE_FRAME, trace.lastTick ? now - trace.lastTick : 0);
+    rg_system_trace_stage(RG_STAGE_EMULATE, busyTime);
+    trace.lastTick = now;
+
+    frame->frame = statistics.ticks;
+    frame->time = now;
+    for (int i = 0; i < RG_STAGE_COUNT; ++i)
+    {
+        int32_t elapsed = __atomic_exchange_n(&trace.pending[i], 0, __ATOMIC_RELAXED);
+        frame->stages[i] = elapsed;
+        if (elapsed > 0)
+        {
+            trace.histogram[i][trace_bucket(elapsed)]++;
+            trace.max[i] = RG_MAX(trace.max[i], elapsed);
+        }
+    }
+    __atomic_store_n(&trace.head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void update_stage_statistics(int64_t since)
+{
+    uint32_t head = __atomic_load_n(&trace.head, __ATOMIC_ACQUIRE);
+    uint32_t count = RG_MIN(head, RG_TRACE_LENGTH);
+
+    for (int i = 0; i < RG_STAGE_COUNT; ++i)
+    {
+        uint32_t histogram[RG_TRACE_BUCKETS] = {0};
+        int max = 0;
+
+        for (uint32_t pos = head - count; pos != head; ++pos)
+        {
+            const __typeof__(trace.frames[0]) *frame = &trace.frames[pos % RG_TRACE_LENGTH];
+            if (frame->time < since || frame->stages[i] <= 0)
+                continue;
+            histogram[trace_bucket(frame->stages[i])]++;
+            max = RG_MAX(max, frame->stages[i]);
+        }
+
+        statistics.stages[i] = trace_histogram_stats(histogram, max);
+    }
+}
+
 static void update_statistics(void)
 {
     static counters_t counters = {0};
@@ -151,6 +396,7 @@ static void update_statistics(void)
     statistics.skippedFPS = statistics.totalFPS - ((counters.totalFrames - previous.totalFrames) / elapsedTime);
     statistics.fullFPS = (counters.fullFrames - previous.fullFrames) / elapsedTime;
 
+    update_stage_statistics(previous.updateTime);
     update_memory_statistics();
 }
 
@@ -211,7 +457,7 @@ static void system_monitor_task(void *arg)
 
         #ifdef RG_ENABLE_PROFILING
             if ((numLoop % 10) == 0)
-                rg_system_dump_profile();
+                rg_system_dump_profile(NULL);
         #endif
 
         // if ((numLoop % 300) == 299)
@@ -315,8 +561,17 @@ rg_app_t *rg_system_init(int sampleRate, const rg_handlers_t *handlers, const rg
     tasks[0] = (rg_task_t){NULL, NULL, xTaskGetCurrentTaskHandle(), "main"};
 #else
     snprintf(app.buildTool, sizeof(app.buildTool), "SDL2 %d.%d.%d / CC %s", 1, 1, 1, __VERSION__);
-    freopen("stdout.txt", "w", stdout);
-    freopen("stderr.txt", "w", stderr);
+    if ((benchmark.frames = atoi(getenv("RG_BENCHMARK_FRAMES") ?: "0")) > 0)
+    {
+        // Keep the console output, the results are printed there
+        benchmark.samples = calloc(benchmark.frames, sizeof(int32_t));
+        RG_ASSERT(benchmark.samples, "Out of memory!");
+    }
+    else
+    {
+        freopen("stdout.txt", "w", stdout);
+        freopen("stderr.txt", "w", stderr);
+    }
     tasks[0] = (rg_task_t){NULL, NULL, SDL_ThreadID(), "main"};
 #endif
 
@@ -352,6 +607,15 @@ rg_app_t *rg_system_init(int sampleRate, const rg_handlers_t *handlers, const rg
     app.configNs = rg_settings_get_string(NS_BOOT, SETTING_BOOT_NAME, app.name);
     app.bootArgs = rg_settings_get_string(NS_BOOT, SETTING_BOOT_ARGS, "");
     app.bootFlags = rg_settings_get_number(NS_BOOT, SETTING_BOOT_FLAGS, 0);
+#ifndef ESP_PLATFORM
+    // There is no launcher on the host, the app and rom can be selected from the environment instead
+    if (getenv("RG_BOOT_NAME"))
+        app.configNs = strdup(getenv("RG_BOOT_NAME"));
+    if (getenv("RG_BOOT_ARGS"))
+        app.bootArgs = strdup(getenv("RG_BOOT_ARGS"));
+    if (benchmark.frames)
+        app.bootFlags = 0; // Always start from power on
+#endif
     app.saveSlot = (app.bootFlags & RG_BOOT_SLOT_MASK) >> 4;
     app.romPath = app.bootArgs;
 
@@ -397,14 +661,22 @@ rg_app_t *rg_system_init(int sampleRate, const rg_handlers_t *handlers, const rg
     if (handlers)
         app.handlers = *handlers;
 
+    history.enabled = app.handlers.serialize && app.handlers.deserialize && rg_settings_get_number(NS_APP, SETTING_REWIND, 0);
+    history.budget = RG_MAX(rg_settings_get_number(NS_GLOBAL, SETTING_REWIND_BUDGET, 500), 1);
+    runahead.frames = RG_MIN(RG_MAX(rg_settings_get_number(NS_APP, SETTING_RUN_AHEAD, 0), 0), RG_RUN_AHEAD_MAX_FRAMES);
+
 #ifdef RG_ENABLE_PROFILING
     RG_LOGI("Profiling has been enabled at compile time!\n");
-    profile = rg_alloc(sizeof(*profile), MEM_SLOW);
-    profile->lock = xSemaphoreCreateMutex();
+    profile_init();
 #endif
 
     rg_task_create("rg_system", &system_monitor_task, NULL, 3 * 1024, RG_TASK_PRIORITY, -1);
 
+#ifndef ESP_PLATFORM
+    if (benchmark.frames)
+        RG_LOGI("Benchmark mode: app=%s frames=%d\n", app.configNs, benchmark.frames);
+#endif
+
     app.initialized = true;
 
     RG_LOGI("Retro-Go ready.\n\n");
@@ -546,12 +818,397 @@ rg_stats_t rg_system_get_counters(void)
     return statistics;
 }
 
+IRAM_ATTR void rg_system_trace_stage(rg_stage_t stage, int elapsed)
+{
+    if (stage < RG_STAGE_COUNT && elapsed > 0)
+        __atomic_fetch_add(&trace.pending[stage], elapsed, __ATOMIC_RELAXED);
+}
+
+rg_stage_stats_t rg_system_get_stage_stats(rg_stage_t stage)
+{
+    RG_ASSERT(stage < RG_STAGE_COUNT, "bad stage");
+    return trace_histogram_stats(trace.histogram[stage], trace.max[stage]);
+}
+
+void rg_system_reset_stage_stats(void)
+{
+    memset(trace.histogram, 0, sizeof(trace.histogram));
+    memset(trace.max, 0, sizeof(trace.max));
+    trace.lastTick = 0; // The gap since the last frame isn't representative
+}
+
+bool rg_system_save_timings(const char *filename)
+{
+    RG_ASSERT(filename, "bad param");
+
+    FILE *fp = fopen(filename, "w");
+    if (!fp)
+    {
+        RG_LOGE("Failed to open '%s'\n", filename);
+        return false;
+    }
+
+    fprintf(fp, "stage,count,p50,p99,max\n");
+    for (int i = 0; i < RG_STAGE_COUNT; ++i)
+    {
+        rg_stage_stats_t stats = rg_system_get_stage_stats(i);
+        fprintf(fp, "%s,%d,%d,%d,%d\n", stage_names[i], stats.count, stats.p50, stats.p99, stats.max);
+    }
+
+    fprintf(fp, "\nbucket_us");
+    for (int i = 0; i < RG_STAGE_COUNT; ++i)
+        fprintf(fp, ",%s", stage_names[i]);
+    for (int b = 0; b < RG_TRACE_BUCKETS; ++b)
+    {
+        fprintf(fp, "\n%d", trace_bucket_limit(b));
+        for (int i = 0; i < RG_STAGE_COUNT; ++i)
+            fprintf(fp, ",%u", (unsigned)trace.histogram[i][b]);
+    }
+
+    fprintf(fp, "\n\nframe,time_us");
+    for (int i = 0; i < RG_STAGE_COUNT; ++i)
+        fprintf(fp, ",%s", stage_names[i]);
+    uint32_t head = __atomic_load_n(&trace.head, __ATOMIC_ACQUIRE);
+    for (uint32_t pos = head - RG_MIN(head, RG_TRACE_LENGTH); pos != head; ++pos)
+    {
+        const __typeof__(trace.frames[0]) *frame = &trace.frames[pos % RG_TRACE_LENGTH];
+        fprintf(fp, "\n%u,%lld", (unsigned)frame->frame, (long long)frame->time);
+        for (int i = 0; i < RG_STAGE_COUNT; ++i)
+            fprintf(fp, ",%d", (int)frame->stages[i]);
+    }
+    fprintf(fp, "\n");
+
+    fclose(fp);
+    RG_LOGI("Frame timings saved to '%s'\n", filename);
+    return true;
+}
+
+#ifndef ESP_PLATFORM
+static int compare_samples(const void *a, const void *b)
+{
+    return *(const int32_t *)a - *(const int32_t *)b;
+}
+
+static void benchmark_report(void)
+{
+    int32_t *samples = benchmark.samples;
+    int count = benchmark.count;
+    float elapsed = (benchmark.lastTick - benchmark.started) / 1000000.f;
+    rg_display_counters_t display = rg_display_get_counters();
+
+    qsort(samples, count, sizeof(int32_t), compare_samples);
+
+    // The RGD: prefix makes the line easy to grep out of the log, like the profiler's output
+    printf("RGD:BENCH app=%s rom=%s frames=%d drawn=%d full=%d dropped=%d time=%.3f fps=%.2f "
+           "p50=%d p90=%d p99=%d max=%d crc=%08X\n",
+           app.configNs, rg_basename(app.romPath ?: "-"), count, display.totalFrames, display.fullFrames,
+           display.droppedFrames, elapsed, count / elapsed, samples[count * 50 / 100], samples[count * 90 / 100],
+           samples[count * 99 / 100], samples[count - 1], (unsigned)rg_display_get_frame_crc());
+    fflush(stdout);
+}
+
+static void benchmark_tick(void)
+{
+    // The display task would otherwise drop whichever frames it's too slow for, and which ones depends on
+    // thread timing. Draining it every frame makes drawn and crc the same from one run to the next.
+    rg_display_sync(true);
+
+    // The first tick only starts the clock
+    if (benchmark.started == 0)
+        benchmark.started = statistics.lastTick;
+    else
+        benchmark.samples[benchmark.count++] = statistics.lastTick - benchmark.lastTick;
+    benchmark.lastTick = statistics.lastTick;
+
+    if (benchmark.count == benchmark.frames)
+    {
+        benchmark_report();
+        exit(0);
+    }
+}
+
+// esp-idf calls app_main() itself, the host needs a regular entry point
+extern void app_main(void);
+
+int main(int argc, char **argv)
+{
+    app_main();
+    return 0;
+}
+#endif
+
+static void rewind_free(void)
+{
+    free(history.state);
+    free(history.scratch);
+    free(history.buffer);
+    history.state = history.scratch = history.buffer = NULL;
+    history.state_size = history.buffer_size = 0;
+    history.head = history.count = 0;
+    history.current = false;
+}
+
+static bool rewind_alloc(size_t state_size)
+{
+    rewind_free();
+    history.buffer_size = RG_MAX(RG_REWIND_BUFFER_SIZE, REWIND_MAX_DELTA(state_size) * 2);
+    history.state = malloc(state_size);
+    history.scratch = malloc(state_size);
+    history.buffer = malloc(history.buffer_size);
+    if (!state_size || !history.state || !history.scratch || !history.buffer)
+    {
+        RG_LOGE("Unable to allocate rewind buffers (state: %d bytes)\n", (int)state_size);
+        rewind_free();
+        return false;
+    }
+    history.state_size = state_size;
+    history.interval = history.countdown = REWIND_INTERVAL;
+    RG_LOGI("Rewind enabled, state: %d bytes, buffer: %d bytes\n", (int)state_size, (int)history.buffer_size);
+    return true;
+}
+
+// Encodes a ^ b as {u16 skip, u16 count, count bytes}. A literal run ends at 4 equal bytes, which pays for the
+// next token's header, so the output can't exceed REWIND_MAX_DELTA(size).
+static size_t rewind_encode(uint8_t *out, size_t limit, const uint8_t *a, const uint8_t *b, size_t size)
+{
+    size_t pos = 0, length = 0;
+
+    while (pos < size)
+    {
+        size_t start = pos, end;
+        while (start < size && start - pos < 0xFFFF && a[start] == b[start])
+            start++;
+        for (end = start; end < size && end - start < 0xFFFF; end++)
+        {
+            if (a[end] == b[end] && (end + 4 > size || memcmp(a + end, b + end, 4) == 0))
+                break;
+        }
+        uint16_t header[2] = {start - pos, end - start};
+        if (length + sizeof(header) + header[1] > limit)
+            return 0;
+        memcpy(out + length, header, sizeof(header));
+        length += sizeof(header);
+        for (size_t i = start; i < end; i++)
+            out[length++] = a[i] ^ b[i];
+        pos = end;
+    }
+
+    return length;
+}
+
+static void rewind_decode(uint8_t *state, size_t size, const uint8_t *in, size_t length)
+{
+    size_t pos = 0, i = 0;
+
+    while (i + 4 <= length)
+    {
+        uint16_t header[2];
+        memcpy(header, in + i, sizeof(header));
+        i += sizeof(header);
+        pos += header[0];
+        if (pos + header[1] > size || i + header[1] > length)
+            break;
+        for (size_t end = pos + header[1]; pos < end;)
+            state[pos++] ^= in[i++];
+    }
+}
+
+// Returns where `length` contiguous bytes can be written, dropping the oldest snapshots in the way
+static uint8_t *rewind_reserve(size_t length)
+{
+    size_t offset = 0, end = 0;
+
+    if (history.count > 0)
+    {
+        __typeof__(history.entries[0]) *newest = &history.entries[(history.head - 1) % REWIND_MAX_SNAPSHOTS];
+        end = newest->offset + newest->length;
+        offset = (end + length > history.buffer_size) ? 0 : end;
+    }
+
+    while (history.count > 0)
+    {
+        __typeof__(history.entries[0]) *oldest = &history.entries[(history.head - history.count) % REWIND_MAX_SNAPSHOTS];
+        bool skipped = offset < end && oldest->offset >= end; // Left behind when wrapping around
+        bool overlaps = oldest->offset < offset + length && oldest->offset + oldest->length > offset;
+        if (!skipped && !overlaps && history.count < REWIND_MAX_SNAPSHOTS)
+            break;
+        history.count--;
+    }
+
+    history.entries[history.head % REWIND_MAX_SNAPSHOTS].offset = offset;
+    return history.buffer + offset;
+}
+
+static void rewind_capture(void)
+{
+    int64_t time_start = rg_system_timer();
+
+    if (!history.state)
+    {
+        size_t size = rg_emu_serialize(NULL, 0);
+        if (!rewind_alloc(size) || rg_emu_serialize(history.state, size) != size)
+        {
+            rewind_free();
+            history.enabled = false;
+            return;
+        }
+    }
+    else
+    {
+        size_t size = rg_emu_serialize(history.scratch, history.state_size);
+        if (size != history.state_size)
+        {
+            // The state grew (or serialization failed), the history can't be walked back past this point
+            RG_LOGW("State size changed from %d to %d, starting over\n", (int)history.state_size, (int)size);
+            rewind_free();
+            return;
+        }
+
+        size_t limit = REWIND_MAX_DELTA(size);
+        uint8_t *out = rewind_reserve(limit);
+        size_t length = rewind_encode(out, limit, history.scratch, history.state, size);
+        if (length == 0)
+        {
+            rewind_free();
+            return;
+        }
+        history.entries[history.head % REWIND_MAX_SNAPSHOTS].length = length;
+        history.head++;
+        history.count++;
+
+        uint8_t *temp = history.state;
+        history.state = history.scratch;
+        history.scratch = temp;
+    }
+    history.current = true;
+
+    // Spread the cost over enough frames to stay within the budget
+    int elapsed = rg_system_timer() - time_start;
+    history.interval = RG_MIN(RG_MAX((elapsed + history.budget - 1) / history.budget, REWIND_INTERVAL), REWIND_MAX_INTERVAL);
+    history.countdown = history.interval;
+
+    rg_system_trace_stage(RG_STAGE_REWIND, elapsed);
+}
+
+static void rewind_step(void)
+{
+    int64_t time_start = rg_system_timer();
+
+    // First go back to the last snapshot, it can be a few frames old
+    if (history.current)
+    {
+        if (history.count == 0)
+            return;
+        __typeof__(history.entries[0]) *newest = &history.entries[(history.head - 1) % REWIND_MAX_SNAPSHOTS];
+        rewind_decode(history.state, history.state_size, history.buffer + newest->offset, newest->length);
+        history.head--;
+        history.count--;
+    }
+
+    history.current = rg_emu_deserialize(history.state, history.state_size);
+    if (!history.current)
+        rewind_free();
+
+    rg_system_trace_stage(RG_STAGE_REWIND, rg_system_timer() - time_start);
+}
+
+static void rewind_tick(void)
+{
+    if (history.state && (rg_input_read_gamepad() & RG_KEY_REWIND))
+    {
+        rewind_step();
+        history.countdown = history.interval;
+    }
+    else if (--history.countdown <= 0)
+    {
+        rewind_capture();
+    }
+    else
+    {
+        history.current = false;
+    }
+}
+
 IRAM_ATTR void rg_system_tick(int busyTime)
 {
     statistics.lastTick = rg_system_timer();
     statistics.busyTime += busyTime;
     statistics.ticks++;
+    if (__atomic_load_n(&saver.state, __ATOMIC_SEQ_CST) == SAVER_DONE)
+        save_state_finish();
+    trace_tick(busyTime);
     // WDT_RELOAD(WDT_TIMEOUT);
+#ifndef ESP_PLATFORM
+    if (benchmark.frames)
+        benchmark_tick();
+#endif
+}
+
+IRAM_ATTR bool rg_system_frame_begin(bool skip)
+{
+    int frameTime = pacing.frameTime;
+
+    pacing.frameStart = rg_system_timer();
+    pacing.drawing = !skip;
+
+    // The draw time estimate must only learn from frames that were actually drawn
+    if (skip)
+        return false;
+
+#ifndef ESP_PLATFORM
+    // Benchmarks must draw the same frames every run
+    if (benchmark.frames)
+        return true;
+#endif
+
+    if (frameTime > 0)
+    {
+        // Negative slack means we're already late. When we're ahead of the wall clock, and the audio buffer
+        // has enough to cover it, an expensive frame can borrow the time we're ahead by (one frame at most).
+        int slack = -pacing.lag;
+        int buffered = rg_audio_get_buffered();
+        if (buffered >= 0)
+            slack = RG_MIN(slack, buffered - frameTime);
+
+        float cost = pacing.emulateTime + pacing.drawTime;
+        pacing.drawing = cost <= frameTime + slack && rg_display_get_backlog() == 0;
+
+        // Keep showing signs of life when the target is out of reach
+        if (pacing.skipped >= 100000 / frameTime)
+            pacing.drawing = true;
+    }
+
+    pacing.skipped = pacing.drawing ? 0 : pacing.skipped + 1;
+
+    return pacing.drawing;
+}
+
+IRAM_ATTR void rg_system_frame_end(int duration)
+{
+    int64_t now = rg_system_timer();
+    int busyTime = now - pacing.frameStart;
+    float speed = app.speed > 0.f ? app.speed : 1.f;
+
+    // Audio is resampled by the same factor as the speed so the budget shrinks accordingly
+    pacing.frameTime = (duration > 0 ? duration : 1000000 / app.refreshRate) / speed;
+
+    if (pacing.drawing)
+        pacing.drawTime += (RG_MAX(busyTime - pacing.emulateTime, 0.f) - pacing.drawTime) * 0.125f;
+    else
+        pacing.emulateTime += (busyTime - pacing.emulateTime) * 0.125f;
+
+    int period = now - pacing.lastEnd;
+    if (period > 250000) // Menu, loading, etc. Not something to catch up on
+        pacing.lag = 0;
+    else
+        pacing.lag = RG_MIN(RG_MAX(pacing.lag + period - pacing.frameTime, -pacing.frameTime), pacing.frameTime);
+    pacing.lastEnd = now;
+
+    // Only emulated frames count, rg_system_tick() is also called by menus and dialogs
+    if (history.enabled && !history.suspended)
+        rewind_tick();
+
+    rg_system_tick(busyTime);
 }
 
 IRAM_ATTR int64_t rg_system_timer(void)
@@ -559,7 +1216,12 @@ IRAM_ATTR int64_t rg_system_timer(void)
 #ifdef ESP_PLATFORM
     return esp_timer_get_time();
 #else
-    return SDL_GetTicks() * 1000;
+    // SDL_GetTicks() only has millisecond resolution, not good enough to time frames
+    static uint64_t frequency = 0;
+    if (!frequency)
+        frequency = SDL_GetPerformanceFrequency();
+    uint64_t counter = SDL_GetPerformanceCounter();
+    return (counter / frequency) * 1000000 + (counter % frequency) * 1000000 / frequency;
 #endif
 }
 
@@ -647,21 +1309,34 @@ static void emu_update_save_slot(uint8_t slot)
 
 bool rg_emu_load_state(uint8_t slot)
 {
+    const int64_t time_start = rg_system_timer();
     bool success = false;
 
-    if (!app.romPath || !app.handlers.loadState)
+    rg_emu_save_state_wait();
+
+    if (!app.romPath || (!app.handlers.loadState && !app.handlers.deserialize))
     {
         RG_LOGE("No rom or handler defined...\n");
         return false;
     }
 
     char *filename = rg_emu_get_path(RG_PATH_SAVE_STATE + slot, app.romPath);
+    void *data = NULL;
+    size_t size = 0;
+
     RG_LOGI("Loading state from '%s'.\n", filename);
     WDT_RELOAD(30 * 1000000);
 
     rg_gui_draw_hourglass();
 
-    if (!(success = (*app.handlers.loadState)(filename)))
+    // Files written before the core could serialize are left to its loadState handler
+    if (app.handlers.deserialize && rg_storage_read_file(filename, &data, &size)
+        && size >= 4 && *(uint32_t *)data == BLOB_MAGIC)
+        success = rg_emu_deserialize(data, size);
+    else if (app.handlers.loadState)
+        success = (*app.handlers.loadState)(filename);
+
+    if (!success)
     {
         RG_LOGE("Load failed!\n");
     }
@@ -672,28 +1347,19 @@ bool rg_emu_load_state(uint8_t slot)
 
     WDT_RELOAD(WDT_TIMEOUT);
     free(filename);
+    free(data);
+
+    rg_system_trace_stage(RG_STAGE_STORAGE, rg_system_timer() - time_start);
 
     return success;
 }
 
-bool rg_emu_save_state(uint8_t slot)
+// Writes the state to `.new` then swaps it in. `data` NULL means the core's saveState handler writes it.
+static bool emu_write_state(const char *filename, const void *data, size_t size)
 {
-    if (!app.romPath || !app.handlers.saveState)
-    {
-        RG_LOGE("No rom or handler defined...\n");
-        return false;
-    }
-
-    char *filename = rg_emu_get_path(RG_PATH_SAVE_STATE + slot, app.romPath);
     char tempname[RG_PATH_MAX + 8];
     bool success = false;
 
-    RG_LOGI("Saving state to '%s'.\n", filename);
-    WDT_RELOAD(30 * 1000000);
-
-    rg_system_set_led(1);
-    rg_gui_draw_hourglass();
-
     if (!rg_storage_mkdir(rg_dirname(filename)))
     {
         RG_LOGE("Unable to create dir, save might fail...\n");
@@ -701,7 +1367,7 @@ bool rg_emu_save_state(uint8_t slot)
 
     #define tempname(ext) strcat(strcpy(tempname, filename), ext)
 
-    if ((*app.handlers.saveState)(tempname(".new")))
+    if (data ? rg_storage_write_file(tempname(".new"), data, size) : (*app.handlers.saveState)(tempname(".new")))
     {
         rename(filename, tempname(".bak"));
 
@@ -717,19 +1383,119 @@ bool rg_emu_save_state(uint8_t slot)
         RG_LOGE("Save failed!\n");
         rename(filename, tempname(".bak"));
         unlink(tempname(".new"));
-        rg_gui_alert("Save failed", NULL);
     }
-    else
-    {
-        // Save succeeded, let's take a pretty screenshot for the launcher!
-        char *filename = rg_emu_get_path(RG_PATH_SCREENSHOT + slot, app.romPath);
+
+    #undef tempname
+
+    return success;
+}
+
+static void save_state_task(void *arg)
+{
+    const int64_t time_start = rg_system_timer();
+
+    rg_system_set_led(1);
+
+    // The emulation thread may write its SRAM or settings meanwhile
+    rg_storage_lock();
+    bool success = emu_write_state(saver.filename, saver.data, saver.size);
+    rg_storage_unlock();
+    free(saver.data);
+    saver.data = NULL;
+
+    if (success && saver.frame)
+    {
+        // Save succeeded, let's take a pretty screenshot for the launcher!
+        rg_image_t *img = rg_image_copy_resampled(saver.frame, saver.preview_width, 0, 0);
+        rg_storage_lock();
+        rg_storage_mkdir(rg_dirname(saver.preview));
+        if (!img || !rg_image_save_to_file(saver.preview, img, 0))
+            RG_LOGW("Unable to save the preview '%s'\n", saver.preview);
+        rg_storage_unlock();
+        rg_image_free(img);
+    }
+
+    rg_storage_lock();
+    rg_storage_commit();
+    rg_storage_unlock();
+    rg_system_set_led(0);
+
+    saver.success = success;
+    rg_system_trace_stage(RG_STAGE_STORAGE, rg_system_timer() - time_start);
+    __atomic_store_n(&saver.state, SAVER_DONE, __ATOMIC_SEQ_CST);
+}
+
+// Runs on the emulation thread once the writer is done, callbacks and the slot bookkeeping happen here
+static void save_state_finish(void)
+{
+    if (__atomic_load_n(&saver.state, __ATOMIC_SEQ_CST) != SAVER_DONE)
+        return;
+
+    rg_save_callback_t callback = saver.callback;
+    void *arg = saver.arg;
+    uint8_t slot = saver.slot;
+    bool success = saver.success;
+
+    if (success)
+    {
+        // There was no frame to copy, the handler might still know how to take one
+        if (!saver.frame)
+            rg_emu_screenshot(saver.preview, rg_display_get_info()->screen.width / 2, 0);
+        emu_update_save_slot(slot);
+    }
+
+    rg_image_free(saver.frame);
+    free(saver.filename);
+    free(saver.preview);
+    saver.frame = NULL;
+    saver.filename = saver.preview = NULL;
+    __atomic_store_n(&saver.state, SAVER_IDLE, __ATOMIC_SEQ_CST);
+
+    // We're usually in the middle of a frame, showing a dialog is up to whoever started the save
+    if (callback)
+        (*callback)(slot, success, arg);
+    else if (!success)
+        RG_LOGE("Saving state to slot %d failed!\n", slot);
+}
+
+bool rg_emu_save_state_wait(void)
+{
+    if (__atomic_load_n(&saver.state, __ATOMIC_SEQ_CST) == SAVER_BUSY)
+    {
+        RG_LOGI("Waiting for the save in progress...\n");
+        WDT_RELOAD(30 * 1000000);
+        while (__atomic_load_n(&saver.state, __ATOMIC_SEQ_CST) == SAVER_BUSY)
+            rg_task_delay(10);
+        WDT_RELOAD(WDT_TIMEOUT);
+    }
+    save_state_finish();
+    return saver.success;
+}
+
+// The old way, for the cores that write their state themselves
+static bool emu_save_state_sync(uint8_t slot)
+{
+    const int64_t time_start = rg_system_timer();
+    char *filename = rg_emu_get_path(RG_PATH_SAVE_STATE + slot, app.romPath);
+
+    RG_LOGI("Saving state to '%s'.\n", filename);
+    WDT_RELOAD(30 * 1000000);
+
+    rg_system_set_led(1);
+    rg_gui_draw_hourglass();
+
+    bool success = emu_write_state(filename, NULL, 0);
+
+    if (success)
+    {
+        // Save succeeded, let's take a pretty screenshot for the launcher!
+        char *filename = rg_emu_get_path(RG_PATH_SCREENSHOT + slot, app.romPath);
         rg_emu_screenshot(filename, rg_display_get_info()->screen.width / 2, 0);
         free(filename);
 
         emu_update_save_slot(slot);
     }
 
-    #undef tempname
     free(filename);
 
     rg_storage_commit();
@@ -737,9 +1503,347 @@ bool rg_emu_save_state(uint8_t slot)
 
     WDT_RELOAD(WDT_TIMEOUT);
 
+    rg_system_trace_stage(RG_STAGE_STORAGE, rg_system_timer() - time_start);
+
+    saver.success = success;
     return success;
 }
 
+bool rg_emu_save_state_async(uint8_t slot, rg_save_callback_t callback, void *arg)
+{
+    if (!app.romPath || (!app.handlers.saveState && !app.handlers.serialize))
+    {
+        RG_LOGE("No rom or handler defined...\n");
+        return false;
+    }
+
+    // Only one save is in flight at a time, the previous one must be done with its buffers
+    if (__atomic_load_n(&saver.state, __ATOMIC_SEQ_CST) != SAVER_IDLE)
+    {
+        rg_gui_draw_hourglass();
+        rg_emu_save_state_wait();
+    }
+
+    if (!app.handlers.serialize)
+    {
+        bool success = emu_save_state_sync(slot);
+        if (callback)
+            (*callback)(slot, success, arg);
+        return success;
+    }
+
+    const int64_t time_start = rg_system_timer();
+    size_t size = rg_emu_serialize(NULL, 0);
+    void *data = size ? malloc(size) : NULL;
+
+    if (!data || rg_emu_serialize(data, size) != size)
+    {
+        RG_LOGE("Unable to capture the state!\n");
+        free(data);
+        saver.success = false;
+        if (callback)
+            (*callback)(slot, false, arg);
+        return false;
+    }
+
+    saver.slot = slot;
+    saver.filename = rg_emu_get_path(RG_PATH_SAVE_STATE + slot, app.romPath);
+    saver.preview = rg_emu_get_path(RG_PATH_SCREENSHOT + slot, app.romPath);
+    saver.data = data;
+    saver.size = size;
+    saver.frame = app.handlers.screenshot ? rg_display_copy_frame(NULL) : NULL;
+    saver.preview_width = rg_display_get_info()->screen.width / 2;
+    saver.callback = callback;
+    saver.arg = arg;
+    __atomic_store_n(&saver.state, SAVER_BUSY, __ATOMIC_SEQ_CST);
+
+    RG_LOGI("Saving state to '%s' (%d bytes captured).\n", saver.filename, (int)size);
+    rg_system_trace_stage(RG_STAGE_STORAGE, rg_system_timer() - time_start);
+
+    // The lowest priority, which it shares with the idle task that the task watchdog watches, and away from
+    // the emulation when there's another core. PNG compression is long enough to cost frames otherwise.
+    if (!rg_task_create("rg_saver", &save_state_task, NULL, 8 * 1024, 0, SAVER_CORE))
+        save_state_task(NULL);
+
+    return true;
+}
+
+bool rg_emu_save_state(uint8_t slot)
+{
+    return rg_emu_save_state_async(slot, NULL, NULL) && rg_emu_save_state_wait();
+}
+
+size_t rg_emu_serialize(void *buffer, size_t size)
+{
+    if (!app.handlers.serialize)
+    {
+        RG_LOGE("No handler defined...\n");
+        return 0;
+    }
+
+    blob_header_t header = {BLOB_MAGIC, 0, 0, 0};
+    rg_emu_blob_t blob = {0};
+    if (buffer && size >= sizeof(header))
+    {
+        blob.data = (uint8_t *)buffer + sizeof(header);
+        blob.size = size - sizeof(header);
+    }
+
+    if (!(*app.handlers.serialize)(&blob))
+    {
+        RG_LOGE("Serialization failed!\n");
+        return 0;
+    }
+
+    header.size = sizeof(header) + blob.pos;
+    header.version = blob.version;
+    if (buffer && header.size <= size)
+        memcpy(buffer, &header, sizeof(header));
+
+    return header.size;
+}
+
+bool rg_emu_deserialize(const void *buffer, size_t size)
+{
+    if (!app.handlers.deserialize)
+    {
+        RG_LOGE("No handler defined...\n");
+        return false;
+    }
+
+    blob_header_t header = {0};
+    if (buffer && size >= sizeof(header))
+        memcpy(&header, buffer, sizeof(header));
+
+    if (header.magic != BLOB_MAGIC || header.size < sizeof(header) || header.size > size)
+    {
+        RG_LOGE("Not a valid blob (size: %d)\n", (int)size);
+        return false;
+    }
+
+    // The handlers never write to the blob when deserializing
+    rg_emu_blob_t blob = {(uint8_t *)buffer + sizeof(header), header.size - sizeof(header), 0, header.version};
+    if (!(*app.handlers.deserialize)(&blob))
+    {
+        RG_LOGE("Deserialization failed!\n");
+        return false;
+    }
+
+    return true;
+}
+
+void *rg_emu_blob_put(rg_emu_blob_t *blob, const char *tag, const void *data, size_t length)
+{
+    RG_ASSERT(blob && tag, "Bad param");
+
+    blob_chunk_t chunk = {{0}, length};
+    strncpy(chunk.tag, tag, sizeof(chunk.tag) - 1);
+
+    size_t pos = blob->pos;
+    blob->pos += sizeof(chunk) + length;
+
+    if (!blob->data || blob->pos > blob->size)
+        return NULL;
+
+    memcpy(blob->data + pos, &chunk, sizeof(chunk));
+    if (data)
+        memcpy(blob->data + pos + sizeof(chunk), data, length);
+
+    return blob->data + pos + sizeof(chunk);
+}
+
+const void *rg_emu_blob_get(rg_emu_blob_t *blob, const char *tag, size_t *length)
+{
+    RG_ASSERT(blob && tag, "Bad param");
+
+    // Chunks are usually requested in the order they were written, so start where the last one ended
+    size_t pos = blob->pos;
+    bool wrapped = false;
+
+    while (!wrapped || pos < blob->pos)
+    {
+        blob_chunk_t chunk;
+        if (pos + sizeof(chunk) > blob->size
+            || (memcpy(&chunk, blob->data + pos, sizeof(chunk)), chunk.length > blob->size - pos - sizeof(chunk)))
+        {
+            if (wrapped)
+                break;
+            wrapped = true;
+            pos = 0;
+            continue;
+        }
+        if (strncmp(chunk.tag, tag, sizeof(chunk.tag)) == 0)
+        {
+            blob->pos = pos + sizeof(chunk) + chunk.length;
+            if (length)
+                *length = chunk.length;
+            return blob->data + pos + sizeof(chunk);
+        }
+        pos += sizeof(chunk) + chunk.length;
+    }
+
+    return NULL;
+}
+
+bool rg_emu_blob_read(rg_emu_blob_t *blob, const char *tag, void *data, size_t length)
+{
+    size_t chunk_length;
+    const void *chunk = rg_emu_blob_get(blob, tag, &chunk_length);
+    if (!chunk)
+        return false;
+    memcpy(data, chunk, RG_MIN(chunk_length, length));
+    if (chunk_length < length)
+        memset((uint8_t *)data + chunk_length, 0, length - chunk_length);
+    return true;
+}
+
+void rg_emu_set_rewind(bool enable)
+{
+    history.enabled = enable && app.handlers.serialize && app.handlers.deserialize;
+    if (!history.enabled)
+        rewind_free();
+    rg_settings_set_number(NS_APP, SETTING_REWIND, history.enabled);
+}
+
+bool rg_emu_get_rewind(void)
+{
+    return history.enabled;
+}
+
+void rg_emu_suspend_rewind(bool suspend)
+{
+    // The snapshots taken before or during the suspension can't be stepped back into afterwards
+    if (suspend != history.suspended)
+        rewind_free();
+    history.suspended = suspend;
+}
+
+static inline void runahead_average(float *average, float value)
+{
+    *average += (value - *average) * (*average > 0.f ? 0.125f : 1.f);
+}
+
+static void runahead_free(void)
+{
+    free(runahead.state);
+    runahead.state = NULL;
+    runahead.state_size = 0;
+    runahead.frameCost = runahead.extraCost = runahead.stateCost = 0.f;
+    runahead.suspended = false;
+}
+
+static size_t runahead_save(void)
+{
+    size_t size = rg_emu_serialize(runahead.state, runahead.state_size);
+    if (size > runahead.state_size)
+    {
+        free(runahead.state);
+        runahead.state = malloc(size);
+        runahead.state_size = runahead.state ? size : 0;
+        size = rg_emu_serialize(runahead.state, runahead.state_size);
+    }
+    return size <= runahead.state_size ? size : 0;
+}
+
+// Suspending looks at what run-ahead actually costs, resuming predicts it from the plain frames
+static void runahead_check_headroom(void)
+{
+    float budget = pacing.frameTime;
+    if (budget <= 0.f)
+        return;
+
+    if (!runahead.suspended)
+    {
+        float cost = runahead.frameCost + runahead.extraCost;
+        if (cost > budget * RUNAHEAD_SUSPEND)
+        {
+            RG_LOGW("Run-ahead suspended, it costs %dus of the %dus frame\n", (int)cost, (int)budget);
+            runahead.suspended = true;
+        }
+    }
+    else
+    {
+        float cost = runahead.frameCost * (runahead.frames + 1) + runahead.stateCost;
+        if (cost < budget * RUNAHEAD_RESUME)
+        {
+            RG_LOGI("Run-ahead resumed, it should cost %dus of the %dus frame\n", (int)cost, (int)budget);
+            runahead.extraCost = cost - runahead.frameCost;
+            runahead.suspended = false;
+        }
+    }
+}
+
+IRAM_ATTR void rg_emu_run_frame(bool draw, rg_run_frame_t run)
+{
+    RG_ASSERT(run, "Bad param");
+
+    runahead.supported = app.handlers.serialize && app.handlers.deserialize;
+
+    // Nobody would see skipped frames early
+    if (runahead.frames <= 0 || !runahead.supported || !draw)
+    {
+        (*run)(draw, false);
+        return;
+    }
+
+    int64_t time_start = rg_system_timer();
+
+    if (runahead.suspended)
+    {
+        (*run)(true, false);
+        runahead_average(&runahead.frameCost, rg_system_timer() - time_start);
+        runahead_check_headroom();
+        return;
+    }
+
+    // The real frame isn't shown, but its audio and side effects are the ones that are kept
+    (*run)(false, false);
+
+    int64_t time_real = rg_system_timer();
+    size_t size = runahead_save();
+    if (!size)
+    {
+        RG_LOGE("Snapshot failed, disabling run-ahead\n");
+        runahead_free();
+        runahead.frames = 0;
+        return;
+    }
+
+    int64_t time_saved = rg_system_timer();
+    for (int i = 1; i <= runahead.frames; ++i)
+        (*run)(i == runahead.frames, true);
+
+    int64_t time_ahead = rg_system_timer();
+    if (!rg_emu_deserialize(runahead.state, size))
+    {
+        // The emulation carries on from the speculative state, it's a few frames in the future but valid
+        RG_LOGE("Restore failed, disabling run-ahead\n");
+        runahead_free();
+        runahead.frames = 0;
+        return;
+    }
+
+    int64_t time_end = rg_system_timer();
+    runahead_average(&runahead.frameCost, time_real - time_start);
+    runahead_average(&runahead.extraCost, time_end - time_real);
+    runahead_average(&runahead.stateCost, (time_saved - time_real) + (time_end - time_ahead));
+    runahead_check_headroom();
+
+    rg_system_trace_stage(RG_STAGE_RUNAHEAD, time_end - time_real);
+}
+
+void rg_emu_set_run_ahead(int frames)
+{
+    runahead.frames = RG_MIN(RG_MAX(frames, 0), RG_RUN_AHEAD_MAX_FRAMES);
+    runahead_free();
+    rg_settings_set_number(NS_APP, SETTING_RUN_AHEAD, runahead.frames);
+}
+
+int rg_emu_get_run_ahead(void)
+{
+    return runahead.supported ? runahead.frames : -1;
+}
+
 bool rg_emu_screenshot(const char *filename, int width, int height)
 {
     if (!app.handlers.screenshot)
@@ -766,6 +1870,7 @@ bool rg_emu_screenshot(const char *filename, int width, int height)
 
 rg_emu_state_t *rg_emu_get_states(const char *romPath, size_t slots)
 {
+    rg_emu_save_state_wait(); // The files might be about to change
     rg_emu_state_t *result = calloc(1, sizeof(rg_emu_state_t) + sizeof(rg_emu_slot_t) * slots);
     uint8_t last_used_slot = 0xFF;
 
@@ -819,6 +1924,7 @@ static void shutdown_cleanup(void)
     rg_display_clear(C_BLACK);                // Let the user know that something is happening
     rg_gui_draw_hourglass();                  // ...
     rg_system_event(RG_EVENT_SHUTDOWN, NULL); // Allow apps to save their state if they want
+    rg_emu_save_state_wait();                 // Storage must stay mounted until the writer is done
     rg_audio_deinit();                        // Disable sound ASAP to avoid audio garbage
     rg_system_save_time();                    // RTC might save to storage, do it before
     rg_storage_deinit();                      // Unmount storage
@@ -878,6 +1984,9 @@ void rg_system_switch_app(const char *partition, const char *name, const char *a
     RG_LOGI("Switching to app %s (%s)!\n", partition, name ?: "-");
     exitCalled = true;
 
+    // The save's slot bookkeeping touches the boot settings too, it must come first
+    rg_emu_save_state_wait();
+
     if (app.initialized)
     {
         rg_settings_set_string(NS_BOOT, SETTING_BOOT_NAME, name);
@@ -948,7 +2057,7 @@ void rg_system_vlog(int level, const char *context, const char *format, va_list
     logbuf_puts(&logbuf, buffer);
     fputs(buffer, stdout);
 
-    #ifdef RG_TARGET_SDL2
+    #ifndef ESP_PLATFORM
     fflush(stdout);
     #endif
 }
@@ -1014,88 +2123,247 @@ int rg_system_get_led(void)
 }
 
 #ifdef RG_ENABLE_PROFILING
-// Note this profiler might be inaccurate because of:
-// https://gcc.gnu.org/bugzilla/show_bug.cgi?id=28205
+// Every thread records its own call tree in a private context, the hooks never lock or allocate. The
+// dump is a snapshot of cumulative counters and may be slightly torn, which doesn't matter for a profile.
+// Note that instrumentation can still be inaccurate because of https://gcc.gnu.org/bugzilla/show_bug.cgi?id=28205
+
+static __thread profile_thread_t *profile_self;
+
+NO_PROFILE static inline uint32_t profile_clock(void)
+{
+#ifdef ESP_PLATFORM
+    return xthal_get_ccount(); // One cycle to read, versus a few hundred for esp_timer_get_time()
+#else
+    return rg_system_timer();
+#endif
+}
 
-// We also need to add multi-core support. Currently it's not an issue
-// because all our profiled code runs on the same core.
+NO_PROFILE static void profile_init(void)
+{
+    profile = rg_alloc(sizeof(*profile), MEM_SLOW);
+    // Calibrate the clock against the system timer, we only need to know it for the report
+    int64_t start = rg_system_timer();
+    uint32_t ticks = profile_clock();
+    while (rg_system_timer() - start < 2000)
+        continue;
+    profile->ticks_per_us = RG_MAX((profile_clock() - ticks) / (uint32_t)(rg_system_timer() - start), 1);
+    profile->time_started = rg_system_timer();
+}
 
-#define LOCK_PROFILE()   xSemaphoreTake(lock, pdMS_TO_TICKS(10000));
-#define UNLOCK_PROFILE() xSemaphoreGive(lock);
+NO_PROFILE static profile_thread_t *profile_register_thread(void)
+{
+    uint32_t index = __atomic_fetch_add(&profile->threads_count, 1, __ATOMIC_RELAXED);
+    if (index >= PROFILE_MAX_THREADS)
+    {
+        profile->threads_count = PROFILE_MAX_THREADS;
+        return (void *)-1; // Not profiled
+    }
 
-NO_PROFILE static inline profile_frame_t *find_frame(void *this_fn, void *call_site)
+    profile_thread_t *thread = &profile->threads[index];
+#ifdef ESP_PLATFORM
+    void *handle = xTaskGetCurrentTaskHandle();
+#else
+    void *handle = (void *)(uintptr_t)SDL_ThreadID();
+#endif
+    snprintf(thread->name, sizeof(thread->name), "thread%d", (int)index);
+    for (size_t i = 0; i < RG_COUNT(tasks); ++i)
+    {
+        if (tasks[i].handle == handle)
+            snprintf(thread->name, sizeof(thread->name), "%s", tasks[i].name);
+    }
+    return thread;
+}
+
+NO_PROFILE static int32_t profile_find_node(profile_thread_t *thread, uintptr_t func, int32_t parent)
 {
-    for (int i = 0; i < 512; ++i)
+    uint32_t hash = ((func >> 2) ^ ((uint32_t)parent * 0x9E3779B1u)) * 0x85EBCA6Bu;
+
+    for (int probe = 0; probe < 32; ++probe)
     {
-        profile_frame_t *frame = &profile->frames[i];
-        if (frame->func_ptr == 0)
+        uint32_t index = (hash + probe) & (PROFILE_MAX_NODES - 1);
+        profile_node_t *node = &thread->nodes[index];
+        if (node->func == func && node->parent == parent)
+            return index;
+        if (node->func == 0)
         {
-            profile->total_frames = RG_MAX(profile->total_frames, i + 1);
-            frame->func_ptr = this_fn;
+            node->parent = parent;
+            node->func = func; // Set last, the dump uses it to detect used nodes
+            return index;
         }
-        if (frame->func_ptr == this_fn) // && frame->caller_ptr == call_site)
-            return frame;
     }
 
-    RG_PANIC("Profile memory exhausted!");
+    thread->dropped++;
+    return -2;
 }
 
-NO_PROFILE void rg_system_dump_profile(void)
+typedef struct
+{
+    FILE *fp;
+    uint8_t buffer[48];
+    size_t length;
+    size_t total;
+} profile_writer_t;
+
+// With no file, the data goes to the console in base64 lines that rg_tool.py knows how to reassemble
+NO_PROFILE static void profile_flush(profile_writer_t *writer)
 {
-    LOCK_PROFILE();
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char line[sizeof(writer->buffer) / 3 * 4 + 8];
+    const uint8_t *in = writer->buffer;
+    char *out = line;
 
-    printf("RGD:PROF:BEGIN %d %d\n", profile->total_frames, (int)(rg_system_timer() - profile->time_started));
+    if (!writer->length)
+        return;
 
-    for (int i = 0; i < profile->total_frames; ++i)
+    if (writer->fp)
     {
-        profile_frame_t *frame = &profile->frames[i];
+        fwrite(writer->buffer, writer->length, 1, writer->fp);
+        writer->length = 0;
+        return;
+    }
 
-        printf(
-            "RGD:PROF:DATA %p\t%p\t%u\t%u\n",
-            frame->caller_ptr,
-            frame->func_ptr,
-            frame->num_calls,
-            frame->run_time
-        );
+    for (size_t i = 0; i < writer->length; i += 3, in += 3)
+    {
+        size_t left = writer->length - i;
+        uint32_t v = (in[0] << 16) | (left > 1 ? in[1] << 8 : 0) | (left > 2 ? in[2] : 0);
+        *out++ = table[(v >> 18) & 0x3F];
+        *out++ = table[(v >> 12) & 0x3F];
+        *out++ = left > 1 ? table[(v >> 6) & 0x3F] : '=';
+        *out++ = left > 2 ? table[v & 0x3F] : '=';
     }
+    *out = 0;
+    printf("RGD:PROF:DATA %s\n", line);
+    writer->length = 0;
+}
 
-    printf("RGD:PROF:END\n");
+NO_PROFILE static void profile_write(profile_writer_t *writer, const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    writer->total += length;
+    while (length--)
+    {
+        writer->buffer[writer->length++] = *bytes++;
+        if (writer->length == sizeof(writer->buffer))
+            profile_flush(writer);
+    }
+}
 
-    memset(profile->frames, 0, sizeof(profile->frames));
-    profile->time_started = rg_system_timer();
-    profile->total_frames = 0;
+// Format (little endian): header, then for each thread a thread header followed by its nodes.
+//   header:  u32 magic, u16 version, u16 threads, u32 ticks_per_us, u32 elapsed_us
+//   thread:  char name[16], u32 nodes, u32 dropped
+//   node:    u64 func, i32 index, i32 parent, u32 calls, u64 self_ticks, u64 total_ticks
+// Nodes reference their parent by index, -1 being the root. Times are cumulative since boot.
+NO_PROFILE bool rg_system_dump_profile(const char *filename)
+{
+    profile_writer_t writer = {0};
+
+    if (!profile)
+        return false;
 
-    UNLOCK_PROFILE();
+    if (filename && !(writer.fp = fopen(filename, "wb")))
+    {
+        RG_LOGE("Failed to open '%s'\n", filename);
+        return false;
+    }
+
+    uint32_t threads_count = RG_MIN(profile->threads_count, PROFILE_MAX_THREADS);
+    uint32_t elapsed = rg_system_timer() - profile->time_started;
+
+    if (!writer.fp)
+        printf("RGD:PROF:BEGIN %d %d\n", (int)threads_count, (int)elapsed);
+
+    profile_write(&writer, &(uint32_t){PROFILE_MAGIC}, 4);
+    profile_write(&writer, &(uint16_t){PROFILE_VERSION}, 2);
+    profile_write(&writer, &(uint16_t){threads_count}, 2);
+    profile_write(&writer, &profile->ticks_per_us, 4);
+    profile_write(&writer, &elapsed, 4);
+
+    for (size_t t = 0; t < threads_count; ++t)
+    {
+        const profile_thread_t *thread = &profile->threads[t];
+        uint32_t count = 0;
+
+        for (size_t i = 0; i < PROFILE_MAX_NODES; ++i)
+            count += thread->nodes[i].func != 0;
+
+        profile_write(&writer, thread->name, sizeof(thread->name));
+        profile_write(&writer, &count, 4);
+        profile_write(&writer, &thread->dropped, 4);
+
+        for (int32_t i = 0; i < PROFILE_MAX_NODES && count > 0; ++i)
+        {
+            const profile_node_t *node = &thread->nodes[i];
+            if (!node->func)
+                continue;
+            profile_write(&writer, &(uint64_t){node->func}, 8);
+            profile_write(&writer, &i, 4);
+            profile_write(&writer, &node->parent, 4);
+            profile_write(&writer, &node->calls, 4);
+            profile_write(&writer, &node->self_time, 8);
+            profile_write(&writer, &node->total_time, 8);
+            count--;
+        }
+    }
+
+    profile_flush(&writer);
+
+    if (writer.fp)
+        fclose(writer.fp);
+    else
+        printf("RGD:PROF:END %d\n", (int)writer.total);
+
+    return true;
 }
 
 NO_PROFILE void __cyg_profile_func_enter(void *this_fn, void *call_site)
 {
-    if (!profile)
+    profile_thread_t *self = profile_self;
+
+    if (!self)
+    {
+        if (!profile)
+            return;
+        self = profile_self = profile_register_thread();
+    }
+
+    if (self == (void *)-1)
         return;
 
-    int64_t now = rg_system_timer();
-    LOCK_PROFILE();
-    profile_frame_t *fn = find_frame(this_fn, call_site);
-    // Recursion will need a real stack, this is absurd
-    if (fn->enter_time != 0)
-        fn->run_time += now - fn->enter_time;
-    fn->enter_time = rg_system_timer(); // not now, because we delayed execution
-    fn->num_calls++;
-    UNLOCK_PROFILE();
+    // Past the maximum depth we keep counting the time in the deepest function
+    int depth = self->depth++;
+    if (depth >= PROFILE_MAX_DEPTH)
+        return;
+
+    int32_t parent = depth > 0 ? self->stack[depth - 1].node : -1;
+    // -1 is the root, -2 means the parent was dropped: the whole subtree is dropped with it
+    int32_t node = (parent != -2) ? profile_find_node(self, (uintptr_t)this_fn, parent) : -2;
+    self->stack[depth].node = node;
+    self->stack[depth].child_time = 0;
+    self->stack[depth].enter_time = profile_clock();
 }
 
 NO_PROFILE void __cyg_profile_func_exit(void *this_fn, void *call_site)
 {
-    if (!profile)
+    uint32_t now = profile_clock();
+    profile_thread_t *self = profile_self;
+
+    if (!self || self == (void *)-1 || self->depth <= 0)
         return;
 
-    int64_t now = rg_system_timer();
-    LOCK_PROFILE();
-    profile_frame_t *fn = find_frame(this_fn, call_site);
-    // Ignore if profiler was disabled when function entered
-    if (fn->enter_time != 0)
-        fn->run_time += now - fn->enter_time;
-    fn->enter_time = 0;
-    UNLOCK_PROFILE();
+    int depth = --self->depth;
+    if (depth >= PROFILE_MAX_DEPTH)
+        return;
+
+    uint32_t elapsed = now - self->stack[depth].enter_time;
+    int32_t index = self->stack[depth].node;
+    if (index >= 0)
+    {
+        profile_node_t *node = &self->nodes[index];
+        node->calls++;
+        node->total_time += elapsed;
+        node->self_time += elapsed - self->stack[depth].child_time;
+    }
+    if (depth > 0)
+        self->stack[depth - 1].child_time += elapsed;
 }
 #endif
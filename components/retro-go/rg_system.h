@@ -8,6 +8,7 @@ extern "C" {
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "config.h"
 
@@ -107,7 +108,21 @@ enum
     RG_EVENT_SLEEP        = RG_EVENT_TYPE_POWER | 2,
 };
 
+// A savestate blob being built by rg_emu_serialize() or read by rg_emu_deserialize(). It is a flat sequence of
+// tagged chunks, see rg_emu_blob_put() and rg_emu_blob_get(). `data` excludes the blob's header.
+typedef struct
+{
+    uint8_t *data;
+    size_t size;      // Capacity when serializing, length of the chunks when deserializing
+    size_t pos;       // Write position (keeps counting past `size`), or where the next chunk lookup starts
+    uint32_t version; // Core specific, serialize sets it and deserialize checks it
+} rg_emu_blob_t;
+
 typedef bool (*rg_state_handler_t)(const char *filename);
+typedef bool (*rg_serialize_handler_t)(rg_emu_blob_t *blob);
+typedef void (*rg_save_callback_t)(uint8_t slot, bool success, void *arg);
+// Runs one frame of the emulator, see rg_emu_run_frame()
+typedef void (*rg_run_frame_t)(bool draw, bool speculative);
 typedef bool (*rg_reset_handler_t)(bool hard);
 typedef void (*rg_event_handler_t)(int event, void *data);
 typedef bool (*rg_screenshot_handler_t)(const char *filename, int width, int height);
@@ -116,8 +131,10 @@ typedef int  (*rg_mem_write_handler_t)(int addr, int value);
 
 typedef struct
 {
-    rg_state_handler_t loadState;       // rg_emu_load_state() handler
-    rg_state_handler_t saveState;       // rg_emu_save_state() handler
+    rg_state_handler_t loadState;       // rg_emu_load_state() handler for files that aren't blobs (legacy saves)
+    rg_state_handler_t saveState;       // rg_emu_save_state() handler, only used if there is no serialize
+    rg_serialize_handler_t serialize;   // rg_emu_serialize() handler
+    rg_serialize_handler_t deserialize; // rg_emu_deserialize() handler
     rg_reset_handler_t reset;           // rg_emu_reset() handler
     rg_screenshot_handler_t screenshot; // rg_emu_screenshot() handler
     rg_event_handler_t event;           // listen to retro-go system events
@@ -167,6 +184,25 @@ typedef struct
     bool initialized;
 } rg_app_t;
 
+typedef enum
+{
+    RG_STAGE_FRAME = 0, // Wall time between two rg_system_tick()
+    RG_STAGE_EMULATE,   // Busy time reported by the application to rg_system_tick()
+    RG_STAGE_SUBMIT,    // rg_display_submit() and rg_display_acquire()
+    RG_STAGE_DISPLAY,   // Diff and transfer, in the display task
+    RG_STAGE_AUDIO,     // rg_audio_submit(), includes the time blocked on the sink
+    RG_STAGE_STORAGE,   // Settings and save states
+    RG_STAGE_REWIND,    // Rewind snapshots, capture and playback
+    RG_STAGE_RUNAHEAD,  // Run-ahead snapshot, speculative frames and restore (also part of emulate)
+    RG_STAGE_COUNT,
+} rg_stage_t;
+
+typedef struct
+{
+    int count;
+    int p50, p99, max; // In microseconds
+} rg_stage_stats_t;
+
 typedef struct
 {
     float skippedFPS;
@@ -183,6 +219,7 @@ typedef struct
     int freeBlockInt;
     int freeBlockExt;
     int freeStackMain;
+    rg_stage_stats_t stages[RG_STAGE_COUNT]; // Over the last second
 } rg_stats_t;
 
 rg_app_t *rg_system_init(int sampleRate, const rg_handlers_t *handlers, const rg_gui_option_t *options);
@@ -197,14 +234,26 @@ bool rg_system_have_app(const char *app);
 void rg_system_set_led(int value);
 int  rg_system_get_led(void);
 void rg_system_tick(int busyTime);
+// Frame pacing: begin returns whether the coming frame should be drawn, end calls rg_system_tick().
+// `skip` is for frames the app won't draw regardless (its own frameskip, startup), they're timed as such.
+// `duration` is the emulated time of the frame in us, 0 means 1/refreshRate. Speed is accounted for.
+bool rg_system_frame_begin(bool skip);
+void rg_system_frame_end(int duration);
 void rg_system_vlog(int level, const char *context, const char *format, va_list va);
 void rg_system_log(int level, const char *context, const char *format, ...) __attribute__((format(printf,3,4)));
 bool rg_system_save_trace(const char *filename, bool append);
+bool rg_system_dump_profile(const char *filename); // NULL = console. Only with RG_ENABLE_PROFILING
 void rg_system_event(int event, void *data);
 int64_t rg_system_timer(void);
 rg_app_t *rg_system_get_app(void);
 rg_stats_t rg_system_get_counters(void);
 
+// Per stage frame timings. Stages are charged to the frame in progress, whichever thread they run on
+void rg_system_trace_stage(rg_stage_t stage, int elapsed);
+rg_stage_stats_t rg_system_get_stage_stats(rg_stage_t stage); // Since boot or the last reset
+void rg_system_reset_stage_stats(void);
+bool rg_system_save_timings(const char *filename);
+
 // RTC and time-related functions
 void rg_system_set_timezone(const char *TZ);
 void rg_system_load_time(void);
@@ -215,8 +264,39 @@ bool rg_task_create(const char *name, void (*taskFunc)(void *data), void *data,
 void rg_task_delay(int ms);
 
 char *rg_emu_get_path(rg_path_type_t type, const char *arg);
+// rg_emu_save_state_async() then rg_emu_save_state_wait(), returns true once the files are written
 bool rg_emu_save_state(uint8_t slot);
+// Captures the state and the last frame in memory and returns, a low priority task writes the files. Only one
+// save can be in flight, it waits for the previous one first. `callback` is called from rg_system_tick() when
+// it's done (or right away if the save failed early), it must not show dialogs. Failures are only logged, the
+// caller decides how to report them. Without the serialize handlers it is the same as rg_emu_save_state().
+bool rg_emu_save_state_async(uint8_t slot, rg_save_callback_t callback, void *arg);
+// Waits for the save in flight, if any, and returns the last save's result
+bool rg_emu_save_state_wait(void);
 bool rg_emu_load_state(uint8_t slot);
+// In-memory savestates. serialize returns the blob's size, if it exceeds `size` nothing usable was written
+// (NULL/0 can be used to query the size). It returns 0 on error. No file I/O is involved.
+size_t rg_emu_serialize(void *buffer, size_t size);
+bool rg_emu_deserialize(const void *buffer, size_t size);
+// Chunks helpers for the handlers. Tags are up to 27 characters. put returns where the chunk's data is (data
+// can be NULL to fill it in place) or NULL if it didn't fit. get returns NULL if the tag is missing, the pointer
+// might not be aligned. read copies the chunk and zero fills what it's missing.
+void *rg_emu_blob_put(rg_emu_blob_t *blob, const char *tag, const void *data, size_t length);
+const void *rg_emu_blob_get(rg_emu_blob_t *blob, const char *tag, size_t *length);
+bool rg_emu_blob_read(rg_emu_blob_t *blob, const char *tag, void *data, size_t length);
+// Rewind: rg_system_frame_end() takes a snapshot every few frames and steps back through them while RG_KEY_REWIND
+// is held. Requires the serialize handlers. The setting is saved per app.
+// It's suspended (and its history dropped) while something else rewrites the state, like netplay's rollback.
+void rg_emu_set_rewind(bool enable);
+bool rg_emu_get_rewind(void);
+void rg_emu_suspend_rewind(bool suspend);
+// Run-ahead: after the real frame the state is saved, a few more frames are emulated with the same input and
+// only the last one is drawn, then the state is restored. It hides that much of the game's own input lag.
+// `run` must not output audio or write anything outside of the savestate when `speculative` is set. It is
+// suspended while the frame cost leaves no headroom. get returns -1 if the app doesn't use rg_emu_run_frame().
+void rg_emu_run_frame(bool draw, rg_run_frame_t run);
+void rg_emu_set_run_ahead(int frames);
+int rg_emu_get_run_ahead(void);
 bool rg_emu_reset(bool hard);
 bool rg_emu_screenshot(const char *filename, int width, int height);
 rg_emu_state_t *rg_emu_get_states(const char *romPath, size_t slots);
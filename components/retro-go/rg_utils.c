@@ -81,6 +81,28 @@ const char *rg_relpath(const char *path)
     return path;
 }
 
+#ifndef ESP_PLATFORM
+// Slicing-by-8, as described by Intel: https://create.stephan-brumme.com/crc32/#slicing-by-8-overview
+// The tables are built before main() runs, so before any thread could read them half built.
+static uint32_t crc32_tables[8][256];
+
+__attribute__((constructor)) static void crc32_init_tables(void)
+{
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        crc32_tables[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        for (int t = 1; t < 8; t++)
+            crc32_tables[t][i] = (crc32_tables[t - 1][i] >> 8) ^ crc32_tables[0][crc32_tables[t - 1][i] & 0xFF];
+    }
+}
+#endif
+
 uint32_t rg_crc32(uint32_t crc, const uint8_t *buf, uint32_t len)
 {
 #ifdef ESP_PLATFORM
@@ -88,42 +110,124 @@ uint32_t rg_crc32(uint32_t crc, const uint8_t *buf, uint32_t len)
     extern uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
     return crc32_le(crc, buf, len);
 #else
-    // Derived from: http://www.hackersdelight.org/hdcodetxt/crc.c.txt
+    const uint32_t (*T)[256] = (const uint32_t (*)[256])crc32_tables;
+
     crc = ~crc;
-    for (size_t i = 0; i < len; ++i)
+    for (; len >= 8; len -= 8, buf += 8)
     {
-        crc = crc ^ buf[i];
-        for (int j = 7; j >= 0; j--) // Do eight times.
-        {
-            uint32_t mask = -(crc & 1);
-            crc = (crc >> 1) ^ (0xEDB88320 & mask);
-        }
+        // Assembling the words byte by byte keeps it endian and alignment agnostic, compilers turn it into a load
+        uint32_t lo = crc ^ (buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t)buf[3] << 24);
+        uint32_t hi = buf[4] | buf[5] << 8 | buf[6] << 16 | (uint32_t)buf[7] << 24;
+        crc = T[7][lo & 0xFF] ^ T[6][(lo >> 8) & 0xFF] ^ T[5][(lo >> 16) & 0xFF] ^ T[4][lo >> 24]
+            ^ T[3][hi & 0xFF] ^ T[2][(hi >> 8) & 0xFF] ^ T[1][(hi >> 16) & 0xFF] ^ T[0][hi >> 24];
     }
+    while (len--)
+        crc = (crc >> 8) ^ T[0][(crc ^ *buf++) & 0xFF];
     return ~crc;
 #endif
 }
 
+// Interned strings are copied into an arena and never freed, a hash set of pointers finds them again.
+// The table stores the hashes too, so that growing it doesn't touch the strings.
+typedef struct
+{
+    uint32_t hash;
+    const char *str;
+} string_entry_t;
+
+static struct
+{
+    string_entry_t *table;
+    size_t capacity; // Power of two, 0 until first use
+    size_t count;
+    char *arena;
+    size_t arena_left;
+} strings;
+
+static uint32_t string_hash(const char *str, size_t *len)
+{
+    // FNV-1a, good enough for paths and keys and much cheaper than a CRC on the ESP32
+    const char *ptr = str;
+    uint32_t hash = 0x811C9DC5;
+    while (*ptr)
+        hash = (hash ^ (uint8_t)*ptr++) * 0x01000193;
+    *len = ptr - str;
+    return hash;
+}
+
+static bool strings_grow(void)
+{
+    size_t capacity = strings.capacity ? strings.capacity * 2 : 256;
+    string_entry_t *table = calloc(capacity, sizeof(string_entry_t));
+    if (!table)
+        return false;
+
+    for (size_t i = 0; i < strings.capacity; i++)
+    {
+        if (!strings.table[i].str)
+            continue;
+        size_t pos = strings.table[i].hash & (capacity - 1);
+        while (table[pos].str)
+            pos = (pos + 1) & (capacity - 1);
+        table[pos] = strings.table[i];
+    }
+
+    free(strings.table);
+    strings.table = table;
+    strings.capacity = capacity;
+    return true;
+}
+
 const char *const_string(const char *str)
 {
-    static const char **strings = NULL;
-    static size_t strings_count = 0;
+    size_t len;
 
     if (!str)
         return NULL;
 
-    // To do : use hashmap or something faster
-    for (int i = 0; i < strings_count; i++)
-        if (strcmp(strings[i], str) == 0)
-            return strings[i];
+    uint32_t hash = string_hash(str, &len);
+
+    // Keep the load factor under 1/2, probe sequences stay short
+    if (strings.count * 2 >= strings.capacity)
+    {
+        bool grown = strings_grow();
+        RG_ASSERT(grown, "alloc failed");
+    }
 
-    str = strdup(str);
+    size_t pos = hash & (strings.capacity - 1);
+    while (strings.table[pos].str)
+    {
+        if (strings.table[pos].hash == hash && strcmp(strings.table[pos].str, str) == 0)
+            return strings.table[pos].str;
+        pos = (pos + 1) & (strings.capacity - 1);
+    }
 
-    strings = realloc(strings, (strings_count + 1) * sizeof(char *));
-    RG_ASSERT(strings && str, "alloc failed");
+    char *copy;
+    if (len >= 1024)
+    {
+        // Large strings get a block of their own so that the arena's tail isn't wasted
+        copy = malloc(len + 1);
+        RG_ASSERT(copy, "alloc failed");
+    }
+    else
+    {
+        if (len + 1 > strings.arena_left)
+        {
+            strings.arena = malloc(4096);
+            RG_ASSERT(strings.arena, "alloc failed");
+            strings.arena_left = 4096;
+        }
+        copy = strings.arena;
+        strings.arena += len + 1;
+        strings.arena_left -= len + 1;
+    }
+    memcpy(copy, str, len + 1);
 
-    strings[strings_count++] = str;
+    strings.table[pos].str = copy;
+    strings.table[pos].hash = hash;
+    strings.count++;
 
-    return str;
+    return copy;
 }
 
 // Note: You should use calloc/malloc everywhere possible. This function is used to ensure
@@ -49,7 +49,7 @@ const char *rg_dirname(const char *path);
 const char *rg_basename(const char *path);
 const char *rg_extension(const char *path);
 const char *rg_relpath(const char *path);
-const char *const_string(const char *str);
+const char *const_string(const char *str); // Interned copy, lives forever. Not thread safe
 uint32_t rg_crc32(uint32_t crc, const uint8_t *buf, uint32_t len);
 void *rg_alloc(size_t size, uint32_t caps);
 
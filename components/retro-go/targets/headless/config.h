@@ -0,0 +1,39 @@
+// Headless host target: same as SDL2 but without a window or an audio device.
+// Used to benchmark the emulators, see BUILDING.md.
+
+// Target definition
+#define RG_TARGET_NAME             "HEADLESS"
+
+// Storage
+#define RG_STORAGE_DRIVER           0       // 0 = Host, 1 = SDSPI, 2 = SDMMC, 3 = USB, 4 = Flash
+#define RG_STORAGE_HOST             0       // Used by SDSPI and SDMMC
+#define RG_STORAGE_SPEED            0       // Used by SDSPI and SDMMC
+#define RG_STORAGE_ROOT             "."     // Storage mount point
+
+// Audio
+#define RG_AUDIO_USE_INT_DAC        0   // 0 = Disable, 1 = GPIO25, 2 = GPIO26, 3 = Both
+#define RG_AUDIO_USE_EXT_DAC        0   // 0 = Disable, 1 = Enable
+#define RG_AUDIO_USE_SDL2           0   // 0 = Disable, 1 = Enable
+
+// Video
+#define RG_SCREEN_DRIVER            99  // 0 = ILI9341, 99 = None
+#define RG_SCREEN_HOST              0
+#define RG_SCREEN_SPEED             0
+#define RG_SCREEN_WIDTH             320
+#define RG_SCREEN_HEIGHT            240
+#define RG_SCREEN_ROTATE            0
+#define RG_SCREEN_MARGIN_TOP        0
+#define RG_SCREEN_MARGIN_BOTTOM     0
+#define RG_SCREEN_MARGIN_LEFT       0
+#define RG_SCREEN_MARGIN_RIGHT      0
+#define RG_SCREEN_INIT()
+
+// Input
+#define RG_GAMEPAD_DRIVER           6   // 1 = ODROID-GO, 2 = Serial, 3 = I2C, 4 = QTPY, 5 = ESPLAY-S3, 6 = SDL2
+#define RG_GAMEPAD_HAS_MENU_BTN     1
+#define RG_GAMEPAD_HAS_OPTION_BTN   1
+// No window means no keyboard events, the map is only there to keep the SDL2 driver happy
+#define RG_GAMEPAD_MAP {\
+    {RG_KEY_MENU,   SDL_SCANCODE_ESCAPE},\
+    {RG_KEY_OPTION, SDL_SCANCODE_TAB},\
+}
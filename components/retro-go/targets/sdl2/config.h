@@ -15,7 +15,7 @@
 #define RG_AUDIO_USE_SDL2           1   // 0 = Disable, 1 = Enable
 
 // Video
-#define RG_SCREEN_DRIVER            0   // 0 = ILI9341
+#define RG_SCREEN_DRIVER            99  // 0 = ILI9341, 99 = None (there is no window yet)
 #define RG_SCREEN_HOST              0
 #define RG_SCREEN_SPEED             0
 #define RG_SCREEN_WIDTH             320
@@ -203,26 +203,38 @@ static inline void gwenesis_SN76489_Update(INT16 *buffer, int length)
         }
     }
 }
+/* Deferred synthesis: when set, writes are handed to gwenesis_sn76489_queue */
+/* and replayed in another task with gwenesis_SN76489_synth_*()             */
+void (*gwenesis_sn76489_queue)(int data, int target) = NULL;
+
+static struct {
+  INT16 *buffer;
+  int index;
+  int clock;
+} synth;
+
 /* SN76589 execution */
 extern int scan_line;
-void gwenesis_SN76489_run(int target) {
+static inline void gwenesis_SN76489_advance(INT16 *buffer, int *index, int *clock, int target) {
  
-if ( sn76489_clock >= target) return;
+if ( *clock >= target) return;
 
-  int sn76489_prev_index = sn76489_index;
-  sn76489_index += (target-sn76489_clock) / gwenesis_SN76489.divisor;
-  if (sn76489_index > sn76489_prev_index) {
-    gwenesis_SN76489_Update(gwenesis_sn76489_buffer + sn76489_prev_index, sn76489_index-sn76489_prev_index);
-    sn76489_clock = sn76489_index*gwenesis_SN76489.divisor;
+  int prev_index = *index;
+  *index += (target-*clock) / gwenesis_SN76489.divisor;
+  if (*index > prev_index) {
+    gwenesis_SN76489_Update(buffer + prev_index, *index-prev_index);
+    *clock = *index*gwenesis_SN76489.divisor;
   } else {
-    sn76489_index = sn76489_prev_index;
+    *index = prev_index;
   }
 }
-void gwenesis_SN76489_Write(int data, int target)
+void gwenesis_SN76489_run(int target) {
+  // Nothing to keep in sync on the CPU side, the PSG can't be read
+  if (gwenesis_sn76489_queue == NULL)
+    gwenesis_SN76489_advance(gwenesis_sn76489_buffer, &sn76489_index, &sn76489_clock, target);
+}
+static void gwenesis_SN76489_apply(int data)
 {
-  if (GWENESIS_AUDIO_ACCURATE == 1)
-    gwenesis_SN76489_run(target);
-
   if (data & 0x80) {
     /* Latch/data byte  %1 cc t dddd */
     gwenesis_SN76489.LatchedRegister = ((data >> 4) & 0x07);
@@ -253,6 +265,38 @@ void gwenesis_SN76489_Write(int data, int target)
 		break;
     }
 }
+void gwenesis_SN76489_Write(int data, int target)
+{
+  if (gwenesis_sn76489_queue) {
+    gwenesis_sn76489_queue(data, target);
+    return;
+  }
+
+  if (GWENESIS_AUDIO_ACCURATE == 1)
+    gwenesis_SN76489_run(target);
+
+  gwenesis_SN76489_apply(data);
+}
+
+/* Synthesis side of the queue, one frame at a time. buffer = NULL skips */
+/* the synthesis, writes are still applied.                               */
+void gwenesis_SN76489_synth_begin(INT16 *buffer)
+{
+  synth.buffer = buffer;
+  synth.index = 0;
+  synth.clock = buffer ? 0 : 0x1000000;
+}
+void gwenesis_SN76489_synth_write(int data, int target)
+{
+  if (GWENESIS_AUDIO_ACCURATE == 1)
+    gwenesis_SN76489_advance(synth.buffer, &synth.index, &synth.clock, target);
+  gwenesis_SN76489_apply(data);
+}
+int gwenesis_SN76489_synth_end(int target)
+{
+  gwenesis_SN76489_advance(synth.buffer, &synth.index, &synth.clock, target);
+  return synth.buffer ? synth.index : 0;
+}
 
 void gwenesis_sn76489_save_state() {
   SaveState* state;
@@ -67,6 +67,12 @@ int gwenesis_SN76489_GetContextSize(void);
 void gwenesis_SN76489_Write(int data, int target);
 void gwenesis_SN76489_run(int target);
 
+/* Deferred synthesis, see gwenesis_sn76489.c */
+extern void (*gwenesis_sn76489_queue)(int data, int target);
+void gwenesis_SN76489_synth_begin(INT16 *buffer);
+void gwenesis_SN76489_synth_write(int data, int target);
+int gwenesis_SN76489_synth_end(int target);
+
 void gwenesis_sn76489_save_state();
 void gwenesis_sn76489_load_state();
 
@@ -1956,6 +1956,111 @@ static void init_tables(void)
 
 }
 
+/* Deferred synthesis */
+/* When gwenesis_ym2612_queue is set, YM2612Write() hands the writes to it and */
+/* ym2612_synth_*() replay them in another task. Games poll the timers through */
+/* the status register, so a copy of them keeps running on the CPU side.      */
+void (*gwenesis_ym2612_queue)(unsigned int a, unsigned int v, int target) = NULL;
+
+static struct
+{
+  UINT16  address;
+  UINT8   status;
+  UINT32  mode;
+  INT32   TAL;
+  INT32   TAC;
+  INT32   TBL;
+  INT32   TBC;
+} timers;
+
+static struct
+{
+  int16_t *buffer;
+  int index;
+  int clock;
+} synth;
+
+static void timers_sync(void)
+{
+  timers.address = ym2612.OPN.ST.address;
+  timers.status = ym2612.OPN.ST.status;
+  timers.mode = ym2612.OPN.ST.mode;
+  timers.TAL = ym2612.OPN.ST.TAL;
+  timers.TAC = ym2612.OPN.ST.TAC;
+  timers.TBL = ym2612.OPN.ST.TBL;
+  timers.TBC = ym2612.OPN.ST.TBC;
+}
+
+/* Same as INTERNAL_TIMER_A() length times and INTERNAL_TIMER_B(length) */
+static void timers_run(int length)
+{
+  if (timers.mode & 0x01)
+  {
+    int left = length;
+    while (left > 0)
+    {
+      int step = timers.TAC > 0 ? (timers.TAC < left ? timers.TAC : left) : 1;
+      timers.TAC -= step;
+      left -= step;
+      if (timers.TAC <= 0)
+      {
+        if (timers.mode & 0x04)
+          timers.status |= 0x01;
+        timers.TAC = timers.TAL;
+      }
+    }
+  }
+
+  if (timers.mode & 0x02)
+  {
+    timers.TBC -= length;
+    if (timers.TBC <= 0)
+    {
+      if (timers.mode & 0x08)
+        timers.status |= 0x02;
+      if (timers.TBL)
+        timers.TBC += timers.TBL;
+      else
+        timers.TBC = timers.TBL;
+    }
+  }
+}
+
+/* Timer related subset of YM2612Write() */
+static void timers_write(unsigned int a, unsigned int v)
+{
+  switch (a)
+  {
+    case 0:
+      timers.address = v;
+      break;
+    case 2:
+      timers.address = v | 0x100;
+      break;
+    default:
+      switch (timers.address)
+      {
+        case 0x24:
+          timers.TAL = 1024 - (((1024 - timers.TAL) & 0x03) | (v << 2));
+          break;
+        case 0x25:
+          timers.TAL = 1024 - (((1024 - timers.TAL) & 0x3fc) | (v & 3));
+          break;
+        case 0x26:
+          timers.TBL = (256 - v) << 4;
+          break;
+        case 0x27:
+          if ((v & 1) && !(timers.mode & 1))
+            timers.TAC = timers.TAL;
+          if ((v & 2) && !(timers.mode & 2))
+            timers.TBC = timers.TBL;
+          timers.status &= (~v >> 4);
+          timers.mode = v;
+          break;
+      }
+  }
+}
+
 /* initialize ym2612 emulator */
 void YM2612Init(void) {
   static unsigned init_table_done = 0;
@@ -2009,6 +2114,8 @@ void YM2612ResetChip(void)
     OPNWriteReg(i      ,0);
     OPNWriteReg(i|0x100,0);
   }
+
+  timers_sync();
 }
 
 /* YM2612 execution */
@@ -2148,34 +2255,32 @@ static inline void YM2612Update(int16_t *buffer, int length)
   INTERNAL_TIMER_B(length);
 }
 
-void ym2612_run( int target) {
+/* buffer = NULL only runs the CPU side timers */
+static inline void ym2612_advance(int16_t *buffer, int *index, int *clock, int target) {
 
-  if ( ym2612_clock >= target) {
+  if ( *clock >= target) {
     return;
   }
-  int ym2612_prev_index = ym2612_index;
-  ym2612_index += (target-ym2612_clock) / ym2612.divisor;
-  if (ym2612_index > ym2612_prev_index) {
-    YM2612Update(gwenesis_ym2612_buffer + ym2612_prev_index, ym2612_index-ym2612_prev_index);
-    ym2612_clock = ym2612_index*ym2612.divisor;
+  int prev_index = *index;
+  *index += (target-*clock) / ym2612.divisor;
+  if (*index > prev_index) {
+    if (buffer)
+      YM2612Update(buffer + prev_index, *index-prev_index);
+    else
+      timers_run(*index-prev_index);
+    *clock = *index*ym2612.divisor;
 
   } else {
-    ym2612_index = ym2612_prev_index;
+    *index = prev_index;
   }
 }
 
-/* ym2612 write */
-/* n = number  */
-/* a = address */
-/* v = value   */
-void YM2612Write(unsigned int a, unsigned int v,  int target)
-{
-  ym_log(__FUNCTION__," %06x : %02x",a,v);
-
-  //Sync
-  if (GWENESIS_AUDIO_ACCURATE == 1)
-    ym2612_run(target); 
+void ym2612_run( int target) {
+  ym2612_advance(gwenesis_ym2612_queue ? NULL : gwenesis_ym2612_buffer, &ym2612_index, &ym2612_clock, target);
+}
 
+static void ym2612_apply(unsigned int a, unsigned int v)
+{
   v &= 0xff;  /* adjust to 8 bit bus */
 
   switch( a )
@@ -2220,15 +2325,60 @@ void YM2612Write(unsigned int a, unsigned int v,  int target)
   }
 }
 
+/* ym2612 write */
+/* n = number  */
+/* a = address */
+/* v = value   */
+void YM2612Write(unsigned int a, unsigned int v,  int target)
+{
+  ym_log(__FUNCTION__," %06x : %02x",a,v);
+
+  //Sync
+  if (GWENESIS_AUDIO_ACCURATE == 1)
+    ym2612_run(target); 
+
+  if (gwenesis_ym2612_queue) {
+    timers_write(a, v & 0xff);
+    gwenesis_ym2612_queue(a, v & 0xff, target);
+    return;
+  }
+
+  ym2612_apply(a, v);
+}
+
 unsigned int YM2612Read(int target)
 {
   // //Sync
   if (GWENESIS_AUDIO_ACCURATE == 1)
     ym2612_run(target);
+  if (gwenesis_ym2612_queue)
+    return timers.status;
   ym_log(__FUNCTION__, "%02x",ym2612.OPN.ST.status & 0xff);
   return ym2612.OPN.ST.status & 0xff;
 }
 
+/* Synthesis side of the queue, one frame at a time. buffer = NULL skips */
+/* the synthesis, writes are still applied.                               */
+void ym2612_synth_begin(int16_t *buffer)
+{
+  synth.buffer = buffer;
+  synth.index = 0;
+  synth.clock = buffer ? 0 : 0x1000000;
+}
+
+void ym2612_synth_write(unsigned int a, unsigned int v, int target)
+{
+  if (GWENESIS_AUDIO_ACCURATE == 1)
+    ym2612_advance(synth.buffer, &synth.index, &synth.clock, target);
+  ym2612_apply(a, v);
+}
+
+int ym2612_synth_end(int target)
+{
+  ym2612_advance(synth.buffer, &synth.index, &synth.clock, target);
+  return synth.buffer ? synth.index : 0;
+}
+
 
 void YM2612Config(unsigned char dac_bits) //,unsigned int AUDIO_FREQ_DIVISOR)
 {
@@ -2333,6 +2483,15 @@ int YM2612SaveContext(unsigned char *state)
 
 void gwenesis_ym2612_save_state() {
   SaveState* state;
+
+  // The CPU side timers are the ones the game has seen
+  if (gwenesis_ym2612_queue) {
+    ym2612.OPN.ST.address = timers.address;
+    ym2612.OPN.ST.status = timers.status;
+    ym2612.OPN.ST.TAC = timers.TAC;
+    ym2612.OPN.ST.TBC = timers.TBC;
+  }
+
   state = saveGwenesisStateOpenForWrite("ym2612");
   saveGwenesisStateSetBuffer(state, "ym2612", &ym2612, sizeof(ym2612));
   saveGwenesisStateSet(state, "m2", m2);
@@ -2354,4 +2513,5 @@ void gwenesis_ym2612_load_state() {
   saveGwenesisStateGetBuffer(state, "out_fm", out_fm, sizeof(out_fm));
   bitmask = saveGwenesisStateGet(state, "bitmask");
   saveGwenesisStateGetBuffer(state, "OPNREGS", OPNREGS, sizeof(OPNREGS));
+  timers_sync();
 }
@@ -28,6 +28,12 @@ extern void YM2612Write(unsigned int a, unsigned int v, int target);
 extern void ym2612_run(int target);
 extern unsigned int YM2612Read(int target);
 
+/* Deferred synthesis, see ym2612.c */
+extern void (*gwenesis_ym2612_queue)(unsigned int a, unsigned int v, int target);
+extern void ym2612_synth_begin(int16_t *buffer);
+extern void ym2612_synth_write(unsigned int a, unsigned int v, int target);
+extern int ym2612_synth_end(int target);
+
 #if 0
 extern int YM2612LoadContext(unsigned char *state);
 extern int YM2612SaveContext(unsigned char *state);
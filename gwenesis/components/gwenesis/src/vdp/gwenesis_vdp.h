@@ -134,6 +134,25 @@ void gwenesis_vdp_render_line(int line);
 
 void gwenesis_vdp_render_config();
 
+/* Deferred rendering: register and VSRAM writes are logged with their line so the renderer can
+ * run behind the CPUs. When set, gwenesis_vdp_render_wait() must return once every line handed
+ * to the renderer is drawn, it's called before VRAM changes, before the sprite overflow/collision
+ * flags are read by the status register and when the log is full. */
+#define VDP_LOG_SIZE 512 // Must be a power of two
+#define VDP_LOG_REG 0
+#define VDP_LOG_VSRAM 1
+
+typedef struct {
+  unsigned short line;
+  unsigned char target;
+  unsigned char index;
+  unsigned short value;
+} gwenesis_vdp_log_t;
+
+extern void (*gwenesis_vdp_render_wait)(void);
+void gwenesis_vdp_log_apply(int line);
+void gwenesis_vdp_log_reset();
+
 unsigned int gwenesis_vdp_get_status();
 void gwenesis_vdp_get_debug_status(char *s);
 unsigned short gwenesis_vdp_get_cram(int index);
@@ -45,6 +45,11 @@ extern unsigned char *VRAM;
 
 #endif
 
+/* The renderer may run behind the CPUs, so it works from its own copy of the registers
+ * and VSRAM. gwenesis_vdp_log_apply() replays the writes made up to the line being drawn. */
+#define gwenesis_vdp_regs gwenesis_vdp_render_regs
+#define VSRAM gwenesis_vdp_render_vsram
+
 extern unsigned short CRAM[];            // CRAM - Palettes
 extern unsigned char SAT_CACHE[]__attribute__((aligned(4)));        // Sprite cache
 extern unsigned char gwenesis_vdp_regs[]; // Registers
@@ -923,6 +928,8 @@ void draw_sprites(int line)
 
 void gwenesis_vdp_render_config()
 {
+    gwenesis_vdp_log_reset();
+
     mode_h40 = REG12_MODE_H40;
     mode_pal = REG1_PAL;
 
@@ -1009,6 +1016,8 @@ blit_4to5_line(uint16_t *in, uint16_t *out) {
 
 void gwenesis_vdp_render_line(int line)
 {
+  gwenesis_vdp_log_apply(line);
+
   mode_h40 = REG12_MODE_H40;
   //mode_pal = REG1_PAL;
 
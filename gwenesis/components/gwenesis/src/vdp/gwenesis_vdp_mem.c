@@ -21,6 +21,7 @@ __license__ = "GPLv3"
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <limits.h>
 #include "m68k.h"
 #include "ym2612.h"
 #include "gwenesis_vdp.h"
@@ -75,6 +76,16 @@ unsigned short fifo[FIFO_SIZE];               // Fifo
 unsigned short CRAM565[CRAM_MAX_SIZE * 4];    // CRAM - Palettes
 unsigned short VSRAM[VSRAM_MAX_SIZE];         // VSRAM - Scrolling
 
+// Renderer's copy of the registers and VSRAM, brought up to date line by line from the log
+unsigned char gwenesis_vdp_render_regs[REG_SIZE];
+unsigned short gwenesis_vdp_render_vsram[VSRAM_MAX_SIZE];
+
+static gwenesis_vdp_log_t vdp_log[VDP_LOG_SIZE];
+static unsigned int vdp_log_head; // Written by the CPU side
+static unsigned int vdp_log_tail; // Written by the renderer, or by the CPU side when it's idle
+
+void (*gwenesis_vdp_render_wait)(void) = NULL;
+
 // Define VDP control code and set initial code
 static unsigned char code_reg = 0;
 // Define VDP control address and set initial address
@@ -115,6 +126,67 @@ extern bool sprite_collision;
 #define FETCH16(A) ( ( (*(unsigned short *)&VRAM[(A)]) >> 8 ) | ( (*(unsigned short *)&VRAM[(A)]) << 8 ) )
 
 
+/******************************************************************************
+ *
+ *  Render log
+ *  Apply the writes made up to the given line to the renderer's copy
+ *
+ ******************************************************************************/
+void gwenesis_vdp_log_apply(int line)
+{
+  unsigned int head = __atomic_load_n(&vdp_log_head, __ATOMIC_ACQUIRE);
+  unsigned int tail = vdp_log_tail;
+
+  while (tail != head) {
+    const gwenesis_vdp_log_t *entry = &vdp_log[tail % VDP_LOG_SIZE];
+    if (entry->line > line)
+      break;
+    if (entry->target == VDP_LOG_REG)
+      gwenesis_vdp_render_regs[entry->index] = entry->value;
+    else
+      gwenesis_vdp_render_vsram[entry->index] = entry->value;
+    tail++;
+  }
+
+  __atomic_store_n(&vdp_log_tail, tail, __ATOMIC_RELEASE);
+}
+
+// Must only be called while the renderer is idle (start of frame, after a reset or a load)
+void gwenesis_vdp_log_reset()
+{
+  memcpy(gwenesis_vdp_render_regs, gwenesis_vdp_regs, sizeof(gwenesis_vdp_render_regs));
+  memcpy(gwenesis_vdp_render_vsram, VSRAM, sizeof(gwenesis_vdp_render_vsram));
+  __atomic_store_n(&vdp_log_tail, vdp_log_head, __ATOMIC_RELEASE);
+}
+
+static inline __attribute__((always_inline))
+void vdp_log_write(int target, int index, int value)
+{
+  unsigned int head = vdp_log_head;
+
+  // Log is full: let the renderer finish the lines it has, then catch up in its place
+  if (head - __atomic_load_n(&vdp_log_tail, __ATOMIC_ACQUIRE) >= VDP_LOG_SIZE) {
+    if (gwenesis_vdp_render_wait)
+      gwenesis_vdp_render_wait();
+    gwenesis_vdp_log_apply(INT_MAX);
+  }
+
+  gwenesis_vdp_log_t *entry = &vdp_log[head % VDP_LOG_SIZE];
+  entry->line = scan_line;
+  entry->target = target;
+  entry->index = index;
+  entry->value = value;
+  __atomic_store_n(&vdp_log_head, head + 1, __ATOMIC_RELEASE);
+}
+
+// The renderer reads VRAM directly, it must be done with every line it was given before it changes
+static inline __attribute__((always_inline))
+void gwenesis_vdp_render_sync(void)
+{
+  if (gwenesis_vdp_render_wait)
+    gwenesis_vdp_render_wait();
+}
+
 /******************************************************************************
  *
  *  SEGA 315-5313 Reset
@@ -156,6 +228,7 @@ void gwenesis_vdp_reset() {
   memset(CRAM565, 0, sizeof(CRAM565));
   memset(VSRAM, 0, sizeof(VSRAM));
   memset(gwenesis_vdp_regs, 0, sizeof(gwenesis_vdp_regs));
+  gwenesis_vdp_log_reset();
   command_word_pending = 0;
   address_reg = 0;
   code_reg = 0;
@@ -287,6 +360,7 @@ static inline __attribute__((always_inline)) void gwenesis_vdp_register_w(int re
         return;
 
     gwenesis_vdp_regs[reg] = value;
+    vdp_log_write(VDP_LOG_REG, reg, value);
     vdpm_log(__FUNCTION__, "reg:%02d <- %02x", reg, value);
 
 
@@ -345,6 +419,13 @@ void gwenesis_vdp_vram_write(unsigned int address, unsigned int value)
     SAT_CACHE[address - REG5_SAT_ADDRESS] = value;
 }
 
+static inline __attribute__((always_inline))
+void gwenesis_vdp_vsram_write(unsigned int index, unsigned int value)
+{
+  VSRAM[index] = value;
+  vdp_log_write(VDP_LOG_VSRAM, index, value);
+}
+
 static inline __attribute__((always_inline)) 
 unsigned short status_register_r(void)
 {
@@ -373,6 +454,9 @@ unsigned short status_register_r(void)
             status |= STATUS_HBLANK;
     }
 
+    // The renderer sets these, it must be done with the lines the CPUs have seen so far. It's
+    // only a few lines behind and this returns immediately once it has caught up (in vblank).
+    gwenesis_vdp_render_sync();
     if (sprite_overflow)
         status |= STATUS_SPRITEOVERFLOW;
     if (sprite_collision)
@@ -427,6 +511,7 @@ void gwenesis_vdp_dma_fill(unsigned short value)
         
   switch (code_reg & 0xF) {
   case 0x1:
+    gwenesis_vdp_render_sync();
     do {
       gwenesis_vdp_vram_write((address_reg ^ 1) & 0xFFFF, value >> 8);
       address_reg += REG15_DMA_INCREMENT;
@@ -460,7 +545,7 @@ void gwenesis_vdp_dma_fill(unsigned short value)
     break;
   case 0x5: // undocumented and buggy, see vdpfifotesting:
     do {
-      VSRAM[(address_reg & 0x7f) >> 1] = fifo[3] & 0x03FF;
+      gwenesis_vdp_vsram_write((address_reg & 0x7f) >> 1, fifo[3] & 0x03FF);
       address_reg += REG15_DMA_INCREMENT;
       src_addr_low++;
     } while (--dma_length);
@@ -522,6 +607,7 @@ void gwenesis_vdp_dma_m68k()
       switch (code_reg & 0xF) {
 
       case 0x1: // dest is VRAM
+        gwenesis_vdp_render_sync();
         do {
           value = FETCH16RAM( src_addr );
           push_fifo(value);
@@ -564,7 +650,7 @@ void gwenesis_vdp_dma_m68k()
         do {
           value = FETCH16RAM( src_addr );
           push_fifo(value);
-          VSRAM[(address_reg & 0x7f) >> 1] = value & 0x03FF;
+          gwenesis_vdp_vsram_write((address_reg & 0x7f) >> 1, value & 0x03FF);
           address_reg += REG15_DMA_INCREMENT;
           src_addr += 2;
         } while (--dma_length);
@@ -581,7 +667,7 @@ void gwenesis_vdp_dma_m68k()
       switch (code_reg & 0xF) {
 
       case 0x1: // dest is VRAM
-
+        gwenesis_vdp_render_sync();
         do {
           value = FETCH16ROM(src_addr);
           push_fifo(value);
@@ -628,7 +714,7 @@ void gwenesis_vdp_dma_m68k()
         do {
           value = FETCH16ROM(src_addr);
           push_fifo(value);
-          VSRAM[(address_reg & 0x7f) >> 1] = value & 0x03FF;
+          gwenesis_vdp_vsram_write((address_reg & 0x7f) >> 1, value & 0x03FF);
           address_reg += REG15_DMA_INCREMENT;
           src_addr += 2;
         } while (--dma_length);
@@ -662,6 +748,7 @@ void gwenesis_vdp_dma_copy()
     unsigned short src_addr_low = REG21_DMA_SRCADDR_LOW;
     //vdpm_log(__FUNCTION__,"length:%x src:%x",dma_length,src_addr_low);
 
+    gwenesis_vdp_render_sync();
     do
     {
         unsigned short value = VRAM[src_addr_low ^ 1];
@@ -834,6 +921,7 @@ void gwenesis_vdp_write_data_port_16(unsigned int value)
         case 0x1: /* VRAM write */
             //vdpm_log(__FUNCTION__,"VRAM write : addr:%x increment:%d value:%04x",
              // address_reg, REG15_DMA_INCREMENT, value);
+            gwenesis_vdp_render_sync();
             gwenesis_vdp_vram_write(address_reg& 0xFFFF, (value >> 8) & 0xFF);
             gwenesis_vdp_vram_write((address_reg^1)& 0xFFFF, (value)&0xFF);
             address_reg += REG15_DMA_INCREMENT;
@@ -869,7 +957,7 @@ void gwenesis_vdp_write_data_port_16(unsigned int value)
             //vdpm_log(__FUNCTION__,"VSRAM write : addr:%x increment:%d value:%04x",
             //  address_reg, REG15_DMA_INCREMENT, value);
            // printf("write dataport 16: VSRAM@%04x:%04x\n",address_reg,value);
-            VSRAM[(address_reg & 0x7f) >> 1] = value & 0X03FF;
+            gwenesis_vdp_vsram_write((address_reg & 0x7f) >> 1, value & 0X03FF);
             address_reg += REG15_DMA_INCREMENT;
             address_reg &= 0xFFFF;
             break;
@@ -1030,4 +1118,5 @@ void gwenesis_vdp_mem_load_state() {
   hvcounter_latch = saveGwenesisStateGet(state, "hvcounter_latch");
   hvcounter_latched = saveGwenesisStateGet(state, "hvcounter_latched");
   hint_pending = saveGwenesisStateGet(state, "hint_pending");
+  gwenesis_vdp_log_reset();
 }
\ No newline at end of file
@@ -1,6 +1,14 @@
 #include <rg_system.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#else
+#include <SDL2/SDL.h>
+#endif
 
 /* Gwenesis Emulator */
 #include "m68k.h"
@@ -15,6 +23,32 @@
 #define AUDIO_SAMPLE_RATE (53267)
 #define AUDIO_BUFFER_LENGTH (AUDIO_SAMPLE_RATE / 60 + 1)
 
+// Video and sound are offloaded to tasks on the other core when there is one
+#if !defined(ESP_PLATFORM) || !CONFIG_FREERTOS_UNICORE
+#define DUAL_CORE 1
+#else
+#define DUAL_CORE 0
+#endif
+
+// Both must be powers of two
+#define SOUND_QUEUE_LENGTH 2048
+#define SOUND_RING_LENGTH 4096
+
+#define ATOMIC_LOAD(ptr)        __atomic_load_n(ptr, __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE(ptr, val)  __atomic_store_n(ptr, val, __ATOMIC_SEQ_CST)
+
+#ifdef ESP_PLATFORM
+typedef SemaphoreHandle_t semaphore_t;
+#define SEM_CREATE()    xSemaphoreCreateBinary()
+#define SEM_WAIT(sem)   xSemaphoreTake(sem, portMAX_DELAY)
+#define SEM_POST(sem)   xSemaphoreGive(sem)
+#else
+typedef SDL_sem *semaphore_t;
+#define SEM_CREATE()    SDL_CreateSemaphore(0)
+#define SEM_WAIT(sem)   SDL_SemWait(sem)
+#define SEM_POST(sem)   SDL_SemPost(sem)
+#endif
+
 extern unsigned char* VRAM;
 extern int zclk;
 int system_clock;
@@ -29,6 +63,47 @@ int ym2612_clock;
 
 static rg_video_update_t updates[2];
 static rg_video_update_t *currentUpdate = &updates[0];
+static rg_video_update_t *previousUpdate = NULL;
+
+// The CPUs hand each finished line to the render task, which stays at most a few lines behind.
+// The VDP logs register and VSRAM writes per line and waits for it before touching VRAM.
+// Either side that runs out of work sleeps, and raises its flag so that the other one wakes it up.
+static struct
+{
+    semaphore_t start;  // A frame begins
+    semaphore_t posted_sem;
+    semaphore_t rendered_sem;
+    int lines;          // Lines to render in the current frame
+    int posted;         // Lines the CPUs are done with, written by the main task only
+    int rendered;       // Lines drawn, written by the render task only
+    int render_idle;    // The render task waits for posted to move
+    int main_waiting;   // The main task waits for rendered to catch up
+} render;
+
+enum {SOUND_YM2612, SOUND_SN76489, SOUND_FRAME};
+
+typedef struct
+{
+    uint8_t chip;
+    uint8_t addr;
+    uint8_t value;
+    int32_t clock;  // Master clock, relative to the start of the frame
+} sound_event_t;
+
+// The sound chips are written to with timestamps, the sound task replays the writes a frame behind.
+// The samples come back through a ring that the main task drains into rg_audio_submit().
+static struct
+{
+    semaphore_t wakeup;
+    sound_event_t *queue;
+    uint32_t head;          // Written by the main task only
+    uint32_t tail;          // Written by the sound task only
+    int16_t *ring;
+    uint32_t ring_head;     // Written by the sound task only
+    uint32_t ring_tail;     // Written by the main task only
+    uint32_t frames_posted; // Written by the main task only
+    uint32_t frames_done;   // Written by the sound task only
+} sound;
 
 static rg_app_t *app;
 
@@ -36,9 +111,9 @@ static bool yfm_enabled = true;
 static bool yfm_resample = true;
 static bool z80_enabled = true;
 static bool sn76489_enabled = true;
-static int frameskip = 3;
+static int frameskip = DUAL_CORE ? 1 : 3;
 
-static FILE *savestate_fp = NULL;
+static rg_emu_blob_t *savestate_blob = NULL;
 static int savestate_errors = 0;
 
 static const char *SETTING_YFM_EMULATION = "yfm_enable";
@@ -49,11 +124,6 @@ static const char *SETTING_FRAMESKIP = "frameskip";
 
 // --- MAIN
 
-typedef struct {
-    char key[28];
-    uint32_t length;
-} svar_t;
-
 SaveState* saveGwenesisStateOpenForRead(const char* fileName)
 {
     return (void*)1;
@@ -78,49 +148,184 @@ void saveGwenesisStateSet(SaveState* state, const char* tagName, int value)
 
 void saveGwenesisStateGetBuffer(SaveState* state, const char* tagName, void* buffer, int length)
 {
-    size_t initial_pos = ftell(savestate_fp);
-    bool from_start = false;
-    svar_t var;
+    if (!rg_emu_blob_read(savestate_blob, tagName, buffer, length))
+    {
+        RG_LOGW("Key %s NOT FOUND!\n", tagName);
+        savestate_errors++;
+    }
+}
+
+void saveGwenesisStateSetBuffer(SaveState* state, const char* tagName, void* buffer, int length)
+{
+    // During the sizing pass put() returns NULL, the blob's position is all that matters then
+    rg_emu_blob_put(savestate_blob, tagName, buffer, length);
+}
+
+void gwenesis_io_get_buttons()
+{
+}
 
-    // Odds are that calls to this func will be in order, so try searching from current file position.
-    while (!from_start || ftell(savestate_fp) < initial_pos)
+
+// The flags are set before checking again and the semaphores are binary, a wakeup can't be lost and
+// a stale one only costs an extra check.
+static void render_wait(void)
+{
+    while (ATOMIC_LOAD(&render.rendered) < ATOMIC_LOAD(&render.posted))
     {
-        if (!fread(&var, sizeof(svar_t), 1, savestate_fp))
+        ATOMIC_STORE(&render.main_waiting, 1);
+        if (ATOMIC_LOAD(&render.rendered) < ATOMIC_LOAD(&render.posted))
+            SEM_WAIT(render.rendered_sem);
+        ATOMIC_STORE(&render.main_waiting, 0);
+    }
+}
+
+static void render_post(int lines)
+{
+    ATOMIC_STORE(&render.posted, lines);
+    if (ATOMIC_LOAD(&render.render_idle))
+        SEM_POST(render.posted_sem);
+}
+
+static void render_task(void *arg)
+{
+    while (true)
+    {
+        SEM_WAIT(render.start);
+        for (int line = 0; line < render.lines;)
         {
-            if (!from_start)
+            if (line < ATOMIC_LOAD(&render.posted))
             {
-                fseek(savestate_fp, 0, SEEK_SET);
-                from_start = true;
+                gwenesis_vdp_render_line(line);
+                ATOMIC_STORE(&render.rendered, ++line);
+                if (ATOMIC_LOAD(&render.main_waiting))
+                    SEM_POST(render.rendered_sem);
                 continue;
             }
-            break;
-        }
-        if (strncmp(var.key, tagName, sizeof(var.key)) == 0)
-        {
-            fread(buffer, RG_MIN(var.length, length), 1, savestate_fp);
-            RG_LOGI("Loaded key '%s'\n", tagName);
-            return;
+            ATOMIC_STORE(&render.render_idle, 1);
+            if (line >= ATOMIC_LOAD(&render.posted))
+                SEM_WAIT(render.posted_sem);
+            ATOMIC_STORE(&render.render_idle, 0);
         }
-        fseek(savestate_fp, var.length, SEEK_CUR);
     }
-    RG_LOGW("Key %s NOT FOUND!\n", tagName);
-    savestate_errors++;
 }
 
-void saveGwenesisStateSetBuffer(SaveState* state, const char* tagName, void* buffer, int length)
+static void sound_wakeup(void)
 {
-    // TO DO: seek the file to find if the key already exists. It's possible it could be written twice.
-    svar_t var = {{0}, length};
-    strncpy(var.key, tagName, sizeof(var.key) - 1);
-    fwrite(&var, sizeof(var), 1, savestate_fp);
-    fwrite(buffer, length, 1, savestate_fp);
-    RG_LOGI("Saved key '%s'\n", tagName);
+    SEM_POST(sound.wakeup);
 }
 
-void gwenesis_io_get_buttons()
+static void sound_queue(int chip, int addr, int value, int clock)
+{
+    uint32_t head = sound.head;
+    if (head - ATOMIC_LOAD(&sound.tail) >= SOUND_QUEUE_LENGTH)
+    {
+        sound_wakeup();
+        while (head - ATOMIC_LOAD(&sound.tail) >= SOUND_QUEUE_LENGTH)
+            continue;
+    }
+    sound.queue[head % SOUND_QUEUE_LENGTH] = (sound_event_t){chip, addr, value, clock};
+    ATOMIC_STORE(&sound.head, head + 1);
+}
+
+static void ym2612_queue(unsigned int addr, unsigned int value, int clock)
+{
+    sound_queue(SOUND_YM2612, addr, value, clock);
+}
+
+static void sn76489_queue(int value, int clock)
+{
+    sound_queue(SOUND_SN76489, 0, value, clock);
+}
+
+// Waits until every frame handed to the sound task is done, the chips can then be accessed directly
+static void sound_sync(void)
+{
+    if (!gwenesis_ym2612_queue)
+        return;
+    sound_wakeup();
+    while (ATOMIC_LOAD(&sound.frames_done) != sound.frames_posted)
+        usleep(1000);
+}
+
+static void sound_task(void *arg)
 {
+    int16_t *ym2612_buffer = rg_alloc(AUDIO_BUFFER_LENGTH * 2, MEM_FAST);
+    int16_t *sn76489_buffer = rg_alloc(AUDIO_BUFFER_LENGTH * 2, MEM_FAST);
+    bool new_frame = true;
+
+    while (true)
+    {
+        SEM_WAIT(sound.wakeup);
+        uint32_t head = ATOMIC_LOAD(&sound.head);
+        uint32_t tail = sound.tail;
+
+        while (tail != head)
+        {
+            if (new_frame)
+            {
+                ym2612_synth_begin(yfm_enabled ? ym2612_buffer : NULL);
+                gwenesis_SN76489_synth_begin(sn76489_enabled ? sn76489_buffer : NULL);
+                new_frame = false;
+            }
+
+            sound_event_t event = sound.queue[tail % SOUND_QUEUE_LENGTH];
+            ATOMIC_STORE(&sound.tail, ++tail);
+
+            if (event.chip == SOUND_YM2612)
+            {
+                ym2612_synth_write(event.addr, event.value, event.clock);
+            }
+            else if (event.chip == SOUND_SN76489)
+            {
+                gwenesis_SN76489_synth_write(event.value, event.clock);
+            }
+            else if (event.chip == SOUND_FRAME)
+            {
+                int ym2612_samples = ym2612_synth_end(event.clock);
+                int sn76489_samples = gwenesis_SN76489_synth_end(event.clock);
+                int samples = RG_MIN(event.clock / AUDIO_FREQ_DIVISOR, AUDIO_BUFFER_LENGTH * 2);
+
+                // The main task drains the ring every frame, it's only full if it's stuck in a menu
+                while (ATOMIC_LOAD(&sound.ring_head) + samples - ATOMIC_LOAD(&sound.ring_tail) > SOUND_RING_LENGTH)
+                    usleep(1000);
+
+                uint32_t ring_head = sound.ring_head;
+                for (int i = 0; i < samples; ++i)
+                {
+                    int sample = (i < ym2612_samples) ? ym2612_buffer[i] : 0;
+                    if (i < sn76489_samples)
+                        sample += sn76489_buffer[i];
+                    sound.ring[ring_head++ % SOUND_RING_LENGTH] = RG_MAX(-32768, RG_MIN(sample, 32767));
+                }
+                ATOMIC_STORE(&sound.ring_head, ring_head);
+                ATOMIC_STORE(&sound.frames_done, sound.frames_done + 1);
+                new_frame = true;
+            }
+        }
+    }
 }
 
+static void sound_submit(void)
+{
+    // The last frame is still being synthesized, the one before must be done for audio to stay contiguous
+    while (ATOMIC_LOAD(&sound.frames_done) + 1 < sound.frames_posted)
+        usleep(500);
+
+    uint32_t ring_head = ATOMIC_LOAD(&sound.ring_head);
+    uint32_t ring_tail = sound.ring_tail;
+    size_t count = (ring_head - ring_tail) & ~1;
+
+    while (count > 0)
+    {
+        size_t offset = ring_tail % SOUND_RING_LENGTH;
+        size_t chunk = RG_MIN(count, SOUND_RING_LENGTH - offset);
+        rg_audio_submit((void *)&sound.ring[offset], chunk >> 1);
+        ring_tail += chunk;
+        count -= chunk;
+    }
+
+    ATOMIC_STORE(&sound.ring_tail, ring_tail);
+}
 
 static rg_gui_event_t yfm_update_cb(rg_gui_option_t *option, rg_gui_event_t event)
 {
@@ -187,37 +392,52 @@ static rg_gui_event_t frameskip_cb(rg_gui_option_t *option, rg_gui_event_t event
 
 static bool screenshot_handler(const char *filename, int width, int height)
 {
-    return rg_display_save_frame(filename, currentUpdate, width, height);
+    return rg_display_save_frame(filename, previousUpdate ?: currentUpdate, width, height);
 }
 
-static bool save_state_handler(const char *filename)
+static bool serialize_handler(rg_emu_blob_t *blob)
 {
-    if ((savestate_fp = fopen(filename, "wb")))
-    {
-        savestate_errors = 0;
-        gwenesis_save_state();
-        fclose(savestate_fp);
-        return savestate_errors == 0;
-    }
+    sound_sync();
+    savestate_blob = blob;
+    blob->version = 1;
+    gwenesis_save_state();
+    savestate_blob = NULL;
+    return true;
+}
+
+static bool deserialize_handler(rg_emu_blob_t *blob)
+{
+    sound_sync();
+    savestate_blob = blob;
+    savestate_errors = 0;
+    gwenesis_load_state();
+    savestate_blob = NULL;
+    if (savestate_errors == 0)
+        return true;
+    reset_emulation();
     return false;
 }
 
 static bool load_state_handler(const char *filename)
 {
-    if ((savestate_fp = fopen(filename, "rb")))
+    // Older saves are the same chunks without the blob header
+    rg_emu_blob_t blob = {0};
+    void *data = NULL;
+    bool success = false;
+    if (rg_storage_read_file(filename, &data, &blob.size))
     {
-        savestate_errors = 0;
-        gwenesis_load_state();
-        fclose(savestate_fp);
-        if (savestate_errors == 0)
-            return true;
+        blob.data = data;
+        success = deserialize_handler(&blob);
+        free(data);
     }
-    reset_emulation();
-    return false;
+    else
+        reset_emulation();
+    return success;
 }
 
 static bool reset_handler(bool hard)
 {
+    sound_sync();
     reset_emulation();
     return true;
 }
@@ -226,7 +446,8 @@ void app_main(void)
 {
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
-        .saveState = &save_state_handler,
+        .serialize = &serialize_handler,
+        .deserialize = &deserialize_handler,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
     };
@@ -248,28 +469,45 @@ void app_main(void)
     frameskip = rg_settings_get_number(NS_APP, SETTING_FRAMESKIP, frameskip);
 
     updates[0].buffer = rg_alloc(320 * 240, MEM_FAST);
-    // updates[1].buffer = rg_alloc(320 * 240, MEM_FAST);
+    updates[1].buffer = rg_alloc(320 * 240, MEM_FAST);
 
     VRAM = rg_alloc(VRAM_MAX_SIZE, MEM_FAST);
 
-    // rg_task_create("gen_sound", &sound_task, NULL, 2048, 7, 1);
+    if (DUAL_CORE)
+    {
+        render.start = SEM_CREATE();
+        render.posted_sem = SEM_CREATE();
+        render.rendered_sem = SEM_CREATE();
+        // Below the display task, which shares the core and must not wait for a whole frame
+        if (render.start && render.posted_sem && render.rendered_sem && rg_task_create("gen_render", &render_task, NULL, 3 * 1024, 4, 1))
+            gwenesis_vdp_render_wait = &render_wait;
+        else
+            RG_LOGW("Render task creation failed, rendering inline\n");
+
+        sound.queue = rg_alloc(SOUND_QUEUE_LENGTH * sizeof(sound_event_t), MEM_ANY);
+        sound.ring = rg_alloc(SOUND_RING_LENGTH * sizeof(int16_t), MEM_ANY);
+        sound.wakeup = SEM_CREATE();
+        // Above the display task, an audio underrun is more noticeable than a late frame
+        if (sound.wakeup && rg_task_create("gen_sound", &sound_task, NULL, 4 * 1024, 6, 1))
+        {
+            gwenesis_ym2612_queue = &ym2612_queue;
+            gwenesis_sn76489_queue = &sn76489_queue;
+        }
+        else
+            RG_LOGW("Sound task creation failed, synthesizing inline\n");
+    }
     // rg_audio_set_sample_rate(yfm_resample ? 26634 : 53267);
 
     RG_LOGI("Genesis start\n");
 
-    FILE *fp = fopen(app->romPath, "rb");
-    if (!fp)
+    // load_cartridge byteswaps (and maybe de-interleaves) in place, which our private view allows.
+    // It keeps the pointer for the lifetime of the app, so the view is never unmapped.
+    rg_file_map_t *rom = rg_storage_map_file(app->romPath, 0, 0x10000);
+    if (!rom)
         RG_PANIC("Rom load failed");
-    fseek(fp, 0, SEEK_END);
-    size_t rom_size = ftell(fp);
-    void *rom_data = malloc((rom_size & ~0xFFFF) + 0x10000);
-    fseek(fp, 0, SEEK_SET);
-    fread(rom_data, 1, rom_size, fp);
-    fclose(fp);
 
-    RG_LOGI("load_cartridge(%p, %d)\n", rom_data, rom_size);
-    load_cartridge(rom_data, rom_size);
-    // free(rom_data); // load_cartridge takes ownership
+    RG_LOGI("load_cartridge(%p, %d)\n", rom->data, (int)rom->size);
+    load_cartridge(rom->data, rom->size);
 
     RG_LOGI("power_on()\n");
     power_on();
@@ -320,8 +558,8 @@ void app_main(void)
             }
         }
 
-        int64_t startTime = rg_system_timer();
-        bool drawFrame = (frames++ % frameskip) == 0;
+        bool drawFrame = rg_system_frame_begin(frames++ % frameskip != 0);
+        bool threaded = gwenesis_vdp_render_wait != NULL;
 
         int lines_per_frame = REG1_PAL ? LINES_PER_FRAME_PAL : LINES_PER_FRAME_NTSC;
         int hint_counter = gwenesis_vdp_regs[10];
@@ -336,9 +574,19 @@ void app_main(void)
             prev_screen_height = screen_height;
         }
 
+        // The render task is idle at this point, it finished the last frame before we queued it
         gwenesis_vdp_set_buffer(currentUpdate->buffer);
         gwenesis_vdp_render_config();
 
+        if (threaded)
+        {
+            ATOMIC_STORE(&render.posted, 0);
+            ATOMIC_STORE(&render.rendered, 0);
+            render.lines = drawFrame ? screen_height : 0;
+            if (drawFrame)
+                SEM_POST(render.start);
+        }
+
         /* Reset the difference clocks and audio index */
         system_clock = 0;
         zclk = z80_enabled ? 0 : 0x1000000;
@@ -368,7 +616,12 @@ void app_main(void)
 
             /* Video */
             if (drawFrame && scan_line < screen_height)
-                gwenesis_vdp_render_line(scan_line); /* render scan_line */
+            {
+                if (threaded)
+                    render_post(scan_line + 1);
+                else
+                    gwenesis_vdp_render_line(scan_line); /* render scan_line */
+            }
 
             // On these lines, the line counter interrupt is reloaded
             if ((scan_line == 0) || (scan_line > screen_height)) {
@@ -420,17 +673,27 @@ void app_main(void)
 
         if (drawFrame)
         {
+            if (threaded)
+                render_wait();
             for (int i = 0; i < 256; ++i)
                 currentUpdate->palette[i] = (CRAM565[i] << 8) | (CRAM565[i] >> 8);
-            // rg_video_update_t *previousUpdate = &updates[currentUpdate == &updates[0]];
-            rg_display_queue_update(currentUpdate, NULL);
-            // currentUpdate = previousUpdate;
+            rg_display_queue_update(currentUpdate, previousUpdate);
+            previousUpdate = currentUpdate;
+            currentUpdate = rg_display_acquire(updates, 2);
+        }
+
+        if (gwenesis_ym2612_queue)
+        {
+            sound.frames_posted++;
+            sound_queue(SOUND_FRAME, 0, 0, system_clock);
+            sound_wakeup();
         }
 
-        int elapsed = rg_system_timer() - startTime;
-        rg_system_tick(elapsed);
+        rg_system_frame_end(0);
 
-        if (yfm_enabled || z80_enabled) {
+        if (gwenesis_ym2612_queue) {
+            sound_submit();
+        } else if (yfm_enabled || z80_enabled) {
             rg_audio_submit((void *)gwenesis_ym2612_buffer, AUDIO_BUFFER_LENGTH >> 1);
         }
     }
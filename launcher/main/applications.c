@@ -11,18 +11,98 @@
 #include "bookmarks.h"
 #include "gui.h"
 
-#define CRC_CACHE_MAGIC 0x21112222
-#define CRC_CACHE_MAX_ENTRIES 8192
-static struct __attribute__((__packed__))
+// The CRC cache is an open addressing hash table keyed on (name, size, mtime). Updates are appended to
+// a journal that is replayed at boot, and compacted when it has grown well past the live entries.
+// When it's full the CLOCK algorithm picks the entry to evict: the hand skips (and clears) recently
+// used entries, which approximates LRU at a constant cost per insertion.
+#define CRC_CACHE_MAGIC     0x21112223
+#define CRC_CACHE_CAPACITY  8192 // Slots, must be a power of two
+#define CRC_CACHE_MAX_ENTRIES (CRC_CACHE_CAPACITY * 3 / 4)
+#define CRC_CACHE_PATH      RG_BASE_PATH_CACHE "/crc32.log"
+
+typedef struct __attribute__((__packed__))
+{
+    uint32_t name; // rg_crc32() of the file name, 0 marks a free slot
+    uint32_t size;
+    uint32_t mtime;
+    uint32_t crc;
+} crc_cache_entry_t;
+
+static struct
+{
+    crc_cache_entry_t *entries;
+    uint8_t *referenced; // Used since the hand last passed
+    size_t hand;
+    size_t count;
+    size_t journal_count; // Records in the journal, including overwritten ones
+} crc_cache;
+
+// Background CRC computation, done a slice at a time from the idle event. It stays on the UI thread so that
+// it stops at the first button press. Like all tab events it runs with the storage lock held (gui_event).
+static struct
+{
+    retro_app_t *app;
+    size_t index; // In app->files
+    rg_hasher_t *hasher;
+} crc_worker;
+
+static void crc_worker_reset(void)
+{
+    rg_storage_hasher_free(crc_worker.hasher);
+    memset(&crc_worker, 0, sizeof(crc_worker));
+}
+
+// The library index caches what we know about the files: names, types, sizes, mtimes and checksums. Folders
+// are still listed at every boot (see scan_folder), the index spares us the stat and the CRC of the files it
+// already knows, and the size and mtime must match the disk before its checksum is used (see file_check).
+// Its string blob stays loaded for the launcher's lifetime, file names point directly into it.
+// File format: {header} {folder, ...} {file, ...} {strings}
+#define LIBRARY_MAGIC   0x494C4752 // "RGLI"
+#define LIBRARY_VERSION 1
+#define LIBRARY_PATH    RG_BASE_PATH_CACHE "/library_%s.bin"
+
+typedef struct __attribute__((__packed__))
 {
     uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t folders_count;
+    uint32_t files_count;
+    uint32_t strings_size;
+} library_header_t;
+
+typedef struct __attribute__((__packed__))
+{
+    uint32_t path;  // Offset in strings
+    int32_t mtime;
+    uint32_t first; // Index in files
     uint32_t count;
-    struct {
-        uint32_t key;
-        uint32_t crc;
-    } entries[CRC_CACHE_MAX_ENTRIES];
-} *crc_cache;
-static bool crc_cache_dirty = true;
+} library_folder_t;
+
+typedef struct __attribute__((__packed__))
+{
+    uint32_t name;  // Offset in strings
+    uint8_t type;
+    uint8_t reserved[3];
+    int32_t size;
+    int32_t mtime;
+    uint32_t checksum;
+} library_file_t;
+
+typedef struct
+{
+    const library_header_t *header;
+    const library_folder_t *folders;
+    const library_file_t *files;
+    const char *strings;
+    uint32_t *folders_table; // Open addressing hash tables of index + 1, 0 is a free slot
+    uint32_t *files_table;
+    uint32_t folders_mask, files_mask;
+    bool used;
+} library_t;
+
+static char *names_pool;
+static size_t names_pool_left;
 
 static retro_app_t *apps[24];
 static int apps_count = 0;
@@ -36,18 +116,327 @@ static const char *get_file_path(retro_file_t *file)
     return buffer;
 }
 
-static void scan_folder(retro_app_t *app, const char* path, void *parent)
+static const char *names_pool_strdup(const char *str)
 {
-    RG_ASSERT(app && path, "Bad param");
+    // Names are never freed because bookmarks keep pointers to them, the pool saves malloc's overhead
+    size_t len = strlen(str) + 1;
+    if (len > names_pool_left)
+    {
+        names_pool_left = RG_MAX(len, 4096);
+        if (!(names_pool = malloc(names_pool_left)))
+        {
+            names_pool_left = 0;
+            return NULL;
+        }
+    }
+    char *ptr = memcpy(names_pool, str, len);
+    names_pool += len;
+    names_pool_left -= len;
+    return ptr;
+}
+
+static uint32_t library_hash(uint32_t seed, const char *str)
+{
+    uint32_t hash = 0x811C9DC5 ^ (seed * 0x9E3779B1);
+    while (*str)
+        hash = (hash ^ (uint8_t)*str++) * 0x01000193;
+    return hash;
+}
+
+static uint32_t *library_make_table(size_t count, uint32_t *mask)
+{
+    size_t capacity = 16;
+    while (capacity < count * 2)
+        capacity *= 2;
+    *mask = capacity - 1;
+    return calloc(capacity, sizeof(uint32_t));
+}
+
+static bool library_index(library_t *library)
+{
+    const library_header_t *header = library->header;
+
+    library->folders_table = library_make_table(header->folders_count, &library->folders_mask);
+    library->files_table = library_make_table(header->files_count, &library->files_mask);
+    if (!library->folders_table || !library->files_table)
+        return false;
+
+    for (size_t i = 0; i < header->folders_count; i++)
+    {
+        const library_folder_t *folder = &library->folders[i];
+        uint32_t pos = library_hash(0, library->strings + folder->path) & library->folders_mask;
+        while (library->folders_table[pos])
+            pos = (pos + 1) & library->folders_mask;
+        library->folders_table[pos] = i + 1;
+
+        // Files are hashed with their folder, the same name can be in several of them
+        for (size_t j = folder->first; j < folder->first + folder->count; j++)
+        {
+            pos = library_hash(i + 1, library->strings + library->files[j].name) & library->files_mask;
+            while (library->files_table[pos])
+                pos = (pos + 1) & library->files_mask;
+            library->files_table[pos] = j + 1;
+        }
+    }
 
-    RG_LOGI("Scanning directory %s\n", path);
+    return true;
+}
+
+static void library_free(library_t *library)
+{
+    free(library->folders_table);
+    free(library->files_table);
+    // If we kept anything from the index its strings must stay, our file names point to them
+    if (library->header && !library->used)
+        free((void *)library->header);
+    memset(library, 0, sizeof(library_t));
+}
+
+static bool library_load(retro_app_t *app, library_t *library)
+{
+    char path[RG_PATH_MAX];
+    void *data = NULL;
+    size_t size = 0;
+
+    snprintf(path, sizeof(path), LIBRARY_PATH, app->short_name);
+    if (!rg_storage_read_file(path, &data, &size))
+        return false;
+
+    const library_header_t *header = data;
+    if (size < sizeof(*header) || header->magic != LIBRARY_MAGIC || header->version != LIBRARY_VERSION
+        || size != sizeof(*header) + header->folders_count * sizeof(library_folder_t)
+            + header->files_count * sizeof(library_file_t) + header->strings_size
+        || header->strings_size == 0)
+    {
+        RG_LOGW("Library index '%s' is invalid, ignoring it.\n", path);
+        free(data);
+        return false;
+    }
+
+    *library = (library_t){
+        .header = header,
+        .folders = data + sizeof(*header),
+        .files = data + sizeof(*header) + header->folders_count * sizeof(library_folder_t),
+        .strings = data + size - header->strings_size,
+    };
+
+    bool valid = library->strings[header->strings_size - 1] == 0;
+    for (size_t i = 0; i < header->folders_count && valid; i++)
+    {
+        const library_folder_t *folder = &library->folders[i];
+        valid = folder->path < header->strings_size && folder->first + folder->count <= header->files_count;
+    }
+    for (size_t i = 0; i < header->files_count && valid; i++)
+        valid = library->files[i].name < header->strings_size;
+
+    if (!valid)
+    {
+        RG_LOGW("Library index '%s' is corrupted, ignoring it.\n", path);
+        library_free(library);
+        return false;
+    }
+
+    if (!library_index(library))
+    {
+        RG_LOGW("Not enough memory to use the library index.\n");
+        library_free(library);
+        return false;
+    }
+
+    RG_LOGI("Loaded library index (folders: %d, files: %d)\n", (int)header->folders_count, (int)header->files_count);
+    return true;
+}
+
+static bool library_save(retro_app_t *app)
+{
+    char path[RG_PATH_MAX];
+    uint32_t offset = 0;
+    bool success = false;
+
+    snprintf(path, sizeof(path), LIBRARY_PATH, app->short_name);
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        return false;
+
+    library_header_t header = {
+        .magic = LIBRARY_MAGIC,
+        .version = LIBRARY_VERSION,
+        .folders_count = app->folders_count,
+        .files_count = app->files_count,
+    };
+    for (size_t i = 0; i < app->folders_count; i++)
+        header.strings_size += strlen(app->folders[i].path) + 1;
+    for (size_t i = 0; i < app->files_count; i++)
+        header.strings_size += strlen(app->files[i].name) + 1;
+
+    if (!fwrite(&header, sizeof(header), 1, fp))
+        goto _cleanup;
+
+    for (size_t i = 0; i < app->folders_count; i++)
+    {
+        library_folder_t folder = {
+            .path = offset,
+            .mtime = app->folders[i].mtime,
+            .first = app->folders[i].first,
+            .count = app->folders[i].count,
+        };
+        offset += strlen(app->folders[i].path) + 1;
+        if (!fwrite(&folder, sizeof(folder), 1, fp))
+            goto _cleanup;
+    }
+
+    for (size_t i = 0; i < app->files_count; i++)
+    {
+        retro_file_t *file = &app->files[i];
+        library_file_t entry = {
+            .name = offset,
+            // Deleted files are kept until the folder is rescanned, so they must not come back
+            .type = file->is_valid ? file->type : 0xFE,
+            .size = file->size,
+            .mtime = file->mtime,
+            .checksum = file->checksum,
+        };
+        offset += strlen(file->name) + 1;
+        if (!fwrite(&entry, sizeof(entry), 1, fp))
+            goto _cleanup;
+    }
+
+    for (size_t i = 0; i < app->folders_count; i++)
+        if (!fwrite(app->folders[i].path, strlen(app->folders[i].path) + 1, 1, fp))
+            goto _cleanup;
+
+    for (size_t i = 0; i < app->files_count; i++)
+        if (!fwrite(app->files[i].name, strlen(app->files[i].name) + 1, 1, fp))
+            goto _cleanup;
+
+    app->library_dirty = false;
+    success = true;
+
+_cleanup:
+    fclose(fp);
+    if (!success)
+    {
+        RG_LOGE("Failed to save library index '%s'\n", path);
+        unlink(path);
+    }
+    return success;
+}
+
+static const library_folder_t *library_find_folder(library_t *library, const char *path)
+{
+    if (!library || !library->header)
+        return NULL;
+
+    uint32_t pos = library_hash(0, path) & library->folders_mask;
+    for (uint32_t index; (index = library->folders_table[pos]); pos = (pos + 1) & library->folders_mask)
+    {
+        const library_folder_t *folder = &library->folders[index - 1];
+        if (strcmp(library->strings + folder->path, path) == 0)
+            return folder;
+    }
+    return NULL;
+}
+
+static const library_file_t *library_find_file(library_t *library, const library_folder_t *folder, const char *name)
+{
+    uint32_t seed = folder - library->folders + 1;
+    uint32_t pos = library_hash(seed, name) & library->files_mask;
+    for (uint32_t index; (index = library->files_table[pos]); pos = (pos + 1) & library->files_mask)
+    {
+        const library_file_t *file = &library->files[index - 1];
+        if (index - 1 >= folder->first && index - 1 < folder->first + folder->count
+            && strcmp(library->strings + file->name, name) == 0)
+            return file;
+    }
+    return NULL;
+}
+
+// The size, mtime and checksum that came from the index are only trusted once a stat() agrees with them.
+// It's done the first time the file is used rather than during the scan, a stat() per file is slow on FAT.
+static bool file_check(retro_file_t *file)
+{
+    struct stat st;
+
+    if (file->checked)
+        return true;
+
+    if (stat(get_file_path(file), &st) != 0)
+        return false;
+
+    if (file->size != st.st_size || file->mtime != st.st_mtime)
+    {
+        file->size = st.st_size;
+        file->mtime = st.st_mtime;
+        file->checksum = 0;
+        file->missing_cover = 0;
+        file->app->library_dirty = true;
+    }
+    file->checked = true;
+    return true;
+}
+
+static bool add_file(retro_app_t *app, retro_file_t file)
+{
+    if (app->files_count + 1 > app->files_capacity)
+    {
+        size_t new_capacity = app->files_capacity * 1.5;
+        retro_file_t *new_buf = realloc(app->files, new_capacity * sizeof(retro_file_t));
+        if (!new_buf)
+        {
+            RG_LOGW("Ran out of memory, file scanning stopped at %d entries ...\n", app->files_count);
+            return false;
+        }
+        app->files = new_buf;
+        app->files_capacity = new_capacity;
+    }
+    app->files[app->files_count++] = file;
+    return true;
+}
+
+static bool add_folder(retro_app_t *app, const char *path, int32_t mtime, size_t first)
+{
+    if (app->folders_count + 1 > app->folders_capacity)
+    {
+        size_t new_capacity = app->folders_capacity * 1.5 + 8;
+        void *new_buf = realloc(app->folders, new_capacity * sizeof(*app->folders));
+        if (!new_buf)
+            return false;
+        app->folders = new_buf;
+        app->folders_capacity = new_capacity;
+    }
+    app->folders[app->folders_count].path = path;
+    app->folders[app->folders_count].mtime = mtime;
+    app->folders[app->folders_count].first = first;
+    app->folders[app->folders_count].count = app->files_count - first;
+    app->folders_count++;
+    return true;
+}
+
+static void scan_folder(retro_app_t *app, const char *path, library_t *library)
+{
+    RG_ASSERT(app && path, "Bad param");
 
     const char *folder = const_string(path);
-    rg_scandir_t *files = rg_storage_scandir(path, NULL, false);
+    const library_folder_t *cached = library_find_folder(library, folder);
+    size_t first = app->files_count;
+    struct stat st;
+
+    // FAT only updates a folder's mtime when the folder itself is renamed or created, not when its
+    // content changes. So the folder is always listed, the index only spares us the stat and the CRC
+    // of the files it already knows. A changed mtime or list of names means the index must be saved.
+    int32_t mtime = stat(folder, &st) == 0 ? st.st_mtime : 0;
+    bool changed = !cached || cached->mtime != mtime || mtime == 0;
+
+    if (!cached)
+        RG_LOGI("Scanning directory %s\n", folder);
+
+    // No RG_SCANDIR_STAT, a stat() per file is quadratic on FAT. Size and mtime get filled when known.
+    rg_scandir_t *files = rg_storage_scandir(folder, NULL, 0);
     char ext_buf[32];
 
-    for (rg_scandir_t *entry = files; entry && entry->is_valid; ++entry)
+    for (size_t i = 0; files && i < files->count; ++i)
     {
+        rg_scandir_entry_t *entry = &files->entries[i];
         const char *ext = rg_extension(entry->name);
         uint8_t is_valid = false;
         uint8_t type = 0x00;
@@ -67,63 +456,124 @@ static void scan_folder(retro_app_t *app, const char* path, void *parent)
         if (!is_valid)
             continue;
 
-        if (app->files_count + 1 > app->files_capacity)
-        {
-            size_t new_capacity = app->files_capacity * 1.5;
-            retro_file_t *new_buf = realloc(app->files, new_capacity * sizeof(retro_file_t));
-            if (!new_buf)
-            {
-                RG_LOGW("Ran out of memory, file scanning stopped at %d entries ...\n", app->files_count);
-                break;
-            }
-            app->files = new_buf;
-            app->files_capacity = new_capacity;
-        }
-
-        app->files[app->files_count++] = (retro_file_t) {
-            .name = strdup(entry->name),
+        const library_file_t *known = cached ? library_find_file(library, cached, entry->name) : NULL;
+        retro_file_t file = {
             .folder = folder,
+            .size = entry->size,
+            .mtime = entry->mtime,
             .app = (void*)app,
             .type = type,
             .is_valid = true,
         };
 
-        if (type == 0xFF)
+        // Still unchecked, file_check() compares them with the disk before the checksum is used
+        if (known && known->type == type)
         {
-            retro_file_t *file = &app->files[app->files_count-1];
-            scan_folder(app, get_file_path(file), file);
+            file.name = library->strings + known->name;
+            file.checksum = known->checksum;
+            file.size = known->size;
+            file.mtime = known->mtime;
+            library->used = true;
         }
+        else
+        {
+            file.name = names_pool_strdup(entry->name);
+            changed = true;
+        }
+
+        if (!file.name || !add_file(app, file))
+            break;
     }
 
     free(files);
+
+    // Files that disappeared don't show up in the loop above, only in the count
+    if (cached && !changed)
+    {
+        size_t count = 0;
+        for (size_t i = cached->first; i < cached->first + cached->count; i++)
+            count += (library->files[i].type == 0x00 || library->files[i].type == 0xFF);
+        changed = count != app->files_count - first;
+    }
+
+    if (changed)
+        app->library_dirty = true;
+
+    add_folder(app, folder, mtime, first);
+
+    // Subfolders come after all of our files, to keep them contiguous in the index
+    size_t last = app->files_count;
+    for (size_t i = first; i < last; i++)
+    {
+        if (app->files[i].type == 0xFF)
+            scan_folder(app, get_file_path(&app->files[i]), library);
+    }
 }
 
 static void application_init(retro_app_t *app)
 {
     RG_LOGI("Initializing application '%s' (%s)\n", app->description, app->partition);
 
-    if (app->initialized)
-        app->files_count = 0;
+    library_t library = {0};
+    size_t folders_count = app->folders_count;
+
+    // A re-init means something changed behind our back (web interface, etc), don't trust the index
+    if (app->initialized || app->rescan)
+    {
+        folders_count = 0;
+        app->library_dirty = true;
+    }
+    else if (library_load(app, &library))
+    {
+        folders_count = library.header->folders_count;
+    }
+
+    if (crc_worker.app == app)
+        crc_worker_reset();
+
+    app->files_count = 0;
+    app->folders_count = 0;
+    app->rescan = false;
+    app->crc_scan_done = false;
 
     // This checks if we have crc cover folders, the idea is to skip the crc later on if we don't!
     // It adds very little delay but it could become an issue if someone has thousands of named files...
-    rg_scandir_t *files = rg_storage_scandir(app->paths.covers, NULL, false);
+    rg_scandir_t *files = rg_storage_scandir(app->paths.covers, NULL, 0);
     if (!files)
         rg_storage_mkdir(app->paths.covers);
     else
     {
-        for (rg_scandir_t *entry = files; entry->is_valid && !app->use_crc_covers; ++entry)
-            app->use_crc_covers = entry->name[1] == 0 && isalnum(entry->name[0]);
+        for (size_t i = 0; i < files->count && !app->use_crc_covers; ++i)
+            app->use_crc_covers = files->entries[i].name[1] == 0 && isalnum(files->entries[i].name[0]);
         free(files);
     }
 
     rg_storage_mkdir(app->paths.saves);
     rg_storage_mkdir(app->paths.roms);
-    scan_folder(app, app->paths.roms, 0);
+    scan_folder(app, app->paths.roms, &library);
+
+    // Folders that disappeared don't trigger a rescan of anything, but the index must forget them
+    if (app->folders_count != folders_count)
+        app->library_dirty = true;
+
+    if (app->library_dirty)
+    {
+        rg_storage_mkdir(RG_BASE_PATH_CACHE);
+        library_save(app);
+    }
+
+    library_free(&library);
 
     app->initialized = true;
 }
 
+void applications_rescan(void)
+{
+    for (int i = 0; i < apps_count; i++)
+        apps[i]->rescan = true;
+    gui_invalidate();
+}
+
 static void application_start(retro_file_t *file, int load_state)
 {
     RG_ASSERT(file, "Unable to find file...");
@@ -140,165 +590,291 @@ static void application_start(retro_file_t *file, int load_state)
     rg_system_switch_app(part, name, path, flags);
 }
 
+static size_t crc_cache_slot(const crc_cache_entry_t *entry)
+{
+    uint32_t hash = entry->name ^ (entry->size * 0x9E3779B1) ^ (entry->mtime * 0x85EBCA77);
+    return (hash ^ (hash >> 15)) & (CRC_CACHE_CAPACITY - 1);
+}
+
+static size_t crc_cache_find(const crc_cache_entry_t *key)
+{
+    size_t index = crc_cache_slot(key);
+    while (crc_cache.entries[index].name)
+    {
+        const crc_cache_entry_t *entry = &crc_cache.entries[index];
+        if (entry->name == key->name && entry->size == key->size && entry->mtime == key->mtime)
+            break;
+        index = (index + 1) & (CRC_CACHE_CAPACITY - 1);
+    }
+    return index;
+}
+
+static void crc_cache_remove(size_t index)
+{
+    // Backward shift deletion, so that the probe sequences stay unbroken without tombstones
+    size_t next = index;
+    crc_cache.entries[index].name = 0;
+    crc_cache.count--;
+    while (true)
+    {
+        next = (next + 1) & (CRC_CACHE_CAPACITY - 1);
+        if (!crc_cache.entries[next].name)
+            break;
+        size_t home = crc_cache_slot(&crc_cache.entries[next]);
+        bool stays = index <= next ? (index < home && home <= next) : (index < home || home <= next);
+        if (stays)
+            continue;
+        crc_cache.entries[index] = crc_cache.entries[next];
+        crc_cache.referenced[index] = crc_cache.referenced[next];
+        crc_cache.entries[next].name = 0;
+        index = next;
+    }
+}
+
+static void crc_cache_insert(const crc_cache_entry_t *entry)
+{
+    size_t index = crc_cache_find(entry);
+
+    if (!crc_cache.entries[index].name && crc_cache.count >= CRC_CACHE_MAX_ENTRIES)
+    {
+        size_t victim;
+        while (true)
+        {
+            victim = crc_cache.hand;
+            crc_cache.hand = (crc_cache.hand + 1) & (CRC_CACHE_CAPACITY - 1);
+            if (!crc_cache.entries[victim].name)
+                continue;
+            if (!crc_cache.referenced[victim])
+                break;
+            crc_cache.referenced[victim] = 0;
+        }
+        crc_cache_remove(victim);
+        index = crc_cache_find(entry);
+    }
+
+    if (!crc_cache.entries[index].name)
+        crc_cache.count++;
+    crc_cache.entries[index] = *entry;
+    crc_cache.referenced[index] = 1;
+}
+
+static bool crc_cache_make_key(retro_file_t *file, crc_cache_entry_t *key)
+{
+    // The key must describe the file on disk, not what the library index remembers of it. A ROM replaced
+    // under the same name gets a different key, and file_check() forgets the checksum it had.
+    if (!file_check(file))
+        return false;
+
+    *key = (crc_cache_entry_t){
+        .name = rg_crc32(0, (void *)file->name, strlen(file->name)) ?: 1,
+        .size = file->size,
+        .mtime = file->mtime,
+    };
+    return true;
+}
+
 static void crc_cache_init(void)
 {
-    crc_cache = calloc(1, sizeof(*crc_cache));
-    if (!crc_cache)
+    crc_cache.entries = calloc(CRC_CACHE_CAPACITY, sizeof(crc_cache_entry_t));
+    crc_cache.referenced = calloc(CRC_CACHE_CAPACITY, sizeof(uint8_t));
+    if (!crc_cache.entries || !crc_cache.referenced)
     {
         RG_LOGE("Failed to allocate crc_cache!\n");
+        free(crc_cache.entries);
+        free(crc_cache.referenced);
+        crc_cache.entries = NULL;
         return;
     }
-    // File format: {magic:U32 count:U32} {{key:U32 crc:U32}, ...}
-    FILE *fp = fopen(RG_BASE_PATH_CACHE"/crc32.bin", "rb");
-    if (fp)
+
+    // File format: {magic:U32 version:U32} {{name:U32 size:U32 mtime:U32 crc:U32}, ...}
+    void *data = NULL;
+    size_t size = 0;
+    if (rg_storage_read_file(CRC_CACHE_PATH, &data, &size) && size >= 8 && *(uint32_t *)data == CRC_CACHE_MAGIC)
     {
-        fread(crc_cache, 8, 1, fp);
-        if (crc_cache->magic == CRC_CACHE_MAGIC && crc_cache->count <= CRC_CACHE_MAX_ENTRIES)
-        {
-            RG_LOGI("Loaded CRC cache (entries: %d)\n", crc_cache->count);
-            fread(crc_cache->entries, crc_cache->count, 8, fp);
-            crc_cache_dirty = false;
-        }
-        else
+        const crc_cache_entry_t *records = data + 8;
+        crc_cache.journal_count = (size - 8) / sizeof(crc_cache_entry_t);
+        // Replaying in order also restores the eviction order, roughly
+        for (size_t i = 0; i < crc_cache.journal_count; i++)
         {
-            crc_cache->count = 0;
+            if (records[i].name)
+                crc_cache_insert(&records[i]);
         }
-        fclose(fp);
+        RG_LOGI("Loaded CRC cache (entries: %d, journal: %d)\n", (int)crc_cache.count, (int)crc_cache.journal_count);
     }
-}
+    free(data);
 
-static uint32_t crc_cache_calc_key(retro_file_t *file)
-{
-    // return ((uint64_t)rg_crc32(0, (void *)file->name, strlen(file->name)) << 33 | file->size);
-    // This should be reasonably unique
-    return rg_crc32(0, (void *)file->name, strlen(file->name));
+    // The old cache was keyed on the name alone, it can't be converted
+    unlink(RG_BASE_PATH_CACHE "/crc32.bin");
 }
 
 static uint32_t crc_cache_lookup(retro_file_t *file)
 {
-    uint32_t key = crc_cache_calc_key(file);
+    crc_cache_entry_t key;
 
-    if (!crc_cache)
+    if (!crc_cache.entries || !crc_cache_make_key(file, &key))
         return 0;
 
-    for (int i = 0; i < crc_cache->count; i++)
-    {
-        if (crc_cache->entries[i].key == key)
-            return crc_cache->entries[i].crc;
-    }
+    size_t index = crc_cache_find(&key);
+    if (!crc_cache.entries[index].name)
+        return 0;
 
-    return 0;
+    crc_cache.referenced[index] = 1;
+    return crc_cache.entries[index].crc;
 }
 
 static void crc_cache_save(void)
 {
-    if (!crc_cache || !crc_cache_dirty)
+    // The journal is always up to date, we only rewrite it when it's mostly overwritten records
+    if (!crc_cache.entries || crc_cache.journal_count < crc_cache.count * 2 + 256)
         return;
 
-    RG_LOGI("Saving cache\n");
+    // In the order the hand would evict them, unreferenced first, so that replaying it keeps the order
+    size_t count = 0;
+    crc_cache_entry_t *records = malloc(crc_cache.count * sizeof(crc_cache_entry_t));
+    if (!records)
+        return;
 
-    FILE *fp = fopen(RG_BASE_PATH_CACHE"/crc32.bin", "wb");
+    for (int referenced = 0; referenced < 2; referenced++)
+    {
+        for (size_t i = 0; i < CRC_CACHE_CAPACITY; i++)
+        {
+            size_t index = (crc_cache.hand + i) & (CRC_CACHE_CAPACITY - 1);
+            if (crc_cache.entries[index].name && crc_cache.referenced[index] == referenced)
+                records[count++] = crc_cache.entries[index];
+        }
+    }
+
+    FILE *fp = fopen(CRC_CACHE_PATH, "wb");
     if (fp)
     {
-        size_t minsize = RG_MIN(8 + (crc_cache->count * sizeof(crc_cache->entries[0])), sizeof(*crc_cache));
-        fwrite(crc_cache, minsize, 1, fp);
+        uint32_t header[2] = {CRC_CACHE_MAGIC, 1};
+        if (fwrite(header, sizeof(header), 1, fp) && (!count || fwrite(records, count * sizeof(*records), 1, fp)))
+            crc_cache.journal_count = count;
         fclose(fp);
-        crc_cache_dirty = false;
+        RG_LOGI("CRC cache compacted (entries: %d)\n", (int)count);
     }
+
+    free(records);
 }
 
 static void crc_cache_update(retro_file_t *file)
 {
-    uint32_t key = crc_cache_calc_key(file);
-    size_t index = 0;
+    crc_cache_entry_t entry;
 
-    if (!crc_cache)
+    // A zero checksum means unknown (empty file), it couldn't be told apart from a miss anyway
+    if (!crc_cache.entries || !file->checksum || !crc_cache_make_key(file, &entry))
         return;
 
-    if (crc_cache->count < CRC_CACHE_MAX_ENTRIES)
-        index = crc_cache->count++;
-    else
-        index = rand() % CRC_CACHE_MAX_ENTRIES;
-
-    crc_cache->magic = CRC_CACHE_MAGIC;
-    crc_cache->entries[index].key = key;
-    crc_cache->entries[index].crc = file->checksum;
-    crc_cache_dirty = true;
+    entry.crc = file->checksum;
+    crc_cache_insert(&entry);
 
-    RG_LOGI("Adding %08X => %08X to cache (new total: %d)\n",
-        key, file->checksum, crc_cache->count);
+    FILE *fp = fopen(CRC_CACHE_PATH, crc_cache.journal_count ? "ab" : "wb");
+    if (fp)
+    {
+        uint32_t header[2] = {CRC_CACHE_MAGIC, 1};
+        if (crc_cache.journal_count == 0)
+            fwrite(header, sizeof(header), 1, fp);
+        if (fwrite(&entry, sizeof(entry), 1, fp))
+            crc_cache.journal_count++;
+        fclose(fp);
+    }
 
-    // crc_cache_save();
+    RG_LOGD("CRC cache updated: name=%08X size=%d crc=%08X (entries: %d)\n",
+        (unsigned)entry.name, (int)entry.size, (unsigned)entry.crc, (int)crc_cache.count);
 }
 
-void crc_cache_idle_task(tab_t *tab)
+static bool crc_worker_next_file(tab_t *tab, int64_t deadline)
 {
-    // FIXME: Disabled for now because it interferes with the webserver...
-    return;
-
-    if (!crc_cache)
-        return;
+    // The focused app goes first, its covers are the ones being looked at
+    retro_app_t *focused = NULL;
+    for (int i = 0; i < apps_count; i++)
+    {
+        if (tab && tab->arg == apps[i])
+            focused = apps[i];
+    }
 
-    if (crc_cache->count < CRC_CACHE_MAX_ENTRIES)
+    for (int i = -1; i < apps_count; i++)
     {
-        int start_offset = 0;
-        int remaining = 100;
+        retro_app_t *app = i < 0 ? focused : apps[i];
 
-        // Find the currently focused app, if any
-        for (int i = 0; i < apps_count; i++)
-        {
-            if (tab && tab->arg == apps[i])
-            {
-                start_offset = i;
-                break;
-            }
-        }
+        if (!app || !app->initialized || !app->use_crc_covers || app->crc_scan_done)
+            continue;
+
+        if (crc_worker.app != app)
+            crc_worker.index = 0;
+        crc_worker.app = app;
 
-        for (int i = 0; i < apps_count && remaining > 0; i++)
+        for (; crc_worker.index < app->files_count; crc_worker.index++)
         {
-            retro_app_t *app = apps[(start_offset + i) % apps_count];
-            int processed = 0;
+            retro_file_t *file = &app->files[crc_worker.index];
 
-            if (!app->available || app->crc_scan_done)
+            if (!file->is_valid || file->type != 0x00 || (file->checked && file->checksum))
                 continue;
 
-            gui_set_status(tab, "BUILDING CACHE...", "SCANNING");
-            gui_redraw(); // gui_draw_status(tab);
+            // Every file is stat'ed once, a large folder could take a while
+            if (rg_system_timer() > deadline)
+                return false;
 
-            if (!app->initialized)
-                application_init(app);
-
-            if ((gui.joystick |= rg_input_read_gamepad()))
-                remaining = -1;
+            // The index's checksum is fine if the file didn't change
+            if (!file_check(file) || file->checksum)
+                continue;
 
-            for (int j = 0; j < app->files_count && remaining > 0; j++)
+            if ((file->checksum = crc_cache_lookup(file)))
             {
-                retro_file_t *file = &app->files[j];
+                app->library_dirty = true;
+                continue;
+            }
 
-                if (file->checksum == 0)
-                    file->checksum = crc_cache_lookup(file);
+            if (!crc_worker.hasher && !(crc_worker.hasher = rg_storage_hasher_create(0)))
+                return false;
 
-                if (file->checksum == 0 && application_get_file_crc32(file))
-                {
-                    processed++;
-                    remaining--;
-                }
+            if (rg_storage_hasher_open(crc_worker.hasher, get_file_path(file), app->crc_offset))
+                return true;
+        }
 
-                // Give up on any button press to improve responsiveness
-                if ((gui.joystick |= rg_input_read_gamepad()))
-                    remaining = -1;
-            }
+        app->crc_scan_done = true;
+        crc_worker.app = NULL;
+    }
 
-            if (processed == 0 && remaining != -1)
-                app->crc_scan_done = true;
+    return false;
+}
+
+void crc_cache_idle_task(tab_t *tab)
+{
+    // The web interface owns the SD card while it works, and the user always comes first
+    if (!crc_cache.entries || gui.http_lock || gui.joystick)
+        return;
+
+    int64_t deadline = rg_system_timer() + 20000;
+
+    while (rg_system_timer() < deadline)
+    {
+        if ((!crc_worker.hasher || !crc_worker.hasher->fp) && !crc_worker_next_file(tab, deadline))
+            break;
+
+        if ((gui.joystick |= rg_input_read_gamepad()))
+            break;
 
-            gui_set_status(tab, "", "");
-            gui_redraw(); // gui_draw_status(tab);
-            rg_system_tick(0);
+        retro_app_t *app = crc_worker.app;
+        int ret = rg_storage_hasher_step(crc_worker.hasher);
+
+        if (ret <= 0)
+        {
+            // The file list might have been rebuilt under us, only trust what we can verify
+            if (ret == 0 && crc_worker.index < app->files_count)
+            {
+                retro_file_t *file = &app->files[crc_worker.index];
+                file->checksum = crc_worker.hasher->crc;
+                app->library_dirty = true;
+                crc_cache_update(file);
+            }
+            crc_worker.index++;
         }
     }
 
-    crc_cache_save();
+    // Nothing left to hash, give the buffer back
+    if (!crc_worker.app)
+        crc_worker_reset();
 }
 
 static void tab_refresh(tab_t *tab)
@@ -409,7 +985,7 @@ static void event_handler(gui_event_t event, tab_t *tab)
     {
         if (file && !tab->preview && gui.browse && gui.idle_counter == 1)
             gui_load_preview(tab);
-        else if ((gui.idle_counter % 100) == 0)
+        else if (gui.idle_counter > 10)
             crc_cache_idle_task(tab);
     }
     else if (event == TAB_ACTION)
@@ -475,14 +1051,18 @@ bool application_path_to_file(const char *path, retro_file_t *file)
     return false;
 }
 
+bool application_check_file(retro_file_t *file)
+{
+    return file && file_check(file);
+}
+
 bool application_get_file_crc32(retro_file_t *file)
 {
-    uint8_t buffer[0x800];
+    rg_hasher_t *hasher;
     uint32_t crc_tmp = 0;
-    int count = -1;
-    FILE *fp;
+    int ret = -1;
 
-    if (file == NULL)
+    if (file == NULL || !file_check(file))
         return false;
 
     if (file->checksum > 0)
@@ -498,29 +1078,31 @@ bool application_get_file_crc32(retro_file_t *file)
         gui_set_status(tab, NULL, "CRC32...");
         gui_redraw(); // gui_draw_status(tab);
 
-        if ((fp = fopen(get_file_path(file), "rb")))
-        {
-            fseek(fp, file->app->crc_offset, SEEK_SET);
+        // The worker's hasher is reused when it has one, its buffer is the biggest allocation here
+        if (!(hasher = crc_worker.hasher))
+            hasher = rg_storage_hasher_create(0);
 
-            while (count != 0)
+        if (hasher && rg_storage_hasher_open(hasher, get_file_path(file), file->app->crc_offset))
+        {
+            // Give up on any button press to improve responsiveness
+            while ((ret = rg_storage_hasher_step(hasher)) > 0)
             {
-                // Give up on any button press to improve responsiveness
                 if ((gui.joystick = rg_input_read_gamepad()))
                     break;
-
-                count = fread(buffer, 1, sizeof(buffer), fp);
-                crc_tmp = rg_crc32(crc_tmp, buffer, count);
             }
+            rg_storage_hasher_close(hasher);
 
-            if (feof(fp))
+            if (ret == 0)
             {
-                file->checksum = crc_tmp;
+                file->checksum = hasher->crc;
+                file->app->library_dirty = true;
                 crc_cache_update(file);
             }
-
-            fclose(fp);
         }
 
+        if (hasher != crc_worker.hasher)
+            rg_storage_hasher_free(hasher);
+
         gui_set_status(tab, NULL, "");
         gui_redraw(); // gui_draw_status(tab);
     }
@@ -553,6 +1135,15 @@ static void show_file_info(retro_file_t *file)
 
     sprintf(filesize, "%ld KB", st.st_size / 1024);
 
+    if (file->size != st.st_size || file->mtime != st.st_mtime)
+    {
+        file->size = st.st_size;
+        file->mtime = st.st_mtime;
+        file->checksum = 0;
+        file->app->library_dirty = true;
+    }
+    file->checked = true;
+
     while (true) // We loop in case we need to update the CRC
     {
         if (file->checksum)
@@ -571,6 +1162,14 @@ static void show_file_info(retro_file_t *file)
                     bookmark_remove(BOOK_TYPE_FAVORITE, file);
                     bookmark_remove(BOOK_TYPE_RECENT, file);
                     file->is_valid = false;
+                    // `file` may be a bookmark's copy, the library must forget it too
+                    for (size_t i = 0; i < file->app->files_count; i++)
+                    {
+                        retro_file_t *entry = &file->app->files[i];
+                        if (entry->folder == file->folder && strcmp(entry->name, file->name) == 0)
+                            entry->is_valid = false;
+                    }
+                    library_save(file->app); // FAT won't tell us that the folder changed
                     gui_event(TAB_REFRESH, gui_get_current_tab());
                     return;
                 }
@@ -612,6 +1211,8 @@ void application_show_file_menu(retro_file_t *file, bool advanced)
         /* fallthrough */
     case 1:
         crc_cache_save();
+        if (file->app->library_dirty)
+            library_save(file->app);
         gui_save_config();
         application_start(file, slot);
         break;
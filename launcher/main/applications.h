@@ -12,9 +12,12 @@ typedef struct
     const char *name;
     const char *folder;
     uint32_t checksum;
+    int32_t size;
+    int32_t mtime;
     uint16_t missing_cover;
     uint8_t type;
     uint8_t is_valid;
+    uint8_t checked; // size and mtime were compared with the disk, see application_check_file()
     retro_app_t *app;
 } retro_file_t;
 
@@ -33,6 +36,16 @@ typedef struct retro_app_s
     retro_file_t *files;
     size_t files_capacity;
     size_t files_count;
+    struct {
+        const char *path;
+        int32_t mtime;
+        uint32_t first; // A folder's files are contiguous in `files`
+        uint32_t count;
+    } *folders;
+    size_t folders_capacity;
+    size_t folders_count;
+    bool library_dirty;
+    bool rescan;
     bool use_crc_covers;
     bool crc_scan_done;
     bool initialized;
@@ -42,7 +55,9 @@ typedef struct retro_app_s
 typedef struct tab_s tab_t;
 
 void applications_init(void);
+void applications_rescan(void);
 void application_show_file_menu(retro_file_t *file, bool simplified);
 bool application_get_file_crc32(retro_file_t *file);
+bool application_check_file(retro_file_t *file);
 bool application_path_to_file(const char *path, retro_file_t *out_file);
 void crc_cache_idle_task(tab_t *tab);
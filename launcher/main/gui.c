@@ -4,6 +4,7 @@
 #include <dirent.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "applications.h"
 #include "gui.h"
@@ -15,6 +16,51 @@
 
 retro_gui_t gui;
 
+// Previews are decoded by a background task, the UI thread only resolves paths and picks up the results.
+// Decoded and downscaled previews are kept in a memory bounded LRU, and PNGs are also saved as raw RGB565
+// thumbnails so that coming back to a game later skips the decoding entirely.
+#define PREVIEW_QUEUE_SIZE  8   // Both ring buffers
+#define PREVIEW_CACHE_SIZE  32  // Entries, the memory budget usually runs out first
+#define PREVIEW_PREFETCH    2   // Items before and after the cursor
+#define PREVIEW_THUMBS_PATH RG_BASE_PATH_CACHE "/thumbs"
+
+#define ATOMIC_LOAD(ptr)        __atomic_load_n(ptr, __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE(ptr, val)  __atomic_store_n(ptr, val, __ATOMIC_SEQ_CST)
+#define ATOMIC_CAS(ptr, exp, val)   __atomic_compare_exchange_n(ptr, exp, val, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+typedef struct
+{
+    uint32_t key;
+    uint32_t generation;
+    uint8_t types[4]; // Candidates in order of preference, 0 = none
+    bool partial; // Candidates that need an unknown CRC were left out, only a found image is final
+    char paths[4][RG_PATH_MAX + 1];
+} preview_request_t;
+
+typedef struct
+{
+    uint32_t key;
+    uint32_t lastuse;
+    uint16_t missing; // Same as retro_file_t.missing_cover
+    uint16_t errors;
+    rg_image_t *img; // NULL if no image was found
+} preview_entry_t;
+
+static struct
+{
+    preview_request_t *requests; // Written by the UI thread
+    preview_entry_t results[PREVIEW_QUEUE_SIZE]; // Written by the worker
+    uint32_t requests_head, requests_tail;
+    uint32_t results_head, results_tail;
+    uint32_t generation;
+    uint32_t current; // Key of the selected item while we wait for it
+    tab_t *current_tab;
+    // Only the UI thread touches the cache
+    preview_entry_t cache[PREVIEW_CACHE_SIZE];
+    size_t cache_size, cache_budget;
+    uint32_t clock;
+} previews;
+
 #define SETTING_SELECTED_TAB    "SelectedTab"
 #define SETTING_START_SCREEN    "StartScreen"
 #define SETTING_STARTUP_MODE    "StartupMode"
@@ -54,8 +100,11 @@ void gui_init(void)
 
 void gui_event(gui_event_t event, tab_t *tab)
 {
+    // Tabs scan folders, hash files and start games, the preview task must wait for them
+    rg_storage_lock();
     if (tab && tab->event_handler)
         (*tab->event_handler)(event, tab);
+    rg_storage_unlock();
 }
 
 tab_t *gui_add_tab(const char *name, const char *desc, void *arg, void *event_handler)
@@ -499,62 +548,246 @@ void gui_set_preview(tab_t *tab, rg_image_t *preview)
     tab->preview = preview;
 }
 
-void gui_load_preview(tab_t *tab)
+static uint32_t preview_key(const retro_file_t *file)
 {
-    listbox_item_t *item = gui_get_selected_item(tab);
-    bool show_missing_cover = false;
-    char path[RG_PATH_MAX + 1];
-    size_t path_len;
-    uint32_t order;
+    uint32_t key = rg_crc32(gui.show_preview, (const uint8_t *)file->folder, strlen(file->folder));
+    return rg_crc32(key, (const uint8_t *)file->name, strlen(file->name)) ?: 1;
+}
 
-    gui_set_preview(tab, NULL);
+static preview_entry_t *preview_cache_find(uint32_t key)
+{
+    for (size_t i = 0; i < PREVIEW_CACHE_SIZE; i++)
+    {
+        if (previews.cache[i].key == key)
+            return &previews.cache[i];
+    }
+    return NULL;
+}
 
-    if (!item || !item->arg)
-        return;
+static void preview_cache_insert(const preview_entry_t *entry)
+{
+    size_t size = entry->img ? entry->img->width * entry->img->height * 2 : 0;
+    preview_entry_t *slot = preview_cache_find(entry->key);
+
+    // A prefetch and a request for the same item can both complete
+    if (slot)
+    {
+        previews.cache_size -= slot->img ? slot->img->width * slot->img->height * 2 : 0;
+        rg_image_free(slot->img);
+        memset(slot, 0, sizeof(preview_entry_t));
+    }
+
+    // Evict the least recently used previews until there is room
+    while (true)
+    {
+        preview_entry_t *oldest = NULL;
+        slot = NULL;
+        for (size_t i = 0; i < PREVIEW_CACHE_SIZE; i++)
+        {
+            preview_entry_t *e = &previews.cache[i];
+            if (!e->key)
+                slot = slot ?: e;
+            else if (!oldest || e->lastuse < oldest->lastuse)
+                oldest = e;
+        }
+        if (!oldest || (slot && previews.cache_size + size <= previews.cache_budget))
+            break;
+        if (oldest->img)
+            previews.cache_size -= oldest->img->width * oldest->img->height * 2;
+        rg_image_free(oldest->img);
+        memset(oldest, 0, sizeof(preview_entry_t));
+    }
+
+    *slot = *entry;
+    slot->lastuse = ++previews.clock;
+    previews.cache_size += size;
+}
+
+// The UI thread uses the storage too, we only hold the lock while reading. Decoding doesn't need it.
+static void *preview_read(const char *path, size_t *size)
+{
+    void *data = NULL;
+    rg_storage_lock();
+    bool success = rg_storage_read_file(path, &data, size);
+    rg_storage_unlock();
+    return success ? data : NULL;
+}
+
+static rg_image_t *preview_decode(const char *path, bool *error)
+{
+    char thumb_path[RG_PATH_MAX + 1];
+    struct stat st, thumb_st;
+    rg_image_t *img = NULL;
+    size_t size = 0;
+    void *data;
+
+    snprintf(thumb_path, RG_PATH_MAX, "%s/%08X.565", PREVIEW_THUMBS_PATH, (unsigned)rg_crc32(0, (const uint8_t *)path, strlen(path)));
+
+    rg_storage_lock();
+    bool found = stat(path, &st) == 0;
+    bool have_thumb = found && stat(thumb_path, &thumb_st) == 0 && thumb_st.st_mtime >= st.st_mtime;
+    rg_storage_unlock();
+
+    if (!found)
+        return NULL;
+
+    // Thumbnails are raw RGB565, which rg_image_load_from_memory() takes without decoding anything. A truncated
+    // one (power loss, full card) is just ignored, the image gets decoded again and the thumbnail rewritten.
+    if (have_thumb && (data = preview_read(thumb_path, &size)))
+    {
+        const uint16_t *header = data;
+        if (size >= 16 && size == 4 + header[0] * header[1] * 2)
+            img = rg_image_load_from_memory(data, size, 0);
+        free(data);
+        if (img)
+            return img;
+    }
+
+    if ((data = preview_read(path, &size)) && size >= 16)
+        img = rg_image_load_from_memory(data, size, 0);
+    free(data);
+
+    if (!img)
+    {
+        *error = true;
+        return NULL;
+    }
+
+    // Downscale to what will actually be drawn, keeping the aspect ratio
+    float scale = RG_MIN((float)PREVIEW_WIDTH / img->width, (float)PREVIEW_HEIGHT / img->height);
+    if (scale < 1.f)
+    {
+        rg_image_t *scaled = rg_image_copy_resampled(img, img->width * scale, img->height * scale, 0);
+        if (scaled)
+        {
+            rg_image_free(img);
+            img = scaled;
+        }
+    }
+
+    // Other formats are already raw RGB565, a thumbnail wouldn't save anything
+    if (strcasecmp(rg_extension(path), "png") == 0)
+    {
+        rg_storage_lock();
+        rg_storage_mkdir(PREVIEW_THUMBS_PATH);
+        rg_storage_write_file(thumb_path, img, sizeof(rg_image_t) + img->width * img->height * 2);
+        rg_storage_unlock();
+    }
+
+    return img;
+}
+
+static void preview_task(void *arg)
+{
+    static preview_request_t req; // Only this task uses it, no need for the stack space
+
+    while (true)
+    {
+        uint32_t tail = ATOMIC_LOAD(&previews.requests_tail);
+
+        // The web interface owns the SD card while it works
+        if (tail == ATOMIC_LOAD(&previews.requests_head) || gui.http_lock)
+        {
+            usleep(20 * 1000);
+            continue;
+        }
+
+        // The UI thread may reclaim stale entries when the queue is full, so we copy the request and then claim
+        // it. If the claim fails the slot might have been overwritten while we copied it, we just try again.
+        req = previews.requests[tail % PREVIEW_QUEUE_SIZE];
+        if (!ATOMIC_CAS(&previews.requests_tail, &tail, tail + 1))
+            continue;
+
+        // Requests made before the selection changed are cancelled
+        if (req.generation != ATOMIC_LOAD(&previews.generation))
+            continue;
+
+        preview_entry_t result = {.key = req.key};
+        bool error = false;
+
+        for (size_t i = 0; i < 4 && req.types[i] && !result.img; i++)
+        {
+            error = false;
+            result.img = preview_decode(req.paths[i], &error);
+            result.missing |= (result.img ? 0 : 1) << req.types[i];
+            result.errors += error;
+        }
+
+        // Nothing found doesn't mean there is no preview, the CRC covers haven't been tried. Caching that
+        // would hide them, the full request made when the item gets selected will try everything.
+        if (req.partial && !result.img)
+            continue;
+
+        // The UI thread drains the results quickly, it can only be full if it's busy elsewhere
+        while (ATOMIC_LOAD(&previews.results_head) - ATOMIC_LOAD(&previews.results_tail) >= PREVIEW_QUEUE_SIZE)
+            usleep(20 * 1000);
+
+        uint32_t head = ATOMIC_LOAD(&previews.results_head);
+        previews.results[head % PREVIEW_QUEUE_SIZE] = result;
+        ATOMIC_STORE(&previews.results_head, head + 1);
+    }
+}
+
+static bool preview_resolve(retro_file_t *file, preview_request_t *req, bool may_hash)
+{
+    uint32_t order;
+    size_t count = 0;
 
     switch (gui.show_preview)
     {
         case PREVIEW_MODE_COVER_SAVE:
-            show_missing_cover = true;
             order = 0x4123;
             break;
         case PREVIEW_MODE_SAVE_COVER:
-            show_missing_cover = true;
             order = 0x1234;
             break;
         case PREVIEW_MODE_COVER_ONLY:
-            show_missing_cover = true;
             order = 0x0123;
             break;
         case PREVIEW_MODE_SAVE_ONLY:
-            show_missing_cover = false;
             order = 0x0004;
             break;
         default:
-            show_missing_cover = false;
             order = 0x0000;
     }
 
-    retro_file_t *file = item->arg;
     retro_app_t *app = file->app;
-    uint32_t errors = 0;
+    char *path = req->paths[0];
+    size_t path_len;
+
+    memset(req->types, 0, sizeof(req->types));
+    req->key = preview_key(file);
+    req->partial = false;
+
+    // A checksum that came from the library index is only used once the file is known to be the same
+    if (app->use_crc_covers)
+        application_check_file(file);
 
-    while (order && !tab->preview)
+    for (; order; order >>= 4)
     {
         int type = order & 0xF;
-
-        order >>= 4;
+        path = req->paths[count];
 
         // Give up on any button press to improve responsiveness
         if ((gui.joystick |= rg_input_read_gamepad()))
-            break;
+            return false;
 
         if (file->missing_cover & (1 << type))
             continue;
 
-        if (type == 0x1 && app->use_crc_covers && application_get_file_crc32(file)) // Game cover (old format)
+        // Prefetching must not stall the UI, it only uses CRCs that are already known. The candidates after a
+        // CRC cover we can't check yet are left out too, finding one of them would skip a preferred image.
+        if (!may_hash && app->use_crc_covers && !file->checksum && (type == 0x1 || type == 0x2))
+        {
+            req->partial = true;
+            break;
+        }
+
+        bool have_crc = app->use_crc_covers && (may_hash ? application_get_file_crc32(file) : file->checksum != 0);
+
+        if (type == 0x1 && have_crc) // Game cover (old format)
             path_len = snprintf(path, RG_PATH_MAX, "%s/%X/%08X.art", app->paths.covers, file->checksum >> 28, file->checksum);
-        else if (type == 0x2 && app->use_crc_covers && application_get_file_crc32(file)) // Game cover (png)
+        else if (type == 0x2 && have_crc) // Game cover (png)
             path_len = snprintf(path, RG_PATH_MAX, "%s/%X/%08X.png", app->paths.covers, file->checksum >> 28, file->checksum);
         else if (type == 0x3) // Game cover (based on filename)
             path_len = snprintf(path, RG_PATH_MAX, "%s/%s.png", app->paths.covers, file->name);
@@ -567,27 +800,152 @@ void gui_load_preview(tab_t *tab)
             else if (state->latest)
                 path_len = snprintf(path, RG_PATH_MAX, "%s", state->latest->preview);
             else
-                path_len = snprintf(path, RG_PATH_MAX, "%s", "/lazy/invalid/path");
+                path_len = RG_PATH_MAX;
             free(state);
         }
         else
             continue;
 
-        if (path_len < RG_PATH_MAX && access(path, F_OK) == 0)
+        if (path_len < RG_PATH_MAX)
+            req->types[count++] = type;
+    }
+
+    return true;
+}
+
+static void preview_submit(const preview_request_t *req)
+{
+    uint32_t head = previews.requests_head;
+    uint32_t tail = ATOMIC_LOAD(&previews.requests_tail);
+
+    // When the queue is full, the oldest requests are usually for items we've scrolled past. We claim them the
+    // same way the worker does, so that the selected item's request is never the one dropped.
+    while (head - tail >= PREVIEW_QUEUE_SIZE)
+    {
+        if (previews.requests[tail % PREVIEW_QUEUE_SIZE].generation == previews.generation)
+            return;
+        ATOMIC_CAS(&previews.requests_tail, &tail, tail + 1);
+        tail = ATOMIC_LOAD(&previews.requests_tail);
+    }
+
+    // Only we write the queue, reading entries the worker might be consuming is safe
+    for (uint32_t i = tail; i != head; i++)
+    {
+        const preview_request_t *queued = &previews.requests[i % PREVIEW_QUEUE_SIZE];
+        if (queued->key == req->key && queued->generation == previews.generation)
+            return;
+    }
+
+    previews.requests[head % PREVIEW_QUEUE_SIZE] = *req;
+    previews.requests[head % PREVIEW_QUEUE_SIZE].generation = previews.generation;
+    ATOMIC_STORE(&previews.requests_head, head + 1);
+}
+
+static void preview_show(tab_t *tab, retro_file_t *file, preview_entry_t *entry)
+{
+    // The cache keeps its own copy, the tab frees its preview whenever it likes
+    entry->lastuse = ++previews.clock;
+    file->missing_cover |= entry->missing;
+    gui_set_preview(tab, entry->img ? rg_image_copy_resampled(entry->img, 0, 0, 0) : NULL);
+    previews.current = 0;
+
+    bool show_missing_cover = gui.show_preview != PREVIEW_MODE_NONE && gui.show_preview != PREVIEW_MODE_SAVE_ONLY;
+    if (!tab->preview && file->checksum && (show_missing_cover || entry->errors))
+    {
+        RG_LOGI("No image found for '%s'\n", file->name);
+        gui_set_status(tab, NULL, entry->errors ? "Bad cover" : "No cover");
+    }
+}
+
+bool gui_poll_preview(tab_t *tab)
+{
+    if (!previews.requests)
+        return false;
+
+    while (previews.results_tail != ATOMIC_LOAD(&previews.results_head))
+    {
+        preview_cache_insert(&previews.results[previews.results_tail % PREVIEW_QUEUE_SIZE]);
+        ATOMIC_STORE(&previews.results_tail, previews.results_tail + 1);
+    }
+
+    listbox_item_t *item = gui_get_selected_item(tab);
+    preview_entry_t *entry;
+
+    if (!previews.current || tab != previews.current_tab || !item || !item->arg || preview_key(item->arg) != previews.current)
+        return false;
+
+    if (!(entry = preview_cache_find(previews.current)))
+        return false;
+
+    preview_show(tab, item->arg, entry);
+    return true;
+}
+
+void gui_load_preview(tab_t *tab)
+{
+    listbox_item_t *item = gui_get_selected_item(tab);
+    preview_request_t req;
+
+    gui_set_preview(tab, NULL);
+    previews.current = 0;
+
+    if (!item || !item->arg)
+        return;
+
+    if (!previews.requests)
+    {
+        previews.requests = calloc(PREVIEW_QUEUE_SIZE, sizeof(preview_request_t));
+        previews.cache_budget = rg_system_get_counters().totalMemoryExt ? 1024 * 1024 : 128 * 1024;
+        if (!previews.requests || !rg_task_create("gui_preview", &preview_task, NULL, 6 * 1024, RG_TASK_PRIORITY - 2, -1))
         {
-            gui_set_preview(tab, rg_image_load_from_file(path, 0));
-            if (!tab->preview)
-                errors++;
+            RG_LOGE("Preview worker couldn't be started!\n");
+            free(previews.requests);
+            previews.requests = NULL;
+            return;
         }
+    }
+
+    gui_poll_preview(tab);
+
+    retro_file_t *file = item->arg;
+    preview_entry_t *entry = preview_cache_find(preview_key(file));
+
+    if (entry)
+    {
+        preview_show(tab, file, entry);
+        return;
+    }
 
-        file->missing_cover |= (tab->preview ? 0 : 1) << type;
+    if (!preview_resolve(file, &req, true))
+        return;
+
+    // Whatever is still queued is for items we've scrolled past
+    ATOMIC_STORE(&previews.generation, previews.generation + 1);
+    previews.current = req.key;
+    previews.current_tab = tab;
+
+    if (!req.types[0])
+    {
+        preview_cache_insert(&(preview_entry_t){.key = req.key});
+        gui_poll_preview(tab);
+        return;
     }
 
-    if (!tab->preview && file->checksum && (show_missing_cover || errors))
+    preview_submit(&req);
+
+    // Then the neighbours, closest first, so that scrolling a step in either direction is instant
+    for (int i = 1; i <= PREVIEW_PREFETCH; i++)
     {
-        RG_LOGI("No image found for '%s'\n", file->name);
-        gui_set_status(tab, NULL, errors ? "Bad cover" : "No cover");
-        // gui_draw_status(tab);
-        // tab->preview = gui_get_image("cover", file->app);
+        for (int dir = -1; dir <= 1; dir += 2)
+        {
+            int index = tab->listbox.cursor + i * dir;
+            if (index < 0 || index >= tab->listbox.length || !tab->listbox.items[index].arg)
+                continue;
+            retro_file_t *next = tab->listbox.items[index].arg;
+            if (next->type != 0x00 || preview_cache_find(preview_key(next)))
+                continue;
+            if (preview_resolve(next, &req, false) && req.types[0])
+                preview_submit(&req);
+        }
     }
 }
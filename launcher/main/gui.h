@@ -159,6 +159,7 @@ void gui_event(gui_event_t event, tab_t *tab);
 void gui_redraw(void);
 void gui_set_preview(tab_t *tab, rg_image_t *preview);
 void gui_load_preview(tab_t *tab);
+bool gui_poll_preview(tab_t *tab);
 void gui_draw_background(tab_t *tab, int shade);
 void gui_draw_header(tab_t *tab, int offset);
 void gui_draw_status(tab_t *tab);
@@ -175,6 +175,16 @@ static rg_gui_event_t startup_app_cb(rg_gui_option_t *option, rg_gui_event_t eve
     return RG_DIALOG_VOID;
 }
 
+static rg_gui_event_t rescan_roms_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    if (event == RG_DIALOG_ENTER)
+    {
+        applications_rescan();
+        return RG_DIALOG_CLOSE;
+    }
+    return RG_DIALOG_VOID;
+}
+
 static rg_gui_event_t launcher_options_cb(rg_gui_option_t *option, rg_gui_event_t event)
 {
     if (event == RG_DIALOG_ENTER)
@@ -185,6 +195,7 @@ static rg_gui_event_t launcher_options_cb(rg_gui_option_t *option, rg_gui_event_
             {0, "Scroll mode ", "...", 1, &scroll_mode_cb},
             {0, "Start screen", "...", 1, &start_screen_cb},
             {0, "Hide tabs   ", "...", 1, &toggle_tabs_cb},
+            {0, "Rescan ROMs ", NULL, 1, &rescan_roms_cb},
             RG_DIALOG_END,
         };
         gui_redraw(); // clear main menu
@@ -326,6 +337,7 @@ static void retro_loop(void)
 
         if (joystick & (RG_KEY_MENU|RG_KEY_OPTION))
         {
+            rg_storage_lock();
         #if RG_GAMEPAD_HAS_OPTION_BTN
             if (joystick == RG_KEY_MENU)
                 show_about_menu();
@@ -336,6 +348,7 @@ static void retro_loop(void)
             gui_update_theme();
             gui_save_config();
             rg_settings_commit();
+            rg_storage_unlock();
             redraw_pending = true;
         }
 
@@ -384,6 +397,9 @@ static void retro_loop(void)
             }
         }
 
+        if (gui.browse && gui_poll_preview(tab))
+            redraw_pending = true;
+
         if (redraw_pending)
         {
             redraw_pending = false;
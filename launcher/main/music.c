@@ -13,7 +13,6 @@
 #include "gui.h"
 
 static rg_scandir_t *music_files = NULL;
-static size_t music_files_count = 0;
 static QueueHandle_t playback_queue;
 
 static void music_player(void *arg);
@@ -22,7 +21,7 @@ static void tab_refresh(tab_t *tab);
 static void event_handler(gui_event_t event, tab_t *tab)
 {
     listbox_item_t *item = gui_get_selected_item(tab);
-    rg_scandir_t *file = (rg_scandir_t *)(item ? item->arg : NULL);
+    rg_scandir_entry_t *file = (rg_scandir_entry_t *)(item ? item->arg : NULL);
 
     if (event == TAB_INIT)
     {
@@ -70,14 +69,8 @@ static void tab_refresh(tab_t *tab)
         free(music_files);
 
     music_files = rg_storage_scandir(RG_BASE_PATH_MUSIC, NULL, 0);
-    music_files_count = 0;
 
-    for (rg_scandir_t *file = music_files; file && file->is_valid; file++)
-    {
-        music_files_count++;
-    }
-
-    if (music_files_count == 0)
+    if (!music_files || music_files->count == 0)
     {
         gui_resize_list(tab, 6);
         sprintf(tab->listbox.items[0].text, "Welcome to Retro-Go!");
@@ -89,11 +82,11 @@ static void tab_refresh(tab_t *tab)
     }
     else
     {
-        gui_resize_list(tab, music_files_count);
-        for (int i = 0; i < music_files_count; i++)
+        gui_resize_list(tab, music_files->count);
+        for (int i = 0; i < music_files->count; i++)
         {
             listbox_item_t *listitem = &tab->listbox.items[i];
-            rg_scandir_t *file = &music_files[i];
+            rg_scandir_entry_t *file = &music_files->entries[i];
             snprintf(listitem->text, 128, "%s", file->name);
             listitem->arg = file;
             listitem->id = i;
@@ -58,8 +58,9 @@ static esp_err_t http_api_handler(httpd_req_t *req)
     {
         cJSON *array = cJSON_AddArrayToObject(response, "files");
         rg_scandir_t *files = rg_storage_scandir(arg1, NULL, RG_SCANDIR_SORT | RG_SCANDIR_STAT);
-        for (rg_scandir_t *entry = files; entry && entry->is_valid; ++entry)
+        for (size_t i = 0; files && i < files->count; ++i)
         {
+            rg_scandir_entry_t *entry = &files->entries[i];
             cJSON *obj = cJSON_CreateObject();
             cJSON_AddStringToObject(obj, "name", entry->name);
             cJSON_AddNumberToObject(obj, "size", entry->size);
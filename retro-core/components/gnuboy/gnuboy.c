@@ -131,41 +131,118 @@ int gnuboy_load_bios(const char *file)
 }
 
 
-void gnuboy_load_bank(int bank)
+// ROM bank cache settings, they survive gnuboy_free_rom()
+static int romcache_budget = 0;    // Maximum number of resident banks, 0 means as many as malloc allows
+static int romcache_readahead = 0; // Banks to load after a miss, if they fit without evicting
+
+
+void gnuboy_set_rom_cache(int max_banks, int readahead)
+{
+	romcache_budget = max_banks;
+	romcache_readahead = readahead;
+}
+
+
+static byte *evict_bank(void)
+{
+	// Bank 0 is always mapped and the switchable bank is referenced by hw.rmap, the rest is fair game.
+	// A linear scan is nothing compared to the fread that follows.
+	int current = cart.rombank & (cart.romsize - 1);
+	int victim = -1;
+
+	for (int i = 1; i < 512; i++)
+	{
+		if (cart.rombanks[i] && i != current
+			&& (victim < 0 || cart.romcache.lastuse[i] < cart.romcache.lastuse[victim]))
+			victim = i;
+	}
+
+	if (victim < 0)
+		return NULL;
+
+	MESSAGE_DEBUG("evicting bank %d.\n", victim);
+	byte *buffer = cart.rombanks[victim];
+	cart.rombanks[victim] = NULL;
+	cart.romcache.resident--;
+	cart.romcache.evictions++;
+	return buffer;
+}
+
+
+static bool read_bank(int bank, bool evict)
 {
 	const size_t BANK_SIZE = 0x4000;
-	const size_t OFFSET = bank * BANK_SIZE;
+	byte *buffer = NULL;
+
+	if (!romcache_budget || cart.romcache.resident < romcache_budget)
+		buffer = malloc(BANK_SIZE);
+
+	if (!buffer && evict)
+		buffer = evict_bank();
 
-	if (!cart.rombanks[bank])
-		cart.rombanks[bank] = malloc(BANK_SIZE);
+	if (!buffer)
+		return false;
+
+	cart.rombanks[bank] = buffer;
+	cart.romcache.resident++;
 
 	if (!cart.romFile)
+		return true;
+
+	// Read-ahead is sequential, no need to seek again
+	if ((ftell(cart.romFile) != bank * BANK_SIZE && fseek(cart.romFile, bank * BANK_SIZE, SEEK_SET) != 0)
+		|| !fread(buffer, BANK_SIZE, 1, cart.romFile))
+	{
+		MESSAGE_WARN("ROM bank loading failed\n");
+		if (!feof(cart.romFile))
+			abort(); // This indicates an SD Card failure
+	}
+	return true;
+}
+
+
+void gnuboy_load_bank(int bank)
+{
+	cart.romcache.lastuse[bank] = ++cart.romcache.clock;
+
+	if (cart.rombanks[bank])
+	{
+		cart.romcache.hits++;
 		return;
+	}
 
 	MESSAGE_INFO("loading bank %d.\n", bank);
-	while (!cart.rombanks[bank])
+	cart.romcache.misses++;
+
+	if (!read_bank(bank, true))
 	{
-		int i = rand() & 0xFF;
-		if (cart.rombanks[i])
-		{
-			MESSAGE_INFO("reclaiming bank %d.\n", i);
-			cart.rombanks[bank] = cart.rombanks[i];
-			cart.rombanks[i] = NULL;
-			break;
-		}
+		MESSAGE_ERROR("Out of memory for bank %d!\n", bank);
+		abort();
 	}
 
-	// Load the 16K page
-	if (fseek(cart.romFile, OFFSET, SEEK_SET) != 0
-		|| !fread(cart.rombanks[bank], BANK_SIZE, 1, cart.romFile))
+	// Games tend to switch to neighbouring banks, grab them while the card is seeking our way
+	for (int i = bank + 1; i <= bank + romcache_readahead && i < cart.romsize; i++)
 	{
-		MESSAGE_WARN("ROM bank loading failed\n");
-		if (!feof(cart.romFile))
-			abort(); // This indicates an SD Card failure
+		if (cart.rombanks[i])
+			break;
+		if (!read_bank(i, false))
+			break;
+		// Older than anything in use, so an unused read-ahead is the first to go
+		cart.romcache.lastuse[i] = 0;
+		cart.romcache.readaheads++;
 	}
 }
 
 
+void gnuboy_get_rom_cache_stats(int *resident, int *hits, int *misses, int *evictions)
+{
+	if (resident) *resident = cart.romcache.resident;
+	if (hits) *hits = cart.romcache.hits;
+	if (misses) *misses = cart.romcache.misses;
+	if (evictions) *evictions = cart.romcache.evictions;
+}
+
+
 int gnuboy_load_rom(const char *file)
 {
 	// Memory Bank Controller names
@@ -359,10 +436,14 @@ int gnuboy_load_rom(const char *file)
 		preload = cart.romsize - 40;
 	}
 
+	if (romcache_budget && preload > romcache_budget)
+		preload = romcache_budget;
+
 	MESSAGE_INFO("Preloading the first %d banks\n", preload);
 	for (int i = 0; i < preload; i++)
 	{
-		gnuboy_load_bank(i);
+		if (!cart.rombanks[i] && !read_bank(i, false))
+			break;
 	}
 
 	// Apply game-specific hacks
@@ -387,6 +468,10 @@ int gnuboy_load_rom(const char *file)
 
 void gnuboy_free_rom(void)
 {
+	MESSAGE_INFO("ROM cache: resident=%d, hits=%d, misses=%d, evictions=%d, readaheads=%d\n",
+		cart.romcache.resident, cart.romcache.hits, cart.romcache.misses,
+		cart.romcache.evictions, cart.romcache.readaheads);
+
 	for (int i = 0; i < 512; i++)
 	{
 		if (cart.rombanks[i]) {
@@ -628,7 +713,8 @@ typedef struct
 } sblock_t;
 
 
-static int do_save_load(const char *file, bool save)
+// Packs (or unpacks) the registers and small arrays into the 4KB header block
+static void do_header(byte *buf, bool save)
 {
 	uint32_t sav_ver = SAVE_VERSION;
 	const svar_t svars[] =
@@ -700,26 +786,10 @@ static int do_save_load(const char *file, bool save)
 		END
 	};
 
-	byte *buf = calloc(1, 4096);
-	if (!buf) return -2;
-
 	uint32_t (*header)[2] = (uint32_t (*)[2])buf;
 
-	sblock_t blocks[] = {
-		{buf, 1},
-		{hw.rambanks, IS_CGB ? 8 : 2},
-		{hw.vbanks, IS_CGB ? 4 : 2},
-		{cart.rambanks, cart.ramsize * 2},
-		{NULL, 0},
-	};
-
-	FILE *fp = NULL;
-
 	if (save)
 	{
-		if (!(fp = fopen(file, "wb")))
-			goto _error;
-
 		for (int i = 0; svars[i].ptr; i++)
 		{
 			uint32_t d = 0;
@@ -745,30 +815,9 @@ static int do_save_load(const char *file, bool save)
 		memcpy(buf + 0xE00, hw.pal, 128);
 		memcpy(buf + 0xF00, hw.oam, 256);
 		memcpy(buf + 0xCF0, hw.snd->wave, 16);
-
-		for (int i = 0; blocks[i].ptr != NULL; i++)
-		{
-			if (fwrite(blocks[i].ptr, 4096, blocks[i].len, fp) < 1)
-			{
-				MESSAGE_ERROR("Write error in block %d\n", i);
-				goto _error;
-			}
-		}
 	}
 	else
 	{
-		if (!(fp = fopen(file, "rb")))
-			goto _error;
-
-		for (int i = 0; blocks[i].ptr != NULL; i++)
-		{
-			if (fread(blocks[i].ptr, 4096, blocks[i].len, fp) < 1)
-			{
-				MESSAGE_ERROR("Read error in block %d\n", i);
-				goto _error;
-			}
-		}
-
 		for (int i = 0; svars[i].ptr; i++)
 		{
 			uint32_t d = 0;
@@ -814,6 +863,56 @@ static int do_save_load(const char *file, bool save)
 		sound_dirty();
 		hw_updatemap();
 	}
+}
+
+
+static int do_save_load(const char *file, bool save)
+{
+	byte *buf = calloc(1, 4096);
+	if (!buf) return -2;
+
+	sblock_t blocks[] = {
+		{buf, 1},
+		{hw.rambanks, IS_CGB ? 8 : 2},
+		{hw.vbanks, IS_CGB ? 4 : 2},
+		{cart.rambanks, cart.ramsize * 2},
+		{NULL, 0},
+	};
+
+	FILE *fp = NULL;
+
+	if (save)
+	{
+		if (!(fp = fopen(file, "wb")))
+			goto _error;
+
+		do_header(buf, true);
+
+		for (int i = 0; blocks[i].ptr != NULL; i++)
+		{
+			if (fwrite(blocks[i].ptr, 4096, blocks[i].len, fp) < 1)
+			{
+				MESSAGE_ERROR("Write error in block %d\n", i);
+				goto _error;
+			}
+		}
+	}
+	else
+	{
+		if (!(fp = fopen(file, "rb")))
+			goto _error;
+
+		for (int i = 0; blocks[i].ptr != NULL; i++)
+		{
+			if (fread(blocks[i].ptr, 4096, blocks[i].len, fp) < 1)
+			{
+				MESSAGE_ERROR("Read error in block %d\n", i);
+				goto _error;
+			}
+		}
+
+		do_header(buf, false);
+	}
 
 	fclose(fp);
 	free(buf);
@@ -838,3 +937,43 @@ int gnuboy_load_state(const char *file)
 {
 	return do_save_load(file, false);
 }
+
+
+#ifdef RETRO_GO
+// Same blocks as the save file, the header is built aside because chunks aren't aligned
+bool gnuboy_serialize(rg_emu_blob_t *blob)
+{
+	byte *buf = calloc(1, 4096);
+	if (!buf) return false;
+
+	do_header(buf, true);
+	rg_emu_blob_put(blob, "HEADER", buf, 4096);
+	rg_emu_blob_put(blob, "WRAM", hw.rambanks, 4096 * (IS_CGB ? 8 : 2));
+	rg_emu_blob_put(blob, "VRAM", hw.vbanks, 4096 * (IS_CGB ? 4 : 2));
+	rg_emu_blob_put(blob, "SRAM", cart.rambanks, 4096 * cart.ramsize * 2);
+	blob->version = SAVE_VERSION;
+
+	free(buf);
+	return true;
+}
+
+
+bool gnuboy_deserialize(rg_emu_blob_t *blob)
+{
+	byte *buf = calloc(1, 4096);
+	if (!buf) return false;
+
+	bool success = rg_emu_blob_read(blob, "HEADER", buf, 4096)
+		&& rg_emu_blob_read(blob, "WRAM", hw.rambanks, 4096 * (IS_CGB ? 8 : 2))
+		&& rg_emu_blob_read(blob, "VRAM", hw.vbanks, 4096 * (IS_CGB ? 4 : 2))
+		&& rg_emu_blob_read(blob, "SRAM", cart.rambanks, 4096 * cart.ramsize * 2);
+
+	if (success)
+		do_header(buf, false);
+	else
+		MESSAGE_ERROR("Missing block\n");
+
+	free(buf);
+	return success;
+}
+#endif
@@ -126,6 +126,8 @@ void gnuboy_reset(bool hard);
 void gnuboy_run(bool draw);
 bool gnuboy_sram_dirty(void);
 void gnuboy_load_bank(int);
+void gnuboy_set_rom_cache(int max_banks, int readahead);
+void gnuboy_get_rom_cache_stats(int *resident, int *hits, int *misses, int *evictions);
 void gnuboy_set_pad(int);
 
 void gnuboy_get_time(int *day, int *hour, int *minute, int *second);
@@ -139,3 +141,7 @@ int gnuboy_load_sram(const char *file);
 int gnuboy_save_sram(const char *file, bool quick_save);
 int gnuboy_load_state(const char *file);
 int gnuboy_save_state(const char *file);
+#ifdef RETRO_GO
+bool gnuboy_serialize(rg_emu_blob_t *blob);
+bool gnuboy_deserialize(rg_emu_blob_t *blob);
+#endif
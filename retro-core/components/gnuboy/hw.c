@@ -287,10 +287,8 @@ void hw_updatemap(void)
 {
 	int rombank = cart.rombank & (cart.romsize - 1);
 
-	if (cart.rombanks[rombank] == NULL)
-	{
-		gnuboy_load_bank(rombank);
-	}
+	// Also keeps the LRU informed, a hit is cheap
+	gnuboy_load_bank(rombank);
 
 	// ROM
 	hw.rmap[0x0] = cart.rombanks[0];
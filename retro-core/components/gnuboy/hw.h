@@ -182,6 +182,12 @@ typedef struct
 
 	// Memory
 	byte *rombanks[512];
+	struct {
+		uint32_t lastuse[512]; // Value of `clock` when the bank was last mapped
+		uint32_t clock;
+		int resident;
+		int hits, misses, evictions, readaheads;
+	} romcache;
 	byte (*rambanks)[8192];
 	unsigned sram_dirty;
 	unsigned sram_saved;
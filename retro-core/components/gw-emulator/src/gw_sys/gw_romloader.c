@@ -21,6 +21,7 @@ __license__ = "GPLv3"
 //to be removed using arguments get rom pointer and size
 #include "rom_manager.h"
 
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -86,7 +86,6 @@ UBYTE   *gPrimaryFrameBuffer=NULL;
 
 extern void lynx_decrypt(unsigned char * result, const unsigned char * encrypted, const int length);
 
-#if 0
 int lss_read(void* dest, int varsize, int varcount, LSS_FILE *fp)
 {
    ULONG copysize;
@@ -101,21 +100,16 @@ int lss_write(void* src, int varsize, int varcount, LSS_FILE *fp)
 {
    ULONG copysize;
    copysize=varsize*varcount;
-   //if((fp->index + copysize) > fp->index_limit) copysize=fp->index_limit - fp->index;
-   memcpy(fp->memptr+fp->index,src,copysize);
+   if(fp->memptr && (fp->index + copysize) <= fp->index_limit)
+      memcpy(fp->memptr+fp->index,src,copysize);
    fp->index+=copysize;
    return copysize;
 }
 
 int lss_printf(LSS_FILE *fp, const char *str)
 {
-   ULONG copysize;
-   copysize=strlen(str);
-   memcpy(fp->memptr+fp->index,str,copysize);
-   fp->index+=copysize;
-   return copysize;
+   return lss_write((void*)str,1,strlen(str),fp);
 }
-#endif
 
 
 CSystem::CSystem(const char* filename, long displayformat, long samplerate)
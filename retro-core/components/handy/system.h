@@ -121,21 +121,17 @@ extern ULONG    gAudioBufferPointer;
 extern ULONG    gAudioLastUpdateCycle;
 extern UBYTE    *gPrimaryFrameBuffer;
 
-// typedef struct lssfile
-// {
-//    UBYTE *memptr;
-//    ULONG index;
-//    ULONG index_limit;
-// } LSS_FILE;
-
-// int lss_read(void* dest, int varsize, int varcount, LSS_FILE *fp);
-// int lss_write(void* src, int varsize, int varcount, LSS_FILE *fp);
-// int lss_printf(LSS_FILE *fp, const char *str);
-
-#define LSS_FILE FILE
-#define lss_read(d, vs, vc, fp) (fread(d, vs, vc, fp) > 0)
-#define lss_write(s, vs, vc, fp) (fwrite(s, vs, vc, fp) > 0)
-#define lss_printf(fp, str) (fputs(str, fp) >= 0)
+// Snapshots are kept in memory, a NULL memptr only measures how much a save needs
+typedef struct lssfile
+{
+   UBYTE *memptr;
+   ULONG index;
+   ULONG index_limit;
+} LSS_FILE;
+
+int lss_read(void* dest, int varsize, int varcount, LSS_FILE *fp);
+int lss_write(void* src, int varsize, int varcount, LSS_FILE *fp);
+int lss_printf(LSS_FILE *fp, const char *str);
 
 //
 // Define logging functions
@@ -20,6 +20,7 @@
 //  - Systems: VSSystem, Playchoice, VT*, Dendy
 //  - Fields: Controller Type, Bus Conflicts, VsSystemType, PpuModel
 //  - Combined work ram and save ram
+//  - Entries must remain sorted by CRC, rom.c does a binary search
 
 // #include "nes/nes.h"
 
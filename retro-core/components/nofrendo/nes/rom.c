@@ -25,7 +25,10 @@
 #include "nes.h"
 #include "../database.h"
 
+#define DATABASE_COUNT (sizeof(games_database) / sizeof(games_database[0]) - 1) // Minus the terminator
+
 static rom_t rom;
+static unsigned checksum_hint = 0;
 
 #ifdef USE_SRAM_FILE
 
@@ -64,9 +67,30 @@ static void rom_loadsram(void)
 }
 #endif
 
+static int database_compare(const void *key, const void *entry)
+{
+   uint32 a = *(const uint32 *)key, b = ((const db_game_t *)entry)->crc;
+   return (a > b) - (a < b);
+}
+
+/* Find a game in the database, which is sorted by CRC */
+static const db_game_t *database_lookup(uint32 checksum)
+{
+   return bsearch(&checksum, games_database, DATABASE_COUNT, sizeof(db_game_t), database_compare);
+}
+
+/* Use a checksum computed earlier instead of hashing the next ROM loaded */
+void rom_setchecksum(uint32 checksum)
+{
+   checksum_hint = checksum;
+}
+
 /* Load a ROM from a memory buffer */
 rom_t *rom_loadmem(uint8 *data, size_t size)
 {
+   unsigned checksum = checksum_hint;
+   checksum_hint = 0;
+
    if (!data || size < 16)
       return NULL;
 
@@ -91,7 +115,7 @@ rom_t *rom_loadmem(uint8 *data, size_t size)
          rom.prg_rom += 0x200;
       }
 
-      rom.checksum = CRC32(0, rom.prg_rom, size - (rom.prg_rom - data));
+      rom.checksum = checksum ?: CRC32(0, rom.prg_rom, size - (rom.prg_rom - data));
       rom.prg_rom_banks = header->prg_banks * 2;
       rom.chr_rom_banks = header->chr_banks;
       rom.prg_ram_banks = 1; // 8KB. Not specified by iNES
@@ -115,11 +139,9 @@ rom_t *rom_loadmem(uint8 *data, size_t size)
       else if (rom.flags & ROM_FLAG_VERTICAL)
          rom.mirroring = PPU_MIRROR_VERT;
 
-      const db_game_t *entry = games_database;
-      while (entry->crc && entry->crc != rom.checksum)
-         entry++;
+      const db_game_t *entry = database_lookup(rom.checksum);
 
-      if (entry->crc == rom.checksum)
+      if (entry)
       {
          MESSAGE_INFO("ROM: Game found in database.\n");
 
@@ -199,7 +221,7 @@ rom_t *rom_loadmem(uint8 *data, size_t size)
       rom.prg_ram_banks = 4; // The FDS adapter contains 32KB to store game program
       rom.chr_ram_banks = 1; // The FDS adapter contains 8KB
       rom.prg_rom_banks = 1; // This will contain the FDS BIOS
-      rom.checksum = CRC32(0, rom.data_ptr, rom.data_len);
+      rom.checksum = checksum ?: CRC32(0, rom.data_ptr, rom.data_len);
       rom.mapper_number = 20;
       rom.system = SYS_FAMICOM;
 
@@ -226,7 +248,7 @@ rom_t *rom_loadmem(uint8 *data, size_t size)
       rom.prg_ram_banks = 1; // Some songs may need it. I store a bootstrap program there at the moment
       rom.chr_ram_banks = 1; // Not used but some code might assume it will be present...
       rom.prg_rom_banks = 4; // This is actually PRG-RAM but some of our code assumes PRG-ROM to be present...
-      rom.checksum = CRC32(0, rom.data_ptr, rom.data_len);
+      rom.checksum = checksum ?: CRC32(0, rom.data_ptr, rom.data_len);
       rom.mapper_number = 31;
 
       MESSAGE_INFO("ROM: CRC32:  %08X\n", (unsigned)rom.checksum);
@@ -254,35 +276,44 @@ rom_t *rom_loadmem(uint8 *data, size_t size)
 rom_t *rom_loadfile(const char *filename)
 {
    uint8 *data = NULL;
-   long size = 0;
+   size_t size = 0;
 
    if (!filename)
       return NULL;
 
-   FILE *fp = fopen(filename, "rb");
-   if (!fp)
-   {
-      MESSAGE_ERROR("ROM: Unable to open file '%s'\n", filename);
-      return NULL;
-   }
-
    MESSAGE_INFO("ROM: Loading file '%s'\n", filename);
 
-   fseek(fp, 0, SEEK_END);
-   size = ftell(fp);
-   fseek(fp, 0, SEEK_SET);
-
-   if (size < 16 || size > 0x200000)
+#ifdef RETRO_GO
+   // On the host the file is mapped and only the pages we touch are ever read
+   rg_file_map_t *map = rg_storage_map_file(filename, 0, 0);
+   if (map)
    {
-      MESSAGE_ERROR("ROM: File size error\n");
+      data = map->data;
+      size = map->size;
+   }
+#else
+   FILE *fp = fopen(filename, "rb");
+   if (fp)
+   {
+      fseek(fp, 0, SEEK_END);
+      size = ftell(fp);
+      fseek(fp, 0, SEEK_SET);
+      if ((data = malloc(size)) && fread(data, size, 1, fp) != 1)
+      {
+         free(data);
+         data = NULL;
+      }
+      fclose(fp);
    }
-   else if ((data = malloc(size)) == NULL)
+#endif
+
+   if (!data)
    {
-      MESSAGE_ERROR("ROM: Memory allocation failed\n");
+      MESSAGE_ERROR("ROM: Unable to read file '%s'\n", filename);
    }
-   else if (fread(data, size, 1, fp) != 1)
+   else if (size < 16 || size > 0x200000)
    {
-      MESSAGE_ERROR("ROM: Read error\n");
+      MESSAGE_ERROR("ROM: File size error\n");
    }
    else if (rom_loadmem(data, size) == NULL)
    {
@@ -290,7 +321,6 @@ rom_t *rom_loadfile(const char *filename)
    }
    else
    {
-      fclose(fp);
       if (rom.system == SYS_UNKNOWN)
       {
          if (strstr(filename, "(E)")
@@ -301,6 +331,9 @@ rom_t *rom_loadfile(const char *filename)
       }
       rom.flags |= ROM_FLAG_FREE_DATA;
       // This is fine, rom_loadmem zeroes `rom`.
+   #ifdef RETRO_GO
+      rom.data_map = map;
+   #endif
       strncpy(rom.filename, filename, sizeof(rom.filename) - 1);
       #ifdef USE_SRAM_FILE
          rom_loadsram();
@@ -308,8 +341,11 @@ rom_t *rom_loadfile(const char *filename)
       return &rom;
    }
 
-   fclose(fp);
+#ifdef RETRO_GO
+   rg_storage_unmap_file(map);
+#else
    free(data);
+#endif
    return NULL;
 }
 
@@ -321,7 +357,12 @@ void rom_free(void)
 #endif
    if (rom.flags & ROM_FLAG_FREE_DATA)
    {
+   #ifdef RETRO_GO
+      rg_storage_unmap_file(rom.data_map);
+      rom.data_map = NULL;
+   #else
       free(rom.data_ptr);
+   #endif
       rom.data_ptr = NULL;
    }
    free(rom.prg_ram);
@@ -81,6 +81,7 @@ typedef struct
 
    uint8 *data_ptr; // Top of our allocation
    size_t data_len; // Size of our allocation
+   void *data_map;  // rg_file_map_t holding data_ptr, RETRO_GO only
 
    uint8 *prg_rom;
    uint8 *chr_rom;
@@ -102,4 +103,5 @@ typedef struct
 
 rom_t *rom_loadfile(const char *filename);
 rom_t *rom_loadmem(uint8 *data, size_t size);
+void rom_setchecksum(uint32 checksum);
 void rom_free(void);
@@ -62,6 +62,10 @@ typedef struct
    uint8  data[];
 } block_t;
 
+#define BLOCK_COUNT 6
+
+static const char block_names[BLOCK_COUNT][5] = {"BASR", "INFO", "SOUN", "VRAM", "SRAM", "MPRD"};
+
 #define _fread(buffer, size) {                       \
    if (fread(buffer, size, 1, file) != 1)            \
    {                                                 \
@@ -116,159 +120,297 @@ static bool memory_zone_dirty(const void *ptr, size_t size)
 }
 
 
-int state_save(const char* fn)
+/* Encodes a block into out and returns its length, 0 means the block isn't needed.
+** With a NULL out only the length is returned. With skip_empty, VRAM and SRAM are left
+** out when they are all zeros, the loaders clear them when they are missing. */
+static size_t save_block(const char *name, uint8 *out, bool skip_empty)
 {
-   uint32 numberOfBlocks = 0;
-   uint8 buffer[512];
    nes_t *machine = nes_getptr();
-   FILE *file;
 
-   if (!(file = fopen(fn, "wb")))
+   if (memcmp(name, "BASR", 4) == 0)
    {
-       MESSAGE_ERROR("state_save: file '%s' could not be opened.\n", fn);
-       return -1; //goto _error;
+      if (out)
+      {
+         out[0] = machine->cpu->a_reg;
+         out[1] = machine->cpu->x_reg;
+         out[2] = machine->cpu->y_reg;
+         out[3] = machine->cpu->p_reg;
+         out[4] = machine->cpu->s_reg;
+         out[5] = machine->cpu->pc_reg / 256;
+         out[6] = machine->cpu->pc_reg % 256;
+         out[7] = machine->ppu->ctrl0;
+         out[8] = machine->ppu->ctrl1;
+         memcpy(out + 0x0009, machine->mem->ram, 0x800);
+         memcpy(out + 0x0809, machine->ppu->oam, 0x100);
+         memcpy(out + 0x0909, machine->ppu->nametab, 0x1000);
+
+         /* Mask off priority color bits */
+         for (int i = 0; i < 32; i++)
+            out[0x1909 + i] = machine->ppu->palette[i] & 0x3F;
+
+         out[0x1929] = machine->ppu->nt1;
+         out[0x192A] = machine->ppu->nt2;
+         out[0x192B] = machine->ppu->nt3;
+         out[0x192C] = machine->ppu->nt4;
+         out[0x192D] = machine->ppu->vaddr / 256;
+         out[0x192E] = machine->ppu->vaddr % 256;
+         out[0x192F] = machine->ppu->oam_addr;
+         out[0x1930] = machine->ppu->tile_xofs;
+      }
+      return 0x1931;
+   }
+   else if (memcmp(name, "INFO", 4) == 0)
+   {
+      if (out)
+         memset(out, 0, 0x100);
+      return 0x100;
+   }
+   else if (memcmp(name, "SOUN", 4) == 0)
+   {
+      if (out)
+      {
+         memset(out, 0, 0x16);
+         out[0x00] = machine->apu->rectangle[0].regs[0];
+         out[0x01] = machine->apu->rectangle[0].regs[1];
+         out[0x02] = machine->apu->rectangle[0].regs[2];
+         out[0x03] = machine->apu->rectangle[0].regs[3];
+         out[0x04] = machine->apu->rectangle[1].regs[0];
+         out[0x05] = machine->apu->rectangle[1].regs[1];
+         out[0x06] = machine->apu->rectangle[1].regs[2];
+         out[0x07] = machine->apu->rectangle[1].regs[3];
+         out[0x08] = machine->apu->triangle.regs[0];
+         out[0x0A] = machine->apu->triangle.regs[1];
+         out[0x0B] = machine->apu->triangle.regs[2];
+         out[0X0C] = machine->apu->noise.regs[0];
+         out[0X0E] = machine->apu->noise.regs[1];
+         out[0x0F] = machine->apu->noise.regs[2];
+         out[0x10] = machine->apu->dmc.regs[0];
+         out[0x11] = machine->apu->dmc.regs[1];
+         out[0x12] = machine->apu->dmc.regs[2];
+         out[0x13] = machine->apu->dmc.regs[3];
+         out[0x15] = machine->apu->control_reg;
+      }
+      return 0x16;
+   }
+   else if (memcmp(name, "VRAM", 4) == 0)
+   {
+      size_t length = 0x2000 * machine->cart->chr_ram_banks;
+      if (!length || (skip_empty && !memory_zone_dirty(machine->cart->chr_ram, length)))
+         return 0;
+      if (out)
+         memcpy(out, machine->cart->chr_ram, length);
+      return length;
+   }
+   else if (memcmp(name, "SRAM", 4) == 0)
+   {
+      size_t length = 0x2000 * machine->cart->prg_ram_banks;
+      if (!length || (skip_empty && !memory_zone_dirty(machine->cart->prg_ram, length)))
+         return 0;
+      if (out)
+      {
+         out[0] = 1; // SRAM enabled (unused)
+         memcpy(out + 1, machine->cart->prg_ram, length);
+      }
+      return length + 1;
    }
+   else if (memcmp(name, "MPRD", 4) == 0)
+   {
+      if (machine->mapper->number == 0)
+         return 0;
+      if (out)
+      {
+         memset(out, 0, 0x98);
 
-   MESSAGE_INFO("state_save: file '%s' opened.\n", fn);
+         for (int i = 0; i < 4; i++)
+         {
+            uint16 temp = swap16((mem_getpage((i + 4) * 4) - machine->cart->prg_rom) >> 13);
+            out[(i * 2) + 0] = ((uint8 *) &temp)[0];
+            out[(i * 2) + 1] = ((uint8 *) &temp)[1];
+         }
 
-   _fwrite("SNSS\x00\x00\x00\x05", 8);
+         for (int i = 0; i < 8; i++)
+         {
+            uint16 temp = (machine->cart->chr_rom_banks) ?
+               ((ppu_getpage(i) - machine->cart->chr_rom + (i * 0x400)) >> 10) : (i);
+            temp = swap16(temp);
+            out[8 + (i * 2) + 0] = ((uint8 *) &temp)[0];
+            out[8 + (i * 2) + 1] = ((uint8 *) &temp)[1];
+         }
 
+         if (machine->mapper->get_state)
+            machine->mapper->get_state(out + 0x18);
+      }
+      return 0x98;
+   }
 
-   /****************************************************/
+   return 0;
+}
 
-   MESSAGE_INFO("  - Saving base block\n");
+/* A state without VRAM or SRAM block had them all zeros, whatever is there now must go */
+static void clear_missing_blocks(bool have_vram, bool have_sram)
+{
+   nes_t *machine = nes_getptr();
 
-   buffer[0] = machine->cpu->a_reg;
-   buffer[1] = machine->cpu->x_reg;
-   buffer[2] = machine->cpu->y_reg;
-   buffer[3] = machine->cpu->p_reg;
-   buffer[4] = machine->cpu->s_reg;
-   buffer[5] = machine->cpu->pc_reg / 256;
-   buffer[6] = machine->cpu->pc_reg % 256;
-   buffer[7] = machine->ppu->ctrl0;
-   buffer[8] = machine->ppu->ctrl1;
+   if (!have_vram && machine->cart->chr_ram)
+      memset(machine->cart->chr_ram, 0, 0x2000 * machine->cart->chr_ram_banks);
+   if (!have_sram && machine->cart->prg_ram)
+      memset(machine->cart->prg_ram, 0, 0x2000 * machine->cart->prg_ram_banks);
+}
 
-   _fwrite("BASR\x00\x00\x00\x01\x00\x00\x19\x31", 12);
-   _fwrite(&buffer, 9);
-   _fwrite(machine->mem->ram, 0x800);
-   _fwrite(machine->ppu->oam, 0x100);
-   _fwrite(machine->ppu->nametab, 0x1000);
+static bool load_block(const char *name, const uint8 *data, size_t length)
+{
+   nes_t *machine = nes_getptr();
 
-   /* Mask off priority color bits */
-   for (int i = 0; i < 32; i++)
-      buffer[i] = machine->ppu->palette[i] & 0x3F;
+   if (memcmp(name, "BASR", 4) == 0)
+   {
+      MESSAGE_INFO("  - Found base block\n");
+
+      if (length < 0x1931)
+         goto _invalid;
+
+      machine->cpu->a_reg = data[0x0];
+      machine->cpu->x_reg = data[0x1];
+      machine->cpu->y_reg = data[0x2];
+      machine->cpu->p_reg = data[0x3];
+      machine->cpu->s_reg = data[0x4];
+      machine->cpu->pc_reg = (data[0x5] << 8) | data[0x6];
+      machine->ppu->ctrl0 = data[0x7];
+      machine->ppu->ctrl1 = data[0x8];
+
+      memcpy(machine->mem->ram, data + 0x0009, 0x800);
+      memcpy(machine->ppu->oam, data + 0x0809, 0x100);
+      memcpy(machine->ppu->nametab, data + 0x0909, 0x1000);
+      memcpy(machine->ppu->palette, data + 0x1909, 0x20);
+
+      /* TODO: argh, this is to handle nofrendo's filthy sprite priority method */
+      for (int i = 0; i < 8; i++)
+         machine->ppu->palette[i << 2] = machine->ppu->palette[0] | 0x80; // BG_TRANS;
 
-   buffer[32] = machine->ppu->nt1;
-   buffer[33] = machine->ppu->nt2;
-   buffer[34] = machine->ppu->nt3;
-   buffer[35] = machine->ppu->nt4;
-   buffer[36] = machine->ppu->vaddr / 256;
-   buffer[37] = machine->ppu->vaddr % 256;
-   buffer[38] = machine->ppu->oam_addr;
-   buffer[39] = machine->ppu->tile_xofs;
+      machine->ppu->vaddr = (data[0x192D] << 8) | data[0x192E];
+      machine->ppu->oam_addr = data[0x192F];
+      machine->ppu->tile_xofs = data[0x1930];
 
-   _fwrite(&buffer, 40);
-   numberOfBlocks++;
+      /* do some extra handling */
+      machine->ppu->flipflop = 0;
+      machine->ppu->strikeflag = false;
 
+      ppu_setnametables(data[0x1929], data[0x192A], data[0x192B], data[0x192C]);
+      ppu_write(PPU_CTRL0, machine->ppu->ctrl0);
+      ppu_write(PPU_CTRL1, machine->ppu->ctrl1);
+      ppu_write(PPU_VADDR, machine->ppu->vaddr >> 8);
+      ppu_write(PPU_VADDR, machine->ppu->vaddr & 0xFF);
+   }
+   else if (memcmp(name, "VRAM", 4) == 0)
+   {
+      MESSAGE_INFO("  - Found VRAM block\n");
 
-   /****************************************************/
+      if (machine->cart->chr_ram_banks < (length / ROM_CHR_BANK_SIZE))
+         goto _invalid;
 
-   MESSAGE_INFO("  - Saving info block\n");
+      memcpy(machine->cart->chr_ram, data, length);
+   }
+   else if (memcmp(name, "SRAM", 4) == 0)
+   {
+      MESSAGE_INFO("  - Found SRAM block\n");
 
-   _fwrite("INFO\x00\x00\x00\x01\x00\x00\x01\x00", 12);
-   _fwrite(&buffer, 0x100);
-   numberOfBlocks++;
+      if (length < 1 || machine->cart->prg_ram_banks < ((length - 1) / ROM_PRG_BANK_SIZE))
+         goto _invalid;
 
+      // Byte 0 = SRAM enabled (always true)
+      memcpy(machine->cart->prg_ram, data + 1, length - 1);
+   }
+   else if (memcmp(name, "MPRD", 4) == 0)
+   {
+      MESSAGE_INFO("  - Found mapper block\n");
 
-   /****************************************************/
+      if (length < 0x98)
+         goto _invalid;
 
-   MESSAGE_INFO("  - Saving sound block\n");
+      for (int i = 0; i < 4; i++)
+         mmc_bankrom(8, 0x8000 + (i * 0x2000), (data[i * 2] << 8) | data[i * 2 + 1]);
 
-   buffer[0x00] = machine->apu->rectangle[0].regs[0];
-   buffer[0x01] = machine->apu->rectangle[0].regs[1];
-   buffer[0x02] = machine->apu->rectangle[0].regs[2];
-   buffer[0x03] = machine->apu->rectangle[0].regs[3];
-   buffer[0x04] = machine->apu->rectangle[1].regs[0];
-   buffer[0x05] = machine->apu->rectangle[1].regs[1];
-   buffer[0x06] = machine->apu->rectangle[1].regs[2];
-   buffer[0x07] = machine->apu->rectangle[1].regs[3];
-   buffer[0x08] = machine->apu->triangle.regs[0];
-   buffer[0x0A] = machine->apu->triangle.regs[1];
-   buffer[0x0B] = machine->apu->triangle.regs[2];
-   buffer[0X0C] = machine->apu->noise.regs[0];
-   buffer[0X0E] = machine->apu->noise.regs[1];
-   buffer[0x0F] = machine->apu->noise.regs[2];
-   buffer[0x10] = machine->apu->dmc.regs[0];
-   buffer[0x11] = machine->apu->dmc.regs[1];
-   buffer[0x12] = machine->apu->dmc.regs[2];
-   buffer[0x13] = machine->apu->dmc.regs[3];
-   buffer[0x15] = machine->apu->control_reg;
+      if (machine->cart->chr_rom_banks)
+      {
+         for (int i = 0; i < 8; i++)
+            mmc_bankvrom(1, i * 0x400, (data[8 + i * 2] << 8) | data[8 + i * 2 + 1]);
+      }
+      else if (machine->cart->chr_ram)
+      {
+         for (int i = 0; i < 8; i++)
+            ppu_setpage(1, i, machine->cart->chr_ram);
+      }
 
-   _fwrite("SOUN\x00\x00\x00\x01\x00\x00\x00\x16", 12);
-   _fwrite(&buffer, 0x16);
-   numberOfBlocks++;
+      if (machine->mapper->set_state)
+         machine->mapper->set_state((uint8 *)data + 0x18);
+   }
+   else if (memcmp(name, "SOUN", 4) == 0)
+   {
+      MESSAGE_INFO("  - Found sound block\n");
 
+      if (length < 0x16)
+         goto _invalid;
 
-   /****************************************************/
+      apu_reset();
 
-   if (memory_zone_dirty(machine->cart->chr_ram, 0x2000 * machine->cart->chr_ram_banks))
+      for (int i = 0; i < 0x16; i++)
+         apu_write(0x4000 + i, data[i]);
+   }
+   else if (memcmp(name, "INFO", 4) == 0)
    {
-      MESSAGE_INFO("  - Saving VRAM block\n");
+      MESSAGE_INFO("  - Found info block\n");
 
-      _fwrite("VRAM\x00\x00\x00\x01\x00\x00\x20\x00", 12);
-      _fwrite(machine->cart->chr_ram, 0x2000 * machine->cart->chr_ram_banks);
-      numberOfBlocks++;
+      // We don't currently do anything with it, it's just to help report bugs to me :)
+   }
+   else
+   {
+      MESSAGE_ERROR("Found unknown block type!\n");
    }
 
+   return true;
 
-   /****************************************************/
+_invalid:
+   MESSAGE_ERROR("Invalid block size!\n");
+   return false;
+}
 
-   if (memory_zone_dirty(machine->cart->prg_ram, 0x2000 * machine->cart->prg_ram_banks))
-   {
-      MESSAGE_INFO("  - Saving SRAM block\n");
 
-      // Byte 0 = SRAM enabled (unused)
-      // Length is always $2001
-      _fwrite("SRAM\x00\x00\x00\x01\x00\x00\x20\x01\x01", 13);
-      _fwrite(machine->cart->prg_ram, 0x2000 * machine->cart->prg_ram_banks);
-      numberOfBlocks++;
+int state_save(const char* fn)
+{
+   uint32 numberOfBlocks = 0;
+   uint8 *buffer = NULL;
+   FILE *file;
+
+   if (!(file = fopen(fn, "wb")))
+   {
+       MESSAGE_ERROR("state_save: file '%s' could not be opened.\n", fn);
+       return -1; //goto _error;
    }
 
+   MESSAGE_INFO("state_save: file '%s' opened.\n", fn);
 
-   /****************************************************/
+   _fwrite("SNSS\x00\x00\x00\x05", 8);
 
-   if (machine->mapper->number > 0)
+   for (int blk = 0; blk < BLOCK_COUNT; blk++)
    {
-      MESSAGE_INFO("  - Saving mapper block\n");
-
-      for (int i = 0; i < 4; i++)
-      {
-         uint16 temp = swap16((mem_getpage((i + 4) * 4) - machine->cart->prg_rom) >> 13);
-         buffer[(i * 2) + 0] = ((uint8 *) &temp)[0];
-         buffer[(i * 2) + 1] = ((uint8 *) &temp)[1];
-      }
+      size_t length = save_block(block_names[blk], NULL, true);
+      if (length == 0)
+         continue;
 
-      for (int i = 0; i < 8; i++)
-      {
-         uint16 temp = (machine->cart->chr_rom_banks) ?
-            ((ppu_getpage(i) - machine->cart->chr_rom + (i * 0x400)) >> 10) : (i);
-         temp = swap16(temp);
-         buffer[8 + (i * 2) + 0] = ((uint8 *) &temp)[0];
-         buffer[8 + (i * 2) + 1] = ((uint8 *) &temp)[1];
-      }
+      MESSAGE_INFO("  - Saving %s block\n", block_names[blk]);
 
-      if (machine->mapper->get_state)
-      {
-         machine->mapper->get_state(buffer + 0x18);
-      }
+      if (!(buffer = malloc(length)))
+         goto _error;
+      save_block(block_names[blk], buffer, true);
 
-      _fwrite("MPRD\x00\x00\x00\x01\x00\x00\x00\x98", 12);
-      _fwrite(&buffer, 0x98);
+      uint32 header[3] = {0, swap32(1), swap32(length)};
+      memcpy(header, block_names[blk], 4);
+      _fwrite(header, 12);
+      _fwrite(buffer, length);
       numberOfBlocks++;
-   }
-
 
-   /****************************************************/
+      free(buffer);
+      buffer = NULL;
+   }
 
    // Update number of blocks
    fseek(file, 4, SEEK_SET);
@@ -284,196 +426,114 @@ int state_save(const char* fn)
 _error:
    MESSAGE_ERROR("state_save: Save failed!\n");
    fclose(file);
+   free(buffer);
    return -1;
 }
 
 
 int state_load(const char* fn)
 {
-   uint8 buffer[512];
-
-   nes_t *machine = nes_getptr();
+   uint8 header[12];
+   uint8 *buffer = NULL;
    FILE *file;
 
    if (!(file = fopen(fn, "rb")))
    {
        MESSAGE_ERROR("state_load: file '%s' could not be opened.\n", fn);
        return -1; //goto _error;
-  }
+   }
 
-   _fread(buffer, 8);
+   _fread(header, 8);
 
-   if (memcmp(buffer, "SNSS", 4) != 0)
+   if (memcmp(header, "SNSS", 4) != 0)
    {
       MESSAGE_ERROR("state_load: file '%s' is not a save file.\n", fn);
       goto _error;
    }
 
-   size_t numberOfBlocks = swap32(*((uint32*)&buffer[4]));
-   size_t nextBlock = 8;
+   size_t numberOfBlocks = swap32(*((uint32*)&header[4]));
+   bool have_vram = false, have_sram = false;
 
    MESSAGE_INFO("state_load: file '%s' opened, blocks=%d.\n", fn, numberOfBlocks);
 
    for (size_t blk = 0; blk < numberOfBlocks; blk++)
    {
-      fseek(file, nextBlock, SEEK_SET);
-      _fread(buffer, 12);
-
-      unsigned blockVersion = swap32(*((uint32*)&buffer[4]));
-      size_t blockLength = swap32(*((uint32*)&buffer[8]));
-
-      UNUSED(blockVersion);
-
-      nextBlock += 12 + blockLength;
-
-      /****************************************************/
-
-      if (memcmp(buffer, "BASR", 4) == 0)
-      {
-         MESSAGE_INFO("  - Found base block\n");
-
-         _fread(buffer, 9);
-
-         machine->cpu->a_reg = buffer[0x0];
-         machine->cpu->x_reg = buffer[0x1];
-         machine->cpu->y_reg = buffer[0x2];
-         machine->cpu->p_reg = buffer[0x3];
-         machine->cpu->s_reg = buffer[0x4];
-         machine->cpu->pc_reg = swap16(*((uint16*)&buffer[0x5]));
-         machine->ppu->ctrl0 = buffer[0x7];
-         machine->ppu->ctrl1 = buffer[0x8];
-
-         _fread(machine->mem->ram, 0x800);
-         _fread(machine->ppu->oam, 0x100);
-         _fread(machine->ppu->nametab, 0x1000);
-         _fread(machine->ppu->palette, 0x20);
-
-         /* TODO: argh, this is to handle nofrendo's filthy sprite priority method */
-         for (int i = 0; i < 8; i++)
-            machine->ppu->palette[i << 2] = machine->ppu->palette[0] | 0x80; // BG_TRANS;
-
-         _fread(buffer, 8);
-
-         machine->ppu->vaddr = swap16(*((uint16*)&buffer[0x4]));
-         machine->ppu->oam_addr = buffer[0x6];
-         machine->ppu->tile_xofs = buffer[0x7];
-
-         /* do some extra handling */
-         machine->ppu->flipflop = 0;
-         machine->ppu->strikeflag = false;
-
-         ppu_setnametables(buffer[0], buffer[1], buffer[2], buffer[3]);
-         ppu_write(PPU_CTRL0, machine->ppu->ctrl0);
-         ppu_write(PPU_CTRL1, machine->ppu->ctrl1);
-         ppu_write(PPU_VADDR, machine->ppu->vaddr >> 8);
-         ppu_write(PPU_VADDR, machine->ppu->vaddr & 0xFF);
-      }
-
-
-      /****************************************************/
-
-      else if (memcmp(buffer, "VRAM", 4) == 0)
-      {
-         MESSAGE_INFO("  - Found VRAM block\n");
-
-         if (machine->cart->chr_ram_banks < (blockLength / ROM_CHR_BANK_SIZE))
-         {
-            MESSAGE_ERROR("Invalid block size!\n");
-            continue;
-         }
-
-         _fread(machine->cart->chr_ram, blockLength);
-      }
-
-
-      /****************************************************/
-
-      else if (memcmp(buffer, "SRAM", 4) == 0)
-      {
-         MESSAGE_INFO("  - Found SRAM block\n");
-
-         if (machine->cart->prg_ram_banks < ((blockLength-1) / ROM_PRG_BANK_SIZE))
-         {
-            MESSAGE_ERROR("Invalid block size!\n");
-            continue;
-         }
-
-         _fread(buffer, 1); // SRAM enabled (always true)
-         _fread(machine->cart->prg_ram, blockLength - 1);
-      }
-
-
-      /****************************************************/
-
-      else if (memcmp(buffer, "MPRD", 4) == 0)
-      {
-         MESSAGE_INFO("  - Found mapper block\n");
+      _fread(header, 12);
 
-         _fread(buffer, 0x98);
+      size_t blockLength = swap32(*((uint32*)&header[8]));
 
-         for (int i = 0; i < 4; i++)
-            mmc_bankrom(8, 0x8000 + (i * 0x2000), swap16(((uint16*)buffer)[i]));
+      if (!(buffer = malloc(blockLength + 1)))
+         goto _error;
 
-         if (machine->cart->chr_rom_banks)
-         {
-            for (int i = 0; i < 8; i++)
-               mmc_bankvrom(1, i * 0x400, swap16(((uint16*)buffer)[4 + i]));
-         }
-         else if (machine->cart->chr_ram)
-         {
-            for (int i = 0; i < 8; i++)
-               ppu_setpage(1, i, machine->cart->chr_ram);
-         }
+      _fread(buffer, blockLength);
+      load_block((char *)header, buffer, blockLength);
+      have_vram |= memcmp(header, "VRAM", 4) == 0;
+      have_sram |= memcmp(header, "SRAM", 4) == 0;
 
-         if (machine->mapper->set_state)
-            machine->mapper->set_state(buffer + 0x18);
-      }
-
-
-      /****************************************************/
+      free(buffer);
+      buffer = NULL;
+   }
 
-      else if (memcmp(buffer, "SOUN", 4) == 0)
-      {
-         MESSAGE_INFO("  - Found sound block\n");
+   /* close file, we're done */
+   fclose(file);
 
-         _fread(buffer, 0x16);
+   clear_missing_blocks(have_vram, have_sram);
 
-         apu_reset();
+   MESSAGE_INFO("state_load: Game restored\n");
 
-         for (int i = 0; i < 0x16; i++)
-            apu_write(0x4000 + i, buffer[i]);
-      }
+   return 0;
 
+_error:
+   MESSAGE_ERROR("state_load: Load failed!\n");
+   fclose(file);
+   free(buffer);
+   return -1;
+}
 
-      /****************************************************/
+#ifdef RETRO_GO
+/* The blob holds the same blocks as the file, one chunk each. VRAM and SRAM are always
+** included so that the layout only depends on the cartridge, rewind and rollback rely on it. */
+bool state_serialize(rg_emu_blob_t *blob)
+{
+   blob->version = 1;
 
-      else if (memcmp(buffer, "INFO", 4) == 0)
+   for (int blk = 0; blk < BLOCK_COUNT; blk++)
+   {
+      size_t length = save_block(block_names[blk], NULL, false);
+      if (length > 0)
       {
-         MESSAGE_INFO("  - Found info block\n");
-
-         _fread(buffer, 0x100);
-
-         // We don't currently do anything with it, it's just to help report bugs to me :)
+         uint8 *data = rg_emu_blob_put(blob, block_names[blk], NULL, length);
+         if (data)
+            save_block(block_names[blk], data, false);
       }
+   }
 
+   return true;
+}
 
-      /****************************************************/
-
-      else
-      {
-         MESSAGE_ERROR("Found unknown block type!\n");
-      }
+bool state_deserialize(rg_emu_blob_t *blob)
+{
+   if (blob->version != 1)
+   {
+      MESSAGE_ERROR("state_deserialize: Unsupported version %d.\n", (int)blob->version);
+      return false;
    }
 
-   /* close file, we're done */
-   fclose(file);
+   bool have_vram = false, have_sram = false;
 
-   MESSAGE_INFO("state_load: Game restored\n");
+   for (int blk = 0; blk < BLOCK_COUNT; blk++)
+   {
+      size_t length;
+      const uint8 *data = rg_emu_blob_get(blob, block_names[blk], &length);
+      if (data && !load_block(block_names[blk], data, length))
+         return false;
+      have_vram |= data && memcmp(block_names[blk], "VRAM", 4) == 0;
+      have_sram |= data && memcmp(block_names[blk], "SRAM", 4) == 0;
+   }
 
-   return 0;
+   // Blobs saved by older versions may still skip them
+   clear_missing_blocks(have_vram, have_sram);
 
-_error:
-   MESSAGE_ERROR("state_load: Load failed!\n");
-   fclose(file);
-   return -1;
+   return true;
 }
+#endif
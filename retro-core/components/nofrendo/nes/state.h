@@ -23,5 +23,11 @@
 
 #pragma once
 
+#include "utils.h"
+
 int state_load(const char *fn);
 int state_save(const char *fn);
+#ifdef RETRO_GO
+bool state_serialize(rg_emu_blob_t *blob);
+bool state_deserialize(rg_emu_blob_t *blob);
+#endif
@@ -320,6 +320,20 @@ RunPCE(void)
 }
 
 
+/**
+ * Rebuild what isn't part of the state
+ */
+static void
+state_restored(void)
+{
+	for (int i = 0; i < 8; i++)
+		pce_bank_set(i, PCE.MMR[i]);
+
+	gfx_reset(true);
+	PCE.VDC.mode_chg = 1;
+}
+
+
 /**
  * Load saved state
  */
@@ -368,11 +382,7 @@ LoadState(const char *name)
 		fseek(fp, block_end, SEEK_SET);
 	}
 
-	for (int i = 0; i < 8; i++)
-		pce_bank_set(i, PCE.MMR[i]);
-
-	gfx_reset(true);
-	PCE.VDC.mode_chg = 1;
+	state_restored();
 	ret = 0;
 
 _cleanup:
@@ -424,6 +434,50 @@ _cleanup:
 }
 
 
+#ifdef RETRO_GO
+/**
+ * Serialize current state, one chunk per variable
+ */
+bool
+SerializeState(rg_emu_blob_t *blob)
+{
+	for (save_var_t *var = SaveStateVars; var->ptr; var++)
+	{
+		void *ptr = var->desc.type == 5 ? *((void**)var->ptr) : var->ptr;
+		rg_emu_blob_put(blob, var->desc.key, ptr, var->desc.len);
+	}
+	blob->version = 1;
+
+	return true;
+}
+
+
+/**
+ * Deserialize state, missing variables are left untouched like LoadState does
+ */
+bool
+DeserializeState(rg_emu_blob_t *blob)
+{
+	if (blob->version != 1)
+	{
+		MESSAGE_ERROR("Deserializing state failed: Version mismatch\n");
+		return false;
+	}
+
+	for (save_var_t *var = SaveStateVars; var->ptr; var++)
+	{
+		void *ptr = var->desc.type == 5 ? *((void**)var->ptr) : var->ptr;
+		if (!rg_emu_blob_read(blob, var->desc.key, ptr, var->desc.len))
+			MESSAGE_WARN("Missing %s\n", var->desc.key);
+	}
+
+	state_restored();
+
+	return true;
+}
+#endif
+
+
 /**
  * Cleanup and quit (not used in retro-go)
  */
@@ -73,6 +73,10 @@
 
 int LoadState(const char *name);
 int SaveState(const char *name);
+#ifdef RETRO_GO
+bool SerializeState(rg_emu_blob_t *blob);
+bool DeserializeState(rg_emu_blob_t *blob);
+#endif
 void ResetPCE(bool);
 void RunPCE(void);
 void ShutdownPCE();
@@ -4,7 +4,6 @@
 #include <unistd.h>
 #include <gnuboy.h>
 
-static bool fullFrame = false;
 static int skipFrames = 20; // The 20 is to hide startup flicker in some games
 
 static const char *sramFile;
@@ -27,19 +26,23 @@ static void update_rtc_time(void)
     gnuboy_set_time(info->tm_yday, info->tm_hour, info->tm_min, info->tm_sec);
 }
 
-static bool screenshot_handler(const char *filename, int width, int height)
+static void run_frame(bool draw, bool speculative)
 {
-    return rg_display_save_frame(filename, currentUpdate, width, height);
+    // The real frame's samples stay in the buffer until they're submitted, the speculative ones are dropped
+    size_t pos = host.audio.pos;
+    gnuboy_run(draw);
+    if (speculative)
+        host.audio.pos = pos;
 }
 
-static bool save_state_handler(const char *filename)
+static bool screenshot_handler(const char *filename, int width, int height)
 {
-    return gnuboy_save_state(filename) == 0;
+    return rg_display_save_frame(filename, currentUpdate, width, height);
 }
 
-static bool load_state_handler(const char *filename)
+static bool state_loaded(bool success)
 {
-    if (gnuboy_load_state(filename) != 0)
+    if (!success)
     {
         // If a state fails to load then we should behave as we do on boot
         // which is a hard reset and load sram if present
@@ -59,12 +62,21 @@ static bool load_state_handler(const char *filename)
     return true;
 }
 
+static bool load_state_handler(const char *filename)
+{
+    return state_loaded(gnuboy_load_state(filename) == 0);
+}
+
+static bool deserialize_handler(rg_emu_blob_t *blob)
+{
+    return state_loaded(gnuboy_deserialize(blob));
+}
+
 static bool reset_handler(bool hard)
 {
     gnuboy_reset(hard);
     update_rtc_time();
 
-    fullFrame = false;
     skipFrames = 20;
     autoSaveSRAM_Timer = 0;
 
@@ -124,6 +136,14 @@ static rg_gui_event_t sram_autosave_cb(rg_gui_option_t *option, rg_gui_event_t e
     return RG_DIALOG_VOID;
 }
 
+static rg_gui_event_t rom_cache_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    int resident, hits, misses;
+    gnuboy_get_rom_cache_stats(&resident, &hits, &misses, NULL);
+    sprintf(option->value, "%d banks %d%%", resident, hits + misses ? (int)(hits * 100LL / (hits + misses)) : 100);
+    return RG_DIALOG_VOID;
+}
+
 static rg_gui_event_t rtc_t_update_cb(rg_gui_option_t *option, rg_gui_event_t event)
 {
     int d, h, m, s;
@@ -186,9 +206,9 @@ static rg_gui_event_t rtc_update_cb(rg_gui_option_t *option, rg_gui_event_t even
 
 static void blit_frame(void)
 {
-    rg_video_update_t *previousUpdate = &updates[currentUpdate == &updates[0]];
-    fullFrame = rg_display_queue_update(currentUpdate, previousUpdate) == RG_UPDATE_FULL;
-    currentUpdate = previousUpdate;
+    rg_display_queue_update(currentUpdate, previousUpdate);
+    previousUpdate = currentUpdate;
+    currentUpdate = rg_display_acquire(updates, 2);
     host.video.buffer = currentUpdate->buffer;
 }
 
@@ -196,7 +216,8 @@ void gbc_main(void)
 {
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
-        .saveState = &save_state_handler,
+        .serialize = &gnuboy_serialize,
+        .deserialize = &deserialize_handler,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
     };
@@ -204,6 +225,7 @@ void gbc_main(void)
         {0, "Palette", "7/7", 1, &palette_update_cb},
         {0, "RTC config", "00:00", 1, &rtc_update_cb},
         {0, "SRAM autosave", "Off", 1, &sram_autosave_cb},
+        {0, "ROM cache", "000 banks 100%", 1, &rom_cache_cb},
         RG_DIALOG_CHOICE_LAST
     };
 
@@ -225,6 +247,14 @@ void gbc_main(void)
     if (gnuboy_init(app->sampleRate, true, GB_PIXEL_565_BE, &blit_frame) < 0)
         RG_PANIC("Emulator init failed!");
 
+    // Large ROMs don't fit in PSRAM, keep some for everything else and let the cache evict the rest
+#ifdef ESP_PLATFORM
+    int romCacheBanks = ((int)heap_caps_get_free_size(MALLOC_CAP_SPIRAM) - 0x80000) / 0x4000;
+    gnuboy_set_rom_cache(RG_MAX(romCacheBanks, 16), 1);
+#else
+    gnuboy_set_rom_cache(0, 1);
+#endif
+
     // Load ROM
     if (gnuboy_load_rom(app->romPath) < 0)
         RG_PANIC("ROM Loading failed!");
@@ -290,10 +320,11 @@ void gbc_main(void)
             joystick_old = joystick;
         }
 
-        int64_t startTime = rg_system_timer();
-        bool drawFrame = !skipFrames;
+        bool drawFrame = rg_system_frame_begin(skipFrames > 0);
+        if (skipFrames > 0)
+            skipFrames--;
 
-        gnuboy_run(drawFrame);
+        rg_emu_run_frame(drawFrame, &run_frame);
 
         if (autoSaveSRAM > 0)
         {
@@ -310,25 +341,8 @@ void gbc_main(void)
             }
         }
 
-        int elapsed = rg_system_timer() - startTime;
-
-        if (skipFrames == 0)
-        {
-            int frameTime = 1000000 / (60 * app->speed);
-            if (elapsed > frameTime - 2000) // It takes about 2ms to copy the audio buffer
-                skipFrames = (elapsed + frameTime / 2) / frameTime;
-            else if (drawFrame && fullFrame) // This could be avoided when scaling != full
-                skipFrames = 1;
-            if (app->speed > 1.f) // This is a hack until we account for audio speed...
-                skipFrames += (int)app->speed;
-        }
-        else if (skipFrames > 0)
-        {
-            skipFrames--;
-        }
-
         // Tick before submitting audio/syncing
-        rg_system_tick(elapsed);
+        rg_system_frame_end(0);
 
         // Audio is used to pace emulation :)
         rg_audio_submit((void*)host.audio.buffer, host.audio.pos >> 1);
@@ -59,17 +59,24 @@ static void gw_check_time()
         gw_system_set_time(time);
     }
 }
-static bool gw_system_SaveState(const char *pathName)
+static bool gw_system_Serialize(rg_emu_blob_t *blob)
 {
-    printf("Saving state...\n");
     gw_state_t state_save_buffer = {0};
     gw_state_save(&state_save_buffer);
-    FILE *fp = fopen(pathName, "wb");
-    if (!fp)
+    blob->version = 1;
+    rg_emu_blob_put(blob, "GW", &state_save_buffer, sizeof(gw_state_t));
+    return true;
+}
+
+static bool gw_system_Deserialize(rg_emu_blob_t *blob)
+{
+    gw_state_t state_save_buffer;
+    size_t length;
+    const void *data = rg_emu_blob_get(blob, "GW", &length);
+    if (!data || length != sizeof(gw_state_t))
         return false;
-    bool success = fwrite(&state_save_buffer, sizeof(gw_state_t), 1, fp);
-    fclose(fp);
-    return success;
+    memcpy(&state_save_buffer, data, sizeof(gw_state_t));
+    return gw_state_load(&state_save_buffer);
 }
 
 static bool gw_system_LoadState(const char *pathName)
@@ -119,7 +126,8 @@ void gw_main(void)
 {
     const rg_handlers_t handlers = {
         .loadState = &gw_system_LoadState,
-        .saveState = &gw_system_SaveState,
+        .serialize = &gw_system_Serialize,
+        .deserialize = &gw_system_Deserialize,
         .screenshot = &screenshot_handler,
     };
     const rg_gui_option_t options[] = {
@@ -243,8 +251,7 @@ void gw_main(void)
             softkey_alarm_pressed = 0;
         }
 
-        int64_t startTime = rg_system_timer();
-        bool drawFrame = true;
+        bool drawFrame = rg_system_frame_begin(false);
 
         /* Emulate and Blit */
         // Call the emulator function with number of clock cycles
@@ -259,9 +266,7 @@ void gw_main(void)
         }
         /****************************************************************************/
 
-        int elapsed = rg_system_timer() - startTime;
-
-        rg_system_tick(elapsed);
+        rg_system_frame_end(0);
 
         /* copy audio samples for DMA */
         rg_audio_sample_t mixbuffer[GW_AUDIO_BUFFER_LENGTH];
@@ -109,31 +109,52 @@ static bool screenshot_handler(const char *filename, int width, int height)
     return rg_display_save_frame(filename, currentUpdate, width, height);
 }
 
-static bool save_state_handler(const char *filename)
+static bool load_state_handler(const char *filename)
 {
+    LSS_FILE fp = {NULL, 0, 0};
+    size_t size = 0;
     bool ret = false;
-    FILE *fp;
 
-    if ((fp = fopen(filename, "wb")))
+    if (rg_storage_read_file(filename, (void **)&fp.memptr, &size))
     {
-        ret = lynx->ContextSave(fp);
-        fclose(fp);
+        fp.index_limit = size;
+        ret = lynx->ContextLoad(&fp);
+        free(fp.memptr);
     }
 
+    if (!ret) lynx->Reset();
+
     return ret;
 }
 
-static bool load_state_handler(const char *filename)
+static bool serialize_handler(rg_emu_blob_t *blob)
 {
-    bool ret = false;
-    FILE *fp;
+    // The first pass only measures the snapshot
+    LSS_FILE fp = {NULL, 0, 0};
+    lynx->ContextSave(&fp);
 
-    if ((fp = fopen(filename, "rb")))
+    UBYTE *data = (UBYTE *)rg_emu_blob_put(blob, "LSS", NULL, fp.index);
+    blob->version = 1;
+
+    if (data)
     {
-        ret = lynx->ContextLoad(fp);
-        fclose(fp);
+        fp = {data, 0, fp.index};
+        return lynx->ContextSave(&fp);
     }
 
+    return true;
+}
+
+static bool deserialize_handler(rg_emu_blob_t *blob)
+{
+    size_t size = 0;
+    const void *data = rg_emu_blob_get(blob, "LSS", &size);
+    LSS_FILE fp = {(UBYTE *)data, 0, (ULONG)size};
+    bool ret = false;
+
+    if (data && blob->version == 1)
+        ret = lynx->ContextLoad(&fp);
+
     if (!ret) lynx->Reset();
 
     return ret;
@@ -151,7 +172,8 @@ extern "C" void lynx_main(void)
 {
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
-        .saveState = &save_state_handler,
+        .serialize = &serialize_handler,
+        .deserialize = &deserialize_handler,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
         .event = NULL,
@@ -191,9 +213,7 @@ extern "C" void lynx_main(void)
 
     set_display_mode();
 
-    float sampleTime = 1000000.f / app->sampleRate;
-    long skipFrames = 0;
-    bool fullFrame = 0;
+    const float sampleTime = 1000000.f / app->sampleRate;
 
     // Start emulation
     while (1)
@@ -206,12 +226,10 @@ extern "C" void lynx_main(void)
                 rg_gui_game_menu();
             else
                 rg_gui_options_menu();
-            sampleTime = 1000000.f / (app->sampleRate * app->speed);
             rg_audio_set_sample_rate(app->sampleRate * app->speed);
         }
 
-        int64_t startTime = rg_system_timer();
-        bool drawFrame = !skipFrames;
+        bool drawFrame = rg_system_frame_begin(false);
         ULONG buttons = 0;
 
     	if (joystick & RG_KEY_UP)     buttons |= dpad_mapped_up;
@@ -229,33 +247,15 @@ extern "C" void lynx_main(void)
 
         if (drawFrame)
         {
-            rg_video_update_t *previousUpdate = &updates[currentUpdate == &updates[0]];
+            rg_display_queue_update(currentUpdate, previousUpdate);
 
-            fullFrame = rg_display_queue_update(currentUpdate, previousUpdate) == RG_UPDATE_FULL;
-
-            currentUpdate = previousUpdate;
+            previousUpdate = currentUpdate;
+            currentUpdate = rg_display_acquire(updates, 2);
             gPrimaryFrameBuffer = (UBYTE*)currentUpdate->buffer;
         }
 
-        int elapsed = rg_system_timer() - startTime;
-
-        // See if we need to skip a frame to keep up
-        if (skipFrames == 0)
-        {
-            if (app->speed > 1.f)
-                skipFrames += (int)app->speed * 2;
-            // The Lynx uses a variable framerate so we use the count of generated audio samples as reference instead
-            else if (elapsed > ((gAudioBufferPointer / 2) * sampleTime))
-                skipFrames += 1;
-            else if (drawFrame && fullFrame) // This could be avoided when scaling != full
-                skipFrames += 1;
-        }
-        else if (skipFrames > 0)
-        {
-            skipFrames--;
-        }
-
-        rg_system_tick(elapsed);
+        // The Lynx uses a variable framerate so we use the count of generated audio samples as reference instead
+        rg_system_frame_end((gAudioBufferPointer / 2) * sampleTime);
 
         rg_audio_submit(audioBuffer, gAudioBufferPointer >> 1);
         gAudioBufferPointer = 0;
@@ -1,14 +1,15 @@
 #include "shared.h"
 
+#include <sys/stat.h>
 #include <nofrendo.h>
 #include <nes/nes.h>
 
-static int fullFrame = 0;
 static int overscan = true;
 static int autocrop = 0;
 static int palette = 0;
 static int crop_h, crop_v;
 static nes_t *nes;
+static short *speculativeAudio;
 
 static const char *SETTING_AUTOCROP = "autocrop";
 static const char *SETTING_OVERSCAN = "overscan";
@@ -23,14 +24,27 @@ static void event_handler(int event, void *arg)
 #endif
 }
 
-static bool screenshot_handler(const char *filename, int width, int height)
+static void run_frame(bool draw, bool speculative)
 {
-	return rg_display_save_frame(filename, currentUpdate, width, height);
+    if (speculative)
+    {
+        // Keep the real frame's samples, they haven't been submitted yet
+        short *buffer = nes->apu->buffer;
+        if (!speculativeAudio)
+            speculativeAudio = rg_alloc((app->sampleRate / 50 + 2) * 2 * sizeof(short), MEM_ANY); // As apu_init()
+        nes->apu->buffer = speculativeAudio;
+        nes_emulate(draw);
+        nes->apu->buffer = buffer;
+    }
+    else
+    {
+        nes_emulate(draw);
+    }
 }
 
-static bool save_state_handler(const char *filename)
+static bool screenshot_handler(const char *filename, int width, int height)
 {
-    return state_save(filename) == 0;
+	return rg_display_save_frame(filename, currentUpdate, width, height);
 }
 
 static bool load_state_handler(const char *filename)
@@ -43,6 +57,16 @@ static bool load_state_handler(const char *filename)
     return true;
 }
 
+static bool deserialize_handler(rg_emu_blob_t *blob)
+{
+    if (!state_deserialize(blob))
+    {
+        nes_reset(true);
+        return false;
+    }
+    return true;
+}
+
 static bool reset_handler(bool hard)
 {
     nes_reset(hard);
@@ -161,9 +185,40 @@ static void blit_screen(uint8 *bmp)
     // A rolling average should be used for autocrop == 1, it causes jitter in some games...
     // int crop_h = (autocrop == 2) || (autocrop == 1 && nes->ppu->left_bg_counter > 210) ? 8 : 0;
     currentUpdate->buffer = NES_SCREEN_GETPTR(bmp, crop_h, crop_v);
-    fullFrame = rg_display_queue_update(currentUpdate, previousUpdate) == RG_UPDATE_FULL;
+    rg_display_queue_update(currentUpdate, previousUpdate);
     previousUpdate = currentUpdate;
-    currentUpdate = &updates[currentUpdate == &updates[0]];
+    // nofrendo alternates between its two framebuffers, so we must wait for that specific one
+    currentUpdate = rg_display_acquire(&updates[currentUpdate == &updates[0]], 1);
+}
+
+// Hashing a large ROM is noticeable at boot, so we keep the CRC in the cache folder. The file's size
+// and mtime tell us when it's stale.
+typedef struct
+{
+    uint32_t size;
+    uint32_t mtime;
+    uint32_t checksum;
+} crc_cache_t;
+
+static crc_cache_t load_crc_cache(const char *cachePath, const char *romPath)
+{
+    crc_cache_t cache = {0};
+    struct stat st;
+    void *data = NULL;
+    size_t length = 0;
+
+    if (stat(romPath, &st) != 0)
+        return cache;
+
+    if (rg_storage_read_file(cachePath, &data, &length) && length == sizeof(cache))
+        memcpy(&cache, data, sizeof(cache));
+    free(data);
+
+    if (cache.size != (uint32_t)st.st_size || cache.mtime != (uint32_t)st.st_mtime)
+        cache.checksum = 0;
+    cache.size = st.st_size;
+    cache.mtime = st.st_mtime;
+    return cache;
 }
 
 static void nsf_draw_overlay(void)
@@ -187,7 +242,8 @@ void nes_main(void)
 {
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
-        .saveState = &save_state_handler,
+        .serialize = &state_serialize,
+        .deserialize = &deserialize_handler,
         .reset = &reset_handler,
         .event = &event_handler,
         .screenshot = &screenshot_handler,
@@ -212,6 +268,11 @@ void nes_main(void)
         RG_PANIC("Init failed.");
     }
 
+    char *crcCachePath = rg_emu_get_path(RG_PATH_CACHE_FILE, app->romPath);
+    strcat(crcCachePath, ".crc");
+    crc_cache_t crcCache = load_crc_cache(crcCachePath, app->romPath);
+    rom_setchecksum(crcCache.checksum);
+
     int ret = nes_insertcart(app->romPath, RG_BASE_PATH_BIOS "/fds_bios.bin");
     if (ret == -1)
         RG_PANIC("ROM load failed.");
@@ -222,6 +283,14 @@ void nes_main(void)
     else if (ret < 0)
         RG_PANIC("Unsupported ROM.");
 
+    if (crcCache.checksum != nes->cart->checksum && crcCache.size)
+    {
+        crcCache.checksum = nes->cart->checksum;
+        rg_storage_mkdir(rg_dirname(crcCachePath));
+        rg_storage_write_file(crcCachePath, &crcCache, sizeof(crcCache));
+    }
+    free(crcCachePath);
+
     app->refreshRate = nes->refresh_rate;
     nes->blit_func = blit_screen;
 
@@ -240,7 +309,7 @@ void nes_main(void)
         rg_emu_load_state(app->saveSlot);
     }
 
-    int skipFrames = 0;
+    int nsfFrames = 0;
     int nsfPlayer = nes->cart->mapper_number == 31;
 
     while (true)
@@ -258,8 +327,7 @@ void nes_main(void)
                 rg_display_clear(C_BLACK);
         }
 
-        int64_t startTime = rg_system_timer();
-        bool drawFrame = !skipFrames && !nsfPlayer;
+        bool drawFrame = rg_system_frame_begin(nsfPlayer);
         int buttons = 0;
 
         if (joystick & RG_KEY_START)  buttons |= NES_PAD_START;
@@ -272,30 +340,13 @@ void nes_main(void)
         if (joystick & RG_KEY_B)      buttons |= NES_PAD_B;
         input_update(0, buttons);
 
-        nes_emulate(drawFrame);
+        rg_emu_run_frame(drawFrame, &run_frame);
 
-        int elapsed = rg_system_timer() - startTime;
-
-        if (skipFrames == 0)
-        {
-            int frameTime = 1000000 / (nes->refresh_rate * app->speed);
-            if (elapsed > frameTime - 2000) // It takes about 2ms to copy the audio buffer
-                skipFrames = (elapsed + frameTime / 2) / frameTime;
-            else if (drawFrame && fullFrame) // This could be avoided when scaling != full
-                skipFrames = 1;
-            else if (nsfPlayer)
-                skipFrames = 10, nsf_draw_overlay();
-
-            if (app->speed > 1.f) // This is a hack until we account for audio speed...
-                skipFrames += (int)app->speed;
-        }
-        else if (skipFrames > 0)
-        {
-            skipFrames--;
-        }
+        if (nsfPlayer && ++nsfFrames % 10 == 0)
+            nsf_draw_overlay();
 
         // Tick before submitting audio/syncing
-        rg_system_tick(elapsed);
+        rg_system_frame_end(0);
 
         // Audio is used to pace emulation :)
         rg_audio_submit((void*)nes->apu->buffer, nes->apu->samples_per_frame);
@@ -8,16 +8,18 @@
 #include <stdio.h>
 
 #include <pce-go.h>
+#include <pce.h>
 #include <psg.h>
 
 #undef AUDIO_SAMPLE_RATE
 #define AUDIO_SAMPLE_RATE 22050
 
 static bool emulationPaused = false; // This should probably be a mutex
+static bool speculating = false; // Run-ahead frames, the audio task must leave the PSG alone
 static int current_height = 0;
 static int current_width = 0;
 static int overscan = false;
-static int skipFrames = 0;
+static bool drawFrame = true;
 static uint8_t *framebuffers[2];
 
 static const char *SETTING_OVERSCAN  = "overscan";
@@ -54,33 +56,23 @@ uint8_t *osd_gfx_framebuffer(int width, int height)
         current_width = width;
         current_height = height;
     }
-    return skipFrames ? NULL : currentUpdate->buffer;
+    return drawFrame ? currentUpdate->buffer : NULL;
 }
 
 void osd_vsync(void)
 {
-    static int64_t lasttime, prevtime;
+    static int64_t lasttime;
 
-    if (skipFrames == 0)
+    if (drawFrame)
     {
-        rg_video_update_t *previousUpdate = &updates[currentUpdate == &updates[0]];
         rg_display_queue_update(currentUpdate, NULL);
-        currentUpdate = previousUpdate;
+        previousUpdate = currentUpdate;
+        currentUpdate = rg_display_acquire(updates, 2);
     }
 
-    // See if we need to skip a frame to keep up
-    if (skipFrames == 0)
-    {
-        if (app->speed > 1.f)
-            skipFrames = app->speed * 2.5f;
-        else
-            skipFrames = 1;
-    }
-    else if (skipFrames > 0)
-    {
-        skipFrames--;
-    }
+    rg_system_frame_end(0);
 
+    // Audio runs in its own task so we have to pace ourselves
     int64_t curtime = rg_system_timer();
     int frameTime = 1000000 / 60 / app->speed;
     int sleep = frameTime - (curtime - lasttime);
@@ -93,18 +85,14 @@ void osd_vsync(void)
     {
         usleep(sleep);
     }
-    else if (sleep < -(frameTime / 2))
-    {
-        skipFrames++;
-    }
-
-    rg_system_tick(curtime - prevtime);
 
-    prevtime = rg_system_timer();
+    curtime = rg_system_timer();
     lasttime += frameTime;
 
-    if ((lasttime + frameTime) < prevtime)
-        lasttime = prevtime;
+    if ((lasttime + frameTime) < curtime)
+        lasttime = curtime;
+
+    drawFrame = rg_system_frame_begin(false);
 }
 
 void osd_input_read(uint8_t joypads[8])
@@ -145,21 +133,24 @@ static void audioTask(void *arg)
         // TODO: Clearly we need to add a better way to remain in sync with the main task...
         while (emulationPaused)
             rg_task_delay(20);
+        while (speculating)
+            rg_task_delay(1);
         psg_update((void*)audioBuffer, numSamples, 0xFF);
         rg_audio_submit(audioBuffer, numSamples);
     }
 }
 
-static bool screenshot_handler(const char *filename, int width, int height)
+static void run_frame(bool draw, bool speculative)
 {
-    // We must use previous update because at this point current has been wiped.
-    rg_video_update_t *previousUpdate = &updates[currentUpdate == &updates[0]];
-    return rg_display_save_frame(filename, previousUpdate, width, height);
+    speculating = speculative;
+    drawFrame = draw;
+    pce_run();
 }
 
-static bool save_state_handler(const char *filename)
+static bool screenshot_handler(const char *filename, int width, int height)
 {
-    return SaveState(filename) == 0;
+    // We must use previous update because at this point current has been wiped.
+    return rg_display_save_frame(filename, previousUpdate ?: currentUpdate, width, height);
 }
 
 static bool load_state_handler(const char *filename)
@@ -182,7 +173,8 @@ void pce_main(void)
 {
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
-        .saveState = &save_state_handler,
+        .serialize = &SerializeState,
+        .deserialize = &DeserializeState, // Only fails before touching anything
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
     };
@@ -218,7 +210,17 @@ void pce_main(void)
     }
 
     emulationPaused = false;
-    RunPCE();
+
+    // Same as RunPCE(), with run-ahead
+    while (true)
+    {
+        bool draw = drawFrame;
+        osd_input_read(PCE.Joypad.regs);
+        rg_emu_run_frame(draw, &run_frame);
+        speculating = false;
+        drawFrame = draw;
+        osd_vsync();
+    }
 
     RG_PANIC("PCE-GO died.");
 }
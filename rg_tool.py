@@ -1,5 +1,6 @@
 #!/usr/bin/env python3
 import argparse
+import base64
 import hashlib
 import subprocess
 import shutil
@@ -51,22 +52,6 @@ class Symbol:
         return text.replace("\n", "\n  ")
 
 
-class CallBranch:
-    def __init__(self, name, parent=None):
-        self.name = name
-        self.parent = parent
-        self.run_time = 0;
-        self.children = dict()
-
-    def add_frame(self, caller, callee, num_calls, run_time):
-        if callee.hash not in self.children:
-            self.children[callee.hash] = [caller, callee, num_calls, run_time]
-        else:
-            self.children[callee.hash][2] += num_calls
-            self.children[callee.hash][3] += run_time
-        self.run_time += run_time
-
-
 def debug_print(text):
     print("\033[0;33m%s\033[0m" % text)
 
@@ -87,32 +72,13 @@ def find_symbol(elf_file, addr):
 symbols_cache = dict()
 
 
-def analyze_profile(frames):
-    flatten = True # False is currently not working correctly
-    tree = dict()
-
-    for caller, callee, num_calls, run_time in frames:
-        branch = '*' if flatten else caller.name + "@" + os.path.basename(caller.source)
-        if branch not in tree:
-            tree[branch] = CallBranch(branch, caller)
-        tree[branch].add_frame(caller, callee, num_calls, run_time)
-
-    tree_sorted = sorted(tree.values(), key=lambda x: x.run_time, reverse=True)
-
-    for branch in tree_sorted:
-        if branch.run_time < 100_000:
-            continue
-
-        debug_print("%-68s %dms" % (branch.name, branch.run_time / 1000))
-        children = sorted(branch.children.values(), key=lambda x: x[3], reverse=True)
-
-        for caller, callee, num_calls, run_time in children:
-            if run_time < 10_000:
-                continue
-            debug_print("    %-32s %-20s %-10d %dms"
-                % (callee.name, os.path.basename(callee.source), num_calls, run_time / 1000))
-
-        debug_print("")
+def analyze_profile(elf, data, output_dir):
+    # The dump is binary, tools/profile.py does the decoding, symbol resolution and flamegraph
+    profile_file = os.path.join(output_dir, "profile.bin")
+    with open(profile_file, "wb") as f:
+        f.write(data)
+    folded_file = os.path.join(output_dir, "profile.folded")
+    subprocess.run([sys.executable, "tools/profile.py", elf, profile_file, "--folded", folded_file, "--top", "15"])
 
 
 def build_firmware(apps, device_type, fw_format="odroid-go"):
@@ -234,7 +200,7 @@ def monitor_app(app, port, baudrate=115200):
 
     # To do: detect ctrl+r ctrl+c etc
 
-    profile_frames = list()
+    profile_chunks = list()
 
     line_bytes = b''
     while 1:
@@ -263,18 +229,11 @@ def monitor_app(app, port, baudrate=115200):
 
                 if rg_debug_ns == "PROF":
                     if rg_debug_cmd == "BEGIN":
-                        profile_frames.clear()
+                        profile_chunks.clear()
                     if rg_debug_cmd == "END":
-                        analyze_profile(profile_frames)
+                        analyze_profile(elf, base64.b64decode("".join(profile_chunks)), os.path.dirname(elf))
                     if rg_debug_cmd == "DATA":
-                        m = re.match(r"([x0-9a-f]+)\s([x0-9a-f]+)\s(\d+)\s(\d+)", rg_debug_arg)
-                        if m:
-                            profile_frames.append([
-                                find_symbol(elf, m.group(1)),
-                                find_symbol(elf, m.group(2)),
-                                int(m.group(3)),
-                                int(m.group(4)),
-                            ])
+                        profile_chunks.append(rg_debug_arg.strip())
                     continue
 
             sys.stdout.buffer.write(b"\n")
@@ -112,6 +112,12 @@ void pio_reset(void)
   pio_ctrl_w(0xFF);
 }
 
+/* Port state after the SMS context was replaced, without the side effects of a write */
+void pio_restored(void)
+{
+  io_current = &io_lut[sms.territory][sms.ioctrl];
+}
+
 void pio_shutdown(void)
 {
   /* Nothing to do */
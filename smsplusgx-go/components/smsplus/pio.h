@@ -60,6 +60,7 @@ enum {
 /* Function prototypes */
 extern void pio_init(void);
 extern void pio_reset(void);
+extern void pio_restored(void);
 extern void pio_shutdown(void);
 extern void pio_ctrl_w(uint8 data);
 extern uint8 pio_port_r(int offset);
@@ -39,6 +39,51 @@ system_save_state: sizeof Z80=72
 system_save_state: sizeof SN76489_Context=92
 */
 
+static void state_restored(void)
+{
+  int i;
+
+  if ((sms.console != CONSOLE_COLECO) && (sms.console != CONSOLE_SG1000))
+  {
+    /* Cartridge by default */
+    slot.rom    = cart.rom;
+    slot.pages  = cart.pages;
+    slot.mapper = cart.mapper;
+    slot.fcr = &cart.fcr[0];
+
+    /* Restore mapping */
+    mapper_reset();
+    cpu_readmap[0]  = &slot.rom[0];
+    if (slot.mapper != MAPPER_KOREA_MSX)
+    {
+      mapper_16k_w(0,slot.fcr[0]);
+      mapper_16k_w(1,slot.fcr[1]);
+      mapper_16k_w(2,slot.fcr[2]);
+      mapper_16k_w(3,slot.fcr[3]);
+    }
+    else
+    {
+      mapper_8k_w(0,slot.fcr[0]);
+      mapper_8k_w(1,slot.fcr[1]);
+      mapper_8k_w(2,slot.fcr[2]);
+      mapper_8k_w(3,slot.fcr[3]);
+    }
+  }
+
+  // /* Force full pattern cache update */
+  // bg_list_index = 0x200;
+  // for(i = 0; i < 0x200; i++)
+  // {
+  //   bg_name_list[i] = i;
+  //   bg_name_dirty[i] = -1;
+  // }
+
+  /* Restore palette */
+  for(i = 0; i < PALETTE_SIZE; i++)
+    palette_sync(i);
+}
+
+
 int system_save_state(void *mem)
 {
   int i;
@@ -134,42 +179,90 @@ void system_load_state(void *mem)
   psg->dClock = psg_dClock;
 
 
-  if ((sms.console != CONSOLE_COLECO) && (sms.console != CONSOLE_SG1000))
+  state_restored();
+}
+
+
+#ifdef RETRO_GO
+/* Same contents as the file, one chunk per component */
+bool system_serialize(rg_emu_blob_t *blob)
+{
+  blob->version = STATE_VERSION;
+
+  rg_emu_blob_put(blob, "sms", &sms, sizeof(sms));
+  rg_emu_blob_put(blob, "vdp", &vdp, sizeof(vdp));
+  rg_emu_blob_put(blob, "cart.fcr", cart.fcr, sizeof(cart.fcr));
+  rg_emu_blob_put(blob, "cart.sram", cart.sram, 0x8000);
+  rg_emu_blob_put(blob, "Z80", &Z80, sizeof(Z80));
+  rg_emu_blob_put(blob, "z80.cycles", &z80_cycle_count, sizeof(z80_cycle_count));
+  rg_emu_blob_put(blob, "SN76489", SN76489_GetContextPtr(0), SN76489_GetContextSize());
+
+  return true;
+}
+
+
+bool system_deserialize(rg_emu_blob_t *blob)
+{
+  size_t length;
+  const uint8 *saved = rg_emu_blob_get(blob, "sms", &length);
+  uint8 console, display;
+
+  /* Nothing is touched until we know the state is for this machine */
+  if (blob->version != STATE_VERSION || !saved || length != sizeof(sms))
   {
-    /* Cartridge by default */
-    slot.rom    = cart.rom;
-    slot.pages  = cart.pages;
-    slot.mapper = cart.mapper;
-    slot.fcr = &cart.fcr[0];
+    MESSAGE_ERROR("Bad save data\n");
+    return false;
+  }
+  memcpy(&console, saved + offsetof(sms_t, console), sizeof(console));
+  if (console != sms.console)
+  {
+    MESSAGE_ERROR("Bad save data\n");
+    return false;
+  }
 
-    /* Restore mapping */
-    mapper_reset();
-    cpu_readmap[0]  = &slot.rom[0];
-    if (slot.mapper != MAPPER_KOREA_MSX)
-    {
-      mapper_16k_w(0,slot.fcr[0]);
-      mapper_16k_w(1,slot.fcr[1]);
-      mapper_16k_w(2,slot.fcr[2]);
-      mapper_16k_w(3,slot.fcr[3]);
-    }
-    else
-    {
-      mapper_8k_w(0,slot.fcr[0]);
-      mapper_8k_w(1,slot.fcr[1]);
-      mapper_8k_w(2,slot.fcr[2]);
-      mapper_8k_w(3,slot.fcr[3]);
-    }
+  /* Rewind and rollback restore a state of the same game every few frames. As long as the
+     timing is the same, replacing the contexts is enough: no reset, nothing reallocated. */
+  memcpy(&display, saved + offsetof(sms_t, display), sizeof(display));
+  bool timing_changed = display != sms.display;
+
+  /* Initialize everything */
+  if (timing_changed)
+    system_reset();
+
+  memcpy(&sms, saved, sizeof(sms));
+  rg_emu_blob_read(blob, "vdp", &vdp, sizeof(vdp));
+
+  /** restore video & audio settings (needed if timing changed) ***/
+  if (timing_changed)
+  {
+    vdp_init();
+    sound_init();
   }
+  else
+  {
+    vdp_restored();
+  }
+  pio_restored();
 
-  // /* Force full pattern cache update */
-  // bg_list_index = 0x200;
-  // for(i = 0; i < 0x200; i++)
-  // {
-  //   bg_name_list[i] = i;
-  //   bg_name_dirty[i] = -1;
-  // }
+  rg_emu_blob_read(blob, "cart.fcr", cart.fcr, sizeof(cart.fcr));
+  rg_emu_blob_read(blob, "cart.sram", cart.sram, 0x8000);
 
-  /* Restore palette */
-  for(i = 0; i < PALETTE_SIZE; i++)
-    palette_sync(i);
+  int (*irq_cb)(int) = Z80.irq_callback;
+  rg_emu_blob_read(blob, "Z80", &Z80, sizeof(Z80));
+  Z80.irq_callback = irq_cb;
+  /* Older blobs don't have it, 0 is what a reset would have left */
+  if (!rg_emu_blob_read(blob, "z80.cycles", &z80_cycle_count, sizeof(z80_cycle_count)))
+    z80_cycle_count = 0;
+
+  SN76489_Context* psg = (SN76489_Context*)SN76489_GetContextPtr(0);
+  float psg_Clock = psg->Clock;
+  float psg_dClock = psg->dClock;
+  rg_emu_blob_read(blob, "SN76489", psg, SN76489_GetContextSize());
+  psg->Clock = psg_Clock;
+  psg->dClock = psg_dClock;
+
+  state_restored();
+
+  return true;
 }
+#endif
@@ -32,5 +32,9 @@
 /* Function prototypes */
 extern int system_save_state(void *mem);
 extern void system_load_state(void *mem);
+#ifdef RETRO_GO
+extern bool system_serialize(rg_emu_blob_t *blob);
+extern bool system_deserialize(rg_emu_blob_t *blob);
+#endif
 
 #endif /* _STATE_H_ */
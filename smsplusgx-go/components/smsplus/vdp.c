@@ -123,6 +123,12 @@ static void viewport_check(void)
   }
 }
 
+/* Refresh what is derived from the registers after the VDP context was replaced */
+void vdp_restored(void)
+{
+  viewport_check();
+}
+
 /* Initialize VDP emulation */
 void vdp_init(void)
 {
@@ -90,6 +90,7 @@ extern const uint8 *vc_table[3];
 extern void vdp_init(void);
 extern void vdp_shutdown(void);
 extern void vdp_reset(void);
+extern void vdp_restored(void);
 extern uint8 vdp_read(int offset);
 extern void vdp_write(int offset, uint8 data);
 extern void gg_vdp_write(int offset, uint8 data);
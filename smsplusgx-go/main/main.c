@@ -6,17 +6,15 @@
 
 static rg_video_update_t updates[2];
 static rg_video_update_t *currentUpdate = &updates[0];
+static rg_video_update_t *previousUpdate = NULL;
 
 static rg_app_t *app;
-
-static uint32_t joystick1;
-static uint32_t *localJoystick = &joystick1;
+static rg_audio_sample_t mixbuffer[AUDIO_SAMPLE_RATE / 50 + 1]; // Same as snd.sample_count at 50Hz
+static size_t mixbuffer_count = 0;
 
 #ifdef RG_ENABLE_NETPLAY
-static uint32_t joystick2;
-static uint32_t *remoteJoystick = &joystick2;
-
 static bool netplay = false;
+static bool netplayDraw = false;
 #endif
 // --- MAIN
 
@@ -46,35 +44,158 @@ static void event_handler(int event, void *arg)
       default:
          break;
    }
-
-   if (netplay && rg_netplay_mode() == NETPLAY_MODE_GUEST)
-   {
-      localJoystick = &joystick2;
-      remoteJoystick = &joystick1;
-   }
-   else
-   {
-      localJoystick = &joystick1;
-      remoteJoystick = &joystick2;
-   }
 #endif
 }
 
-static bool screenshot_handler(const char *filename, int width, int height)
+static void map_joystick(int pad, uint32_t joystick)
 {
-	return rg_display_save_frame(filename, currentUpdate, width, height);
+    if (joystick & RG_KEY_UP)    input.pad[pad] |= INPUT_UP;
+    if (joystick & RG_KEY_DOWN)  input.pad[pad] |= INPUT_DOWN;
+    if (joystick & RG_KEY_LEFT)  input.pad[pad] |= INPUT_LEFT;
+    if (joystick & RG_KEY_RIGHT) input.pad[pad] |= INPUT_RIGHT;
+    if (joystick & RG_KEY_A)     input.pad[pad] |= INPUT_BUTTON2;
+    if (joystick & RG_KEY_B)     input.pad[pad] |= INPUT_BUTTON1;
+
+    if (IS_SMS)
+    {
+        if (joystick & RG_KEY_START)  input.system |= INPUT_PAUSE;
+        if (joystick & RG_KEY_SELECT) input.system |= INPUT_START;
+    }
+    else if (IS_GG)
+    {
+        if (joystick & RG_KEY_START)  input.system |= INPUT_START;
+        if (joystick & RG_KEY_SELECT) input.system |= INPUT_PAUSE;
+    }
 }
 
-static bool save_state_handler(const char *filename)
+// START (and START + LEFT) stand in for the Coleco keypad key each game needs
+static void map_keypad(int pad, uint32_t joystick)
 {
-    FILE* f = fopen(filename, "w");
-    if (f)
+    coleco.keypad[pad] = 0xff;
+
+    // 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, *, #
+    switch (cart.crc)
     {
-        system_save_state(f);
-        fclose(f);
-        return true;
+        case 0x798002a2:    // Frogger
+        case 0x32b95be0:    // Frogger
+        case 0x9cc3fabc:    // Alcazar
+        case 0x964db3bc:    // Fraction Fever
+            if (joystick & RG_KEY_START)
+            {
+                coleco.keypad[pad] = 10; // *
+            }
+            break;
+
+        case 0x1796de5e:    // Boulder Dash
+        case 0x5933ac18:    // Boulder Dash
+        case 0x6e5c4b11:    // Boulder Dash
+            if (joystick & RG_KEY_START)
+            {
+                coleco.keypad[pad] = 11; // #
+            }
+
+            if ((joystick & RG_KEY_START) && (joystick & RG_KEY_LEFT))
+            {
+                coleco.keypad[pad] = 1;
+            }
+            break;
+        case 0x109699e2:    // Dr. Seuss's Fix-Up The Mix-Up Puzzler
+        case 0x614bb621:    // Decathlon
+            if (joystick & RG_KEY_START)
+            {
+                coleco.keypad[pad] = 1;
+            }
+            if ((joystick & RG_KEY_START) && (joystick & RG_KEY_LEFT))
+            {
+                coleco.keypad[pad] = 10; // *
+            }
+            break;
+
+        default:
+            if (joystick & RG_KEY_START)
+            {
+                coleco.keypad[pad] = 1;
+            }
+            break;
+    }
+}
+
+static void update_input(uint32_t joystick)
+{
+    input.pad[0] = 0x00;
+    input.pad[1] = 0x00;
+    input.system = 0x00;
+
+    map_joystick(0, joystick);
+
+    if (!IS_SMS && !IS_GG) // Coleco
+    {
+        if (joystick & RG_KEY_SELECT)
+        {
+            rg_input_wait_for_key(RG_KEY_SELECT, false);
+            system_reset();
+        }
+
+        map_keypad(0, joystick);
+        coleco.keypad[1] = 0xff;
     }
-    return false;
+}
+
+// The emulator's sound buffer isn't in a very convenient format, we must remix it.
+static void mix_audio(void)
+{
+    mixbuffer_count = RG_MIN(snd.sample_count, RG_COUNT(mixbuffer));
+    for (size_t i = 0; i < mixbuffer_count; i++)
+    {
+        mixbuffer[i].left = snd.stream[0][i] * 2.75f;
+        mixbuffer[i].right = snd.stream[1][i] * 2.75f;
+    }
+}
+
+// Frames can come back in any order, make sure the palette is the latest one.
+// A palette change is detected by the display task, no need to force a full update.
+static void copy_palette(void)
+{
+    if (!render_copy_palette(currentUpdate->palette) && previousUpdate && previousUpdate != currentUpdate)
+        memcpy(currentUpdate->palette, previousUpdate->palette, 512);
+}
+
+static void run_frame(bool draw, bool speculative)
+{
+    system_frame(!draw);
+    // Before run-ahead restores the state, the palette has to match the frame
+    if (draw)
+        copy_palette();
+    if (!speculative)
+        mix_audio();
+}
+
+#ifdef RG_ENABLE_NETPLAY
+static void netplay_advance(const uint32_t inputs[2], bool replay)
+{
+    input.pad[0] = 0x00;
+    input.pad[1] = 0x00;
+    input.system = 0x00;
+
+    map_joystick(0, inputs[0]);
+    map_joystick(1, inputs[1]);
+
+    // Same mapping as update_input(), minus the reset which isn't part of the synchronized inputs
+    if (!IS_SMS && !IS_GG) // Coleco
+    {
+        map_keypad(0, inputs[0]);
+        map_keypad(1, inputs[1]);
+    }
+
+    system_frame(replay || !netplayDraw);
+    if (!replay && netplayDraw)
+        copy_palette();
+}
+#endif
+
+static bool screenshot_handler(const char *filename, int width, int height)
+{
+	return rg_display_save_frame(filename, currentUpdate, width, height);
 }
 
 static bool load_state_handler(const char *filename)
@@ -100,7 +221,8 @@ void app_main(void)
 {
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
-        .saveState = &save_state_handler,
+        .serialize = &system_serialize,
+        .deserialize = &system_deserialize,
         .event = &event_handler,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
@@ -141,184 +263,47 @@ void app_main(void)
         rg_emu_load_state(app->saveSlot);
     }
 
-    int skipFrames = 0;
-    int copyPalette = 0;
-
     while (true)
     {
-        *localJoystick = rg_input_read_gamepad();
+        uint32_t joystick = rg_input_read_gamepad();
 
-        if (*localJoystick & (RG_KEY_MENU|RG_KEY_OPTION))
+        if (joystick & (RG_KEY_MENU|RG_KEY_OPTION))
         {
-            if (*localJoystick & RG_KEY_MENU)
+            if (joystick & RG_KEY_MENU)
                 rg_gui_game_menu();
             else
                 rg_gui_options_menu();
             rg_audio_set_sample_rate(app->sampleRate * app->speed);
         }
 
-        int64_t startTime = rg_system_timer();
-        bool drawFrame = !skipFrames;
-        bool fullFrame = true;
-
-        input.pad[0] = 0x00;
-        input.pad[1] = 0x00;
-        input.system = 0x00;
+        bool drawFrame = rg_system_frame_begin(false);
 
         #ifdef RG_ENABLE_NETPLAY
         if (netplay)
         {
-            rg_netplay_sync(localJoystick, remoteJoystick, sizeof(*localJoystick));
-
-            uint32_t joystick = *remoteJoystick;
-
-            if (joystick & RG_KEY_UP)    input.pad[1] |= INPUT_UP;
-            if (joystick & RG_KEY_DOWN)  input.pad[1] |= INPUT_DOWN;
-            if (joystick & RG_KEY_LEFT)  input.pad[1] |= INPUT_LEFT;
-            if (joystick & RG_KEY_RIGHT) input.pad[1] |= INPUT_RIGHT;
-            if (joystick & RG_KEY_A)     input.pad[1] |= INPUT_BUTTON2;
-            if (joystick & RG_KEY_B)     input.pad[1] |= INPUT_BUTTON1;
-            if (IS_SMS)
-            {
-                if (joystick & RG_KEY_START)  input.system |= INPUT_PAUSE;
-                if (joystick & RG_KEY_SELECT) input.system |= INPUT_START;
-            }
-            else if (IS_GG)
-            {
-                if (joystick & RG_KEY_START)  input.system |= INPUT_START;
-                if (joystick & RG_KEY_SELECT) input.system |= INPUT_PAUSE;
-            }
+            netplayDraw = drawFrame;
+            rg_netplay_run_frame(joystick, &netplay_advance);
+            mix_audio();
         }
+        else
         #endif
-
-        uint32_t joystick = *localJoystick;
-
-        if (joystick & RG_KEY_UP)    input.pad[0] |= INPUT_UP;
-        if (joystick & RG_KEY_DOWN)  input.pad[0] |= INPUT_DOWN;
-        if (joystick & RG_KEY_LEFT)  input.pad[0] |= INPUT_LEFT;
-        if (joystick & RG_KEY_RIGHT) input.pad[0] |= INPUT_RIGHT;
-        if (joystick & RG_KEY_A)     input.pad[0] |= INPUT_BUTTON2;
-        if (joystick & RG_KEY_B)     input.pad[0] |= INPUT_BUTTON1;
-
-        if (IS_SMS)
-        {
-            if (joystick & RG_KEY_START)  input.system |= INPUT_PAUSE;
-            if (joystick & RG_KEY_SELECT) input.system |= INPUT_START;
-        }
-        else if (IS_GG)
         {
-            if (joystick & RG_KEY_START)  input.system |= INPUT_START;
-            if (joystick & RG_KEY_SELECT) input.system |= INPUT_PAUSE;
+            update_input(joystick);
+            rg_emu_run_frame(drawFrame, &run_frame);
         }
-        else // Coleco
-        {
-            coleco.keypad[0] = 0xff;
-            coleco.keypad[1] = 0xff;
-
-            if (joystick & RG_KEY_SELECT)
-            {
-                rg_input_wait_for_key(RG_KEY_SELECT, false);
-                system_reset();
-            }
-
-            // 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, *, #
-            switch (cart.crc)
-            {
-                case 0x798002a2:    // Frogger
-                case 0x32b95be0:    // Frogger
-                case 0x9cc3fabc:    // Alcazar
-                case 0x964db3bc:    // Fraction Fever
-                    if (joystick & RG_KEY_START)
-                    {
-                        coleco.keypad[0] = 10; // *
-                    }
-                    break;
-
-                case 0x1796de5e:    // Boulder Dash
-                case 0x5933ac18:    // Boulder Dash
-                case 0x6e5c4b11:    // Boulder Dash
-                    if (joystick & RG_KEY_START)
-                    {
-                        coleco.keypad[0] = 11; // #
-                    }
-
-                    if ((joystick & RG_KEY_START) && (joystick & RG_KEY_LEFT))
-                    {
-                        coleco.keypad[0] = 1;
-                    }
-                    break;
-                case 0x109699e2:    // Dr. Seuss's Fix-Up The Mix-Up Puzzler
-                case 0x614bb621:    // Decathlon
-                    if (joystick & RG_KEY_START)
-                    {
-                        coleco.keypad[0] = 1;
-                    }
-                    if ((joystick & RG_KEY_START) && (joystick & RG_KEY_LEFT))
-                    {
-                        coleco.keypad[0] = 10; // *
-                    }
-                    break;
-
-                default:
-                    if (joystick & RG_KEY_START)
-                    {
-                        coleco.keypad[0] = 1;
-                    }
-                    break;
-            }
-        }
-
-        system_frame(!drawFrame);
 
         if (drawFrame)
         {
-            rg_video_update_t *previousUpdate = &updates[currentUpdate == &updates[0]];
-            if (render_copy_palette(currentUpdate->palette))
-            {
-                previousUpdate = NULL;
-                copyPalette = true;
-            }
-            else if (copyPalette)
-            {
-                memcpy(currentUpdate->palette, previousUpdate->palette, 512);
-                copyPalette = false;
-            }
-            fullFrame = rg_display_queue_update(currentUpdate, previousUpdate) == RG_UPDATE_FULL;
-            currentUpdate = &updates[currentUpdate == &updates[0]]; // Swap
+            rg_display_queue_update(currentUpdate, previousUpdate);
+            previousUpdate = currentUpdate;
+            currentUpdate = rg_display_acquire(updates, 2);
             bitmap.data = currentUpdate->buffer - bitmap.viewport.x;
         }
 
-        int elapsed = rg_system_timer() - startTime;
-
-        // See if we need to skip a frame to keep up
-        if (skipFrames == 0)
-        {
-            int frameTime = 1000000 / (app->refreshRate * app->speed);
-            if (elapsed > frameTime - 2000) // It takes about 2ms to copy the audio buffer
-                skipFrames = (elapsed + frameTime / 2) / frameTime;
-            else if (drawFrame && fullFrame) // This could be avoided when scaling != full
-                skipFrames = 1;
-            if (app->speed > 1.f) // This is a hack until we account for audio speed...
-                skipFrames += (int)app->speed;
-        }
-        else if (skipFrames > 0)
-        {
-            skipFrames--;
-        }
-
         // Tick before submitting audio/syncing
-        rg_system_tick(elapsed);
-
-        // The emulator's sound buffer isn't in a very convenient format, we must remix it.
-        size_t sample_count = snd.sample_count;
-        rg_audio_sample_t mixbuffer[sample_count];
-        for (size_t i = 0; i < sample_count; i++)
-        {
-            mixbuffer[i].left = snd.stream[0][i] * 2.75f;
-            mixbuffer[i].right = snd.stream[1][i] * 2.75f;
-        }
+        rg_system_frame_end(0);
 
         // Audio is used to pace emulation :)
-        rg_audio_submit(mixbuffer, sample_count);
+        rg_audio_submit(mixbuffer, mixbuffer_count);
     }
 }
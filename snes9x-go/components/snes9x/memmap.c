@@ -30,6 +30,9 @@
 #define MAP_RONLY_SRAM_OR_NONE (Memory.SRAMSize == 0 ? (uint8_t*) MAP_NONE : (uint8_t*) MAP_RONLY_SRAM)
 
 static int32_t retry_count = 0;
+#ifdef RETRO_GO
+static rg_file_map_t *rom_map; // Backs Memory.ROM
+#endif
 static uint8_t *bytes0x2000; //  [0x2000];
 static bool is_bsx(uint8_t*);
 static bool bs_name(uint8_t*);
@@ -249,7 +252,11 @@ bool S9xInitMemory(void)
    Memory.RAM   = (uint8_t*) calloc(RAM_SIZE, 1);
    Memory.SRAM  = (uint8_t*) calloc(SRAM_SIZE, 1);
    Memory.VRAM  = (uint8_t*) calloc(VRAM_SIZE, 1);
+#ifdef RETRO_GO
+   /* Memory.ROM is a private view of the ROM file, LoadROM() sets it up */
+#else
    Memory.ROM   = (uint8_t*) calloc(MAX_ROM_SIZE + 0x200, 1);
+#endif
    Memory.FillRAM = (uint8_t*) calloc(0x8000, 1);
    Memory.ROM_Size = MAX_ROM_SIZE + 0x200;
 
@@ -258,7 +265,7 @@ bool S9xInitMemory(void)
 
    bytes0x2000 = (uint8_t *)calloc(0x2000, 1);
 
-   if (!Memory.RAM || !Memory.SRAM || !Memory.VRAM || !Memory.ROM
+   if (!Memory.RAM || !Memory.SRAM || !Memory.VRAM
       || !IPPU.TileCache || !IPPU.TileCached || !bytes0x2000)
    {
       S9xDeinitMemory();
@@ -286,11 +293,20 @@ void S9xDeinitMemory(void)
       free(Memory.VRAM);
       Memory.VRAM = NULL;
    }
+#ifdef RETRO_GO
+   if (rom_map)
+   {
+      rg_storage_unmap_file(rom_map);
+      rom_map = NULL;
+      Memory.ROM = NULL;
+   }
+#else
    if (Memory.ROM)
    {
       free(Memory.ROM);
       Memory.ROM = NULL;
    }
+#endif
    if (Memory.FillRAM)
    {
       free(Memory.FillRAM);
@@ -331,7 +347,9 @@ bool LoadROM(const char* filename)
    size_t TotalFileSize = 0;
    bool Interleaved = false;
    bool Tales = false;
+#ifndef RETRO_GO
    FILE *fp;
+#endif
 
    printf("Loading ROM: '%s'\n", filename ?: "(null)");
 
@@ -349,6 +367,21 @@ again:
       printf("Using Memory.ROM as is.\n");
       TotalFileSize = Memory.ROM_Size;
    }
+#ifdef RETRO_GO
+   else
+   {
+      /* A fresh view on every pass, the retry must start over from the untouched file */
+      rg_storage_unmap_file(rom_map);
+      if (!(rom_map = rg_storage_map_file(filename, Memory.ROM_Size, 0)))
+      {
+         printf("Failed to open %s\n", filename);
+         Memory.ROM = NULL;
+         return false;
+      }
+      Memory.ROM = rom_map->data;
+      TotalFileSize = rom_map->size;
+   }
+#else
    else if ((fp = fopen(filename, "rb")))
    {
       fseek(fp, 0, SEEK_END);
@@ -362,6 +395,7 @@ again:
       printf("Failed to open %s\n", filename);
       return false;
    }
+#endif
 
    if (TotalFileSize > Memory.ROM_Size)
    {
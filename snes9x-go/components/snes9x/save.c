@@ -12,6 +12,30 @@
 
 static const char header[16] = "SNES9X_000000002";
 
+static void state_restored(uint8_t *IAPU_RAM)
+{
+   // Fixing up registers and pointers:
+
+   IAPU.PC = IAPU.PC - IAPU.RAM + IAPU_RAM;
+   IAPU.DirectPage = IAPU.DirectPage - IAPU.RAM + IAPU_RAM;
+   IAPU.WaitAddress1 = IAPU.WaitAddress1 - IAPU.RAM + IAPU_RAM;
+   IAPU.WaitAddress2 = IAPU.WaitAddress2 - IAPU.RAM + IAPU_RAM;
+   IAPU.RAM = IAPU_RAM;
+
+   FixROMSpeed();
+   IPPU.ColorsChanged = true;
+   IPPU.OBJChanged = true;
+   CPU.InDMA = false;
+   S9xFixColourBrightness();
+   S9xAPUUnpackStatus();
+   S9xFixSoundAfterSnapshotLoad();
+   ICPU.ShiftedPB = ICPU.Registers.PB << 16;
+   ICPU.ShiftedDB = ICPU.Registers.DB << 16;
+   S9xSetPCBase(ICPU.ShiftedPB + ICPU.Registers.PC);
+   S9xUnpackStatus();
+   S9xFixCycles();
+   S9xReschedule();
+}
 
 bool S9xSaveState(const char *filename)
 {
@@ -77,27 +101,7 @@ bool S9xLoadState(const char *filename)
 
    printf("Loaded chunks = %d\n", chunks);
 
-   // Fixing up registers and pointers:
-
-   IAPU.PC = IAPU.PC - IAPU.RAM + IAPU_RAM;
-   IAPU.DirectPage = IAPU.DirectPage - IAPU.RAM + IAPU_RAM;
-   IAPU.WaitAddress1 = IAPU.WaitAddress1 - IAPU.RAM + IAPU_RAM;
-   IAPU.WaitAddress2 = IAPU.WaitAddress2 - IAPU.RAM + IAPU_RAM;
-   IAPU.RAM = IAPU_RAM;
-
-   FixROMSpeed();
-   IPPU.ColorsChanged = true;
-   IPPU.OBJChanged = true;
-   CPU.InDMA = false;
-   S9xFixColourBrightness();
-   S9xAPUUnpackStatus();
-   S9xFixSoundAfterSnapshotLoad();
-   ICPU.ShiftedPB = ICPU.Registers.PB << 16;
-   ICPU.ShiftedDB = ICPU.Registers.DB << 16;
-   S9xSetPCBase(ICPU.ShiftedPB + ICPU.Registers.PC);
-   S9xUnpackStatus();
-   S9xFixCycles();
-   S9xReschedule();
+   state_restored(IAPU_RAM);
 
    fclose(fp);
    return true;
@@ -106,3 +110,58 @@ fail:
    fclose(fp);
    return false;
 }
+
+#ifdef RETRO_GO
+bool S9xSerialize(rg_emu_blob_t *blob)
+{
+   blob->version = 2;
+   rg_emu_blob_put(blob, "CPU", &CPU, sizeof(CPU));
+   rg_emu_blob_put(blob, "ICPU", &ICPU, sizeof(ICPU));
+   rg_emu_blob_put(blob, "PPU", &PPU, sizeof(PPU));
+   rg_emu_blob_put(blob, "DMA", &DMA, sizeof(DMA));
+   rg_emu_blob_put(blob, "VRAM", Memory.VRAM, VRAM_SIZE);
+   rg_emu_blob_put(blob, "RAM", Memory.RAM, RAM_SIZE);
+   rg_emu_blob_put(blob, "SRAM", Memory.SRAM, SRAM_SIZE);
+   rg_emu_blob_put(blob, "FILLRAM", Memory.FillRAM, FILLRAM_SIZE);
+   rg_emu_blob_put(blob, "APU", &APU, sizeof(APU));
+   rg_emu_blob_put(blob, "IAPU", &IAPU, sizeof(IAPU));
+   rg_emu_blob_put(blob, "APURAM", IAPU.RAM, 0x10000);
+   rg_emu_blob_put(blob, "SOUND", &SoundData, sizeof(SoundData));
+   return true;
+}
+
+bool S9xDeserialize(rg_emu_blob_t *blob)
+{
+   size_t length;
+
+   // The structs are copied whole, a blob from another build would corrupt them
+   if (blob->version != 2 || !rg_emu_blob_get(blob, "CPU", &length) || length != sizeof(CPU)
+      || !rg_emu_blob_get(blob, "IAPU", &length) || length != sizeof(IAPU))
+   {
+      printf("Wrong blob version or layout\n");
+      return false;
+   }
+
+   S9xReset();
+
+   uint8_t *IAPU_RAM = IAPU.RAM;
+   size_t chunks = 0;
+
+   chunks += rg_emu_blob_read(blob, "CPU", &CPU, sizeof(CPU));
+   chunks += rg_emu_blob_read(blob, "ICPU", &ICPU, sizeof(ICPU));
+   chunks += rg_emu_blob_read(blob, "PPU", &PPU, sizeof(PPU));
+   chunks += rg_emu_blob_read(blob, "DMA", &DMA, sizeof(DMA));
+   chunks += rg_emu_blob_read(blob, "VRAM", Memory.VRAM, VRAM_SIZE);
+   chunks += rg_emu_blob_read(blob, "RAM", Memory.RAM, RAM_SIZE);
+   chunks += rg_emu_blob_read(blob, "SRAM", Memory.SRAM, SRAM_SIZE);
+   chunks += rg_emu_blob_read(blob, "FILLRAM", Memory.FillRAM, FILLRAM_SIZE);
+   chunks += rg_emu_blob_read(blob, "APU", &APU, sizeof(APU));
+   chunks += rg_emu_blob_read(blob, "IAPU", &IAPU, sizeof(IAPU));
+   chunks += rg_emu_blob_read(blob, "APURAM", IAPU_RAM, 0x10000);
+   chunks += rg_emu_blob_read(blob, "SOUND", &SoundData, sizeof(SoundData));
+
+   state_restored(IAPU_RAM);
+
+   return chunks == 12;
+}
+#endif
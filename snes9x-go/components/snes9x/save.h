@@ -5,3 +5,9 @@
 
 bool S9xSaveState(const char *filename);
 bool S9xLoadState(const char *filename);
+
+#ifdef RETRO_GO
+#include <rg_system.h>
+bool S9xSerialize(rg_emu_blob_t *blob);
+bool S9xDeserialize(rg_emu_blob_t *blob);
+#endif
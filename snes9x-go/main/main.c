@@ -51,11 +51,6 @@ static bool screenshot_handler(const char *filename, int width, int height)
     return rg_display_save_frame(filename, currentUpdate, width, height);
 }
 
-static bool save_state_handler(const char *filename)
-{
-    return S9xSaveState(filename);
-}
-
 static bool load_state_handler(const char *filename)
 {
     return S9xLoadState(filename);
@@ -263,7 +258,8 @@ void app_main(void)
 {
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
-        .saveState = &save_state_handler,
+        .serialize = &S9xSerialize,
+        .deserialize = &S9xDeserialize,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
     };
@@ -361,9 +357,7 @@ void app_main(void)
             menuCancelled = true;
         }
 
-        int64_t startTime = rg_system_timer();
-
-        IPPU.RenderThisFrame = (frames++ % frameskip) == 0;
+        IPPU.RenderThisFrame = rg_system_frame_begin(frames++ % frameskip != 0);
         GFX.Screen = currentUpdate->buffer;
         S9xMainLoop();
 
@@ -377,13 +371,11 @@ void app_main(void)
             S9xMixSamples((void *)mixbuffer, AUDIO_BUFFER_LENGTH << 1);
     #endif
 
-        int elapsed = rg_system_timer() - startTime;
-
     #ifndef USE_BLARGG_APU
         if (apu_enabled)
             rg_audio_submit(mixbuffer, AUDIO_BUFFER_LENGTH);
     #endif
 
-        rg_system_tick(elapsed);
+        rg_system_frame_end(0);
     }
 }
@@ -0,0 +1,74 @@
+# Builds an app for the host (sdl2 or headless target) without esp-idf, see BUILDING.md.
+#
+# Usage, from the repository root:
+#   make -f tools/host.mk APP=retro-core TARGET=headless
+# The binary is build-host/<app>-<target>/<app>.
+#
+# The components, source and include directories are read from the same CMakeLists.txt files that
+# esp-idf uses, so there is nothing to keep in sync when files are added.
+
+APP    ?= retro-core
+TARGET ?= headless
+BUILD  ?= build-host/$(APP)-$(TARGET)
+
+CC  ?= gcc
+CXX ?= g++
+SDL_CFLAGS ?= $(shell sdl2-config --cflags)
+SDL_LIBS   ?= $(shell sdl2-config --libs)
+
+ifeq ($(wildcard $(APP)/CMakeLists.txt),)
+$(error Unknown app '$(APP)')
+endif
+ifeq ($(wildcard components/retro-go/targets/$(TARGET)/config.h),)
+$(error Unknown target '$(TARGET)')
+endif
+
+# $(call cmake_list,component_dir,VARIABLE): the value of set(VARIABLE "...") in the component's CMakeLists.txt
+cmake_list = $(shell sed -n 's/^ *set($(2) "\(.*\)")/\1/p' $(1)/CMakeLists.txt)
+
+# Only the components listed by the project, plus main and retro-go which live elsewhere
+components := $(filter $(notdir $(wildcard $(APP)/components/*)),$(call cmake_list,$(APP),COMPONENTS))
+component_dirs := $(APP)/main $(addprefix $(APP)/components/,$(components)) components/retro-go
+
+src_dirs := $(foreach d,$(component_dirs),$(patsubst %/.,%,$(addprefix $(d)/,$(call cmake_list,$(d),COMPONENT_SRCDIRS))))
+inc_dirs := $(foreach d,$(component_dirs),$(patsubst %/.,%,$(addprefix $(d)/,$(call cmake_list,$(d),COMPONENT_ADD_INCLUDEDIRS))))
+
+# cJSON comes from esp-idf's json component on the device
+src_dirs += components/retro-go/libs/cJSON
+inc_dirs += components/retro-go/libs/cJSON
+
+# The components' own -D options (snes9x, prboom, lodepng...), the feature flags and build time are set below
+defines := $(filter-out -DRG_ENABLE_% -DRG_BUILD_TIME,$(sort $(foreach d,$(component_dirs),\
+    $(shell grep -ho -- '-D[A-Za-z_][A-Za-z0-9_]*' $(d)/CMakeLists.txt))))
+
+sources := $(foreach d,$(src_dirs),$(wildcard $(d)/*.c $(d)/*.cpp))
+objects := $(addprefix $(BUILD)/obj/,$(addsuffix .o,$(sources)))
+
+FLAGS := -O2 -g -DRETRO_GO -DRG_TARGET_$(shell echo $(TARGET) | tr 'a-z-' 'A-Z_') -DRG_BUILD_TIME=$(shell date +%s) \
+    $(defines) $(addprefix -I,$(inc_dirs)) $(SDL_CFLAGS) -MMD -MP
+ifeq ($(NETWORKING),1)
+FLAGS += -DRG_ENABLE_NETWORKING
+endif
+ifeq ($(PROFILING),1)
+FLAGS += -DRG_ENABLE_PROFILING -finstrument-functions
+endif
+CFLAGS   ?= -std=gnu11
+CXXFLAGS ?= -std=gnu++11 -fno-rtti -fno-exceptions
+
+$(BUILD)/$(APP): $(objects)
+	$(if $(filter %.cpp,$(sources)),$(CXX),$(CC)) -o $@ $^ $(SDL_LIBS) -lm -lpthread
+
+$(BUILD)/obj/%.c.o: %.c
+	@mkdir -p $(dir $@)
+	$(CC) $(FLAGS) $(CFLAGS) -c -o $@ $<
+
+$(BUILD)/obj/%.cpp.o: %.cpp
+	@mkdir -p $(dir $@)
+	$(CXX) $(FLAGS) $(CXXFLAGS) -c -o $@ $<
+
+clean:
+	rm -rf $(BUILD)
+
+.PHONY: clean
+
+-include $(objects:.o=.d)
@@ -0,0 +1,302 @@
+// Runs two rollback netplay peers (rg_rollback.c) over loopback UDP with injected latency, jitter and loss.
+// A toy deterministic "emulator" stands in for the cores, the peers must agree on every state checksum.
+//
+// Build (from the repository root):
+//   gcc -O2 -Wall -DRG_ENABLE_NETPLAY -Icomponents/retro-go/libs/netplay -o netplay_harness
+//       tools/netplay_harness.c components/retro-go/libs/netplay/rg_rollback.c
+// Usage:
+//   ./netplay_harness [--latency ms] [--jitter ms] [--loss percent] [--delay frames] [--frames n] [--desync frame]
+// --desync corrupts player 2's state at that frame to check that it gets detected. Exits with 0 when the peers
+// agreed on every checksum or, with --desync, when both of them detected the corruption.
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rg_rollback.h"
+
+#define BASE_PORT      17340
+#define FRAME_TIME     16667   // us
+#define QUEUE_LENGTH   256
+#define STALL_TIMEOUT  5000000 // us
+#define TAIL_FRAMES    120     // Played after --frames with no input, so the last checksums get compared
+
+typedef struct
+{
+    uint32_t frame;
+    uint32_t seed;
+    int32_t x[2], y[2];
+    uint8_t memory[2048];
+} toy_state_t;
+
+static struct
+{
+    int latency, jitter, loss, delay, frames, desync;
+} options = {50, 10, 5, 2, 1200, -1};
+
+static struct
+{
+    int player;
+    int sock;
+    struct sockaddr_in peer;
+    toy_state_t state;
+    struct
+    {
+        int64_t due;
+        size_t length;
+        uint8_t data[ROLLBACK_MAX_PACKET];
+    } queue[QUEUE_LENGTH];
+    int queued;
+    uint32_t sent, dropped;
+} local;
+
+
+static int64_t timer(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static void flush_queue(void)
+{
+    int64_t now = timer();
+
+    for (int i = 0; i < local.queued;)
+    {
+        if (local.queue[i].due > now)
+        {
+            i++;
+            continue;
+        }
+        sendto(local.sock, local.queue[i].data, local.queue[i].length, 0, (struct sockaddr *)&local.peer,
+               sizeof(local.peer));
+        local.queue[i] = local.queue[--local.queued];
+    }
+}
+
+
+static bool toy_send(void *arg, const void *data, size_t length)
+{
+    local.sent++;
+
+    if (rand() % 100 < options.loss || local.queued == QUEUE_LENGTH || length > ROLLBACK_MAX_PACKET)
+    {
+        local.dropped++;
+        return true; // Lost in transit, the sender can't tell
+    }
+
+    int delay = options.latency * 1000;
+    if (options.jitter > 0)
+        delay += (rand() % (options.jitter * 2000 + 1)) - options.jitter * 1000;
+
+    local.queue[local.queued].due = timer() + (delay > 0 ? delay : 0);
+    local.queue[local.queued].length = length;
+    memcpy(local.queue[local.queued].data, data, length);
+    local.queued++;
+    return true;
+}
+
+
+static int toy_receive(void *arg, void *data, size_t length)
+{
+    flush_queue();
+    return recv(local.sock, data, length, MSG_DONTWAIT);
+}
+
+
+static size_t toy_save_state(void *arg, void *buffer, size_t size)
+{
+    if (buffer && size >= sizeof(toy_state_t))
+        memcpy(buffer, &local.state, sizeof(toy_state_t));
+    return sizeof(toy_state_t);
+}
+
+
+static bool toy_load_state(void *arg, const void *buffer, size_t size)
+{
+    if (size != sizeof(toy_state_t))
+        return false;
+    memcpy(&local.state, buffer, sizeof(toy_state_t));
+    return true;
+}
+
+
+static void toy_advance(void *arg, const uint32_t inputs[2], bool replay)
+{
+    toy_state_t *state = &local.state;
+
+    for (int i = 0; i < 2; i++)
+    {
+        state->x[i] += ((inputs[i] >> 1) & 1) - ((inputs[i] >> 3) & 1);
+        state->y[i] += ((inputs[i] >> 2) & 1) - ((inputs[i] >> 0) & 1);
+        state->seed = state->seed * 1103515245 + 12345 + inputs[i] * (i + 1);
+    }
+    state->memory[state->seed % sizeof(state->memory)] ^= state->frame ^ state->x[0] ^ state->y[1];
+
+    if (local.player == 1 && (int)state->frame == options.desync)
+        state->memory[0] ^= 0x55;
+
+    state->frame++;
+}
+
+
+static void toy_desync(void *arg, uint32_t frame)
+{
+    printf("[P%d] Desync detected at frame %u\n", local.player + 1, frame);
+}
+
+
+static uint32_t read_input(uint32_t frame)
+{
+    // Buttons are held for a while, like a player would, so predictions are sometimes right
+    static uint32_t input = 0, until = 0;
+    if (frame >= until)
+    {
+        input = rand() & 0xFFF;
+        until = frame + 5 + rand() % 40;
+    }
+    return frame < (uint32_t)options.frames ? input : 0;
+}
+
+
+static int run_peer(int player)
+{
+    rollback_config_t config = {
+        .send = &toy_send,
+        .receive = &toy_receive,
+        .save_state = &toy_save_state,
+        .load_state = &toy_load_state,
+        .advance = &toy_advance,
+        .desync = &toy_desync,
+        .player = player,
+        .input_delay = options.delay,
+        .checksum_interval = 30,
+    };
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+
+    local.player = player;
+    local.sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    addr.sin_port = htons(BASE_PORT + player);
+    local.peer = addr;
+    local.peer.sin_port = htons(BASE_PORT + (player ^ 1));
+    if (local.sock < 0 || bind(local.sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("socket");
+        return 2;
+    }
+    srand(1234 + player * 7919);
+
+    rollback_t *rb = rg_rollback_create(&config);
+    if (!rb)
+    {
+        printf("[P%d] rg_rollback_create() failed\n", player + 1);
+        return 2;
+    }
+
+    uint32_t total = options.frames + TAIL_FRAMES;
+    int64_t next_frame = timer();
+    int64_t stalled_since = 0;
+    int64_t linger_until = 0;
+
+    // Keep running a little after the last frame, the peer might still need our inputs
+    while (rg_rollback_get_stats(rb).frame < total || timer() < linger_until)
+    {
+        rollback_stats_t stats = rg_rollback_get_stats(rb);
+
+        if (timer() < next_frame)
+        {
+            rg_rollback_poll(rb);
+            usleep(500);
+            continue;
+        }
+
+        if (!rg_rollback_advance(rb, read_input(stats.frame)))
+        {
+            if (!stalled_since)
+                stalled_since = timer();
+            else if (timer() - stalled_since > STALL_TIMEOUT && !linger_until)
+            {
+                printf("[P%d] Lost sync at frame %u\n", player + 1, stats.frame);
+                return 1;
+            }
+            usleep(1000);
+            continue;
+        }
+
+        stalled_since = 0;
+        next_frame += FRAME_TIME;
+        if (stats.frame + 1 == total)
+            linger_until = timer() + 500000;
+    }
+
+    rollback_stats_t stats = rg_rollback_get_stats(rb);
+    printf("[P%d] frames=%u rollbacks=%u replayed=%u max_rollback=%u stalls=%u checksums=%u desyncs=%u "
+           "packets=%u dropped=%u\n", player + 1, stats.frame, stats.rollbacks, stats.replayed_frames,
+           stats.max_rollback, stats.stalls, stats.checksums, stats.desyncs, local.sent, local.dropped);
+
+    rg_rollback_destroy(rb);
+    close(local.sock);
+
+    if (options.desync >= 0)
+        return stats.desyncs > 0 ? 0 : 1;
+    return (stats.desyncs == 0 && stats.checksums > 0) ? 0 : 1;
+}
+
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        int value = atoi(argv[i + 1]);
+        if (strcmp(argv[i], "--latency") == 0)
+            options.latency = value;
+        else if (strcmp(argv[i], "--jitter") == 0)
+            options.jitter = value;
+        else if (strcmp(argv[i], "--loss") == 0)
+            options.loss = value;
+        else if (strcmp(argv[i], "--delay") == 0)
+            options.delay = value;
+        else if (strcmp(argv[i], "--frames") == 0)
+            options.frames = value;
+        else if (strcmp(argv[i], "--desync") == 0)
+            options.desync = value;
+        else
+        {
+            fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+            return 2;
+        }
+    }
+
+    printf("latency=%dms jitter=%dms loss=%d%% delay=%d frames=%d\n", options.latency, options.jitter,
+           options.loss, options.delay, options.frames);
+
+    fflush(stdout);
+
+    pid_t peers[2];
+    for (int player = 0; player < 2; player++)
+    {
+        if ((peers[player] = fork()) == 0)
+            exit(run_peer(player));
+    }
+
+    int failed = 0;
+    for (int player = 0; player < 2; player++)
+    {
+        int status = 0;
+        waitpid(peers[player], &status, 0);
+        failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed;
+}
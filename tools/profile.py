@@ -0,0 +1,109 @@
+#!/usr/bin/env python
+# Converts a profile dumped by rg_system_dump_profile() into folded stacks for flamegraph.pl,
+# speedscope, inferno, etc. The input can be the binary file or a log containing RGD:PROF lines.
+import argparse, base64, struct, subprocess, sys
+
+PROFILE_MAGIC = 0x46504752
+PROFILE_VERSION = 1
+
+
+def extract_from_log(text):
+    # Keep the last complete dump, the monitor task prints a new one every few seconds
+    data, chunks = None, None
+    for line in text.splitlines():
+        if line.startswith("RGD:PROF:BEGIN"):
+            chunks = []
+        elif line.startswith("RGD:PROF:DATA") and chunks is not None:
+            chunks.append(line.split(None, 1)[1].strip())
+        elif line.startswith("RGD:PROF:END") and chunks is not None:
+            data, chunks = base64.b64decode("".join(chunks)), None
+    return data
+
+
+def parse_profile(data):
+    magic, version, threads_count, ticks_per_us, elapsed = struct.unpack_from("<IHHII", data, 0)
+    if magic != PROFILE_MAGIC or version != PROFILE_VERSION:
+        exit("ERROR: Not a retro-go profile (or unsupported version %d)" % version)
+    offset = 16
+    threads = []
+    for _ in range(threads_count):
+        name, count, dropped = struct.unpack_from("<16sII", data, offset)
+        offset += 24
+        nodes = {}
+        for _ in range(count):
+            func, index, parent, calls, self_time, total_time = struct.unpack_from("<QiiIQQ", data, offset)
+            offset += 36
+            nodes[index] = (func, parent, calls, self_time / ticks_per_us, total_time / ticks_per_us)
+        threads.append((name.split(b"\0")[0].decode(errors="ignore"), dropped, nodes))
+    return elapsed, threads
+
+
+def resolve_symbols(elf, addresses, addr2line):
+    symbols = {addr: "0x%x" % addr for addr in addresses}
+    if not elf or not addresses:
+        return symbols
+    addresses = sorted(addresses)
+    try:
+        cmd = [addr2line, "-fCe", elf] + ["0x%x" % addr for addr in addresses]
+        lines = subprocess.check_output(cmd).decode(errors="ignore").splitlines()
+        for addr, name in zip(addresses, lines[0::2]):
+            if name and name != "??":
+                symbols[addr] = name
+    except (OSError, subprocess.CalledProcessError) as err:
+        print("WARNING: Symbol resolution failed: %s" % err, file=sys.stderr)
+    return symbols
+
+
+def fold_stacks(threads, symbols):
+    folded = {}
+    for name, dropped, nodes in threads:
+        for index, (func, parent, calls, self_us, total_us) in nodes.items():
+            stack = [symbols[func]]
+            while parent >= 0 and parent in nodes:
+                stack.append(symbols[nodes[parent][0]])
+                parent = nodes[parent][1]
+            key = ";".join([name] + stack[::-1])
+            folded[key] = folded.get(key, 0) + self_us
+    return folded
+
+
+def print_summary(elapsed, threads, symbols, top):
+    print("Profile covers %.1fs" % (elapsed / 1000000))
+    for name, dropped, nodes in threads:
+        funcs = {}
+        for func, parent, calls, self_us, total_us in nodes.values():
+            entry = funcs.setdefault(func, [0, 0])
+            entry[0] += calls
+            entry[1] += self_us
+        total = sum(entry[1] for entry in funcs.values()) or 1
+        print("\n[%s] %d nodes, %d dropped" % (name, len(nodes), dropped))
+        for func, (calls, self_us) in sorted(funcs.items(), key=lambda x: x[1][1], reverse=True)[:top]:
+            print("  %5.1f%%  %10dus  %10d calls  %s" % (self_us * 100 / total, self_us, calls, symbols[func]))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Retro-Go profile converter")
+    parser.add_argument("elf", help="the application's elf file (host builds must not be PIE)")
+    parser.add_argument("input", help="profile.bin or a log containing RGD:PROF lines")
+    parser.add_argument("--addr2line", default="xtensa-esp32-elf-addr2line")
+    parser.add_argument("--folded", help="write folded stacks (in microseconds) to this file")
+    parser.add_argument("--top", type=int, default=20, help="number of functions to list per thread")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+    if not data.startswith(struct.pack("<I", PROFILE_MAGIC)):
+        data = extract_from_log(data.decode(errors="ignore"))
+        if not data:
+            exit("ERROR: No complete profile found in '%s'" % args.input)
+
+    elapsed, threads = parse_profile(data)
+    symbols = resolve_symbols(args.elf, {node[0] for _, _, nodes in threads for node in nodes.values()}, args.addr2line)
+    print_summary(elapsed, threads, symbols, args.top)
+
+    if args.folded:
+        with open(args.folded, "w") as f:
+            for stack, value in sorted(fold_stacks(threads, symbols).items()):
+                if int(value) > 0:
+                    f.write("%s %d\n" % (stack, value))
+        print("\nFolded stacks saved to %s" % args.folded)
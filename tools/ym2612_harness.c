@@ -0,0 +1,230 @@
+// Checks that gwenesis' deferred YM2612 synthesis (gwenesis_ym2612_queue + ym2612_synth_*()) produces the same
+// audio and the same status reads as writing to the chip inline. Both paths are fed one random write/read sequence.
+//
+// Build (from the repository root):
+//   gcc -O2 -Wall -Igwenesis/components/gwenesis/src/sound -Igwenesis/components/gwenesis/src/bus
+//       -Igwenesis/components/gwenesis/src/savestate -o ym2612_harness
+//       tools/ym2612_harness.c gwenesis/components/gwenesis/src/sound/ym2612.c -lm
+// Usage:
+//   ./ym2612_harness [--frames n] [--seed n]
+// Exits with 0 when both paths agree. Each path runs in its own process, ym2612.c has statics that a reset
+// doesn't clear.
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ym2612.h"
+#include "gwenesis_bus.h"
+#include "gwenesis_savestate.h"
+
+#define FRAME_CLOCK   (VDP_CYCLES_PER_LINE * 262)
+#define BUFFER_LENGTH (FRAME_CLOCK / AUDIO_FREQ_DIVISOR + 16)
+#define MAX_EVENTS    256
+
+int16_t gwenesis_ym2612_buffer[BUFFER_LENGTH];
+int ym2612_index;
+int ym2612_clock;
+
+typedef struct
+{
+    bool read;
+    unsigned int addr, value;
+    int clock;
+} event_t;
+
+static struct
+{
+    event_t events[MAX_EVENTS];
+    int count;
+} queue;
+
+static struct
+{
+    int frames;
+    unsigned seed;
+} options = {600, 1};
+
+// ym2612.c saves its state through these, the harness never does
+SaveState *saveGwenesisStateOpenForRead(const char *fileName) { return NULL; }
+SaveState *saveGwenesisStateOpenForWrite(const char *fileName) { return NULL; }
+int saveGwenesisStateGet(SaveState *state, const char *tagName) { return 0; }
+void saveGwenesisStateSet(SaveState *state, const char *tagName, int value) {}
+void saveGwenesisStateGetBuffer(SaveState *state, const char *tagName, void *buffer, int length) {}
+void saveGwenesisStateSetBuffer(SaveState *state, const char *tagName, void *buffer, int length) {}
+
+
+static void queue_write(unsigned int addr, unsigned int value, int clock)
+{
+    if (queue.count < MAX_EVENTS)
+        queue.events[queue.count++] = (event_t){false, addr, value, clock};
+}
+
+
+// A frame of register traffic that looks like a sound driver's: timers, key on/off, DAC and operator registers
+static int make_frame(event_t *events)
+{
+    static const uint8_t mode_regs[] = {0x22, 0x24, 0x25, 0x26, 0x27, 0x28, 0x2a, 0x2b};
+    int count = 0;
+    int clock = 0;
+
+    while (count < MAX_EVENTS - 3)
+    {
+        clock += rand() % (FRAME_CLOCK / 40);
+        if (clock >= FRAME_CLOCK)
+            break;
+
+        if (rand() % 4 == 0)
+        {
+            events[count++] = (event_t){true, 0, 0, clock};
+            continue;
+        }
+
+        unsigned int port = (rand() % 2) * 2;
+        unsigned int reg = (port == 0 && rand() % 3 == 0) ? mode_regs[rand() % sizeof(mode_regs)]
+                                                          : 0x30 + rand() % 0x88;
+        unsigned int value = rand() & 0xFF;
+        if (reg == 0x27)
+            value = (value & 0xF0) | 0x0F; // Keep the timers running and reporting
+        events[count++] = (event_t){false, port, reg, clock};
+        events[count++] = (event_t){false, port + 1, value, clock};
+    }
+
+    return count;
+}
+
+
+static void run_inline(event_t *events, int count, int16_t *audio, uint8_t *reads)
+{
+    ym2612_clock = ym2612_index = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (events[i].read)
+            reads[i] = YM2612Read(events[i].clock);
+        else
+            YM2612Write(events[i].addr, events[i].value, events[i].clock);
+    }
+    ym2612_run(FRAME_CLOCK);
+    memcpy(audio, gwenesis_ym2612_buffer, ym2612_index * sizeof(int16_t));
+}
+
+
+// The CPU side answers the reads, the synthesis replays the queue at the end of the frame
+static void run_deferred(event_t *events, int count, int16_t *audio, uint8_t *reads)
+{
+    queue.count = 0;
+    ym2612_clock = ym2612_index = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (events[i].read)
+            reads[i] = YM2612Read(events[i].clock);
+        else
+            YM2612Write(events[i].addr, events[i].value, events[i].clock);
+    }
+    ym2612_run(FRAME_CLOCK);
+
+    ym2612_synth_begin(audio);
+    for (int i = 0; i < queue.count; i++)
+        ym2612_synth_write(queue.events[i].addr, queue.events[i].value, queue.events[i].clock);
+    ym2612_synth_end(FRAME_CLOCK);
+}
+
+
+// Runs every frame through one path in a child process, the results land in shared memory
+static bool run_path(bool deferred, event_t (*frames)[MAX_EVENTS], const int *counts, int16_t *audio, uint8_t *reads)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        YM2612Init();
+        YM2612Config(9);
+        YM2612ResetChip();
+        if (deferred)
+            gwenesis_ym2612_queue = &queue_write;
+        for (int f = 0; f < options.frames; f++)
+            (deferred ? run_deferred : run_inline)(frames[f], counts[f], &audio[f * BUFFER_LENGTH],
+                                                   &reads[f * MAX_EVENTS]);
+        exit(0);
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+static void *shared_alloc(size_t size)
+{
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--frames") == 0)
+            options.frames = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--seed") == 0)
+            options.seed = atoi(argv[i + 1]);
+        else
+        {
+            fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+            return 2;
+        }
+    }
+
+    event_t (*frames)[MAX_EVENTS] = calloc(options.frames, sizeof(*frames));
+    int *counts = calloc(options.frames, sizeof(int));
+    int16_t *inline_audio = shared_alloc(options.frames * sizeof(gwenesis_ym2612_buffer));
+    int16_t *deferred_audio = shared_alloc(options.frames * sizeof(gwenesis_ym2612_buffer));
+    uint8_t *inline_reads = shared_alloc(options.frames * MAX_EVENTS);
+    uint8_t *deferred_reads = shared_alloc(options.frames * MAX_EVENTS);
+    int reads = 0, failures = 0;
+
+    if (!frames || !counts || !inline_audio || !deferred_audio || !inline_reads || !deferred_reads)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 2;
+    }
+
+    srand(options.seed);
+    for (int f = 0; f < options.frames; f++)
+        counts[f] = make_frame(frames[f]);
+
+    if (!run_path(false, frames, counts, inline_audio, inline_reads)
+        || !run_path(true, frames, counts, deferred_audio, deferred_reads))
+    {
+        fprintf(stderr, "A path crashed\n");
+        return 2;
+    }
+
+    for (int f = 0; f < options.frames; f++)
+    {
+        for (int i = 0; i < counts[f]; i++)
+        {
+            if (!frames[f][i].read)
+                continue;
+            reads++;
+            if (inline_reads[f * MAX_EVENTS + i] != deferred_reads[f * MAX_EVENTS + i] && failures++ < 10)
+                printf("Frame %d, read %d: status %02X inline, %02X deferred\n", f, i,
+                       inline_reads[f * MAX_EVENTS + i], deferred_reads[f * MAX_EVENTS + i]);
+        }
+        if (memcmp(&inline_audio[f * BUFFER_LENGTH], &deferred_audio[f * BUFFER_LENGTH],
+                   BUFFER_LENGTH * sizeof(int16_t)) != 0 && failures++ < 10)
+        {
+            int i = 0;
+            while (inline_audio[f * BUFFER_LENGTH + i] == deferred_audio[f * BUFFER_LENGTH + i])
+                i++;
+            printf("Frame %d: sample %d is %d inline, %d deferred\n", f, i, inline_audio[f * BUFFER_LENGTH + i],
+                   deferred_audio[f * BUFFER_LENGTH + i]);
+        }
+    }
+    printf("frames=%d status_reads=%d failures=%d\n%s\n", options.frames, reads, failures, failures ? "FAIL" : "PASS");
+    return failures ? 1 : 0;
+}